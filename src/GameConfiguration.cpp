@@ -860,7 +860,10 @@ void GameConfiguration::readUDMFProperties(ParseTreeNode* block, UDMFPropMap& pl
 				{
 					// Create property if needed
 					if (!plist[def->getName()].property)
+					{
 						plist[def->getName()].property = new UDMFProperty();
+						MobjPropertyList::atom(def->getName());
+					}
 
 					// Parse group defaults
 					plist[def->getName()].property->parse(group, groupname);
@@ -2951,47 +2954,34 @@ void GameConfiguration::cleanObjectUDMFProps(MapObject* object)
 	else
 		return;
 
-	// Go through properties
-	UDMFPropMap::iterator i = map->begin();
-	while (i != map->end())
+	// Go through object properties (backwards, since removing a
+	// property moves the last one into its place)
+	vector<MobjPropertyList::prop_t>& props = object->props().allProperties();
+	for (int a = (int)props.size() - 1; a >= 0; a--)
 	{
-		if (!i->second.property)
-		{
-			i++;
+		if (!props[a].value.hasValue())
 			continue;
-		}
 
-		// Check if the object even has this property
-		if (!object->hasProp(i->first))
-		{
-			i++;
+		// Check if the property is defined in the configuration
+		UDMFPropMap::iterator i = map->find(props[a].name());
+		if (i == map->end() || !i->second.property)
 			continue;
-		}
 
 		// Remove the property from the object if it is the default value
-		//Property& def = i->second.property->getDefaultValue();
-		if (i->second.property->getDefaultValue().getType() == PROP_BOOL)
-		{
-			if (i->second.property->getDefaultValue().getBoolValue() == object->boolProperty(i->first))
-				object->props().removeProperty(i->first);
-		}
-		else if (i->second.property->getDefaultValue().getType() == PROP_INT)
-		{
-			if (i->second.property->getDefaultValue().getIntValue() == object->intProperty(i->first))
-				object->props().removeProperty(i->first);
-		}
-		else if (i->second.property->getDefaultValue().getType() == PROP_FLOAT)
-		{
-			if (i->second.property->getDefaultValue().getFloatValue() == object->floatProperty(i->first))
-				object->props().removeProperty(i->first);
-		}
-		else if (i->second.property->getDefaultValue().getType() == PROP_STRING)
-		{
-			if (i->second.property->getDefaultValue().getStringValue() == object->stringProperty(i->first))
-				object->props().removeProperty(i->first);
-		}
-
-		i++;
+		Property def = i->second.property->getDefaultValue();
+		Property& value = props[a].value;
+		bool is_default = false;
+		if (def.getType() == PROP_BOOL)
+			is_default = (def.getBoolValue() == value.getBoolValue());
+		else if (def.getType() == PROP_INT)
+			is_default = (def.getIntValue() == value.getIntValue());
+		else if (def.getType() == PROP_FLOAT)
+			is_default = (def.getFloatValue() == value.getFloatValue());
+		else if (def.getType() == PROP_STRING)
+			is_default = (def.getStringValue() == value.getStringValue());
+
+		if (is_default)
+			object->props().removeProperty(props[a].atom);
 	}
 }
 
@@ -59,6 +59,7 @@
 #include "LinePropsPanel.h"
 #include "SectorPropsPanel.h"
 #include "ThingPropsPanel.h"
+#include "RenderProfiler.h"
 
 
 /*******************************************************************
@@ -1102,10 +1103,11 @@ void MapCanvas::drawObjectEdit()
 	}
 }
 
-/* MapCanvas::drawMap2d
- * Draws the 2d map
+/* MapCanvas::setup2dView
+ * Sets up the projection and modelview matrices for drawing the 2d
+ * map in the current view
  *******************************************************************/
-void MapCanvas::drawMap2d()
+void MapCanvas::setup2dView()
 {
 	// Setup the screen projection
 	glMatrixMode(GL_PROJECTION);
@@ -1130,11 +1132,25 @@ void MapCanvas::drawMap2d()
 
 	// Translate to offsets
 	glTranslated(-view_xoff_inter, -view_yoff_inter, 0);
+}
+
+/* MapCanvas::drawMap2d
+ * Draws the 2d map
+ *******************************************************************/
+void MapCanvas::drawMap2d()
+{
+	setup2dView();
 
 	// Update visibility info if needed
 	if (!renderer_2d->visOK())
 		renderer_2d->updateVisibility(view_tl, view_br);
 
+	// Update any sector polygons built in the background, and build
+	// polygons in view first
+	editor->getMap().setPolygonPriorityArea(view_tl, view_br);
+	RenderProfiler::beginPass("Polygons");
+	RenderProfiler::endPass(editor->getMap().updateSectorPolygons());
+
 
 	// Draw flats if needed
 	OpenGL::setColour(COL_WHITE);
@@ -1158,7 +1174,9 @@ void MapCanvas::drawMap2d()
 	}
 
 	// Draw grid
+	RenderProfiler::beginPass("Grid");
 	drawGrid();
+	RenderProfiler::endPass();
 
 	// --- Draw map (depending on mode) ---
 	OpenGL::resetBlend();
@@ -1240,6 +1258,7 @@ void MapCanvas::drawMap2d()
 
 
 	// Draw tagged sectors/lines/things if needed
+	RenderProfiler::beginPass("Editing");
 	if (!overlayActive() && (mouse_state == MSTATE_NORMAL || mouse_state == MSTATE_TAG_SECTORS || mouse_state == MSTATE_TAG_THINGS))
 	{
 		if (editor->taggedSectors().size() > 0)
@@ -1297,14 +1316,19 @@ void MapCanvas::drawMap2d()
 		glEnd();
 	}
 
+	RenderProfiler::endPass();
+
 	// Draw animations
+	RenderProfiler::beginPass("Animations");
 	for (unsigned a = 0; a < animations.size(); a++)
 	{
 		if (!animations[a]->mode3d())
 			animations[a]->draw();
 	}
+	RenderProfiler::endPass(animations.size());
 
 	// Draw paste objects if needed
+	RenderProfiler::beginPass("Editing");
 	if (mouse_state == MSTATE_PASTE)
 	{
 
@@ -1343,6 +1367,7 @@ void MapCanvas::drawMap2d()
 		default: break;
 		};
 	}
+	RenderProfiler::endPass();
 }
 
 /* MapCanvas::drawMap3d
@@ -1350,6 +1375,15 @@ void MapCanvas::drawMap2d()
  *******************************************************************/
 void MapCanvas::drawMap3d()
 {
+	// Update any sector polygons built in the background, and
+	// regenerate the 3d flats of those sectors only
+	RenderProfiler::beginPass("Polygons");
+	vector<unsigned> updated_sectors;
+	unsigned n_polygons = editor->getMap().updateSectorPolygons(&updated_sectors);
+	for (unsigned a = 0; a < updated_sectors.size(); a++)
+		renderer_3d->invalidateSector(updated_sectors[a]);
+	RenderProfiler::endPass(n_polygons);
+
 	// Setup 3d renderer view
 	renderer_3d->setupView(GetSize().x, GetSize().y);
 
@@ -1357,6 +1391,7 @@ void MapCanvas::drawMap3d()
 	renderer_3d->renderMap();
 
 	// Determine hilight
+	RenderProfiler::beginPass("Hilight");
 	selection_3d_t hl;
 	if (!editor->hilightLocked())
 	{
@@ -1380,7 +1415,10 @@ void MapCanvas::drawMap3d()
 		}
 	}
 
+	RenderProfiler::endPass();
+
 	// Draw selection if any
+	RenderProfiler::beginPass("Selection");
 	vector<selection_3d_t> selection = editor->get3dSelection();
 	renderer_3d->renderFlatSelection(selection);
 	renderer_3d->renderWallSelection(selection);
@@ -1389,13 +1427,52 @@ void MapCanvas::drawMap3d()
 	// Draw hilight if any
 	if (hl.index >= 0)
 		renderer_3d->renderHilight(hl, anim_flash_level);
+	RenderProfiler::endPass(selection.size());
 
 	// Draw animations
+	RenderProfiler::beginPass("Animations");
 	for (unsigned a = 0; a < animations.size(); a++)
 	{
 		if (animations[a]->mode3d())
 			animations[a]->draw();
 	}
+	RenderProfiler::endPass(animations.size());
+}
+
+/* MapCanvas::timeThingRendering
+ * Renders the things in the current 2d view [runs] times batched by
+ * texture, then [runs] times one at a time, and sets [batched] and
+ * [immediate] to the total time taken by each (us). Nothing is shown
+ * since the back buffer is cleared when the canvas is next drawn
+ *******************************************************************/
+void MapCanvas::timeThingRendering(unsigned runs, long& batched, long& immediate)
+{
+	batched = 0;
+	immediate = 0;
+	if (editor->editMode() == MapEditor::MODE_3D || !setContext())
+		return;
+
+	glViewport(0, 0, GetSize().x, GetSize().y);
+	setup2dView();
+	if (!renderer_2d->visOK())
+		renderer_2d->updateVisibility(view_tl, view_br);
+
+	// Render once each first so any textures are loaded
+	renderer_2d->renderThingsBatched(1.0f);
+	renderer_2d->renderThingsImmediate(1.0f);
+	glFinish();
+
+	sf::Clock clock;
+	for (unsigned a = 0; a < runs; a++)
+		renderer_2d->renderThingsBatched(1.0f);
+	glFinish();
+	batched = clock.getElapsedTime().asMicroseconds();
+
+	clock.restart();
+	for (unsigned a = 0; a < runs; a++)
+		renderer_2d->renderThingsImmediate(1.0f);
+	glFinish();
+	immediate = clock.getElapsedTime().asMicroseconds();
 }
 
 /* MapCanvas::draw
@@ -1419,12 +1496,16 @@ void MapCanvas::draw()
 	glDisable(GL_TEXTURE_2D);
 
 	// Draw 2d or 3d map depending on mode
+	RenderProfiler::beginFrame(editor->editMode() == MapEditor::MODE_3D ? "3d" : "2d");
+	RenderProfiler::beginPass("Map");
 	if (editor->editMode() == MapEditor::MODE_3D)
 		drawMap3d();
 	else
 		drawMap2d();
+	RenderProfiler::endPass();
 
 	// Draw info overlay
+	RenderProfiler::beginPass("Overlays");
 	glDisable(GL_CULL_FACE);
 	glDisable(GL_DEPTH_TEST);
 	glMatrixMode(GL_PROJECTION);
@@ -1537,6 +1618,7 @@ void MapCanvas::draw()
 		for (unsigned a = 0; a < fps_avg.size(); a++)
 			afps += fps_avg[a];
 		if (fps_avg.size() > 0) afps /= fps_avg.size();
+
 		Drawing::drawText(S_FMT("FPS: %d", afps));
 	}
 
@@ -1549,9 +1631,16 @@ void MapCanvas::draw()
 	// Help text
 	drawFeatureHelpText();
 
+	// Render profiler (shows the last complete frame)
+	RenderProfiler::drawOverlay(GetSize().x - 320, 4);
+	RenderProfiler::endPass();
+
+	RenderProfiler::beginPass("Swap");
 	SwapBuffers();
 
 	glFinish();
+	RenderProfiler::endPass();
+	RenderProfiler::endFrame();
 }
 
 /* MapCanvas::update2d
@@ -1828,15 +1917,24 @@ bool MapCanvas::update3d(double mult)
  *******************************************************************/
 void MapCanvas::update(long frametime)
 {
+	// Start profiling the frame (ended in draw). If the last update
+	// wasn't followed by a redraw its frame is still open, so end it
+	// first rather than counting both updates in one frame
+	RenderProfiler::endFrame();
+	RenderProfiler::beginFrame(editor->editMode() == MapEditor::MODE_3D ? "3d" : "2d");
+	RenderPassTimer timer("Update");
+
 	// Get frame time multiplier
 	float mult = (float)frametime / 10.0f;
 
 	// Update stuff depending on (2d/3d) mode
 	bool mode_anim = false;
+	RenderProfiler::beginPass("View");
 	if (editor->editMode() == MapEditor::MODE_3D)
 		mode_anim = update3d(mult);
 	else
 		mode_anim = update2d(mult);
+	RenderProfiler::endPass();
 
 	// Flashing animation for hilight
 	// Pulsates between 0.5-1.0f (multiplied with hilight alpha)
@@ -1930,6 +2028,7 @@ void MapCanvas::update(long frametime)
 		overlay_current->update(frametime);
 
 	// Update animations
+	RenderProfiler::beginPass("Animations");
 	bool anim_running = false;
 	for (unsigned a = 0; a < animations.size(); a++)
 	{
@@ -1943,6 +2042,7 @@ void MapCanvas::update(long frametime)
 		else
 			anim_running = true;
 	}
+	RenderProfiler::endPass(animations.size());
 
 	// Determine the framerate limit
 #ifdef USE_SFML_RENDERWINDOW
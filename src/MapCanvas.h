@@ -148,9 +148,11 @@ public:
 	void	drawLineDrawLines();
 	void	drawPasteLines();
 	void	drawObjectEdit();
+	void	setup2dView();
 	void	drawMap2d();
 	void	drawMap3d();
 	void	draw();
+	void	timeThingRendering(unsigned runs, long& batched, long& immediate);
 
 	// Frame updates
 	bool	update2d(double mult);
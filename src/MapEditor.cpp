@@ -43,6 +43,7 @@
 #include "Clipboard.h"
 #include "UndoRedo.h"
 #include "MapChecks.h"
+#include "ObjectPool.h"
 
 
 /*******************************************************************
@@ -60,10 +61,84 @@ EXTERN_CVAR(Int, shapedraw_sides)
 EXTERN_CVAR(Int, shapedraw_shape)
 EXTERN_CVAR(Bool, shapedraw_centered)
 EXTERN_CVAR(Bool, shapedraw_lockratio)
+extern ObjectPool<MapVertex>	vertex_pool;
+extern ObjectPool<MapLine>		line_pool;
+extern ObjectPool<MapSide>		side_pool;
+extern ObjectPool<MapSector>	sector_pool;
+extern ObjectPool<MapThing>		thing_pool;
 
 
 #pragma region UNDO STEPS
 
+/* getBackupObjectIds
+ * Adds the id of the object [backup] was taken from, along with the
+ * ids of any other map objects it links to, to [list]
+ *******************************************************************/
+void getBackupObjectIds(mobj_backup_t* backup, vector<unsigned>& list)
+{
+	list.push_back(backup->id);
+
+	const char* links[] = { "v1", "v2", "s1", "s2", "sector" };
+	for (unsigned a = 0; a < 5; a++)
+	{
+		Property* link = backup->props_internal.getProperty(links[a]);
+		if (link)
+			list.push_back(link->getUnsignedValue());
+	}
+}
+
+/* updateObjectConnections
+ * Connects the line or side with [id] to its vertices/sector if it
+ * is in the map, or disconnects it if not. Used after undo/redo
+ * instead of rebuilding connections for the whole map
+ *******************************************************************/
+void updateObjectConnections(SLADEMap* map, unsigned id)
+{
+	MapObject* object = map->getObjectById(id);
+	if (!object)
+		return;
+	bool in_map = map->objectInMap(id);
+
+	if (object->getObjType() == MOBJ_LINE)
+	{
+		MapLine* line = (MapLine*)object;
+		if (in_map)
+		{
+			line->v1()->connectLine(line);
+			line->v2()->connectLine(line);
+		}
+		else
+		{
+			line->v1()->disconnectLine(line);
+			line->v2()->disconnectLine(line);
+		}
+	}
+	else if (object->getObjType() == MOBJ_SIDE)
+	{
+		MapSide* side = (MapSide*)object;
+		MapSector* sector = side->getSector();
+		if (!sector)
+			return;
+
+		// Check if the side is already connected
+		vector<MapSide*>& connected = sector->connectedSides();
+		bool connected_now = false;
+		for (unsigned a = 0; a < connected.size(); a++)
+		{
+			if (connected[a] == side)
+			{
+				connected_now = true;
+				break;
+			}
+		}
+
+		if (in_map && !connected_now)
+			sector->connectSide(side);
+		else if (!in_map && connected_now)
+			sector->disconnectSide(side);
+	}
+}
+
 /*******************************************************************
  * PROPERTYCHANGEUS CLASS
  *******************************************************************
@@ -93,6 +168,7 @@ public:
 		obj->loadFromBackup(backup);
 		delete backup;
 		backup = temp;
+		updateObjectConnections(UndoRedo::currentMap(), obj->getId());
 	}
 
 	bool doUndo()
@@ -110,6 +186,11 @@ public:
 
 		return true;
 	}
+
+	void getObjectIds(vector<unsigned>& list)
+	{
+		getBackupObjectIds(backup, list);
+	}
 };
 
 /*******************************************************************
@@ -120,264 +201,129 @@ public:
 class MapObjectCreateDeleteUS : public UndoStep
 {
 private:
-	//vector<mobj_cd_t>	objects;
+	vector<mobj_cd_t>	objects;
 
-	vector<unsigned>	vertices;
-	vector<unsigned>	lines;
-	vector<unsigned>	sides;
-	vector<unsigned>	sectors;
-	vector<unsigned>	things;
-
-public:
-	MapObjectCreateDeleteUS()
+	// Updates geometry info affected by [id] being created/deleted
+	void updateGeometry(SLADEMap* map, unsigned id)
 	{
-		SLADEMap* map = UndoRedo::currentMap();
-		map->getObjectIdList(MOBJ_VERTEX, vertices);
-		map->getObjectIdList(MOBJ_LINE, lines);
-		map->getObjectIdList(MOBJ_SIDE, sides);
-		map->getObjectIdList(MOBJ_SECTOR, sectors);
-		map->getObjectIdList(MOBJ_THING, things);
+		MapObject* object = map->getObjectById(id);
+		if (!object)
+			return;
+
+		if (object->getObjType() == MOBJ_LINE)
+		{
+			MapLine* line = (MapLine*)object;
+			line->resetInternals();
+			if (line->frontSector())
+			{
+				line->frontSector()->resetPolygon();
+				line->frontSector()->updateBBox();
+			}
+			if (line->backSector())
+			{
+				line->backSector()->resetPolygon();
+				line->backSector()->updateBBox();
+			}
+		}
+		else if (object->getObjType() == MOBJ_SIDE)
+		{
+			MapSector* sector = ((MapSide*)object)->getSector();
+			if (sector)
+			{
+				sector->resetPolygon();
+				sector->updateBBox();
+			}
+		}
 	}
 
+public:
+	MapObjectCreateDeleteUS() {}
 	~MapObjectCreateDeleteUS() {}
 
-	bool isValid(vector<unsigned>& list)
-	{
-		return !(list.size() == 1 && list[0] == 0);
-	}
-
-	void swapLists()
+	bool doUndo()
 	{
-		// Backup
-		vector<unsigned> vertices;
-		vector<unsigned> lines;
-		vector<unsigned> sides;
-		vector<unsigned> sectors;
-		vector<unsigned> things;
+		// Undo creation/deletion (in reverse order, so that deleted
+		// objects end up back at their original indices)
 		SLADEMap* map = UndoRedo::currentMap();
-		if (isValid(this->vertices))	map->getObjectIdList(MOBJ_VERTEX, vertices);
-		if (isValid(this->lines))		map->getObjectIdList(MOBJ_LINE, lines);
-		if (isValid(this->sides))		map->getObjectIdList(MOBJ_SIDE, sides);
-		if (isValid(this->sectors))		map->getObjectIdList(MOBJ_SECTOR, sectors);
-		if (isValid(this->things))		map->getObjectIdList(MOBJ_THING, things);
-
-		// Restore
-		if (isValid(this->vertices))
-		{
-			map->restoreObjectIdList(MOBJ_VERTEX, this->vertices);
-			this->vertices = vertices;
-			map->updateGeometryInfo(0);
-		}
-		if (isValid(this->lines))
-		{
-			map->restoreObjectIdList(MOBJ_LINE, this->lines);
-			this->lines = lines;
-			map->updateGeometryInfo(0);
-		}
-		if (isValid(this->sides))
-		{
-			map->restoreObjectIdList(MOBJ_SIDE, this->sides);
-			this->sides = sides;
-		}
-		if (isValid(this->sectors))
+		for (int a = objects.size() - 1; a >= 0; a--)
 		{
-			map->restoreObjectIdList(MOBJ_SECTOR, this->sectors);
-			this->sectors = sectors;
+			if (objects[a].created)
+				map->removeObjectById(objects[a].id);
+			else
+				map->restoreObjectById(objects[a].id, objects[a].index);
 		}
-		if (isValid(this->things))
+
+		for (unsigned a = 0; a < objects.size(); a++)
 		{
-			map->restoreObjectIdList(MOBJ_THING, this->things);
-			this->things = things;
+			updateObjectConnections(map, objects[a].id);
+			updateGeometry(map, objects[a].id);
 		}
-	}
 
-	bool doUndo()
-	{
-		swapLists();
 		return true;
 	}
 
 	bool doRedo()
 	{
-		swapLists();
-		return true;
-	}
-
-	void checkChanges()
-	{
+		// Redo creation/deletion
 		SLADEMap* map = UndoRedo::currentMap();
-
-		// Check vertices changed
-		bool vertices_changed = false;
-		if (map->nVertices() != vertices.size())
-			vertices_changed = true;
-		else
-			for (unsigned a = 0; a < map->nVertices(); a++)
-				if (map->getSector(a)->getId() != vertices[a])
-				{
-					vertices_changed = true;
-					break;
-				}
-		if (!vertices_changed)
+		for (unsigned a = 0; a < objects.size(); a++)
 		{
-			// No change, clear
-			vertices.clear();
-			vertices.push_back(0);
-			LOG_MESSAGE(3, "MapObjectCreateDeleteUS: No vertices added/deleted");
+			if (objects[a].created)
+				map->restoreObjectById(objects[a].id);
+			else
+				map->removeObjectById(objects[a].id);
 		}
 
-		// Check lines changed
-		bool lines_changed = false;
-		if (map->nLines() != lines.size())
-			lines_changed = true;
-		else
-			for (unsigned a = 0; a < map->nLines(); a++)
-				if (map->getLine(a)->getId() != lines[a])
-				{
-					lines_changed = true;
-					break;
-				}
-		if (!lines_changed)
+		for (unsigned a = 0; a < objects.size(); a++)
 		{
-			// No change, clear
-			lines.clear();
-			lines.push_back(0);
-			LOG_MESSAGE(3, "MapObjectCreateDeleteUS: No lines added/deleted");
+			updateObjectConnections(map, objects[a].id);
+			updateGeometry(map, objects[a].id);
 		}
 
-		// Check sides changed
-		bool sides_changed = false;
-		if (map->nSides() != sides.size())
-			sides_changed = true;
-		else
-			for (unsigned a = 0; a < map->nSides(); a++)
-				if (map->getSide(a)->getId() != sides[a])
-				{
-					sides_changed = true;
-					break;
-				}
-		if (!sides_changed)
-		{
-			// No change, clear
-			sides.clear();
-			sides.push_back(0);
-			LOG_MESSAGE(3, "MapObjectCreateDeleteUS: No sides added/deleted");
-		}
+		return true;
+	}
 
-		// Check sectors changed
-		bool sectors_changed = false;
-		if (map->nSectors() != sectors.size())
-			sectors_changed = true;
-		else
-			for (unsigned a = 0; a < map->nSectors(); a++)
-				if (map->getSector(a)->getId() != sectors[a])
-				{
-					sectors_changed = true;
-					break;
-				}
-		if (!sectors_changed)
-		{
-			// No change, clear
-			sectors.clear();
-			sectors.push_back(0);
-			LOG_MESSAGE(3, "MapObjectCreateDeleteUS: No sectors added/deleted");
-		}
+	void checkChanges()
+	{
+		// Get objects created and deleted since recording began
+		// (in the order they were created/deleted)
+		vector<mobj_cd_t>& cd_objects = UndoRedo::currentMap()->createdDeletedObjectIds();
+		objects = cd_objects;
+		cd_objects.clear();
 
-		// Check things changed
-		bool things_changed = false;
-		if (map->nThings() != things.size())
-			things_changed = true;
-		else
-			for (unsigned a = 0; a < map->nThings(); a++)
-				if (map->getThing(a)->getId() != things[a])
-				{
-					things_changed = true;
-					break;
-				}
-		if (!things_changed)
+		if (Global::log_verbosity >= 4)
 		{
-			// No change, clear
-			things.clear();
-			things.push_back(0);
-			LOG_MESSAGE(3, "MapObjectCreateDeleteUS: No things added/deleted");
+			string ids;
+			for (unsigned a = 0; a < objects.size(); a++)
+			{
+				if (objects[a].created)
+					ids += S_FMT("%d, ", objects[a].id);
+			}
+			LOG_MESSAGE(4, "Created: %s", ids);
+
+			ids = "";
+			for (unsigned a = 0; a < objects.size(); a++)
+			{
+				if (!objects[a].created)
+					ids += S_FMT("%d, ", objects[a].id);
+			}
+			LOG_MESSAGE(4, "Deleted: %s", ids);
 		}
+
+		if (objects.empty())
+			LOG_MESSAGE(3, "MapObjectCreateDeleteUS: No objects added/deleted");
 	}
 
 	bool isOk()
 	{
-		// Check for any changes at all
-		if (vertices.size() == 1 && vertices[0] == 0 &&
-			lines.size() == 1 && lines[0] == 0 &&
-			sides.size() == 1 && sides[0] == 0 &&
-			sectors.size() == 1 && sectors[0] == 0 &&
-			things.size() == 1 && things[0] == 0)
-			return false;
-
-		return true;
+		return !objects.empty();
 	}
 
-	//MapObjectCreateDeleteUS()
-	//{
-	//	// Get recently created and deleted object ids from map
-	//	// (in the order they were created/deleted)
-	//	vector<mobj_cd_t>& cd_objects = UndoRedo::currentMap()->createdDeletedObjectIds();
-	//	for (unsigned a = 0; a < cd_objects.size(); a++)
-	//		objects.push_back(cd_objects[a]);
-
-	//	if (Global::log_verbosity >= 4)
-	//	{
-	//		string ids;
-	//		for (unsigned a = 0; a < cd_objects.size(); a++)
-	//		{
-	//			if (cd_objects[a].created)
-	//				ids += S_FMT("%d, ", cd_objects[a].id);
-	//		}
-	//		LOG_MESSAGE(4, "Created: %s", ids);
-
-	//		ids = "";
-	//		for (unsigned a = 0; a < cd_objects.size(); a++)
-	//		{
-	//			if (!cd_objects[a].created)
-	//				ids += S_FMT("%d, ", cd_objects[a].id);
-	//		}
-	//		LOG_MESSAGE(4, "Deleted: %s", ids);
-	//	}
-	//}
-
-	//~MapObjectCreateDeleteUS() {}
-
-	//bool doUndo()
-	//{
-	//	// Undo creation/deletion
-	//	for (int a = objects.size() - 1; a >= 0; a--)
-	//	{
-	//		if (objects[a].created)
-	//			UndoRedo::currentMap()->removeObjectById(objects[a].id);
-	//		else
-	//			UndoRedo::currentMap()->restoreObjectById(objects[a].id);
-	//	}
-
-	//	return true;
-	//}
-
-	//bool doRedo()
-	//{
-	//	// Redo creation/deletion
-	//	for (unsigned a = 0; a < objects.size(); a++)
-	//	{
-	//		if (!objects[a].created)
-	//			UndoRedo::currentMap()->removeObjectById(objects[a].id);
-	//		else
-	//			UndoRedo::currentMap()->restoreObjectById(objects[a].id);
-	//	}
-
-	//	return true;
-	//}
-
-	//bool isOk()
-	//{
-	//	return !objects.empty();
-	//}
+	void getObjectIds(vector<unsigned>& list)
+	{
+		for (unsigned a = 0; a < objects.size(); a++)
+			list.push_back(objects[a].id);
+	}
 };
 
 
@@ -392,10 +338,10 @@ private:
 	vector<mobj_backup_t*>	backups;
 
 public:
-	MultiMapObjectPropertyChangeUS()
+	MultiMapObjectPropertyChangeUS(long since)
 	{
-		// Get backups of recently modified map objects
-		vector<MapObject*> objects = UndoRedo::currentMap()->getAllModifiedObjects(MapObject::propBackupTime());
+		// Get backups of map objects modified since [since]
+		vector<MapObject*> objects = UndoRedo::currentMap()->getAllModifiedObjects(since);
 		for (unsigned a = 0; a < objects.size(); a++)
 		{
 			mobj_backup_t* bak = objects[a]->getBackup(true);
@@ -428,6 +374,7 @@ public:
 		obj->loadFromBackup(backups[index]);
 		delete backups[index];
 		backups[index] = temp;
+		updateObjectConnections(UndoRedo::currentMap(), obj->getId());
 	}
 
 	bool doUndo()
@@ -457,6 +404,12 @@ public:
 	{
 		return !backups.empty();
 	}
+
+	void getObjectIds(vector<unsigned>& list)
+	{
+		for (unsigned a = 0; a < backups.size(); a++)
+			getBackupObjectIds(backups[a], list);
+	}
 };
 
 #pragma endregion
@@ -488,6 +441,10 @@ MapEditor::MapEditor()
 	undo_manager_3d = new UndoManager(&map);
 	current_tag = 0;
 	us_create_delete = NULL;
+
+	// Listen to undo managers (to free objects once undo history is trimmed)
+	listenTo(undo_manager);
+	listenTo(undo_manager_3d);
 }
 
 /* MapEditor::~MapEditor
@@ -551,7 +508,7 @@ void MapEditor::setEditMode(int mode)
 	// Clear hilight and selection stuff
 	hilight_item = -1;
 	hilight_3d = -1;
-	selection.clear();
+	clearSelectionList();
 	selection_3d.clear();
 	tagged_sectors.clear();
 	tagged_lines.clear();
@@ -647,13 +604,14 @@ void MapEditor::clearMap()
 	map.clearMap();
 
 	// Clear selection
-	selection.clear();
+	clearSelectionList();
 	hilight_item = -1;
 	link_3d_light = true;
 	link_3d_offset = true;
 
-	// Clear undo manager
+	// Clear undo managers
 	undo_manager->clear();
+	undo_manager_3d->clear();
 	last_undo_level = "";
 }
 
@@ -665,7 +623,7 @@ void MapEditor::clearMap()
  *******************************************************************/
 void MapEditor::showItem(int index)
 {
-	selection.clear();
+	clearSelectionList();
 	int max = 0;
 	switch (edit_mode)
 	{
@@ -678,7 +636,7 @@ void MapEditor::showItem(int index)
 
 	if (index < max)
 	{
-		selection.push_back(index);
+		addToSelection(index);
 		if (canvas) canvas->viewShowObject();
 	}
 }
@@ -1056,6 +1014,7 @@ void MapEditor::selectionUpdated()
 {
 	// Open selected objects in properties panel
 	vector<MapObject*> objects;
+	objects.reserve(selection.size());
 
 	if (edit_mode == MODE_VERTICES)
 	{
@@ -1083,6 +1042,42 @@ void MapEditor::selectionUpdated()
 	last_undo_level = "";
 }
 
+/* MapEditor::isSelected
+ * Returns true if the object at [index] is selected (in 2d mode)
+ *******************************************************************/
+bool MapEditor::isSelected(int index)
+{
+	return index >= 0 && (unsigned)index < selection_flags.size() && selection_flags[index];
+}
+
+/* MapEditor::clearSelectionList
+ * Clears the 2d mode selection list (without any notifications)
+ *******************************************************************/
+void MapEditor::clearSelectionList()
+{
+	for (unsigned a = 0; a < selection.size(); a++)
+	{
+		if ((unsigned)selection[a] < selection_flags.size())
+			selection_flags[selection[a]] = false;
+	}
+	selection.clear();
+}
+
+/* MapEditor::addToSelection
+ * Adds the object at [index] to the 2d mode selection list, if it
+ * isn't already selected (without any notifications)
+ *******************************************************************/
+void MapEditor::addToSelection(int index)
+{
+	if (index < 0 || isSelected(index))
+		return;
+
+	if ((unsigned)index >= selection_flags.size())
+		selection_flags.resize(index + 1, false);
+	selection_flags[index] = true;
+	selection.push_back(index);
+}
+
 /* MapEditor::clearSelection
  * Clears the current 2d/3d mode selection
  *******************************************************************/
@@ -1096,7 +1091,7 @@ void MapEditor::clearSelection(bool animate)
 	else
 	{
 		if (animate && canvas) canvas->itemsSelected(selection, false);
-		selection.clear();
+		clearSelectionList();
 		theMapEditor->propsPanel()->openObject(NULL);
 	}
 }
@@ -1106,35 +1101,35 @@ void MapEditor::clearSelection(bool animate)
  *******************************************************************/
 void MapEditor::selectAll()
 {
-	// Clear selection initially
-	selection.clear();
-
-	// Select all items depending on mode
+	// Get number of items depending on mode
+	unsigned count = 0;
 	if (edit_mode == MODE_VERTICES)
-	{
-		for (unsigned a = 0; a < map.vertices.size(); a++)
-			selection.push_back(a);
-	}
+		count = map.vertices.size();
 	else if (edit_mode == MODE_LINES)
-	{
-		for (unsigned a = 0; a < map.lines.size(); a++)
-			selection.push_back(a);
-	}
+		count = map.lines.size();
 	else if (edit_mode == MODE_SECTORS)
-	{
-		for (unsigned a = 0; a < map.sectors.size(); a++)
-			selection.push_back(a);
-	}
+		count = map.sectors.size();
 	else if (edit_mode == MODE_THINGS)
+		count = map.things.size();
+
+	// Get items not already selected (for the selection animation)
+	vector<int> nsel;
+	for (unsigned a = 0; a < count; a++)
 	{
-		for (unsigned a = 0; a < map.things.size(); a++)
-			selection.push_back(a);
+		if (!isSelected(a))
+			nsel.push_back(a);
 	}
 
+	// Select all items
+	selection.resize(count);
+	for (unsigned a = 0; a < count; a++)
+		selection[a] = a;
+	selection_flags.assign(count, true);
+
 	addEditorMessage(S_FMT("Selected all %lu %s", selection.size(), getModeString()));
 
-	if (canvas)
-		canvas->itemsSelected(selection);
+	if (canvas && !nsel.empty())
+		canvas->itemsSelected(nsel);
 
 	selectionUpdated();
 }
@@ -1191,7 +1186,7 @@ bool MapEditor::selectCurrent(bool clear_none)
 			if (clear_none)
 			{
 				if (canvas) canvas->itemsSelected(selection, false);
-				selection.clear();
+				clearSelectionList();
 				selectionUpdated();
 				addEditorMessage("Selection cleared");
 			}
@@ -1200,20 +1195,18 @@ bool MapEditor::selectCurrent(bool clear_none)
 		}
 
 		// Otherwise, check if item is in selection
-		for (unsigned a = 0; a < selection.size(); a++)
+		if (isSelected(hilight_item))
 		{
-			if (selection[a] == hilight_item)
-			{
-				// Already selected, deselect
-				selection.erase(selection.begin() + a);
-				if (canvas) canvas->itemSelected(hilight_item, false);
-				selectionUpdated();
-				return true;
-			}
+			// Already selected, deselect
+			selection.erase(std::find(selection.begin(), selection.end(), hilight_item));
+			selection_flags[hilight_item] = false;
+			if (canvas) canvas->itemSelected(hilight_item, false);
+			selectionUpdated();
+			return true;
 		}
 
 		// Not already selected, add to selection
-		selection.push_back(hilight_item);
+		addToSelection(hilight_item);
 		if (canvas) canvas->itemSelected(hilight_item, true);
 
 		selectionUpdated();
@@ -1228,138 +1221,60 @@ bool MapEditor::selectCurrent(bool clear_none)
  *******************************************************************/
 bool MapEditor::selectWithin(double xmin, double ymin, double xmax, double ymax, bool add)
 {
-	// Select depending on editing mode
-	bool selected;
-	vector<int> nsel;
-	vector<int> asel;
-
-	// Vertices
+	// Get object type depending on editing mode
+	uint8_t type;
 	if (edit_mode == MODE_VERTICES)
-	{
-		// Go through vertices
-		double x, y;
-		for (unsigned a = 0; a < map.vertices.size(); a++)
-		{
-			// Check if already selected
-			if (std::find(selection.begin(), selection.end(), a) != selection.end())
-				selected = true;
-			else
-				selected = false;
-
-			// Get position
-			x = map.vertices[a]->xPos();
-			y = map.vertices[a]->yPos();
-
-			// Select if vertex is within bounds
-			if (xmin <= x && x <= xmax && ymin <= y && y <= ymax)
-			{
-				if (selected)
-					asel.push_back(a);
-				else
-					nsel.push_back(a);
-			}
-		}
-	}
-
-	// Lines
+		type = MOBJ_VERTEX;
 	else if (edit_mode == MODE_LINES)
-	{
-		// Go through lines
-		MapLine* line;
-		double x1, y1, x2, y2;
-		for (unsigned a = 0; a < map.lines.size(); a++)
-		{
-			// Check if already selected
-			if (std::find(selection.begin(), selection.end(), a) != selection.end())
-				selected = true;
-			else
-				selected = false;
-
-			// Get vertex positions
-			line = map.lines[a];
-			x1 = line->v1()->xPos();
-			y1 = line->v1()->yPos();
-			x2 = line->v2()->xPos();
-			y2 = line->v2()->yPos();
-
-			// Select if both vertices are within bounds
-			if (xmin <= x1 && x1 <= xmax && ymin <= y1 && y1 <= ymax &&
-					xmin <= x2 && x2 <= xmax && ymin <= y2 && y2 <= ymax)
-			{
-				if (selected)
-					asel.push_back(a);
-				else
-					nsel.push_back(a);
-			}
-		}
-	}
-
-	// Sectors
+		type = MOBJ_LINE;
 	else if (edit_mode == MODE_SECTORS)
-	{
-		// Go through sectors
-		fpoint2_t pmin(xmin, ymin);
-		fpoint2_t pmax(xmax, ymax);
-		for (unsigned a = 0; a < map.sectors.size(); a++)
-		{
-			// Check if already selected
-			if (std::find(selection.begin(), selection.end(), a) != selection.end())
-				selected = true;
-			else
-				selected = false;
+		type = MOBJ_SECTOR;
+	else if (edit_mode == MODE_THINGS)
+		type = MOBJ_THING;
+	else
+		return false;
 
-			// Check if sector's bbox fits within the selection box
-			if (map.sectors[a]->boundingBox().is_within(pmin, pmax))
-			{
-				if (selected)
-					asel.push_back(a);
-				else
-					nsel.push_back(a);
-			}
-		}
+	// Get objects within the box (from the map's spatial index)
+	vector<unsigned> within;
+	map.getObjectsWithin(type, xmin, ymin, xmax, ymax, within);
+
+	// Split into already selected and newly selected items
+	vector<int> nsel;
+	vector<int> asel;
+	for (unsigned a = 0; a < within.size(); a++)
+	{
+		if (isSelected(within[a]))
+			asel.push_back(within[a]);
+		else
+			nsel.push_back(within[a]);
 	}
 
-	// Things
-	else if (edit_mode == MODE_THINGS)
+	// Replace the selection if anything was within the box
+	if (!add && !within.empty())
 	{
-		// Go through things
-		double x, y;
-		for (unsigned a = 0; a < map.things.size(); a++)
+		// Get items being deselected (selected but not in the box)
+		vector<int> dsel;
+		for (unsigned a = 0; a < asel.size(); a++)
+			selection_flags[asel[a]] = false;
+		for (unsigned a = 0; a < selection.size(); a++)
 		{
-			// Check if already selected
-			if (std::find(selection.begin(), selection.end(), a) != selection.end())
-				selected = true;
-			else
-				selected = false;
-
-			// Get position
-			x = map.things[a]->xPos();
-			y = map.things[a]->yPos();
-
-			// Select if thing is within bounds
-			if (xmin <= x && x <= xmax && ymin <= y && y <= ymax)
-			{
-				if (selected)
-					asel.push_back(a);
-				else
-					nsel.push_back(a);
-			}
+			if (isSelected(selection[a]))
+				dsel.push_back(selection[a]);
 		}
-	}
-
+		for (unsigned a = 0; a < asel.size(); a++)
+			selection_flags[asel[a]] = true;
 
-	// Clear selection if anything was within the box
-	if (!add && (nsel.size() > 0 || asel.size() > 0))
-		clearSelection();
+		// Animate deselected items
+		if (canvas && dsel.size() > 0) canvas->itemsSelected(dsel, false);
 
-	// Update selection
-	if (!add)
-	{
+		clearSelectionList();
 		for (unsigned a = 0; a < asel.size(); a++)
-			selection.push_back(asel[a]);
+			addToSelection(asel[a]);
 	}
+
+	// Add newly selected items
 	for (unsigned a = 0; a < nsel.size(); a++)
-		selection.push_back(nsel[a]);
+		addToSelection(nsel[a]);
 
 	if (add)
 		addEditorMessage(S_FMT("Selected %lu %s", asel.size(), getModeString()));
@@ -1426,15 +1341,32 @@ void MapEditor::getSelectedLines(vector<MapLine*>& list)
 		vector<MapSector*> sectors;
 		getSelectedSectors(sectors);
 
+		// Flag lines already in the list
+		vector<bool> added(map.nLines(), false);
+		for (unsigned a = 0; a < list.size(); a++)
+		{
+			if (list[a]->getIndex() < added.size())
+				added[list[a]->getIndex()] = true;
+		}
+
 		// Add lines of selected sectors
+		vector<MapLine*> seclines;
 		for (unsigned a = 0; a < sectors.size(); a++)
 		{
-			vector<MapLine*> seclines;
+			seclines.clear();
 			sectors[a]->getLines(seclines);
 			for (unsigned b = 0; b < seclines.size(); b++)
 			{
-				if (std::find(list.begin(), list.end(), seclines[b]) == list.end())
-					list.push_back(seclines[b]);
+				if (!seclines[b])
+					continue;
+
+				unsigned index = seclines[b]->getIndex();
+				if (index < added.size() && added[index])
+					continue;
+
+				list.push_back(seclines[b]);
+				if (index < added.size())
+					added[index] = true;
 			}
 		}
 	}
@@ -1766,7 +1698,7 @@ void MapEditor::doMove(fpoint2_t mouse_pos)
  *******************************************************************/
 void MapEditor::endMove(bool accept)
 {
-	long move_time = theApp->runTimer();
+	long move_time = map.currentGeneration();
 
 	// Un-filter objects
 	for (unsigned a = 0; a < map.nLines(); a++)
@@ -1872,7 +1804,7 @@ void MapEditor::mergeLines(long move_time, vector<fpoint2_t>& merge_points)
 	for (unsigned a = 0; a < map.nLines(); a++)
 	{
 		MapLine* line = map.getLine(a);
-		if (line->modifiedTime() >= move_time)
+		if (line->modifiedTime() > move_time)
 		{
 			MapVertex* split = map.lineCrossVertex(line->x1(), line->y1(), line->x2(), line->y2());
 			if (split)
@@ -1886,7 +1818,7 @@ void MapEditor::mergeLines(long move_time, vector<fpoint2_t>& merge_points)
 	// Merge lines
 	for (unsigned a = 0; a < map.nLines(); a++)
 	{
-		if (map.getLine(a)->modifiedTime() >= move_time)
+		if (map.getLine(a)->modifiedTime() > move_time)
 		{
 			if (map.mergeLine(a) > 0 && a < map.nLines())
 			{
@@ -2834,7 +2766,7 @@ void MapEditor::deleteObject()
 	endUndoRecord(true);
 
 	// Clear hilight and selection
-	selection.clear();
+	clearSelectionList();
 	hilight_item = -1;
 }
 
@@ -3471,7 +3403,6 @@ void MapEditor::paste(fpoint2_t mouse_pos)
 		if (theClipboard->getItem(a)->getType() == CLIPBOARD_MAP_ARCH)
 		{
 			beginUndoRecord("Paste Map Architecture");
-			long move_time = theApp->runTimer();
 			MapArchClipboardItem* p = (MapArchClipboardItem*)theClipboard->getItem(a);
 			vector<MapVertex*> new_verts = p->pasteToMap(&map, mouse_pos);
 			map.mergeArch(new_verts);
@@ -5003,19 +4934,16 @@ void MapEditor::beginUndoRecord(string name, bool mod, bool create, bool del)
 	// Begin recording
 	manager->beginRecord(name);
 
-	// Init map/objects for recording
+	// Init map/objects for recording (objects modified from the next
+	// edit generation on will be picked up)
 	if (undo_modified)
-		MapObject::beginPropBackup(theApp->runTimer());
+		MapObject::beginPropBackup(map.currentGeneration() + 1);
 	if (undo_deleted || undo_created)
 	{
 		us_create_delete = new MapObjectCreateDeleteUS();
-		//manager->recordUndoStep(new MapObjectCreateDeleteUS());
-		//map.clearCreatedDeletedOjbectIds();
+		map.clearCreatedDeletedObjectIds();
 	}
 
-	// Make sure all modified objects will be picked up
-	wxMilliSleep(5);
-
 	last_undo_level = "";
 }
 
@@ -5044,11 +4972,12 @@ void MapEditor::endUndoRecord(bool success)
 	if (manager->currentlyRecording())
 	{
 		// Record necessary undo steps
+		long since = MapObject::propBackupTime();
 		MapObject::beginPropBackup(-1);
 		bool modified = false;
 		bool created_deleted = false;
 		if (undo_modified)
-			modified = manager->recordUndoStep(new MultiMapObjectPropertyChangeUS());
+			modified = manager->recordUndoStep(new MultiMapObjectPropertyChangeUS(since));
 		if (undo_created || undo_deleted)
 		{
 			us_create_delete->checkChanges();
@@ -5077,7 +5006,7 @@ void MapEditor::recordPropertyChangeUndoStep(MapObject* object)
 void MapEditor::doUndo()
 {
 	// Undo
-	int time = theApp->runTimer() - 1;
+	long generation = map.currentGeneration();
 	UndoManager* manager = (edit_mode == MODE_3D) ? undo_manager_3d : undo_manager;
 	string undo_name = manager->undo();
 
@@ -5089,10 +5018,8 @@ void MapEditor::doUndo()
 		// Refresh stuff
 		//updateTagged();
 		clearSelection();
-		map.rebuildConnectedLines();
-		map.rebuildConnectedSides();
-		map.geometry_updated = theApp->runTimer();
-		map.updateGeometryInfo(time);
+		map.setGeometryUpdated();
+		map.updateGeometryInfo(generation);
 		last_undo_level = "";
 	}
 	updateThingLists();
@@ -5104,7 +5031,7 @@ void MapEditor::doUndo()
 void MapEditor::doRedo()
 {
 	// Redo
-	int time = theApp->runTimer() - 1;
+	long generation = map.currentGeneration();
 	UndoManager* manager = (edit_mode == MODE_3D) ? undo_manager_3d : undo_manager;
 	string undo_name = manager->redo();
 
@@ -5116,17 +5043,50 @@ void MapEditor::doRedo()
 		// Refresh stuff
 		//updateTagged();
 		clearSelection();
-		map.rebuildConnectedLines();
-		map.rebuildConnectedSides();
-		map.geometry_updated = theApp->runTimer();
-		map.updateGeometryInfo(time);
+		map.setGeometryUpdated();
+		map.updateGeometryInfo(generation);
 		last_undo_level = "";
 	}
 	updateThingLists();
 }
 
+/* MapEditor::reclaimObjects
+ * Frees any deleted map objects that can no longer be restored by
+ * undo/redo in either undo manager. Returns the number of objects
+ * freed
+ *******************************************************************/
+unsigned MapEditor::reclaimObjects()
+{
+	// Get all objects referenced by undo history
+	vector<unsigned> referenced;
+	undo_manager->getObjectIds(referenced);
+	undo_manager_3d->getObjectIds(referenced);
+
+	// Free everything else
+	unsigned freed = map.reclaimObjects(referenced);
+	if (freed > 0)
+	{
+		// Refresh anything that might be pointing to freed objects
+		updateTagged();
+		if (canvas)
+			canvas->forceRefreshRenderer();
+	}
+
+	return freed;
+}
+
 #pragma endregion
 
+/* MapEditor::onAnnouncement
+ * Handles any announcements from the undo managers
+ *******************************************************************/
+void MapEditor::onAnnouncement(Announcer* announcer, string event_name, MemChunk& event_data)
+{
+	// Undo levels were removed, objects they referenced may be freed
+	if (event_name == "levels_removed")
+		reclaimObjects();
+}
+
 #pragma region CONSOLE COMMANDS
 
 /*******************************************************************
@@ -5215,6 +5175,56 @@ CONSOLE_COMMAND(m_check, 0, true)
 	}
 }
 
+CONSOLE_COMMAND(m_object_memory, 0, false)
+{
+	MapEditor& editor = theMapEditor->mapEditor();
+	SLADEMap& map = editor.getMap();
+
+	// Free unreachable objects first if requested
+	if (!args.empty() && args[0].CmpNoCase("reclaim") == 0)
+	{
+		unsigned n_freed = editor.reclaimObjects();
+		theConsole->logMessage(S_FMT("Freed %d objects", n_freed));
+	}
+
+	// Count objects in the map and held for undo/redo
+	unsigned in_map[5] = { 0, 0, 0, 0, 0 };
+	unsigned held[5] = { 0, 0, 0, 0, 0 };
+	unsigned freed = 0;
+	for (unsigned a = 1; a < map.nObjectIds(); a++)
+	{
+		MapObject* object = map.getObjectById(a);
+		if (!object)
+		{
+			freed++;
+			continue;
+		}
+
+		unsigned type = object->getObjType() - MOBJ_VERTEX;
+		if (type >= 5)
+			continue;
+		if (map.objectInMap(a))
+			in_map[type]++;
+		else
+			held[type]++;
+	}
+
+	// Pool usage
+	const char* names[] = { "Vertices", "Lines", "Sides", "Sectors", "Things" };
+	unsigned used[] = { vertex_pool.nUsed(), line_pool.nUsed(), side_pool.nUsed(), sector_pool.nUsed(), thing_pool.nUsed() };
+	unsigned slabs[] = { vertex_pool.nSlabs(), line_pool.nSlabs(), side_pool.nSlabs(), sector_pool.nSlabs(), thing_pool.nSlabs() };
+	unsigned mem[] = { vertex_pool.memoryUsage(), line_pool.memoryUsage(), side_pool.memoryUsage(), sector_pool.memoryUsage(), thing_pool.memoryUsage() };
+
+	unsigned total = 0;
+	for (unsigned a = 0; a < 5; a++)
+	{
+		theConsole->logMessage(S_FMT("%s: %d in map, %d deleted (held for undo), %d allocated in %d slabs, %1.2fkb",
+			names[a], in_map[a], held[a], used[a], slabs[a], (double)mem[a] / 1024.0));
+		total += mem[a];
+	}
+	theConsole->logMessage(S_FMT("%d object ids, %d freed, %1.2fkb total", (int)map.nObjectIds(), freed, (double)total / 1024.0));
+}
+
 #pragma endregion
 
 
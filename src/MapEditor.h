@@ -5,6 +5,7 @@
 #include "SLADEMap.h"
 #include "ObjectEdit.h"
 #include "GameConfiguration.h"
+#include "ListenerAnnouncer.h"
 
 struct selection_3d_t
 {
@@ -21,7 +22,7 @@ struct selection_3d_t
 class MapCanvas;
 class UndoManager;
 class MapObjectCreateDeleteUS;
-class MapEditor
+class MapEditor : public Listener
 {
 private:
 	SLADEMap			map;
@@ -37,6 +38,7 @@ private:
 	int			hilight_item;
 	bool		hilight_locked;
 	vector<int>	selection;
+	vector<bool>	selection_flags;	// Selected state by object index
 	int			gridsize;
 	int			sector_mode;
 	bool		grid_snap;
@@ -170,6 +172,7 @@ public:
 	void	setEditMode(int mode);
 	void	setSectorEditMode(int mode);
 	void	setCanvas(MapCanvas* canvas) { this->canvas = canvas; }
+	MapCanvas*	getCanvas() { return canvas; }
 
 	// Map loading
 	bool	openMap(Archive::mapdesc_t map);
@@ -180,6 +183,9 @@ public:
 	bool		updateHilight(fpoint2_t mouse_pos, double dist_scale);
 	void		updateTagged();
 	void		selectionUpdated();
+	bool		isSelected(int index);
+	void		clearSelectionList();
+	void		addToSelection(int index);
 	void		clearSelection(bool animate = true);
 	void		selectAll();
 	bool		selectCurrent(bool clear_none = true);
@@ -280,6 +286,7 @@ public:
 	void	recordPropertyChangeUndoStep(MapObject* object);
 	void	doUndo();
 	void	doRedo();
+	unsigned	reclaimObjects();
 
 	// Misc
 	string	getModeString();
@@ -287,6 +294,8 @@ public:
 	void	updateDisplay();
 	void	updateStatusText();
 	void	updateThingLists();
+
+	void	onAnnouncement(Announcer* announcer, string event_name, MemChunk& event_data);
 };
 
 #endif//__MAP_EDITOR_H__
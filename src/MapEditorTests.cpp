@@ -0,0 +1,1214 @@
+/*******************************************************************
+ * SLADE - It's a Doom Editor
+ * Copyright (C) 2008-2014 Simon Judd
+ *
+ * Email:       sirjuddington@gmail.com
+ * Web:         http://slade.mancubus.net
+ * Filename:    MapEditorTests.cpp
+ * Description: Console commands for testing and timing map editing
+ *              and rendering stuff against the current map
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *******************************************************************/
+
+
+/*******************************************************************
+ * INCLUDES
+ *******************************************************************/
+#include "Main.h"
+#include "MapEditor.h"
+#include "MapEditorWindow.h"
+#include "MathStuff.h"
+#include "Console.h"
+#include "MapCanvas.h"
+#include "MapRenderer2D.h"
+#include "SectorBuilder.h"
+#include "Parser.h"
+
+
+/*******************************************************************
+ * EXTERNAL VARIABLES
+ *******************************************************************/
+EXTERN_CVAR(Float, map_lod_lines)
+
+
+/*******************************************************************
+ * TEST HELPER FUNCTIONS
+ *******************************************************************/
+
+/* testMismatch
+ * Logs [message] for one of the first 10 mismatches in a test, and
+ * increments [mismatches]
+ *******************************************************************/
+void testMismatch(unsigned& mismatches, string message)
+{
+	if (mismatches < 10)
+		wxLogMessage("%s", message);
+	mismatches++;
+}
+
+/* testLoadMapCopy
+ * Loads a separate copy of the current map to test edits on, and
+ * sets [rounds] from the first of [args] (if given). Also seeds rand
+ * so that random edits are the same each run. Returns NULL if the
+ * map has no sectors
+ *******************************************************************/
+SLADEMap* testLoadMapCopy(vector<string>& args, unsigned& rounds)
+{
+	SLADEMap* map = new SLADEMap();
+	map->readMap(theMapEditor->currentMapDesc());
+	if (map->nSectors() == 0)
+	{
+		theConsole->logMessage("Map has no sectors to test with");
+		delete map;
+		return NULL;
+	}
+
+	if (args.size() > 0)
+		rounds = MAX(1, atoi(CHR(args[0])));
+	srand(1);
+
+	return map;
+}
+
+
+/*******************************************************************
+ * MAPEDITTEST CLASS
+ *******************************************************************
+ * Base for tests that make rounds of random edits to a copy of the
+ * current map, checking after each round that whatever was updated
+ * by the edits matches a reference (usually a full rebuild)
+ */
+class MapEditTest
+{
+protected:
+	SLADEMap*	map;
+	unsigned	rounds;
+	unsigned	mismatches;
+
+public:
+	MapEditTest(unsigned rounds)
+	{
+		this->map = NULL;
+		this->rounds = rounds;
+		this->mismatches = 0;
+	}
+
+	virtual ~MapEditTest()
+	{
+		if (map)
+			delete map;
+	}
+
+	// Sets up the test once [map] is loaded, returns false to abort
+	virtual bool init() { return true; }
+
+	// Makes [round]'s edits to [map] and updates what is being tested
+	virtual void edit(unsigned round) = 0;
+
+	// Compares the result of [round]'s edits with the reference,
+	// returns false to stop testing
+	virtual bool check(unsigned round) = 0;
+
+	// Logs the test results
+	virtual void report() = 0;
+
+	void run(vector<string>& args)
+	{
+		map = testLoadMapCopy(args, rounds);
+		if (!map || !init())
+			return;
+
+		for (unsigned r = 0; r < rounds; r++)
+		{
+			edit(r);
+			if (!check(r))
+				break;
+		}
+
+		report();
+	}
+};
+
+
+/*******************************************************************
+ * CONSOLE COMMANDS
+ *******************************************************************/
+
+/* testParseTreeMemory
+ * Returns the approximate memory used by [node] and its children
+ *******************************************************************/
+unsigned long testParseTreeMemory(ParseTreeNode* node)
+{
+	unsigned long mem = sizeof(ParseTreeNode) + node->nChildren() * sizeof(STreeNode*);
+	mem += (node->getName().Length() + node->getType().Length() + node->getInherit().Length()) * sizeof(wxChar);
+	for (unsigned a = 0; a < node->nValues(); a++)
+	{
+		Property value = node->getValue(a);
+		mem += sizeof(Property);
+		if (value.getType() == PROP_STRING)
+			mem += value.getStringValue().Length() * sizeof(wxChar);
+	}
+
+	for (unsigned a = 0; a < node->nChildren(); a++)
+		mem += testParseTreeMemory((ParseTreeNode*)node->getChild(a));
+
+	return mem;
+}
+
+/* testMapObjects
+ * Adds all vertices, lines, sides, sectors and things in [map] to
+ * [objects]
+ *******************************************************************/
+void testMapObjects(SLADEMap* map, vector<MapObject*>& objects)
+{
+	for (unsigned a = 0; a < map->nVertices(); a++)
+		objects.push_back(map->getVertex(a));
+	for (unsigned a = 0; a < map->nLines(); a++)
+		objects.push_back(map->getLine(a));
+	for (unsigned a = 0; a < map->nSides(); a++)
+		objects.push_back(map->getSide(a));
+	for (unsigned a = 0; a < map->nSectors(); a++)
+		objects.push_back(map->getSector(a));
+	for (unsigned a = 0; a < map->nThings(); a++)
+		objects.push_back(map->getThing(a));
+}
+
+/* testObjectMemory
+ * Returns the approximate memory used by all objects in [map] and
+ * their properties. The number of properties and how many of them
+ * are strings are added to [n_props] and [n_strings]
+ *******************************************************************/
+unsigned long testObjectMemory(SLADEMap* map, unsigned& n_props, unsigned& n_strings)
+{
+	unsigned long mem = map->nVertices() * sizeof(MapVertex) + map->nLines() * sizeof(MapLine) +
+		map->nSides() * sizeof(MapSide) + map->nSectors() * sizeof(MapSector) + map->nThings() * sizeof(MapThing);
+
+	// Add properties
+	vector<MapObject*> objects;
+	testMapObjects(map, objects);
+	for (unsigned a = 0; a < objects.size(); a++)
+	{
+		vector<MobjPropertyList::prop_t>& props = objects[a]->props().allProperties();
+		mem += props.capacity() * sizeof(MobjPropertyList::prop_t);
+		for (unsigned b = 0; b < props.size(); b++)
+		{
+			n_props++;
+			if (props[b].value.getType() == PROP_STRING)
+			{
+				n_strings++;
+				mem += sizeof(string) + props[b].value.getStringValue().Length() * sizeof(wxChar);
+			}
+		}
+	}
+
+	return mem;
+}
+
+CONSOLE_COMMAND(m_test_udmf_load, 0, false)
+{
+	Archive::mapdesc_t mdesc = theMapEditor->currentMapDesc();
+	if (mdesc.format != MAP_UDMF || !mdesc.head || mdesc.archive)
+	{
+		theConsole->logMessage("Current map is not a UDMF map in a wad");
+		return;
+	}
+
+	// Parse tree of the TEXTMAP (as used by the generic Parser). The
+	// tree was held in memory until all map objects were created from
+	// it, so it adds to the peak memory of a load
+	sf::Clock clock;
+	Parser* parser = new Parser();
+	parser->parseText(mdesc.head->nextEntry()->getMCData());
+	long time_parse = clock.getElapsedTime().asMicroseconds();
+	unsigned n_blocks = parser->parseTreeRoot()->nChildren();
+	unsigned long mem_tree = testParseTreeMemory(parser->parseTreeRoot());
+	clock.restart();
+	delete parser;
+	long time_tree_cleanup = clock.getElapsedTime().asMicroseconds();
+
+	// Streaming read into map objects
+	clock.restart();
+	SLADEMap* map = new SLADEMap();
+	map->readUDMFMap(mdesc);
+	long time_read = clock.getElapsedTime().asMicroseconds();
+	unsigned n_props = 0;
+	unsigned n_strings = 0;
+	unsigned long mem_map = testObjectMemory(map, n_props, n_strings);
+	wxLogMessage("%d blocks: %lu vertices, %lu lines, %lu sides, %lu sectors, %lu things, %d properties",
+	             n_blocks, map->nVertices(), map->nLines(), map->nSides(), map->nSectors(), map->nThings(), n_props);
+	clock.restart();
+	delete map;
+	long time_map_cleanup = clock.getElapsedTime().asMicroseconds();
+
+	wxLogMessage("Parse tree only: %1.2fms (+%1.2fms cleanup), approx. %1.2fkb",
+	             time_parse * 0.001, time_tree_cleanup * 0.001, (double)mem_tree / 1024.0);
+	wxLogMessage("Streaming read: %1.2fms (+%1.2fms cleanup), map objects approx. %1.2fkb",
+	             time_read * 0.001, time_map_cleanup * 0.001, (double)mem_map / 1024.0);
+	wxLogMessage("Approx. peak memory: parse tree load %1.2fkb, streaming load %1.2fkb",
+	             (double)(mem_tree + mem_map) / 1024.0, (double)mem_map / 1024.0);
+}
+
+CONSOLE_COMMAND(m_test_map_load, 0, false)
+{
+	// Load
+	sf::Clock clock;
+	SLADEMap* map = new SLADEMap();
+	map->readMap(theMapEditor->currentMapDesc());
+	wxLogMessage("Load: %dms", clock.getElapsedTime().asMilliseconds());
+
+	// Iterate over all objects a few times
+	clock.restart();
+	double total = 0;
+	for (unsigned i = 0; i < 10; i++)
+	{
+		for (unsigned a = 0; a < map->nVertices(); a++)
+			total += map->getVertex(a)->xPos();
+		for (unsigned a = 0; a < map->nLines(); a++)
+			total += map->getLine(a)->getLength();
+		for (unsigned a = 0; a < map->nSides(); a++)
+			total += map->getSide(a)->getOffsetX();
+		for (unsigned a = 0; a < map->nSectors(); a++)
+			total += map->getSector(a)->boundingBox().width();
+		for (unsigned a = 0; a < map->nThings(); a++)
+			total += map->getThing(a)->yPos();
+	}
+	wxLogMessage("Full iteration x10: %dms (%1.0f)", clock.getElapsedTime().asMilliseconds(), total);
+
+	// Close
+	clock.restart();
+	delete map;
+	wxLogMessage("Close: %dms", clock.getElapsedTime().asMilliseconds());
+}
+
+CONSOLE_COMMAND(m_test_props, 0, false)
+{
+	SLADEMap& map = theMapEditor->mapEditor().getMap();
+	unsigned atom = MobjPropertyList::atom("lightfloor");
+
+	// Lookup by name
+	sf::Clock clock;
+	long total = 0;
+	for (unsigned i = 0; i < 100; i++)
+	{
+		for (unsigned a = 0; a < map.nSectors(); a++)
+			total += map.getSector(a)->MapObject::intProperty("lightfloor");
+	}
+	wxLogMessage("Property lookup by name x100: %dms (%ld)", clock.getElapsedTime().asMilliseconds(), total);
+
+	// Lookup by atom
+	clock.restart();
+	total = 0;
+	for (unsigned i = 0; i < 100; i++)
+	{
+		for (unsigned a = 0; a < map.nSectors(); a++)
+			total += map.getSector(a)->intPropertyAtom(atom);
+	}
+	wxLogMessage("Property lookup by atom x100: %dms (%ld)", clock.getElapsedTime().asMilliseconds(), total);
+
+	// Sector colours (as used when rendering)
+	clock.restart();
+	total = 0;
+	for (unsigned i = 0; i < 100; i++)
+	{
+		for (unsigned a = 0; a < map.nSectors(); a++)
+			total += map.getSector(a)->getColour(1).r;
+	}
+	wxLogMessage("Sector colour x100: %dms (%ld)", clock.getElapsedTime().asMilliseconds(), total);
+
+	wxLogMessage("%d property names interned", MobjPropertyList::nAtoms());
+}
+
+CONSOLE_COMMAND(m_test_prop_memory, 0, false)
+{
+	SLADEMap& map = theMapEditor->mapEditor().getMap();
+	vector<MapObject*> objects;
+	testMapObjects(&map, objects);
+
+	// Property layout before string values were moved out of line
+	struct old_property_t { uint8_t type; prop_value value; string val_string; bool has_value; };
+	struct old_prop_t { unsigned atom; old_property_t value; };
+
+	// Count properties and the memory used by them, with both layouts
+	unsigned n_props = 0;
+	unsigned n_strings = 0;
+	unsigned long mem = 0;
+	unsigned long mem_old = 0;
+	for (unsigned a = 0; a < objects.size(); a++)
+	{
+		vector<MobjPropertyList::prop_t>& props = objects[a]->props().allProperties();
+		mem += props.capacity() * sizeof(MobjPropertyList::prop_t);
+		mem_old += props.capacity() * sizeof(old_prop_t);
+		for (unsigned b = 0; b < props.size(); b++)
+		{
+			n_props++;
+			if (props[b].value.getType() == PROP_STRING)
+			{
+				unsigned long length = props[b].value.getStringValue().Length() * sizeof(wxChar);
+				n_strings++;
+				mem += sizeof(string) + length;
+				mem_old += length;
+			}
+		}
+	}
+
+	wxLogMessage("sizeof(Property) = %d (previously %d), sizeof(prop_t) = %d (previously %d)",
+	             (int)sizeof(Property), (int)sizeof(old_property_t), (int)sizeof(MobjPropertyList::prop_t), (int)sizeof(old_prop_t));
+	wxLogMessage("%d objects, %d properties (%d strings), approx. %1.2fkb (previously %1.2fkb)",
+	             (int)objects.size(), n_props, n_strings, (double)mem / 1024.0, (double)mem_old / 1024.0);
+}
+
+/* testPolygonArea
+ * Returns the total area of all sub-polygons in [poly], and adds
+ * their vertex positions to [verts]
+ *******************************************************************/
+double testPolygonArea(Polygon2D& poly, std::map<std::pair<double, double>, bool>& verts)
+{
+	double total = 0;
+	for (unsigned a = 0; a < poly.nSubPolys(); a++)
+	{
+		gl_polygon_t* sub = poly.getSubPoly(a);
+		double area = 0;
+		for (unsigned v = 0; v < sub->n_vertices; v++)
+		{
+			gl_vertex_t& v1 = sub->vertices[v];
+			gl_vertex_t& v2 = sub->vertices[(v + 1) % sub->n_vertices];
+			area += v1.x * v2.y - v2.x * v1.y;
+			verts[std::make_pair((double)v1.x, (double)v1.y)] = true;
+		}
+		total += fabs(area) * 0.5;
+	}
+
+	return total;
+}
+
+CONSOLE_COMMAND(m_test_polygons, 0, false)
+{
+	SLADEMap& map = theMapEditor->mapEditor().getMap();
+
+	// Build each sector polygon with the old polygon splitter and the
+	// triangulator, and check both cover the same area with the same
+	// vertices (the triangulator can drop collinear vertices)
+	long time_splitter = 0;
+	long time_triangulator = 0;
+	unsigned n_polys_splitter = 0;
+	unsigned n_polys_triangulator = 0;
+	unsigned n_failed = 0;
+	unsigned mismatches = 0;
+	sf::Clock clock;
+	for (unsigned a = 0; a < map.nSectors(); a++)
+	{
+		vector<fpoint2_t> edges;
+		Polygon2D::getSectorEdges(map.getSector(a), edges);
+
+		// Splitter
+		clock.restart();
+		Polygon2D poly_splitter;
+		PolygonSplitter splitter;
+		for (unsigned e = 0; e + 1 < edges.size(); e += 2)
+			splitter.addEdge(edges[e].x, edges[e].y, edges[e+1].x, edges[e+1].y);
+		splitter.doSplitting(&poly_splitter);
+		time_splitter += clock.getElapsedTime().asMicroseconds();
+		n_polys_splitter += poly_splitter.nSubPolys();
+
+		// Triangulator
+		clock.restart();
+		Polygon2D poly_triangulator;
+		PolygonTriangulator triangulator;
+		for (unsigned e = 0; e + 1 < edges.size(); e += 2)
+			triangulator.addEdge(edges[e].x, edges[e].y, edges[e+1].x, edges[e+1].y);
+		bool ok = triangulator.triangulate(&poly_triangulator);
+		time_triangulator += clock.getElapsedTime().asMicroseconds();
+		n_polys_triangulator += poly_triangulator.nSubPolys();
+
+		// Sectors the triangulator can't handle fall back to the splitter
+		if (!ok)
+		{
+			n_failed++;
+			continue;
+		}
+
+		// Compare area and vertices
+		std::map<std::pair<double, double>, bool> verts_splitter;
+		std::map<std::pair<double, double>, bool> verts_triangulator;
+		double area_splitter = testPolygonArea(poly_splitter, verts_splitter);
+		double area_triangulator = testPolygonArea(poly_triangulator, verts_triangulator);
+		unsigned n_extra = 0;
+		std::map<std::pair<double, double>, bool>::iterator i;
+		for (i = verts_triangulator.begin(); i != verts_triangulator.end(); i++)
+		{
+			if (verts_splitter.find(i->first) == verts_splitter.end())
+				n_extra++;
+		}
+		if (fabs(area_splitter - area_triangulator) > 1 + area_splitter * 0.001 || n_extra > 0)
+			testMismatch(mismatches, S_FMT("Mismatch in sector %d: splitter area %1.1f, triangulator area %1.1f, %d vertices not in splitter polygon",
+			                               a, area_splitter, area_triangulator, n_extra));
+	}
+
+	wxLogMessage("Splitter: %1.2fms (%d polygons)", time_splitter * 0.001, n_polys_splitter);
+	wxLogMessage("Triangulator: %1.2fms (%d polygons, %d sectors need splitter fallback)",
+	             time_triangulator * 0.001, n_polys_triangulator, n_failed);
+	wxLogMessage("%lu sectors compared, %d mismatches", map.nSectors() - n_failed, mismatches);
+
+	// Build all sector polygons (as on map open), with and without threads
+	for (unsigned t = 0; t < 2; t++)
+	{
+		for (unsigned a = 0; a < map.nSectors(); a++)
+		{
+			// Clear the existing polygon so it's rebuilt immediately
+			// rather than in the background
+			map.getSector(a)->getPolygon()->clear();
+			map.getSector(a)->resetPolygon();
+		}
+
+		clock.restart();
+		map.initSectorPolygons(t == 1);
+		wxLogMessage("Build all polygons (%s): %dms", t == 1 ? "threaded" : "single thread", clock.getElapsedTime().asMilliseconds());
+	}
+}
+
+/* testDrawLines
+ * Draws a line between each pair of [points] in [map], cutting any
+ * existing lines crossed (as line drawing in the editor does), and
+ * builds sectors for the new lines with or without the SectorBuilder
+ * geometry index depending on [use_index]. Returns the time taken
+ * to build the sectors (us)
+ *******************************************************************/
+long testDrawLines(SLADEMap* map, vector<fpoint2_t>& points, bool use_index)
+{
+	unsigned nl_start = map->nLines();
+	for (unsigned a = 0; a + 1 < points.size(); a += 2)
+	{
+		map->createVertex(points[a].x, points[a].y, 1);
+		map->createVertex(points[a+1].x, points[a+1].y, 1);
+
+		// Create lines between intersection points
+		vector<fpoint2_t> intersect = map->cutLines(points[a].x, points[a].y, points[a+1].x, points[a+1].y);
+		fpoint2_t start = points[a];
+		for (unsigned p = 0; p < intersect.size(); p++)
+		{
+			map->createLine(start.x, start.y, intersect[p].x, intersect[p].y, 1);
+			start = intersect[p];
+		}
+		map->createLine(start.x, start.y, points[a+1].x, points[a+1].y, 1);
+	}
+
+	// Build sectors
+	vector<MapLine*> new_lines;
+	for (unsigned a = nl_start; a < map->nLines(); a++)
+		new_lines.push_back(map->getLine(a));
+	sf::Clock clock;
+	map->correctSectors(new_lines, false, use_index);
+
+	return clock.getElapsedTime().asMicroseconds();
+}
+
+/* testTraceMatches
+ * Traces the [front] or back side of [line1] in its map with
+ * [builder1], and of [line2] with [builder2]. Returns true if both
+ * traces give the same outline (by line index)
+ *******************************************************************/
+bool testTraceMatches(SectorBuilder& builder1, MapLine* line1, SectorBuilder& builder2, MapLine* line2, bool front)
+{
+	bool ok1 = builder1.traceSector(line1->getParentMap(), line1, front);
+	bool ok2 = builder2.traceSector(line2->getParentMap(), line2, front);
+	if (ok1 != ok2 || builder1.nEdges() != builder2.nEdges())
+		return false;
+
+	for (unsigned e = 0; e < builder1.nEdges(); e++)
+	{
+		if (builder1.getEdgeLine(e)->getIndex() != builder2.getEdgeLine(e)->getIndex() ||
+			builder1.edgeIsFront(e) != builder2.edgeIsFront(e))
+			return false;
+	}
+
+	return true;
+}
+
+/*******************************************************************
+ * CORRECTSECTORSTEST CLASS
+ *******************************************************************
+ * Draws batches of random lines across two copies of the map, and
+ * checks building sectors for them with the SectorBuilder geometry
+ * index gives the same result as without it
+ */
+class CorrectSectorsTest : public MapEditTest
+{
+private:
+	SLADEMap*		map_unindexed;
+	SectorBuilder	builder_indexed;
+	SectorBuilder	builder_unindexed;
+	bbox_t			bbox;
+	unsigned		batch;
+	unsigned		nl_start;
+	unsigned		n_lines;
+	long			time_indexed;
+	long			time_unindexed;
+
+public:
+	CorrectSectorsTest() : MapEditTest(10)
+	{
+		map_unindexed = NULL;
+		batch = 16;
+		nl_start = 0;
+		n_lines = 0;
+		time_indexed = 0;
+		time_unindexed = 0;
+
+		// Builders kept between edits, so the index is updated after
+		// each batch of lines and moved vertices
+		builder_unindexed.setUseIndex(false);
+	}
+
+	~CorrectSectorsTest()
+	{
+		if (map_unindexed)
+			delete map_unindexed;
+	}
+
+	bool init()
+	{
+		// Second copy of the map to build sectors in without the index
+		map_unindexed = new SLADEMap();
+		map_unindexed->readMap(theMapEditor->currentMapDesc());
+		bbox = map->getMapBBox();
+
+		return true;
+	}
+
+	void edit(unsigned round)
+	{
+		// Move some vertices
+		for (unsigned a = 0; a < 4; a++)
+		{
+			unsigned index = rand() % map->nVertices();
+			MapVertex* vertex = map->getVertex(index);
+			double x = vertex->xPos() + rand() % 32 - 16;
+			double y = vertex->yPos() + rand() % 32 - 16;
+			map->moveVertex(index, x, y);
+			map_unindexed->moveVertex(index, x, y);
+		}
+
+		// Draw a batch of random lines across the map, splitting any
+		// lines they cross
+		vector<fpoint2_t> points;
+		for (unsigned a = 0; a < batch * 2; a++)
+			points.push_back(fpoint2_t((int)(bbox.min.x + (bbox.max.x - bbox.min.x) * rand() / RAND_MAX),
+			                           (int)(bbox.min.y + (bbox.max.y - bbox.min.y) * rand() / RAND_MAX)));
+		nl_start = map->nLines();
+		time_indexed += testDrawLines(map, points, true);
+		time_unindexed += testDrawLines(map_unindexed, points, false);
+		n_lines += map->nLines() - nl_start;
+	}
+
+	bool check(unsigned round)
+	{
+		// Compare sectors on both sides of each line
+		if (map->nLines() != map_unindexed->nLines() || map->nSectors() != map_unindexed->nSectors())
+		{
+			testMismatch(mismatches, S_FMT("Mismatch after batch %d: %lu/%lu lines, %lu/%lu sectors", round,
+			                               map->nLines(), map_unindexed->nLines(), map->nSectors(), map_unindexed->nSectors()));
+			return false;
+		}
+		unsigned n_diff = 0;
+		for (unsigned a = 0; a < map->nLines(); a++)
+		{
+			MapSector* f1 = map->getLine(a)->frontSector();
+			MapSector* b1 = map->getLine(a)->backSector();
+			MapSector* f2 = map_unindexed->getLine(a)->frontSector();
+			MapSector* b2 = map_unindexed->getLine(a)->backSector();
+			if ((f1 ? (int)f1->getIndex() : -1) != (f2 ? (int)f2->getIndex() : -1) ||
+				(b1 ? (int)b1->getIndex() : -1) != (b2 ? (int)b2->getIndex() : -1))
+				n_diff++;
+		}
+		if (n_diff > 0)
+			testMismatch(mismatches, S_FMT("Mismatch after batch %d: %d lines have different sectors", round, n_diff));
+
+		// Trace from the new lines with the kept builders
+		for (unsigned a = nl_start; a < map->nLines(); a++)
+		{
+			for (unsigned s = 0; s < 2; s++)
+			{
+				if (!testTraceMatches(builder_indexed, map->getLine(a), builder_unindexed, map_unindexed->getLine(a), s == 0))
+					testMismatch(mismatches, S_FMT("Mismatch after batch %d tracing line %d %s", round, a, s == 0 ? "front" : "back"));
+			}
+		}
+
+		return true;
+	}
+
+	void report()
+	{
+		wxLogMessage("correctSectors over %d batches of %d drawn lines (%d lines after splitting): indexed %1.2fms, unindexed %1.2fms, %d mismatches",
+		             rounds, batch, n_lines, time_indexed * 0.001, time_unindexed * 0.001, mismatches);
+	}
+};
+
+CONSOLE_COMMAND(m_test_correct_sectors, 0, false)
+{
+	CorrectSectorsTest test;
+	test.run(args);
+}
+
+CONSOLE_COMMAND(m_test_visibility, 0, false)
+{
+	SLADEMap& map = theMapEditor->mapEditor().getMap();
+	bbox_t bbox = map.getMapBBox();
+
+	// View size in map units (default 2048x1536, about a 1024x768
+	// window at 50% zoom)
+	double width = 2048;
+	if (args.size() > 0)
+		width = MAX(64, atoi(CHR(args[0])));
+	double height = width * 0.75;
+	MapRenderer2D renderer(&map);
+	renderer.setScale(1024.0 / width);
+
+	// First update (includes building the spatial index)
+	sf::Clock clock;
+	renderer.updateVisibility(bbox.min, fpoint2_t(bbox.min.x + width, bbox.min.y + height));
+	long first = clock.getElapsedTime().asMicroseconds();
+
+	// Pan diagonally across the map
+	unsigned frames = 200;
+	long total = 0;
+	long slowest = 0;
+	unsigned n_sectors = 0;
+	unsigned n_things = 0;
+	for (unsigned a = 0; a < frames; a++)
+	{
+		double x = bbox.min.x + (bbox.max.x - bbox.min.x - width) * a / (frames - 1);
+		double y = bbox.min.y + (bbox.max.y - bbox.min.y - height) * a / (frames - 1);
+
+		clock.restart();
+		renderer.updateVisibility(fpoint2_t(x, y), fpoint2_t(x + width, y + height));
+		long time = clock.getElapsedTime().asMicroseconds();
+		total += time;
+		slowest = MAX(slowest, time);
+
+		unsigned vs, vt;
+		renderer.getVisibleCounts(vs, vt);
+		n_sectors += vs;
+		n_things += vt;
+	}
+
+	wxLogMessage("Visibility update over %d panned frames (%dx%d view, %lu sectors, %lu things): first %1.2fms, average %1.3fms, slowest %1.3fms",
+	             frames, (int)width, (int)height, map.nSectors(), map.nThings(), first * 0.001, total * 0.001 / frames, slowest * 0.001);
+	wxLogMessage("Average %d sectors, %d things in view", n_sectors / frames, n_things / frames);
+}
+
+/*******************************************************************
+ * VBOBUILDTEST CLASS
+ *******************************************************************
+ * Keeps vertex and line data for a copy of the map (standing in for
+ * the 2d VBOs) updated by rewriting only the objects the renderer
+ * reports as dirty, and checks it against a full rebuild
+ */
+class VBOBuildTest : public MapEditTest
+{
+private:
+	MapRenderer2D*					renderer;
+	bbox_t							bbox;
+	vector<float>					vbo_verts;
+	vector<MapRenderer2D::glvert_t>	vbo_lines;
+	unsigned						n_dirty;
+
+public:
+	VBOBuildTest() : MapEditTest(20)
+	{
+		renderer = NULL;
+		n_dirty = 0;
+	}
+
+	~VBOBuildTest()
+	{
+		if (renderer)
+			delete renderer;
+	}
+
+	bool init()
+	{
+		renderer = new MapRenderer2D(map);
+		bbox = map->getMapBBox();
+
+		// Initial vertex and line data
+		renderer->getVertexVBOData(0, map->nVertices(), vbo_verts);
+		renderer->getLineVBOData(0, map->nLines(), true, 1.0f, vbo_lines);
+		renderer->setVBOsUpdated();
+
+		return true;
+	}
+
+	void edit(unsigned round)
+	{
+		// Move some vertices, remove a line and a vertex, and draw a
+		// new line
+		for (unsigned a = 0; a < 8; a++)
+		{
+			unsigned index = rand() % map->nVertices();
+			MapVertex* vertex = map->getVertex(index);
+			map->moveVertex(index, vertex->xPos() + rand() % 64 - 32, vertex->yPos() + rand() % 64 - 32);
+		}
+		if (map->nLines() > 1)
+			map->removeLine(rand() % map->nLines());
+		if (map->nVertices() > 2)
+			map->removeVertex(rand() % map->nVertices());
+		map->createLine(bbox.min.x + (bbox.max.x - bbox.min.x) * rand() / RAND_MAX,
+		                bbox.min.y + (bbox.max.y - bbox.min.y) * rand() / RAND_MAX,
+		                bbox.min.x + (bbox.max.x - bbox.min.x) * rand() / RAND_MAX,
+		                bbox.min.y + (bbox.max.y - bbox.min.y) * rand() / RAND_MAX);
+
+		// Rewrite only the dirty vertices and lines
+		vector<unsigned> dirty;
+		vector<float> verts;
+		vbo_verts.resize(map->nVertices() * 2);
+		renderer->getDirtyVertices(dirty);
+		n_dirty += dirty.size();
+		for (unsigned a = 0; a < dirty.size(); a++)
+		{
+			renderer->getVertexVBOData(dirty[a], 1, verts);
+			vbo_verts[dirty[a] * 2] = verts[0];
+			vbo_verts[dirty[a] * 2 + 1] = verts[1];
+		}
+		vector<MapRenderer2D::glvert_t> lines;
+		vbo_lines.resize(map->nLines() * 4);
+		dirty.clear();
+		renderer->getDirtyLines(dirty);
+		n_dirty += dirty.size();
+		for (unsigned a = 0; a < dirty.size(); a++)
+		{
+			renderer->getLineVBOData(dirty[a], 1, true, 1.0f, lines);
+			for (unsigned v = 0; v < 4; v++)
+				vbo_lines[dirty[a] * 4 + v] = lines[v];
+		}
+		renderer->setVBOsUpdated();
+	}
+
+	bool check(unsigned round)
+	{
+		unsigned bad_verts = 0;
+		vector<float> verts;
+		renderer->getVertexVBOData(0, map->nVertices(), verts);
+		for (unsigned a = 0; a < verts.size(); a++)
+		{
+			if (verts[a] != vbo_verts[a])
+				bad_verts++;
+		}
+
+		unsigned bad_lines = 0;
+		vector<MapRenderer2D::glvert_t> lines;
+		renderer->getLineVBOData(0, map->nLines(), true, 1.0f, lines);
+		for (unsigned a = 0; a < lines.size(); a++)
+		{
+			if (lines[a].x != vbo_lines[a].x || lines[a].y != vbo_lines[a].y ||
+				lines[a].r != vbo_lines[a].r || lines[a].g != vbo_lines[a].g ||
+				lines[a].b != vbo_lines[a].b || lines[a].a != vbo_lines[a].a)
+				bad_lines++;
+		}
+
+		if (bad_verts > 0 || bad_lines > 0)
+			testMismatch(mismatches, S_FMT("Mismatch after edit %d: %d vertex values, %d line vertices differ from a full rebuild", round, bad_verts, bad_lines));
+
+		return true;
+	}
+
+	void report()
+	{
+		wxLogMessage("Incremental VBO data over %d edits (%lu vertices, %lu lines): %d objects rewritten, %d mismatches",
+		             rounds, map->nVertices(), map->nLines(), n_dirty, mismatches);
+	}
+};
+
+CONSOLE_COMMAND(m_test_vbo_build, 0, false)
+{
+	VBOBuildTest test;
+	test.run(args);
+}
+
+CONSOLE_COMMAND(m_test_thing_batch, 0, false)
+{
+	MapEditor& editor = theMapEditor->mapEditor();
+	if (!editor.getCanvas() || editor.editMode() == MapEditor::MODE_3D)
+	{
+		theConsole->logMessage("Map editor must be in 2d mode");
+		return;
+	}
+	unsigned runs = 20;
+	if (args.size() > 0)
+		runs = MAX(1, atoi(CHR(args[0])));
+
+	// Time building the batches for all things in the map
+	SLADEMap& map = editor.getMap();
+	bbox_t bbox = map.getMapBBox();
+	MapRenderer2D renderer(&map);
+	renderer.setScale(1.0);
+	renderer.updateVisibility(bbox.min, bbox.max);
+	renderer.buildThingBatches(1.0f);	// Load any textures first
+
+	sf::Clock clock;
+	for (unsigned a = 0; a < runs; a++)
+		renderer.buildThingBatches(1.0f);
+	long time = clock.getElapsedTime().asMicroseconds();
+
+	unsigned batches, quads;
+	renderer.getThingBatchCounts(batches, quads);
+	wxLogMessage("Thing batches (%lu things, %d runs): %1.3fms average build time, %d quads in %d draw calls",
+	             map.nThings(), runs, time * 0.001 / runs, quads, batches);
+
+	// Compare rendering the things in the current view batched and
+	// one at a time
+	long batched, immediate;
+	editor.getCanvas()->timeThingRendering(runs, batched, immediate);
+	wxLogMessage("Rendering things in view (%d runs): batched %1.3fms, immediate %1.3fms average",
+	             runs, batched * 0.001 / runs, immediate * 0.001 / runs);
+}
+
+/* testCellKey
+ * Returns the key for the grid cell [size] units across containing
+ * [x,y] (packed the same way as in MapRenderer2D::buildLODThings)
+ *******************************************************************/
+uint64_t testCellKey(double x, double y, double size)
+{
+	int32_t cx = (int32_t)floor(x / size);
+	int32_t cy = (int32_t)floor(y / size);
+	return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy;
+}
+
+CONSOLE_COMMAND(m_test_lod, 0, false)
+{
+	SLADEMap& map = theMapEditor->mapEditor().getMap();
+
+	// Test at the view scale where lines switch from full detail to
+	// simplified (or the given scale)
+	double scale = map_lod_lines > 0 ? map_lod_lines * 0.999 : 0.0625;
+	if (args.size() > 0)
+	{
+		args[0].ToDouble(&scale);
+		scale = MAX(scale, 0.0001);
+	}
+	MapRenderer2D renderer(&map);
+	renderer.setScale(scale);
+	int level = renderer.lodLevel();
+	double level_size = pow(2.0, -level);	// Map units per pixel at the LOD level's scale
+
+	sf::Clock clock;
+	renderer.buildLODLines(level);
+	long time_lines = clock.getElapsedTime().asMicroseconds();
+	clock.restart();
+	renderer.buildLODThings(level);
+	long time_things = clock.getElapsedTime().asMicroseconds();
+
+	// Index simplified lines by the grid cells their bounding boxes
+	// cover, with cells 8 pixels across
+	vector<MapRenderer2D::glvert_t>& lod_lines = renderer.getLODLines();
+	double cell = 8 * level_size;
+	vector<std::pair<uint64_t, unsigned> > cells;
+	for (unsigned a = 0; a + 1 < lod_lines.size(); a += 2)
+	{
+		int x1 = (int)floor(MIN(lod_lines[a].x, lod_lines[a+1].x) / cell);
+		int x2 = (int)floor(MAX(lod_lines[a].x, lod_lines[a+1].x) / cell);
+		int y1 = (int)floor(MIN(lod_lines[a].y, lod_lines[a+1].y) / cell);
+		int y2 = (int)floor(MAX(lod_lines[a].y, lod_lines[a+1].y) / cell);
+		for (int x = x1; x <= x2; x++)
+		{
+			for (int y = y1; y <= y2; y++)
+				cells.push_back(std::make_pair(testCellKey((x + 0.5) * cell, (y + 0.5) * cell, cell), a));
+		}
+	}
+	std::sort(cells.begin(), cells.end());
+
+	// Check both ends of every line are drawn within the simplification
+	// tolerance of a simplified line of the same colour
+	unsigned mismatches = 0;
+	double max_dist = 0;
+	double tolerance = 0.75 * level_size + 1;	// distanceToLine keeps 1 unit from segment ends
+	for (unsigned a = 0; a < map.nLines(); a++)
+	{
+		MapLine* line = map.getLine(a);
+		rgba_t col = renderer.lineColour(line);
+		for (unsigned v = 0; v < 2; v++)
+		{
+			MapVertex* vertex = (v == 0) ? line->v1() : line->v2();
+			uint64_t key = testCellKey(vertex->xPos(), vertex->yPos(), cell);
+			double nearest = -1;
+			vector<std::pair<uint64_t, unsigned> >::iterator i = std::lower_bound(cells.begin(), cells.end(), std::make_pair(key, (unsigned)0));
+			for (; i != cells.end() && i->first == key; i++)
+			{
+				MapRenderer2D::glvert_t& v1 = lod_lines[i->second];
+				MapRenderer2D::glvert_t& v2 = lod_lines[i->second + 1];
+				if (v1.r != col.fr() || v1.g != col.fg() || v1.b != col.fb() || v1.a != col.fa())
+					continue;
+
+				double dist = MathStuff::distanceToLine(vertex->xPos(), vertex->yPos(), v1.x, v1.y, v2.x, v2.y);
+				if (nearest < 0 || dist < nearest)
+					nearest = dist;
+			}
+
+			if (nearest >= 0)
+				max_dist = MAX(max_dist, nearest);
+			if (nearest < 0 || nearest > tolerance)
+				testMismatch(mismatches, S_FMT("Mismatch at line %d vertex %d: %s", a, v + 1,
+				             nearest < 0 ? "no simplified line nearby" : CHR(S_FMT("%1.1f pixels from simplified lines", nearest * scale))));
+		}
+	}
+
+	// Check every thing has a density point in its cell
+	vector<MapRenderer2D::glvert_t>& lod_things = renderer.getLODThings();
+	double thing_cell = 4 * level_size;
+	vector<uint64_t> points;
+	for (unsigned a = 0; a < lod_things.size(); a++)
+		points.push_back(testCellKey(lod_things[a].x, lod_things[a].y, thing_cell));
+	std::sort(points.begin(), points.end());
+	for (unsigned a = 0; a < map.nThings(); a++)
+	{
+		MapThing* thing = map.getThing(a);
+		if (!std::binary_search(points.begin(), points.end(), testCellKey(thing->xPos(), thing->yPos(), thing_cell)))
+			testMismatch(mismatches, S_FMT("Mismatch at thing %d: no density point in its cell", a));
+	}
+
+	wxLogMessage("LOD at scale %1.4f: %lu lines simplified to %lu in %1.2fms, %lu things to %lu points in %1.2fms",
+	             scale, map.nLines(), lod_lines.size() / 2, time_lines * 0.001, map.nThings(), lod_things.size(), time_things * 0.001);
+	wxLogMessage("Furthest line vertex from simplified lines: %1.2f pixels, %d mismatches", max_dist * scale, mismatches);
+}
+
+/* test3dEdits
+ * Makes [count] random changes to sector heights, flat textures and
+ * side offsets in [map], for testing 3d geometry updates
+ *******************************************************************/
+void test3dEdits(SLADEMap* map, unsigned count)
+{
+	for (unsigned a = 0; a < count; a++)
+	{
+		MapSector* sector = map->getSector(rand() % map->nSectors());
+		switch (rand() % 4)
+		{
+		case 0: sector->setIntProperty("heightfloor", sector->getFloorHeight() + rand() % 64 - 32); break;
+		case 1: sector->setIntProperty("heightceiling", sector->getCeilingHeight() + rand() % 64 - 32); break;
+		case 2: sector->setStringProperty("texturefloor", sector->getCeilingTex()); break;
+		default:
+		{
+			MapSide* side = map->getSide(rand() % map->nSides());
+			side->setIntProperty("offsetx", side->getOffsetX() + rand() % 64 - 32);
+			break;
+		}
+		}
+	}
+}
+
+/*******************************************************************
+ * GEOMETRY3DTEST CLASS
+ *******************************************************************
+ * Updates 3d geometry for the lines and sectors modified by random
+ * edits, and checks it against a full rebuild
+ */
+class Geometry3DTest : public MapEditTest
+{
+private:
+	MapRenderer3D*	renderer;
+	unsigned		n_updated;
+
+public:
+	Geometry3DTest() : MapEditTest(20)
+	{
+		renderer = NULL;
+		n_updated = 0;
+	}
+
+	~Geometry3DTest()
+	{
+		if (renderer)
+			delete renderer;
+	}
+
+	bool init()
+	{
+		// Generate geometry for the whole map here rather than in the
+		// background (sector polygons too)
+		map->setPolygonBackground(false);
+		renderer = new MapRenderer3D(map);
+		renderer->setGeometryMode(MapRenderer3D::GEOMETRY_IMMEDIATE);
+		renderer->buildPickData();
+
+		return true;
+	}
+
+	void edit(unsigned round)
+	{
+		// Edit some sector heights and textures and side offsets, so
+		// slots are rewritten in place, grown and shrunk
+		test3dEdits(map, 8);
+
+		// Update only the modified lines and sectors
+		n_updated += renderer->updateOutdated();
+	}
+
+	bool check(unsigned round)
+	{
+		MapRenderer3D full(map);
+		full.setGeometryMode(MapRenderer3D::GEOMETRY_IMMEDIATE);
+		full.buildPickData();
+		unsigned n_diff = renderer->compareGeometry(full);
+		if (n_diff > 0)
+			testMismatch(mismatches, S_FMT("Mismatch after edit %d: %d lines/sectors differ from a full rebuild", round, n_diff));
+
+		return true;
+	}
+
+	void report()
+	{
+		wxLogMessage("Incremental 3d geometry over %d edits (%lu lines, %lu sectors): %d lines/sectors updated, %d mismatches",
+		             rounds, map->nLines(), map->nSectors(), n_updated, mismatches);
+	}
+};
+
+CONSOLE_COMMAND(m_test_3d_geometry, 0, false)
+{
+	Geometry3DTest test;
+	test.run(args);
+}
+
+/*******************************************************************
+ * BACKGROUND3DTEST CLASS
+ *******************************************************************
+ * Generates 3d geometry in the background with one renderer and
+ * immediately with another, and checks both match after each round
+ * of random edits
+ */
+class Background3DTest : public MapEditTest
+{
+private:
+	MapRenderer3D*	renderer;
+	MapRenderer3D*	immediate;
+	bool			finished;
+
+public:
+	Background3DTest() : MapEditTest(20)
+	{
+		renderer = NULL;
+		immediate = NULL;
+		finished = false;
+	}
+
+	~Background3DTest()
+	{
+		if (renderer)
+			delete renderer;
+		if (immediate)
+			delete immediate;
+	}
+
+	bool init()
+	{
+		map->setPolygonBackground(false);
+		renderer = new MapRenderer3D(map);
+		immediate = new MapRenderer3D(map);
+		renderer->setGeometryMode(MapRenderer3D::GEOMETRY_BACKGROUND);
+		immediate->setGeometryMode(MapRenderer3D::GEOMETRY_IMMEDIATE);
+		renderer->buildPickData();
+		finished = renderer->finishGeometry();
+		immediate->buildPickData();
+
+		unsigned n_diff = renderer->compareGeometry(*immediate);
+		wxLogMessage("Initial build: %d lines/sectors differ%s", n_diff, finished ? "" : " (timed out waiting for jobs)");
+		if (n_diff > 0 || !finished)
+			mismatches++;
+
+		return true;
+	}
+
+	void edit(unsigned round)
+	{
+		test3dEdits(map, 8);
+
+		renderer->updateOutdated();
+		finished = renderer->finishGeometry();
+		immediate->updateOutdated();
+	}
+
+	bool check(unsigned round)
+	{
+		unsigned n_diff = renderer->compareGeometry(*immediate);
+		if (n_diff > 0 || !finished)
+			testMismatch(mismatches, S_FMT("Mismatch after edit %d: %d lines/sectors differ%s", round, n_diff, finished ? "" : " (timed out waiting for jobs)"));
+
+		return true;
+	}
+
+	void report()
+	{
+		wxLogMessage("Background 3d geometry over %d edits (%lu lines, %lu sectors): %d mismatches",
+		             rounds, map->nLines(), map->nSectors(), mismatches);
+	}
+};
+
+CONSOLE_COMMAND(m_test_3d_background, 0, false)
+{
+	Background3DTest test;
+	test.run(args);
+}
+
+CONSOLE_COMMAND(m_test_3d_pick, 0, false)
+{
+	SLADEMap& map = theMapEditor->mapEditor().getMap();
+	if (map.nSectors() == 0)
+		return;
+	unsigned rays = 1000;
+	if (args.size() > 0)
+		rays = MAX(1, atoi(CHR(args[0])));
+
+	// Setup a renderer with data for the whole map, generated here
+	// rather than in the background
+	MapRenderer3D renderer(&map);
+	renderer.setGeometryMode(MapRenderer3D::GEOMETRY_IMMEDIATE);
+	renderer.buildPickData();
+	renderer.pickIndexed();	// Build spatial indices first
+
+	// Pick along random view vectors from random points in random
+	// sectors, with both methods
+	srand(1);
+	unsigned mismatches = 0;
+	long time_brute = 0;
+	long time_indexed = 0;
+	sf::Clock clock;
+	for (unsigned a = 0; a < rays; a++)
+	{
+		MapSector* sector = map.getSector(rand() % map.nSectors());
+		bbox_t bbox = sector->boundingBox();
+		double floor = sector->getFloorHeight();
+		double ceiling = sector->getCeilingHeight();
+		fpoint3_t pos(bbox.min.x + (bbox.max.x - bbox.min.x) * rand() / RAND_MAX,
+		              bbox.min.y + (bbox.max.y - bbox.min.y) * rand() / RAND_MAX,
+		              floor + (ceiling - floor) * rand() / RAND_MAX);
+		double angle = 2 * PI * rand() / RAND_MAX;
+		renderer.cameraSet(pos, fpoint2_t(cos(angle), sin(angle)));
+		renderer.cameraPitch(PI * ((double)rand() / RAND_MAX - 0.5));
+
+		clock.restart();
+		selection_3d_t brute = renderer.pickBruteForce();
+		int brute_dist = renderer.itemDistance();
+		time_brute += clock.getElapsedTime().asMicroseconds();
+
+		clock.restart();
+		selection_3d_t indexed = renderer.pickIndexed();
+		time_indexed += clock.getElapsedTime().asMicroseconds();
+
+		if (brute.index != indexed.index || brute.type != indexed.type || brute_dist != renderer.itemDistance())
+			testMismatch(mismatches, S_FMT("Mismatch at (%1.1f, %1.1f, %1.1f): brute force %d/%d at %d, indexed %d/%d at %d",
+			                               pos.x, pos.y, pos.z, brute.type, brute.index, brute_dist, indexed.type, indexed.index, renderer.itemDistance()));
+	}
+
+	wxLogMessage("3d picking (%d rays, %lu lines, %lu sectors, %lu things): brute force %1.3fms, indexed %1.3fms average, %d mismatches",
+	             rays, map.nLines(), map.nSectors(), map.nThings(), time_brute * 0.001 / rays, time_indexed * 0.001 / rays, mismatches);
+}
@@ -1078,7 +1078,7 @@ bool MapEditorWindow::handleAction(string id)
 				vector<Archive::mapdesc_t> maps = data->detectMaps();
 				if (!maps.empty())
 				{
-					editor.getMap().clearMap();
+					editor.clearMap();
 					editor.openMap(maps[0]);
 					loadMapScripts(maps[0]);
 				}
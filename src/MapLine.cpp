@@ -29,6 +29,7 @@
  *******************************************************************/
 #include "Main.h"
 #include "MapLine.h"
+#include "ObjectPool.h"
 #include "MapVertex.h"
 #include "MapSide.h"
 #include "MathStuff.h"
@@ -37,6 +38,12 @@
 #include "GameConfiguration.h"
 
 
+/*******************************************************************
+ * VARIABLES
+ *******************************************************************/
+OBJECT_POOL(MapLine, line_pool)
+
+
 /*******************************************************************
  * MAPLINE CLASS FUNCTIONS
  *******************************************************************/
@@ -306,6 +313,7 @@ void MapLine::setIntProperty(string key, int value)
 	{
 		if ((vertex = parent_map->getVertex(value)))
 		{
+			setModified();
 			vertex1->disconnectLine(this);
 			vertex1 = vertex;
 			vertex1->connectLine(this);
@@ -316,6 +324,7 @@ void MapLine::setIntProperty(string key, int value)
 	{
 		if ((vertex = parent_map->getVertex(value)))
 		{
+			setModified();
 			vertex2->disconnectLine(this);
 			vertex2 = vertex;
 			vertex2->connectLine(this);
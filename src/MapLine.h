@@ -75,6 +75,10 @@ public:
 	MapLine(MapVertex* v1, MapVertex* v2, MapSide* s1, MapSide* s2, SLADEMap* parent = NULL);
 	~MapLine();
 
+	// Pooled allocation
+	static void*	operator new(size_t size);
+	static void		operator delete(void* ptr, size_t size);
+
 	bool	isOk() { return vertex1 && vertex2; }
 
 	MapVertex*		v1() { return vertex1; }
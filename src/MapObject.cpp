@@ -55,7 +55,7 @@ MapObject::MapObject(int type, SLADEMap* parent)
 	this->parent_map = parent;
 	this->index = 0;
 	this->filtered = false;
-	this->modified_time = theApp->runTimer();
+	this->modified_time = newGeneration();
 	this->id = 0;
 	this->obj_backup = NULL;
 
@@ -116,7 +116,21 @@ void MapObject::setModified()
 		backup(obj_backup);
 	}
 
-	modified_time = theApp->runTimer();
+	modified_time = newGeneration();
+	if (parent_map)
+		parent_map->objectModified(this);
+}
+
+/* MapObject::newGeneration
+ * Returns a new edit generation from the parent map (or 0 if the
+ * object isn't part of a map)
+ *******************************************************************/
+long MapObject::newGeneration()
+{
+	if (parent_map)
+		return parent_map->nextGeneration();
+
+	return 0;
 }
 
 /* MapObject::copy
@@ -149,8 +163,9 @@ void MapObject::copy(MapObject* c)
 bool MapObject::boolProperty(string key)
 {
 	// If the property exists already, return it
-	if (properties[key].hasValue())
-		return properties[key].getBoolValue();
+	Property* value = properties.getProperty(key);
+	if (value && value->hasValue())
+		return value->getBoolValue();
 
 	// Otherwise check the game configuration for a default value
 	else
@@ -169,8 +184,9 @@ bool MapObject::boolProperty(string key)
 int MapObject::intProperty(string key)
 {
 	// If the property exists already, return it
-	if (properties[key].hasValue())
-		return properties[key].getIntValue();
+	Property* value = properties.getProperty(key);
+	if (value && value->hasValue())
+		return value->getIntValue();
 
 	// Otherwise check the game configuration for a default value
 	else
@@ -189,8 +205,9 @@ int MapObject::intProperty(string key)
 double MapObject::floatProperty(string key)
 {
 	// If the property exists already, return it
-	if (properties[key].hasValue())
-		return properties[key].getFloatValue();
+	Property* value = properties.getProperty(key);
+	if (value && value->hasValue())
+		return value->getFloatValue();
 
 	// Otherwise check the game configuration for a default value
 	else
@@ -209,8 +226,9 @@ double MapObject::floatProperty(string key)
 string MapObject::stringProperty(string key)
 {
 	// If the property exists already, return it
-	if (properties[key].hasValue())
-		return properties[key].getStringValue();
+	Property* value = properties.getProperty(key);
+	if (value && value->hasValue())
+		return value->getStringValue();
 
 	// Otherwise check the game configuration for a default value
 	else
@@ -223,6 +241,75 @@ string MapObject::stringProperty(string key)
 	}
 }
 
+/* MapObject::boolPropertyAtom
+ * Returns the value of the boolean property with name [atom]. Unlike
+ * boolProperty this isn't virtual, so object-specific properties
+ * (eg. sector heights) aren't handled
+ *******************************************************************/
+bool MapObject::boolPropertyAtom(unsigned atom)
+{
+	// If the property exists already, return it
+	Property* value = properties.getProperty(atom);
+	if (value && value->hasValue())
+		return value->getBoolValue();
+
+	// Otherwise check the game configuration for a default value
+	else
+	{
+		UDMFProperty* prop = theGameConfiguration->getUDMFProperty(MobjPropertyList::atomName(atom), type);
+		if (prop)
+			return prop->getDefaultValue().getBoolValue();
+		else
+			return false;
+	}
+}
+
+/* MapObject::intPropertyAtom
+ * Returns the value of the integer property with name [atom]. Unlike
+ * intProperty this isn't virtual, so object-specific properties
+ * (eg. sector heights) aren't handled
+ *******************************************************************/
+int MapObject::intPropertyAtom(unsigned atom)
+{
+	// If the property exists already, return it
+	Property* value = properties.getProperty(atom);
+	if (value && value->hasValue())
+		return value->getIntValue();
+
+	// Otherwise check the game configuration for a default value
+	else
+	{
+		UDMFProperty* prop = theGameConfiguration->getUDMFProperty(MobjPropertyList::atomName(atom), type);
+		if (prop)
+			return prop->getDefaultValue().getIntValue();
+		else
+			return 0;
+	}
+}
+
+/* MapObject::floatPropertyAtom
+ * Returns the value of the float property with name [atom]. Unlike
+ * floatProperty this isn't virtual, so object-specific properties
+ * (eg. sector heights) aren't handled
+ *******************************************************************/
+double MapObject::floatPropertyAtom(unsigned atom)
+{
+	// If the property exists already, return it
+	Property* value = properties.getProperty(atom);
+	if (value && value->hasValue())
+		return value->getFloatValue();
+
+	// Otherwise check the game configuration for a default value
+	else
+	{
+		UDMFProperty* prop = theGameConfiguration->getUDMFProperty(MobjPropertyList::atomName(atom), type);
+		if (prop)
+			return prop->getDefaultValue().getFloatValue();
+		else
+			return 0;
+	}
+}
+
 /* MapObject::setBoolProperty
  * Sets the boolean value of the property [key] to [value]
  *******************************************************************/
@@ -332,9 +419,9 @@ mobj_backup_t* MapObject::getBackup(bool remove)
  *******************************************************************/
 
 /* MapObject::propBackupTime
- * Returns the property backup time (used for the undo system - if
- * an object's properties are modified, they will be backed up first
- * if they haven't since this time)
+ * Returns the property backup generation (used for the undo system -
+ * if an object's properties are modified, they will be backed up
+ * first if they haven't since this generation)
  *******************************************************************/
 long MapObject::propBackupTime()
 {
@@ -345,9 +432,9 @@ long MapObject::propBackupTime()
  * Begins property backup, any time a MapObject property is changed
  * it's properties will be backed up before changing (only once)
  *******************************************************************/
-void MapObject::beginPropBackup(long current_time)
+void MapObject::beginPropBackup(long generation)
 {
-	prop_backup_time = current_time;
+	prop_backup_time = generation;
 }
 
 /* MapObject::endPropBackup
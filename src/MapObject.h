@@ -57,9 +57,10 @@ public:
 	unsigned	getId() { return id; }
 	string		getTypeName();
 	void		setModified();
+	long		newGeneration();
 
 	MobjPropertyList&	props()				{ return properties; }
-	bool				hasProp(string key)	{ return properties[key].hasValue(); }
+	bool				hasProp(string key)	{ Property* p = properties.getProperty(key); return p && p->hasValue(); }
 
 	// Generic property modification
 	virtual bool	boolProperty(string key);
@@ -71,6 +72,11 @@ public:
 	virtual void	setFloatProperty(string key, double value);
 	virtual void	setStringProperty(string key, string value);
 
+	// Property access by interned name (see MobjPropertyList)
+	bool	boolPropertyAtom(unsigned atom);
+	int		intPropertyAtom(unsigned atom);
+	double	floatPropertyAtom(unsigned atom);
+
 	virtual fpoint2_t	getPoint(uint8_t point) { return fpoint2_t(0,0); }
 
 	void	filter(bool f = true) { filtered = f; }
@@ -86,7 +92,7 @@ public:
 
 	static void resetIdCounter();
 	static long propBackupTime();
-	static void beginPropBackup(long current_time);
+	static void beginPropBackup(long generation);
 	static void endPropBackup();
 	
 	static bool	multiBoolProperty(vector<MapObject*>& objects, string prop, bool& value);
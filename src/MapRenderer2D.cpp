@@ -40,6 +40,8 @@
 #include "ObjectEdit.h"
 #include "OpenGL.h"
 #include "Drawing.h"
+#include "MathStuff.h"
+#include "RenderProfiler.h"
 
 
 /*******************************************************************
@@ -63,6 +65,9 @@ CVAR(Bool, map_animate_tagged, true, CVAR_SAVE)
 CVAR(Float, arrow_alpha, 1.0f, CVAR_SAVE)
 CVAR(Bool, arrow_colour, false, CVAR_SAVE)
 CVAR(Bool, flats_use_vbo, true, CVAR_SAVE)
+CVAR(Bool, things_batched, true, CVAR_SAVE)
+CVAR(Float, map_lod_lines, 0.0625f, CVAR_SAVE)	// View scale below which lines are simplified (0 = never)
+CVAR(Float, map_lod_things, 0.125f, CVAR_SAVE)	// View scale below which things are drawn as points (0 = never)
 CVAR(Int, halo_width, 5, CVAR_SAVE)
 CVAR(Float, arrowhead_angle, 0.7854f, CVAR_SAVE)
 CVAR(Float, arrowhead_length, 25.f, CVAR_SAVE)
@@ -106,6 +111,21 @@ MapRenderer2D::MapRenderer2D(SLADEMap* map)
 	this->n_vertices = 0;
 	this->n_lines = 0;
 	this->n_things = 0;
+	this->vis_thing_radius = 0;
+	this->vis_thing_radius_updated = -1;
+	this->vbo_vertices_size = 0;
+	this->vbo_lines_size = 0;
+	this->vbo_flats_size = 0;
+	this->vbo_flats_used = 0;
+	this->lines_alpha = 1.0f;
+	this->n_thing_batches = 0;
+	this->n_thing_batches_base = 0;
+	this->lod_lines_alpha = 1.0f;
+	this->lod_lines_updated = -1;
+	this->lod_lines_level = 0;
+	this->lod_things_alpha = 1.0f;
+	this->lod_things_updated = -1;
+	this->lod_things_level = 0;
 }
 
 /* MapRenderer2D::~MapRenderer2D
@@ -183,6 +203,13 @@ void MapRenderer2D::renderVertices(float alpha)
 	if (alpha <= 0.01f)
 		return;
 
+	// Vertices aren't drawn when zoomed out far enough to simplify lines
+	if (lodLinesActive())
+		return;
+
+	RenderPassTimer timer("Vertices");
+	timer.setCount(map->nVertices());
+
 	// Setup rendering properties
 	bool point = setupVertexRendering(1.0f);
 
@@ -225,7 +252,7 @@ void MapRenderer2D::renderVerticesImmediate()
 
 		glEndList();
 
-		vertices_updated = theApp->runTimer();
+		vertices_updated = map->currentGeneration();
 	}
 }
 
@@ -238,9 +265,14 @@ void MapRenderer2D::renderVerticesVBO()
 	if (map->nVertices() == 0)
 		return;
 
-	// Update vertices VBO if required
-	if (vbo_vertices == 0 || map->nVertices() != n_vertices || map->geometryUpdated() > vertices_updated)
+	// Update vertices VBO if required (only changed vertices are
+	// updated, unless there are more vertices than the VBO can hold)
+	if (vbo_vertices == 0 || map->nVertices() > vbo_vertices_size)
 		updateVerticesVBO();
+	else if (map->nVertices() != n_vertices ||
+		map->geometryUpdated() > vertices_updated ||
+		map->modifiedSince(vertices_updated, MOBJ_VERTEX))
+		updateDirtyVertices();
 
 	// Set VBO arrays to use
 	glEnableClientState(GL_VERTEX_ARRAY);
@@ -370,6 +402,9 @@ void MapRenderer2D::renderLines(bool show_direction, float alpha)
 	if (alpha <= 0.01f)
 		return;
 
+	RenderPassTimer timer("Lines");
+	timer.setCount(map->nLines());
+
 	// Setup rendering properties
 	glLineWidth(line_width);
 	if (line_smooth)
@@ -378,6 +413,13 @@ void MapRenderer2D::renderLines(bool show_direction, float alpha)
 		glDisable(GL_LINE_SMOOTH);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+	// Draw simplified lines if zoomed out far enough
+	if (lodLinesActive())
+	{
+		renderLinesLOD(alpha);
+		return;
+	}
+
 	// Render the lines depending on what features are supported
 	if (OpenGL::vboSupport())
 		renderLinesVBO(show_direction, alpha);
@@ -446,7 +488,7 @@ void MapRenderer2D::renderLinesImmediate(bool show_direction, float alpha)
 
 	glEndList();
 	lines_dirs = show_direction;
-	lines_updated = theApp->runTimer();
+	lines_updated = map->currentGeneration();
 }
 
 /* MapRenderer2D::renderLinesVBO
@@ -458,13 +500,17 @@ void MapRenderer2D::renderLinesVBO(bool show_direction, float alpha)
 	if (map->nLines() == 0)
 		return;
 
-	// Update lines VBO if required
+	// Update lines VBO if required (only changed lines are updated,
+	// unless the VBO needs to be recreated)
 	if (vbo_lines == 0 ||
 		show_direction != lines_dirs ||
-		map->nLines() != n_lines ||
-		map->geometryUpdated() > lines_updated ||
-		map->modifiedSince(lines_updated, MOBJ_LINE))
+		map->nLines() > vbo_lines_size)
 		updateLinesVBO(show_direction, alpha);
+	else if (map->nLines() != n_lines ||
+		map->geometryUpdated() > lines_updated ||
+		map->modifiedSince(lines_updated, MOBJ_LINE) ||
+		map->modifiedSince(lines_updated, MOBJ_VERTEX))
+		updateDirtyLines(alpha);
 
 	// Disable any blending
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -763,21 +809,15 @@ void MapRenderer2D::renderThingOverlay(double x, double y, double radius, bool p
 	}
 }
 
-/* MapRenderer2D::renderRoundThing
- * Renders a round thing icon at [x,y]
+/* MapRenderer2D::getRoundThingTexture
+ * Returns the texture to use for a round thing of type [tt] at
+ * [angle]. [rotate] is set to true if the texture should be rotated
+ * to the thing's angle
  *******************************************************************/
-void MapRenderer2D::renderRoundThing(double x, double y, double angle, ThingType* tt, float alpha, double radius_mult)
+GLTexture* MapRenderer2D::getRoundThingTexture(ThingType* tt, double angle, bool& rotate)
 {
-	// Ignore if no type given (shouldn't happen)
-	if (!tt)
-		return;
-
-	// --- Determine texture to use ---
 	GLTexture* tex = NULL;
-	bool rotate = false;
-
-	// Set colour
-	glColor4f(tt->getColour().fr(), tt->getColour().fg(), tt->getColour().fb(), alpha);
+	rotate = false;
 
 	// Check for custom thing icon
 	if (!tt->getIcon().IsEmpty() && !thing_force_dir && !things_angles)
@@ -802,6 +842,125 @@ void MapRenderer2D::renderRoundThing(double x, double y, double angle, ThingType
 			tex = theMapEditor->textureManager().getEditorImage("thing/normal_n");
 	}
 
+	return tex;
+}
+
+/* MapRenderer2D::getSquareThingTexture
+ * Returns the texture to use for a square thing of type [tt] at
+ * [angle]. [tc_start] is set to the first texture coordinate to use
+ * (in sq_thing_tc) to rotate the texture to the angle
+ *******************************************************************/
+GLTexture* MapRenderer2D::getSquareThingTexture(ThingType* tt, double angle, bool showicon, bool framed, int& tc_start)
+{
+	GLTexture* tex = NULL;
+	tc_start = 0;
+
+	// Check for custom thing icon
+	if (!tt->getIcon().IsEmpty() && showicon && !thing_force_dir && !things_angles && !framed)
+		tex = theMapEditor->textureManager().getEditorImage(S_FMT("thing/square/%s", tt->getIcon()));
+
+	// Otherwise, no icon
+	if (!tex)
+	{
+		if (framed)
+		{
+			tex = theMapEditor->textureManager().getEditorImage("thing/square/frame");
+		}
+		else
+		{
+			tex = theMapEditor->textureManager().getEditorImage("thing/square/normal_n");
+
+			if ((tt->isAngled() && showicon) || thing_force_dir || things_angles)
+			{
+				tex = theMapEditor->textureManager().getEditorImage("thing/square/normal_d1");
+
+				// Setup variables depending on angle
+				switch ((int)angle)
+				{
+				case 0:		// East: normal, texcoord 0
+					break;
+				case 45:	// Northeast: diagonal, texcoord 0
+					tex = theMapEditor->textureManager().getEditorImage("thing/square/normal_d2");
+					break;
+				case 90:	// North: normal, texcoord 2
+					tc_start = 2;
+					break;
+				case 135:	// Northwest: diagonal, texcoord 2
+					tex = theMapEditor->textureManager().getEditorImage("thing/square/normal_d2");
+					tc_start = 2;
+					break;
+				case 180:	// West: normal, texcoord 4
+					tc_start = 4;
+					break;
+				case 225:	// Southwest: diagonal, texcoord 4
+					tex = theMapEditor->textureManager().getEditorImage("thing/square/normal_d2");
+					tc_start = 4;
+					break;
+				case 270:	// South: normal, texcoord 6
+					tc_start = 6;
+					break;
+				case 315:	// Southeast: diagonal, texcoord 6
+					tex = theMapEditor->textureManager().getEditorImage("thing/square/normal_d2");
+					tc_start = 6;
+					break;
+				default:	// Unsupported angle, don't draw arrow
+					tex = theMapEditor->textureManager().getEditorImage("thing/square/normal_n");
+					break;
+				};
+			}
+		}
+	}
+
+	return tex;
+}
+
+/* MapRenderer2D::getThingSprite
+ * Returns the sprite texture for thing [index] of type [tt] (cached
+ * in thing_sprites)
+ *******************************************************************/
+GLTexture* MapRenderer2D::getThingSprite(ThingType* tt, unsigned index)
+{
+	// Refresh sprites list if needed
+	if (thing_sprites.size() != map->nThings())
+	{
+		thing_sprites.clear();
+		for (unsigned a = 0; a < map->nThings(); a++)
+			thing_sprites.push_back(NULL);
+	}
+
+	GLTexture* tex = index < thing_sprites.size() ? thing_sprites[index] : NULL;
+
+	// Attempt to get sprite texture
+	if (!tex)
+	{
+		tex = theMapEditor->textureManager().getSprite(tt->getSprite(), tt->getTranslation(), tt->getPalette());
+
+		if (index < thing_sprites.size())
+		{
+			thing_sprites[index] = tex;
+			thing_sprites_updated = map->currentGeneration();
+		}
+	}
+
+	return tex;
+}
+
+/* MapRenderer2D::renderRoundThing
+ * Renders a round thing icon at [x,y]
+ *******************************************************************/
+void MapRenderer2D::renderRoundThing(double x, double y, double angle, ThingType* tt, float alpha, double radius_mult)
+{
+	// Ignore if no type given (shouldn't happen)
+	if (!tt)
+		return;
+
+	// --- Determine texture to use ---
+	bool rotate = false;
+	GLTexture* tex = getRoundThingTexture(tt, angle, rotate);
+
+	// Set colour
+	glColor4f(tt->getColour().fr(), tt->getColour().fg(), tt->getColour().fb(), alpha);
+
 	// If for whatever reason the thing texture doesn't exist, just draw a basic, square thing
 	if (!tex)
 	{
@@ -850,29 +1009,9 @@ bool MapRenderer2D::renderSpriteThing(double x, double y, double angle, ThingTyp
 	if (!tt)
 		return false;
 
-	// Refresh sprites list if needed
-	if (thing_sprites.size() != map->nThings())
-	{
-		thing_sprites.clear();
-		for (unsigned a = 0; a < map->nThings(); a++)
-			thing_sprites.push_back(NULL);
-	}
-
 	// --- Determine texture to use ---
 	bool show_angle = false;
-	GLTexture* tex = index < thing_sprites.size() ? thing_sprites[index] : NULL;
-
-	// Attempt to get sprite texture
-	if (!tex)
-	{
-		tex = theMapEditor->textureManager().getSprite(tt->getSprite(), tt->getTranslation(), tt->getPalette());
-
-		if (index < thing_sprites.size())
-		{
-			thing_sprites[index] = tex;
-			thing_sprites_updated = theApp->runTimer();
-		}
-	}
+	GLTexture* tex = getThingSprite(tt, index);
 
 	// If sprite not found, just draw as a normal, round thing
 	if (!tex)
@@ -955,9 +1094,6 @@ bool MapRenderer2D::renderSquareThing(double x, double y, double angle, ThingTyp
 	if (!tt)
 		return false;
 
-	// --- Determine texture to use ---
-	GLTexture* tex = NULL;
-
 	// Set colour
 	glColor4f(tt->getColour().fr(), tt->getColour().fg(), tt->getColour().fb(), alpha);
 
@@ -965,62 +1101,9 @@ bool MapRenderer2D::renderSquareThing(double x, double y, double angle, ThingTyp
 	if (tt->getSprite().IsEmpty())
 		showicon = true;
 
-	// Check for custom thing icon
-	if (!tt->getIcon().IsEmpty() && showicon && !thing_force_dir && !things_angles && !framed)
-		tex = theMapEditor->textureManager().getEditorImage(S_FMT("thing/square/%s", tt->getIcon()));
-
-	// Otherwise, no icon
+	// --- Determine texture to use ---
 	int tc_start = 0;
-	if (!tex)
-	{
-		if (framed)
-		{
-			tex = theMapEditor->textureManager().getEditorImage("thing/square/frame");
-		}
-		else
-		{
-			tex = theMapEditor->textureManager().getEditorImage("thing/square/normal_n");
-
-			if ((tt->isAngled() && showicon) || thing_force_dir || things_angles)
-			{
-				tex = theMapEditor->textureManager().getEditorImage("thing/square/normal_d1");
-
-				// Setup variables depending on angle
-				switch ((int)angle)
-				{
-				case 0:		// East: normal, texcoord 0
-					break;
-				case 45:	// Northeast: diagonal, texcoord 0
-					tex = theMapEditor->textureManager().getEditorImage("thing/square/normal_d2");
-					break;
-				case 90:	// North: normal, texcoord 2
-					tc_start = 2;
-					break;
-				case 135:	// Northwest: diagonal, texcoord 2
-					tex = theMapEditor->textureManager().getEditorImage("thing/square/normal_d2");
-					tc_start = 2;
-					break;
-				case 180:	// West: normal, texcoord 4
-					tc_start = 4;
-					break;
-				case 225:	// Southwest: diagonal, texcoord 4
-					tex = theMapEditor->textureManager().getEditorImage("thing/square/normal_d2");
-					tc_start = 4;
-					break;
-				case 270:	// South: normal, texcoord 6
-					tc_start = 6;
-					break;
-				case 315:	// Southeast: diagonal, texcoord 6
-					tex = theMapEditor->textureManager().getEditorImage("thing/square/normal_d2");
-					tc_start = 6;
-					break;
-				default:	// Unsupported angle, don't draw arrow
-					tex = theMapEditor->textureManager().getEditorImage("thing/square/normal_n");
-					break;
-				};
-			}
-		}
-	}
+	GLTexture* tex = getSquareThingTexture(tt, angle, showicon, framed, tc_start);
 
 	// If for whatever reason the thing texture doesn't exist, just draw a basic, square thing
 	if (!tex)
@@ -1122,7 +1205,15 @@ void MapRenderer2D::renderThings(float alpha, bool force_dir)
 		return;
 
 	things_angles = force_dir;
-	renderThingsImmediate(alpha);
+
+	RenderPassTimer timer("Things");
+	timer.setCount(vis_list_t.size());
+	if (lodThingsActive())
+		renderThingsLOD(alpha);
+	else if (things_batched)
+		renderThingsBatched(alpha);
+	else
+		renderThingsImmediate(alpha);
 }
 
 /* MapRenderer2D::renderThingsImmediate
@@ -1166,8 +1257,9 @@ void MapRenderer2D::renderThingsImmediate(float alpha)
 				point = true;
 			}
 
-			for (unsigned a = 0; a < map->nThings(); a++)
+			for (unsigned v = 0; v < vis_list_t.size(); v++)
 			{
+				unsigned a = vis_list_t[v];
 				if (vis_t[a] > 0)
 					continue;
 
@@ -1214,8 +1306,9 @@ void MapRenderer2D::renderThingsImmediate(float alpha)
 
 	// Draw things
 	double talpha;
-	for (unsigned a = 0; a < map->nThings(); a++)
+	for (unsigned v = 0; v < vis_list_t.size(); v++)
 	{
+		unsigned a = vis_list_t[v];
 		if (vis_t[a] > 0)
 			continue;
 
@@ -1259,8 +1352,9 @@ void MapRenderer2D::renderThingsImmediate(float alpha)
 	{
 		glEnable(GL_TEXTURE_2D);
 
-		for (unsigned a = 0; a < map->nThings(); a++)
+		for (unsigned v = 0; v < vis_list_t.size(); v++)
 		{
+			unsigned a = vis_list_t[v];
 			if (vis_t[a] > 0)
 				continue;
 
@@ -1333,6 +1427,401 @@ void MapRenderer2D::renderThingsImmediate(float alpha)
 	glDisable(GL_TEXTURE_2D);
 }
 
+/* MapRenderer2D::startThingPass
+ * Starts a new pass of thing batches. Batches from earlier passes are
+ * drawn before any started in this one
+ *******************************************************************/
+void MapRenderer2D::startThingPass()
+{
+	thing_batch_index.clear();
+	thing_tex_index.clear();
+	thing_texs.clear();
+}
+
+/* MapRenderer2D::thingTexture
+ * Returns the index of [tex] in the textures used in the current pass,
+ * adding it if needed. Textures in a texture manager atlas share the
+ * batch for their atlas page, otherwise each texture gets its own
+ *******************************************************************/
+unsigned MapRenderer2D::thingTexture(GLTexture* tex)
+{
+	std::map<GLTexture*, unsigned>::iterator i = thing_tex_index.find(tex);
+	if (i != thing_tex_index.end())
+		return i->second;
+
+	// Get batch texture (and area of it to use)
+	thing_tex_t ttex;
+	ttex.u1 = ttex.v1 = 0.0f;
+	ttex.u2 = ttex.v2 = 1.0f;
+	GLTexture* batch_tex = tex;
+	TextureAtlas::entry_t* entry = theMapEditor->textureManager().getAtlasEntry(tex);
+	if (entry)
+	{
+		batch_tex = entry->page;
+		ttex.u1 = entry->u1;
+		ttex.v1 = entry->v1;
+		ttex.u2 = entry->u2;
+		ttex.v2 = entry->v2;
+	}
+
+	// Get batch, reusing an old one if possible
+	i = thing_batch_index.find(batch_tex);
+	if (i != thing_batch_index.end())
+		ttex.batch = i->second;
+	else
+	{
+		if (n_thing_batches >= thing_batches.size())
+			thing_batches.push_back(thing_batch_t());
+		thing_batches[n_thing_batches].texture = batch_tex;
+		thing_batches[n_thing_batches].verts.clear();
+		thing_batch_index[batch_tex] = n_thing_batches;
+		ttex.batch = n_thing_batches++;
+	}
+
+	thing_tex_index[tex] = thing_texs.size();
+	thing_texs.push_back(ttex);
+	return thing_texs.size() - 1;
+}
+
+/* MapRenderer2D::addThingQuad
+ * Adds a quad using texture [ttex] (see thingTexture) to its batch,
+ * from [x1,y1] to [x2,y2] relative to [x,y], rotated by [angle]
+ * degrees around [x,y]. [tc] is the texture coordinates for each
+ * corner
+ *******************************************************************/
+void MapRenderer2D::addThingQuad(unsigned ttex, double x, double y, double x1, double y1, double x2, double y2, double angle, const float* tc, float r, float g, float b, float a)
+{
+	double cx[4] = { x1, x1, x2, x2 };
+	double cy[4] = { y1, y2, y2, y1 };
+
+	// Rotate corners if needed
+	if (angle != 0)
+	{
+		double rad = angle * (PI / 180.0);
+		double c = cos(rad);
+		double s = sin(rad);
+		for (unsigned i = 0; i < 4; i++)
+		{
+			double rx = cx[i]*c - cy[i]*s;
+			cy[i] = cx[i]*s + cy[i]*c;
+			cx[i] = rx;
+		}
+	}
+
+	thing_tex_t& tt = thing_texs[ttex];
+	vector<gltexvert_t>& verts = thing_batches[tt.batch].verts;
+	for (unsigned i = 0; i < 4; i++)
+	{
+		gltexvert_t v;
+		v.x = x + cx[i];
+		v.y = y + cy[i];
+		v.tx = tt.u1 + tc[i*2] * (tt.u2 - tt.u1);
+		v.ty = tt.v1 + tc[i*2+1] * (tt.v2 - tt.v1);
+		v.r = r;
+		v.g = g;
+		v.b = b;
+		v.a = a;
+		verts.push_back(v);
+	}
+}
+
+/* MapRenderer2D::addRoundThing
+ * Adds a round thing icon at [x,y] to the thing batches (see
+ * renderRoundThing)
+ *******************************************************************/
+void MapRenderer2D::addRoundThing(unsigned index, double x, double y, double angle, ThingType* tt, float alpha, double radius_mult)
+{
+	// Get texture, draw as a simple square later if there isn't one
+	bool rotate = false;
+	GLTexture* tex = getRoundThingTexture(tt, angle, rotate);
+	if (!tex)
+	{
+		things_simple.push_back(index);
+		return;
+	}
+
+	double radius = tt->getRadius() * radius_mult;
+	if (tt->shrinkOnZoom()) radius = scaledRadius(radius);
+	addThingQuad(thingTexture(tex), x, y, -radius, -radius, radius, radius, rotate ? angle : 0, sq_thing_tc,
+	             tt->getColour().fr(), tt->getColour().fg(), tt->getColour().fb(), alpha);
+}
+
+/* MapRenderer2D::addSpriteThing
+ * Adds a sprite thing at [x,y] to the thing batches, with its shadow
+ * (see renderSpriteThing)
+ *******************************************************************/
+void MapRenderer2D::addSpriteThing(GLTexture* tex, double x, double y, ThingType* tt, float alpha, bool fitradius)
+{
+	double hw = tex->getWidth()*0.5;
+	double hh = tex->getHeight()*0.5;
+
+	// Fit to radius if needed
+	if (fitradius)
+	{
+		double scale = ((double)tt->getRadius()*0.8) / max(hw, hh);
+		hw *= scale;
+		hh *= scale;
+	}
+
+	// Shadow if needed (same texture, so goes in the same batch just
+	// before the sprite itself)
+	unsigned ttex = thingTexture(tex);
+	if (thing_shadow > 0.01f && alpha >= 0.9 && !fitradius)
+	{
+		double sz = (min(hw, hh))*0.1;
+		if (sz < 1) sz = 1;
+		float salpha = alpha*(thing_shadow*0.7);
+		addThingQuad(ttex, x, y, -hw-sz, -hh-sz, hw+sz, hh+sz, 0, sq_thing_tc, 0.0f, 0.0f, 0.0f, salpha);
+		addThingQuad(ttex, x, y, -hw-sz, -hh-sz-sz, hw+sz+sz, hh+sz, 0, sq_thing_tc, 0.0f, 0.0f, 0.0f, salpha);
+	}
+
+	// Sprite
+	addThingQuad(ttex, x, y, -hw, -hh, hw, hh, 0, sq_thing_tc, 1.0f, 1.0f, 1.0f, alpha);
+}
+
+/* MapRenderer2D::buildThingBatches
+ * Builds vertex arrays for all visible things, grouped by texture
+ * (or texture atlas page, see thingTexture). Batches are built in the
+ * same passes as renderThingsImmediate (shadows, things, sprites
+ * within squares, direction arrows) so things overlap the same way,
+ * but within a pass everything using the same texture is drawn at
+ * once. No OpenGL calls are made here other than loading any textures
+ * (or atlas pages) that aren't loaded yet
+ *******************************************************************/
+void MapRenderer2D::buildThingBatches(float alpha)
+{
+	n_thing_batches = 0;
+	n_thing_batches_base = 0;
+	things_simple.clear();
+
+	MapThing* thing = NULL;
+	double x, y, angle;
+	float talpha;
+	vector<int> things_arrows;
+	long last_update = thing_sprites_updated;
+
+	// Thing shadows
+	startThingPass();
+	if (thing_shadow > 0.01f && thing_drawtype != TDT_SPRITE)
+	{
+		GLTexture* tex_shadow = theMapEditor->textureManager().getEditorImage("thing/shadow");
+		if (thing_drawtype == TDT_SQUARE || thing_drawtype == TDT_SQUARESPRITE || thing_drawtype == TDT_FRAMEDSPRITE)
+			tex_shadow = theMapEditor->textureManager().getEditorImage("thing/square/shadow");
+		if (tex_shadow)
+		{
+			unsigned ttex = thingTexture(tex_shadow);
+			for (unsigned v = 0; v < vis_list_t.size(); v++)
+			{
+				unsigned a = vis_list_t[v];
+				if (vis_t[a] > 0)
+					continue;
+
+				// No shadow if filtered
+				thing = map->getThing(a);
+				if (thing->isFiltered())
+					continue;
+
+				ThingType* tt = theGameConfiguration->thingType(thing->getType());
+				double radius = (tt->getRadius()+1);
+				if (tt->shrinkOnZoom()) radius = scaledRadius(radius);
+				radius *= 1.3;
+				addThingQuad(ttex, thing->xPos(), thing->yPos(), -radius, -radius, radius, radius, 0, sq_thing_tc,
+				             0.0f, 0.0f, 0.0f, alpha*thing_shadow);
+			}
+		}
+	}
+
+	// Things
+	startThingPass();
+	for (unsigned v = 0; v < vis_list_t.size(); v++)
+	{
+		unsigned a = vis_list_t[v];
+		if (vis_t[a] > 0)
+			continue;
+
+		// Get thing info
+		thing = map->getThing(a);
+		x = thing->xPos();
+		y = thing->yPos();
+		angle = thing->getAngle();
+		talpha = thing->isFiltered() ? alpha*0.25 : alpha;
+		ThingType* tt = theGameConfiguration->thingType(thing->getType());
+
+		// Reset thing sprite if modified
+		if (thing->modifiedTime() > last_update && thing_sprites.size() > a)
+			thing_sprites[a] = NULL;
+
+		if (thing_drawtype == TDT_SPRITE)
+		{
+			GLTexture* tex = getThingSprite(tt, a);
+			if (!tex)
+				addRoundThing(a, x, y, angle, tt, talpha);
+			else
+			{
+				addSpriteThing(tex, x, y, tt, talpha, false);
+				if (tt->isAngled() || thing_force_dir || things_angles)
+					things_arrows.push_back(a);
+			}
+		}
+		else if (thing_drawtype == TDT_ROUND)
+			addRoundThing(a, x, y, angle, tt, talpha);
+		else
+		{
+			bool showicon = (thing_drawtype < TDT_SQUARESPRITE) || tt->getSprite().IsEmpty();
+			bool framed = (thing_drawtype == TDT_FRAMEDSPRITE);
+			int tc_start = 0;
+			GLTexture* tex = getSquareThingTexture(tt, angle, showicon, framed, tc_start);
+			if (!tex)
+			{
+				things_simple.push_back(a);
+				continue;
+			}
+
+			// Rotate texture coordinates
+			float tc[8];
+			for (unsigned i = 0; i < 8; i++)
+				tc[i] = sq_thing_tc[(tc_start + i) % 8];
+
+			double radius = tt->getRadius();
+			if (tt->shrinkOnZoom()) radius = scaledRadius(radius);
+			addThingQuad(thingTexture(tex), x, y, -radius, -radius, radius, radius, 0, tc,
+			             tt->getColour().fr(), tt->getColour().fg(), tt->getColour().fb(), talpha);
+
+			if ((tt->isAngled() || thing_force_dir || things_angles) && !showicon)
+				things_arrows.push_back(a);
+		}
+	}
+
+	n_thing_batches_base = n_thing_batches;
+
+	// Thing sprites within squares
+	startThingPass();
+	if (thing_drawtype > TDT_SPRITE)
+	{
+		for (unsigned v = 0; v < vis_list_t.size(); v++)
+		{
+			unsigned a = vis_list_t[v];
+			if (vis_t[a] > 0)
+				continue;
+
+			thing = map->getThing(a);
+			ThingType* tt = theGameConfiguration->thingType(thing->getType());
+			if (thing_drawtype == TDT_SQUARESPRITE && tt->getSprite().IsEmpty())
+				continue;
+
+			talpha = thing->isFiltered() ? alpha*0.25 : alpha;
+			GLTexture* tex = getThingSprite(tt, a);
+			if (tex)
+				addSpriteThing(tex, thing->xPos(), thing->yPos(), tt, talpha, true);
+			else
+				addRoundThing(a, thing->xPos(), thing->yPos(), thing->getAngle(), tt, talpha, thing_drawtype == TDT_FRAMEDSPRITE ? 0.7 : 1.0);
+		}
+	}
+
+	// Direction arrows
+	startThingPass();
+	GLTexture* tex_arrow = things_arrows.empty() ? NULL : theMapEditor->textureManager().getEditorImage("arrow");
+	if (tex_arrow)
+	{
+		unsigned ttex = thingTexture(tex_arrow);
+		rgba_t acol = COL_WHITE;
+		for (unsigned a = 0; a < things_arrows.size(); a++)
+		{
+			thing = map->getThing(things_arrows[a]);
+			if (arrow_colour)
+			{
+				ThingType* tt = theGameConfiguration->thingType(thing->getType());
+				if (tt)
+					acol.set(tt->getColour());
+			}
+
+			addThingQuad(ttex, thing->xPos(), thing->yPos(), -32, -32, 32, 32, thing->getAngle(), sq_thing_tc,
+			             acol.fr(), acol.fg(), acol.fb(), alpha*arrow_alpha);
+		}
+	}
+}
+
+/* MapRenderer2D::getThingBatchCounts
+ * Gets the number of thing [batches] (ie. draw calls) and [quads] from
+ * the last call to buildThingBatches
+ *******************************************************************/
+void MapRenderer2D::getThingBatchCounts(unsigned& batches, unsigned& quads)
+{
+	batches = 0;
+	quads = 0;
+	for (unsigned a = 0; a < n_thing_batches; a++)
+	{
+		if (thing_batches[a].verts.empty())
+			continue;
+
+		batches++;
+		quads += thing_batches[a].verts.size() / 4;
+	}
+}
+
+/* MapRenderer2D::renderThingsBatched
+ * Renders map things using vertex arrays, one draw call per texture
+ * in each pass
+ *******************************************************************/
+void MapRenderer2D::renderThingsBatched(float alpha)
+{
+	buildThingBatches(alpha);
+
+	// Draw shadows and things
+	renderThingBatches(0, n_thing_batches_base);
+
+	// Draw any things without textures
+	for (unsigned a = 0; a < things_simple.size(); a++)
+	{
+		MapThing* thing = map->getThing(things_simple[a]);
+		renderSimpleSquareThing(thing->xPos(), thing->yPos(), thing->getAngle(),
+		                        theGameConfiguration->thingType(thing->getType()),
+		                        thing->isFiltered() ? alpha*0.25 : alpha);
+	}
+
+	// Draw sprites within squares and direction arrows on top
+	renderThingBatches(n_thing_batches_base, n_thing_batches);
+}
+
+/* MapRenderer2D::renderThingBatches
+ * Draws thing batches from [first] up to (but not including) [last]
+ *******************************************************************/
+void MapRenderer2D::renderThingBatches(unsigned first, unsigned last)
+{
+	if (first >= last)
+		return;
+
+	// Setup opengl state
+	glEnable(GL_TEXTURE_2D);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	if (OpenGL::vboSupport())
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+
+	// Draw batches
+	for (unsigned a = first; a < last; a++)
+	{
+		vector<gltexvert_t>& verts = thing_batches[a].verts;
+		if (verts.empty())
+			continue;
+
+		thing_batches[a].texture->bind();
+		glVertexPointer(2, GL_FLOAT, sizeof(gltexvert_t), &verts[0].x);
+		glTexCoordPointer(2, GL_FLOAT, sizeof(gltexvert_t), &verts[0].tx);
+		glColorPointer(4, GL_FLOAT, sizeof(gltexvert_t), &verts[0].r);
+		glDrawArrays(GL_QUADS, 0, verts.size());
+	}
+
+	// Clean up opengl state
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisable(GL_TEXTURE_2D);
+	tex_last = NULL;
+}
+
 /* MapRenderer2D::renderThingHilight
  * Renders the thing hilight overlay for thing [index]
  *******************************************************************/
@@ -1592,7 +2081,7 @@ void MapRenderer2D::renderPathedThings(vector<MapThing*>& things)
 			}
 		}
 		if (!update)
-			thing_paths_updated = theApp->runTimer();
+			thing_paths_updated = map->currentGeneration();
 	}
 
 	// Get colours
@@ -1728,23 +2217,331 @@ void MapRenderer2D::renderPathedThings(vector<MapThing*>& things)
 			}
 
 		}
-		thing_paths_updated = theApp->runTimer();
+		thing_paths_updated = map->currentGeneration();
+	}
+
+	// Setup GL stuff
+	glLineWidth(line_width*1.5f);
+
+	for (unsigned a = 0; a < thing_paths.size(); a++)
+	{
+		if (thing_paths[a].from_index == thing_paths[a].to_index)
+			continue;
+
+		Drawing::drawArrow(map->getThing(thing_paths[a].to_index)->getPoint(MOBJ_POINT_MID),
+			map->getThing(thing_paths[a].from_index)->getPoint(MOBJ_POINT_MID),
+			(thing_paths[a].type == PATH_DRAGON_BOTH || thing_paths[a].type == PATH_DRAGON) ? dragoncol : pathedcol, 
+			(thing_paths[a].type == PATH_NORMAL_BOTH || thing_paths[a].type == PATH_DRAGON_BOTH), 
+			arrowhead_angle, arrowhead_length);
+	}
+}
+
+/* simplifyPolyline
+ * Simplifies the polyline [points] (Douglas-Peucker), setting [keep]
+ * to true for each point that should be kept. Points are removed if
+ * the simplified line is still within [tolerance] of them
+ *******************************************************************/
+void simplifyPolyline(vector<fpoint2_t>& points, double tolerance, vector<bool>& keep)
+{
+	keep.assign(points.size(), false);
+	if (points.empty())
+		return;
+	keep[0] = keep[points.size() - 1] = true;
+
+	// Go through sections to check (as first/last point pairs)
+	vector<unsigned> sections;
+	sections.push_back(0);
+	sections.push_back(points.size() - 1);
+	while (!sections.empty())
+	{
+		unsigned last = sections.back();
+		sections.pop_back();
+		unsigned first = sections.back();
+		sections.pop_back();
+
+		// Find the point furthest from the line between first and last
+		double max_dist = 0;
+		unsigned furthest = first;
+		for (unsigned a = first + 1; a < last; a++)
+		{
+			double dist = MathStuff::distanceToLine(points[a].x, points[a].y, points[first].x, points[first].y, points[last].x, points[last].y);
+			if (dist > max_dist)
+			{
+				max_dist = dist;
+				furthest = a;
+			}
+		}
+
+		// Keep it and check either side of it if it's too far away
+		if (max_dist > tolerance)
+		{
+			keep[furthest] = true;
+			sections.push_back(first);
+			sections.push_back(furthest);
+			sections.push_back(furthest);
+			sections.push_back(last);
+		}
+	}
+}
+
+/* MapRenderer2D::lodLevel
+ * Returns the level of detail level for the current view scale (the
+ * view scale rounded down to a power of 2)
+ *******************************************************************/
+int MapRenderer2D::lodLevel()
+{
+	return (int)floor(log(view_scale) / log(2.0));
+}
+
+/* MapRenderer2D::lodLinesActive
+ * Returns true if lines should be drawn simplified at the current
+ * view scale
+ *******************************************************************/
+bool MapRenderer2D::lodLinesActive()
+{
+	return map_lod_lines > 0 && view_scale < map_lod_lines;
+}
+
+/* MapRenderer2D::lodThingsActive
+ * Returns true if things should be drawn as density points at the
+ * current view scale
+ *******************************************************************/
+bool MapRenderer2D::lodThingsActive()
+{
+	return map_lod_things > 0 && view_scale < map_lod_things;
+}
+
+/* MapRenderer2D::buildLODLines
+ * Builds simplified lines for LOD [level]. Lines are joined into
+ * chains through vertices with only two lines attached (where both
+ * lines are the same colour), and each chain is simplified to within
+ * about a pixel at the level's scale
+ *******************************************************************/
+void MapRenderer2D::buildLODLines(int level)
+{
+	lod_lines.clear();
+	lod_lines_a.clear();
+
+	// Get line colours
+	unsigned n_lines = map->nLines();
+	vector<rgba_t> colours(n_lines);
+	for (unsigned a = 0; a < n_lines; a++)
+		colours[a] = lineColour(map->getLine(a));
+
+	// Max distance a simplified line can be from the real lines
+	double tolerance = 0.75 * pow(2.0, -level);
+
+	vector<bool> done(n_lines, false);
+	vector<fpoint2_t> points;
+	vector<bool> keep;
+	for (unsigned a = 0; a < n_lines; a++)
+	{
+		if (done[a])
+			continue;
+
+		// Go back to the start of the chain this line is in
+		MapLine* line = map->getLine(a);
+		MapVertex* vertex = line->v1();
+		while (vertex->nConnectedLines() == 2)
+		{
+			MapLine* prev = vertex->connectedLine(0);
+			if (prev == line) prev = vertex->connectedLine(1);
+			unsigned pi = prev->getIndex();
+			if (prev == map->getLine(a) || done[pi] || !colours[pi].equals(colours[a], true))
+				break;
+
+			line = prev;
+			vertex = (line->v1() == vertex) ? line->v2() : line->v1();
+		}
+
+		// Follow the chain forward, adding points
+		points.clear();
+		points.push_back(fpoint2_t(vertex->xPos(), vertex->yPos()));
+		while (true)
+		{
+			done[line->getIndex()] = true;
+			vertex = (line->v1() == vertex) ? line->v2() : line->v1();
+			points.push_back(fpoint2_t(vertex->xPos(), vertex->yPos()));
+
+			if (vertex->nConnectedLines() != 2)
+				break;
+			MapLine* next = vertex->connectedLine(0);
+			if (next == line) next = vertex->connectedLine(1);
+			unsigned ni = next->getIndex();
+			if (done[ni] || !colours[ni].equals(colours[a], true))
+				break;
+
+			line = next;
+		}
+
+		// Simplify and add resulting lines
+		simplifyPolyline(points, tolerance, keep);
+		rgba_t& col = colours[a];
+		unsigned prev = 0;
+		for (unsigned p = 1; p < points.size(); p++)
+		{
+			if (!keep[p])
+				continue;
+
+			glvert_t v;
+			v.r = col.fr();
+			v.g = col.fg();
+			v.b = col.fb();
+			v.a = col.fa();
+			v.x = points[prev].x;
+			v.y = points[prev].y;
+			lod_lines.push_back(v);
+			v.x = points[p].x;
+			v.y = points[p].y;
+			lod_lines.push_back(v);
+			lod_lines_a.push_back(col.fa());
+			lod_lines_a.push_back(col.fa());
+			prev = p;
+		}
 	}
 
-	// Setup GL stuff
-	glLineWidth(line_width*1.5f);
+	lod_lines_alpha = 1.0f;
+	lod_lines_level = level;
+	lod_lines_updated = map->currentGeneration();
+}
 
-	for (unsigned a = 0; a < thing_paths.size(); a++)
+/* MapRenderer2D::buildLODThings
+ * Builds thing density points for LOD [level]. Things are grouped in
+ * a grid of cells a few pixels across at the level's scale, and each
+ * cell with things in it becomes a point at their average position
+ * and colour. Cells with more things are drawn more opaque
+ *******************************************************************/
+void MapRenderer2D::buildLODThings(int level)
+{
+	lod_things.clear();
+	lod_things_a.clear();
+
+	// Get cell for each thing
+	double cell_size = 4 * pow(2.0, -level);
+	vector<std::pair<uint64_t, unsigned> > cells;
+	cells.reserve(map->nThings());
+	for (unsigned a = 0; a < map->nThings(); a++)
 	{
-		if (thing_paths[a].from_index == thing_paths[a].to_index)
-			continue;
+		MapThing* thing = map->getThing(a);
+		int32_t cx = (int32_t)floor(thing->xPos() / cell_size);
+		int32_t cy = (int32_t)floor(thing->yPos() / cell_size);
+		cells.push_back(std::make_pair(((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy, a));
+	}
+	std::sort(cells.begin(), cells.end());
 
-		Drawing::drawArrow(map->getThing(thing_paths[a].to_index)->getPoint(MOBJ_POINT_MID),
-			map->getThing(thing_paths[a].from_index)->getPoint(MOBJ_POINT_MID),
-			(thing_paths[a].type == PATH_DRAGON_BOTH || thing_paths[a].type == PATH_DRAGON) ? dragoncol : pathedcol, 
-			(thing_paths[a].type == PATH_NORMAL_BOTH || thing_paths[a].type == PATH_DRAGON_BOTH), 
-			arrowhead_angle, arrowhead_length);
+	// Add a point for each cell
+	unsigned start = 0;
+	while (start < cells.size())
+	{
+		double x = 0, y = 0, r = 0, g = 0, b = 0;
+		unsigned end = start;
+		while (end < cells.size() && cells[end].first == cells[start].first)
+		{
+			MapThing* thing = map->getThing(cells[end].second);
+			ThingType* tt = theGameConfiguration->thingType(thing->getType());
+			x += thing->xPos();
+			y += thing->yPos();
+			r += tt->getColour().fr();
+			g += tt->getColour().fg();
+			b += tt->getColour().fb();
+			end++;
+		}
+
+		unsigned count = end - start;
+		glvert_t v;
+		v.x = x / count;
+		v.y = y / count;
+		v.r = r / count;
+		v.g = g / count;
+		v.b = b / count;
+		v.a = MIN(1.0, 0.4 + count * 0.15);
+		lod_things.push_back(v);
+		lod_things_a.push_back(v.a);
+
+		start = end;
+	}
+
+	lod_things_alpha = 1.0f;
+	lod_things_level = level;
+	lod_things_updated = map->currentGeneration();
+}
+
+/* MapRenderer2D::renderLinesLOD
+ * Renders simplified lines (rebuilding them first if needed)
+ *******************************************************************/
+void MapRenderer2D::renderLinesLOD(float alpha)
+{
+	// Rebuild if needed
+	int level = lodLevel();
+	if (lod_lines_updated < 0 ||
+		level != lod_lines_level ||
+		map->geometryUpdated() > lod_lines_updated ||
+		map->modifiedSince(lod_lines_updated, MOBJ_LINE))
+		buildLODLines(level);
+
+	if (lod_lines.empty())
+		return;
+
+	// Apply alpha if it changed
+	if (alpha != lod_lines_alpha)
+	{
+		for (unsigned a = 0; a < lod_lines.size(); a++)
+			lod_lines[a].a = lod_lines_a[a] * alpha;
+		lod_lines_alpha = alpha;
+	}
+
+	// Draw
+	if (OpenGL::vboSupport())
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer(2, GL_FLOAT, sizeof(glvert_t), &lod_lines[0].x);
+	glColorPointer(4, GL_FLOAT, sizeof(glvert_t), &lod_lines[0].r);
+	glDrawArrays(GL_LINES, 0, lod_lines.size());
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_COLOR_ARRAY);
+}
+
+/* MapRenderer2D::renderThingsLOD
+ * Renders thing density points (rebuilding them first if needed)
+ *******************************************************************/
+void MapRenderer2D::renderThingsLOD(float alpha)
+{
+	// Rebuild if needed
+	int level = lodLevel();
+	if (lod_things_updated < 0 ||
+		level != lod_things_level ||
+		map->thingsUpdated() > lod_things_updated ||
+		map->modifiedSince(lod_things_updated, MOBJ_THING))
+		buildLODThings(level);
+
+	if (lod_things.empty())
+		return;
+
+	// Apply alpha if it changed
+	if (alpha != lod_things_alpha)
+	{
+		for (unsigned a = 0; a < lod_things.size(); a++)
+			lod_things[a].a = lod_things_a[a] * alpha;
+		lod_things_alpha = alpha;
 	}
+
+	// Draw (points about as big as a grid cell)
+	glDisable(GL_TEXTURE_2D);
+	glDisable(GL_POINT_SMOOTH);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glPointSize(MAX(2.0, 3 * pow(2.0, -lod_things_level) * view_scale));
+	if (OpenGL::vboSupport())
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer(2, GL_FLOAT, sizeof(glvert_t), &lod_things[0].x);
+	glColorPointer(4, GL_FLOAT, sizeof(glvert_t), &lod_things[0].r);
+	glDrawArrays(GL_POINTS, 0, lod_things.size());
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_COLOR_ARRAY);
 }
 
 /* MapRenderer2D::renderFlats
@@ -1756,12 +2553,15 @@ void MapRenderer2D::renderFlats(int type, bool texture, float alpha)
 	if (alpha <= 0.01f)
 		return;
 
+	RenderPassTimer timer("Flats");
+	timer.setCount(vis_list_s.size());
+
 	if (OpenGL::vboSupport() && flats_use_vbo)
 		renderFlatsVBO(type, texture, alpha);
 	else
 		renderFlatsImmediate(type, texture, alpha);
 
-	flats_updated = theApp->runTimer();
+	flats_updated = map->currentGeneration();
 }
 
 /* MapRenderer2D::sortPolyByTex
@@ -1801,8 +2601,9 @@ void MapRenderer2D::renderFlatsImmediate(int type, bool texture, float alpha)
 	// Go through sectors
 	GLTexture* tex_last = NULL;
 	GLTexture* tex = NULL;
-	for (unsigned a = 0; a < map->nSectors(); a++)
+	for (unsigned v = 0; v < vis_list_s.size(); v++)
 	{
+		unsigned a = vis_list_s[v];
 		MapSector* sector = map->getSector(a);
 
 		// Skip if sector is out of view
@@ -1811,7 +2612,7 @@ void MapRenderer2D::renderFlatsImmediate(int type, bool texture, float alpha)
 
 		if (texture)
 		{
-			if (!tex_flats[a] || sector->modifiedTime() > flats_updated - 100)
+			if (!tex_flats[a] || sector->modifiedTime() > flats_updated)
 			{
 				// Get the sector texture
 				if (type <= 1)
@@ -1917,20 +2718,9 @@ void MapRenderer2D::renderFlatsVBO(int type, bool texture, float alpha)
 		last_flat_type = type;
 	}
 
-	// First, check if any polygon vertex data has changed (in this case we need to refresh the entire vbo)
-	for (unsigned a = 0; a < map->nSectors(); a++)
-	{
-		Polygon2D* poly = map->getSector(a)->getPolygon();
-		if (poly && poly->vboUpdate() > 1)
-		{
-			//wxLogMessage("Updating sector %d polygon vbo data", a);
-			updateFlatsVBO();
-			vbo_updated = true;
-		}
-	}
-
-	// Create VBO if necessary
-	if (!vbo_updated && vbo_flats == 0)
+	// Create VBO if necessary (polygons that have changed are updated
+	// in their own slots as they are drawn, below)
+	if (vbo_flats == 0)
 	{
 		updateFlatsVBO();
 		vbo_updated = true;
@@ -1951,8 +2741,9 @@ void MapRenderer2D::renderFlatsVBO(int type, bool texture, float alpha)
 	GLTexture* tex = NULL;
 	bool first = true;
 	unsigned update = 0;
-	for (unsigned a = 0; a < map->nSectors(); a++)
+	for (unsigned v = 0; v < vis_list_s.size(); v++)
 	{
+		unsigned a = vis_list_s[v];
 		MapSector* sector = map->getSector(a);
 
 		// Skip if sector is out of view
@@ -1962,7 +2753,7 @@ void MapRenderer2D::renderFlatsVBO(int type, bool texture, float alpha)
 		first = false;
 		if (texture)
 		{
-			if (!tex_flats[a] || sector->modifiedTime() > flats_updated - 100)
+			if (!tex_flats[a] || sector->modifiedTime() > flats_updated)
 			{
 				// Get the sector texture
 				if (type <= 1)
@@ -2015,9 +2806,18 @@ void MapRenderer2D::renderFlatsVBO(int type, bool texture, float alpha)
 		}
 
 		// Update polygon VBO data if needed
-		if (poly->vboUpdate() > 0)
+		if (poly->vboUpdate() > 0 || a >= vbo_flat_slots.size() || vbo_flat_slots[a].poly != poly)
 		{
-			poly->updateVBOData();
+			if (poly->vboUpdate() == 1 && a < vbo_flat_slots.size() && vbo_flat_slots[a].poly == poly)
+				poly->updateVBOData();	// Same size, update in place
+			else if (!updateFlatSlot(a, poly))
+			{
+				// No room left in the VBO, rebuild it
+				updateFlatsVBO();
+				glBindBuffer(GL_ARRAY_BUFFER, vbo_flats);
+				Polygon2D::setupVBOPointers();
+			}
+
 			update++;
 			if (update > 200)
 				break;
@@ -2736,57 +3536,37 @@ void MapRenderer2D::renderObjectEditGroup(ObjectEditGroup* group)
 	}
 }
 
-/* MapRenderer2D::updateVerticesVBO
- * (Re)builds the map vertices VBO
+/* MapRenderer2D::getVertexVBOData
+ * Writes VBO data for [count] map vertices starting from [first] to
+ * [data]
  *******************************************************************/
-void MapRenderer2D::updateVerticesVBO()
+void MapRenderer2D::getVertexVBOData(unsigned first, unsigned count, vector<float>& data)
 {
-	// Create VBO if needed
-	if (vbo_vertices == 0)
-		glGenBuffers(1, &vbo_vertices);
-
-	// Fill vertices VBO
-	int nfloats = map->nVertices()*2;
-	GLfloat* verts = new GLfloat[nfloats];
+	data.resize(count * 2);
 	unsigned i = 0;
-	for (unsigned a = 0; a < map->nVertices(); a++)
+	for (unsigned a = first; a < first + count; a++)
 	{
-		verts[i++] = map->getVertex(a)->xPos();
-		verts[i++] = map->getVertex(a)->yPos();
+		MapVertex* vertex = map->getVertex(a);
+		data[i++] = vertex->xPos();
+		data[i++] = vertex->yPos();
 	}
-	glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*nfloats, verts, GL_STATIC_DRAW);
-
-	// Clean up
-	delete[] verts;
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	n_vertices = map->nVertices();
-	vertices_updated = theApp->runTimer();
 }
 
-/* MapRenderer2D::updateLinesVBO
- * (Re)builds the map lines VBO
+/* MapRenderer2D::getLineVBOData
+ * Writes VBO data for [count] map lines starting from [first] to
+ * [data] (2 vertices per line, or 4 if [show_direction] is true)
  *******************************************************************/
-void MapRenderer2D::updateLinesVBO(bool show_direction, float base_alpha)
+void MapRenderer2D::getLineVBOData(unsigned first, unsigned count, bool show_direction, float base_alpha, vector<glvert_t>& data)
 {
-	LOG_MESSAGE(3, "Updating lines VBO");
-
-	// Create VBO if needed
-	if (vbo_lines == 0)
-		glGenBuffers(1, &vbo_lines);
-
 	// Determine the number of vertices per line
 	int vpl = 2;
 	if (show_direction) vpl = 4;
 
-	// Fill lines VBO
-	int nverts = map->nLines()*vpl;
-	glvert_t* lines = new glvert_t[nverts];
+	data.resize(count * vpl);
 	unsigned v = 0;
 	rgba_t col;
 	float alpha;
-	for (unsigned a = 0; a < map->nLines(); a++)
+	for (unsigned a = first; a < first + count; a++)
 	{
 		MapLine* line = map->getLine(a);
 
@@ -2795,46 +3575,258 @@ void MapRenderer2D::updateLinesVBO(bool show_direction, float base_alpha)
 		alpha = base_alpha*col.fa();
 
 		// Set line vertices
-		lines[v].x = line->v1()->xPos();
-		lines[v].y = line->v1()->yPos();
-		lines[v+1].x = line->v2()->xPos();
-		lines[v+1].y = line->v2()->yPos();
+		data[v].x = line->v1()->xPos();
+		data[v].y = line->v1()->yPos();
+		data[v+1].x = line->v2()->xPos();
+		data[v+1].y = line->v2()->yPos();
 
 		// Set line colour(s)
-		lines[v].r = lines[v+1].r = col.fr();
-		lines[v].g = lines[v+1].g = col.fg();
-		lines[v].b = lines[v+1].b = col.fb();
-		lines[v].a = lines[v+1].a = alpha;
+		data[v].r = data[v+1].r = col.fr();
+		data[v].g = data[v+1].g = col.fg();
+		data[v].b = data[v+1].b = col.fb();
+		data[v].a = data[v+1].a = alpha;
 
 		// Direction tab if needed
 		if (show_direction)
 		{
 			fpoint2_t mid = line->getPoint(MOBJ_POINT_MID);
 			fpoint2_t tab = line->dirTabPoint();
-			lines[v+2].x = mid.x;
-			lines[v+2].y = mid.y;
-			lines[v+3].x = tab.x;
-			lines[v+3].y = tab.y;
+			data[v+2].x = mid.x;
+			data[v+2].y = mid.y;
+			data[v+3].x = tab.x;
+			data[v+3].y = tab.y;
 
 			// Colours
-			lines[v+2].r = lines[v+3].r = col.fr();
-			lines[v+2].g = lines[v+3].g = col.fg();
-			lines[v+2].b = lines[v+3].b = col.fb();
-			lines[v+2].a = lines[v+3].a = alpha*0.6f;
+			data[v+2].r = data[v+3].r = col.fr();
+			data[v+2].g = data[v+3].g = col.fg();
+			data[v+2].b = data[v+3].b = col.fb();
+			data[v+2].a = data[v+3].a = alpha*0.6f;
 		}
 
 		// Next line
 		v += vpl;
 	}
+}
+
+/* MapRenderer2D::getDirtyVertices
+ * Adds the indices of all vertices that need to be rewritten to the
+ * vertices VBO to [dirty] (sorted, no duplicates). These are vertices
+ * modified since the VBO was last updated, and any indices that have
+ * had a different vertex put in them (created/removed vertices)
+ *******************************************************************/
+void MapRenderer2D::getDirtyVertices(vector<unsigned>& dirty)
+{
+	// Indices with a different vertex in them, or all of them if the
+	// map doesn't know which
+	if (!map->getChangedIndices(vertices_updated, MOBJ_VERTEX, dirty))
+	{
+		for (unsigned a = 0; a < map->nVertices(); a++)
+			dirty.push_back(a);
+	}
+
+	// Modified vertices
+	vector<MapObject*> modified = map->getModifiedObjects(vertices_updated, MOBJ_VERTEX);
+	for (unsigned a = 0; a < modified.size(); a++)
+		dirty.push_back(modified[a]->getIndex());
+
+	std::sort(dirty.begin(), dirty.end());
+	dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+	dirty.erase(std::lower_bound(dirty.begin(), dirty.end(), map->nVertices()), dirty.end());
+}
+
+/* MapRenderer2D::getDirtyLines
+ * Adds the indices of all lines that need to be rewritten to the
+ * lines VBO to [dirty] (sorted, no duplicates). These are lines that
+ * were modified or had a vertex modified since the VBO was last
+ * updated, and any indices that have had a different line put in
+ * them (created/removed lines)
+ *******************************************************************/
+void MapRenderer2D::getDirtyLines(vector<unsigned>& dirty)
+{
+	// Indices with a different line in them, or all of them if the map
+	// doesn't know which
+	if (!map->getChangedIndices(lines_updated, MOBJ_LINE, dirty))
+	{
+		for (unsigned a = 0; a < map->nLines(); a++)
+			dirty.push_back(a);
+	}
+
+	// Modified lines
+	vector<MapObject*> modified = map->getModifiedObjects(lines_updated, MOBJ_LINE);
+	for (unsigned a = 0; a < modified.size(); a++)
+		dirty.push_back(modified[a]->getIndex());
+
+	// Lines attached to modified vertices
+	modified = map->getModifiedObjects(lines_updated, MOBJ_VERTEX);
+	for (unsigned a = 0; a < modified.size(); a++)
+	{
+		MapVertex* vertex = (MapVertex*)modified[a];
+		for (unsigned l = 0; l < vertex->nConnectedLines(); l++)
+			dirty.push_back(vertex->connectedLine(l)->getIndex());
+	}
+
+	std::sort(dirty.begin(), dirty.end());
+	dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+	dirty.erase(std::lower_bound(dirty.begin(), dirty.end(), map->nLines()), dirty.end());
+}
+
+/* MapRenderer2D::getDirtyRanges
+ * Converts the sorted list of [dirty] indices to a list of ranges to
+ * update, as [start, end) pairs in [ranges]. Ranges separated by a
+ * small gap are merged, since it's quicker to rewrite a few unchanged
+ * objects than to do another buffer update
+ *******************************************************************/
+void MapRenderer2D::getDirtyRanges(vector<unsigned>& dirty, vector<unsigned>& ranges)
+{
+	for (unsigned a = 0; a < dirty.size(); a++)
+	{
+		if (!ranges.empty() && dirty[a] <= ranges.back() + 16)
+			ranges.back() = dirty[a] + 1;
+		else
+		{
+			ranges.push_back(dirty[a]);
+			ranges.push_back(dirty[a] + 1);
+		}
+	}
+}
+
+/* MapRenderer2D::setVBOsUpdated
+ * Marks the vertex and line VBOs as up to date with the current map,
+ * as if they had just been fully rebuilt (without doing any OpenGL
+ * calls)
+ *******************************************************************/
+void MapRenderer2D::setVBOsUpdated()
+{
+	n_vertices = map->nVertices();
+	n_lines = map->nLines();
+	vertices_updated = map->currentGeneration();
+	lines_updated = map->currentGeneration();
+}
+
+/* MapRenderer2D::updateVerticesVBO
+ * (Re)builds the map vertices VBO
+ *******************************************************************/
+void MapRenderer2D::updateVerticesVBO()
+{
+	// Create VBO if needed
+	if (vbo_vertices == 0)
+		glGenBuffers(1, &vbo_vertices);
+
+	// Allocate VBO, with some room for new vertices
+	vbo_vertices_size = map->nVertices() + map->nVertices() / 4 + 64;
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*2*vbo_vertices_size, NULL, GL_STATIC_DRAW);
+
+	// Fill vertices VBO
+	vector<float> verts;
+	getVertexVBOData(0, map->nVertices(), verts);
+	if (!verts.empty())
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat)*verts.size(), &verts[0]);
+
+	// Clean up
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	n_vertices = map->nVertices();
+	vertices_updated = map->currentGeneration();
+}
+
+/* MapRenderer2D::updateDirtyVertices
+ * Rewrites any changed vertices to the vertices VBO
+ *******************************************************************/
+void MapRenderer2D::updateDirtyVertices()
+{
+	vector<unsigned> dirty;
+	getDirtyVertices(dirty);
+
+	// Just rebuild the whole thing if most vertices have changed
+	if (dirty.size() > map->nVertices() / 2)
+	{
+		updateVerticesVBO();
+		return;
+	}
+
+	// Write changed ranges
+	vector<unsigned> ranges;
+	getDirtyRanges(dirty, ranges);
+	vector<float> verts;
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
+	for (unsigned a = 0; a < ranges.size(); a += 2)
+	{
+		getVertexVBOData(ranges[a], ranges[a+1] - ranges[a], verts);
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(GLfloat)*2*ranges[a], sizeof(GLfloat)*verts.size(), &verts[0]);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	n_vertices = map->nVertices();
+	vertices_updated = map->currentGeneration();
+}
+
+/* MapRenderer2D::updateLinesVBO
+ * (Re)builds the map lines VBO
+ *******************************************************************/
+void MapRenderer2D::updateLinesVBO(bool show_direction, float base_alpha)
+{
+	LOG_MESSAGE(3, "Updating lines VBO");
+
+	// Create VBO if needed
+	if (vbo_lines == 0)
+		glGenBuffers(1, &vbo_lines);
+
+	// Determine the number of vertices per line
+	int vpl = 2;
+	if (show_direction) vpl = 4;
+
+	// Allocate VBO, with some room for new lines
+	vbo_lines_size = map->nLines() + map->nLines() / 4 + 64;
 	glBindBuffer(GL_ARRAY_BUFFER, vbo_lines);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glvert_t)*nverts, lines, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glvert_t)*vpl*vbo_lines_size, NULL, GL_STATIC_DRAW);
+
+	// Fill lines VBO
+	vector<glvert_t> lines;
+	getLineVBOData(0, map->nLines(), show_direction, base_alpha, lines);
+	if (!lines.empty())
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glvert_t)*lines.size(), &lines[0]);
 
 	// Clean up
-	delete[] lines;
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	n_lines = map->nLines();
-	lines_updated = theApp->runTimer();
+	lines_dirs = show_direction;
+	lines_alpha = base_alpha;
+	lines_updated = map->currentGeneration();
+}
+
+/* MapRenderer2D::updateDirtyLines
+ * Rewrites any changed lines to the lines VBO
+ *******************************************************************/
+void MapRenderer2D::updateDirtyLines(float alpha)
+{
+	vector<unsigned> dirty;
+	getDirtyLines(dirty);
+
+	// Just rebuild the whole thing if most lines have changed, or the
+	// line alpha is different
+	if (dirty.size() > map->nLines() / 2 || alpha != lines_alpha)
+	{
+		updateLinesVBO(lines_dirs, alpha);
+		return;
+	}
+
+	// Write changed ranges
+	unsigned vpl = lines_dirs ? 4 : 2;
+	vector<unsigned> ranges;
+	getDirtyRanges(dirty, ranges);
+	vector<glvert_t> lines;
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_lines);
+	for (unsigned a = 0; a < ranges.size(); a += 2)
+	{
+		getLineVBOData(ranges[a], ranges[a+1] - ranges[a], lines_dirs, lines_alpha, lines);
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(glvert_t)*vpl*ranges[a], sizeof(glvert_t)*lines.size(), &lines[0]);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	n_lines = map->nLines();
+	lines_updated = map->currentGeneration();
 }
 
 /* MapRenderer2D::updateFlatsVBO
@@ -2857,83 +3849,162 @@ void MapRenderer2D::updateFlatsVBO()
 		totalsize += poly->vboDataSize();
 	}
 
-	// Allocate buffer data
+	// Allocate buffer data, with some room for polygons to grow (any
+	// polygon that doesn't fit in its slot anymore is moved to the end)
+	vbo_flats_size = totalsize + totalsize / 4 + 20 * 256;
 	glBindBuffer(GL_ARRAY_BUFFER, vbo_flats);
-	glBufferData(GL_ARRAY_BUFFER, totalsize, NULL, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, vbo_flats_size, NULL, GL_STATIC_DRAW);
 
 	// Write polygon data to VBO
 	unsigned offset = 0;
 	unsigned index = 0;
+	vbo_flat_slots.resize(map->nSectors());
 	for (unsigned a = 0; a < map->nSectors(); a++)
 	{
 		Polygon2D* poly = map->getSector(a)->getPolygon();
+		vbo_flat_slots[a].poly = poly;
+		vbo_flat_slots[a].offset = offset;
+		vbo_flat_slots[a].size = poly->vboDataSize();
 		offset = poly->writeToVBO(offset, index);
 		index += poly->totalVertices();
 	}
+	vbo_flats_used = offset;
 
 	// Clean up
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	flats_updated = theApp->runTimer();
+	flats_updated = map->currentGeneration();
+}
+
+/* MapRenderer2D::updateFlatSlot
+ * Writes [poly] to the flats VBO slot for sector [index], moving it to
+ * the end of the VBO if it no longer fits. Returns false if there is
+ * no room left in the VBO. The flats VBO must be bound
+ *******************************************************************/
+bool MapRenderer2D::updateFlatSlot(unsigned index, Polygon2D* poly)
+{
+	if (index >= vbo_flat_slots.size())
+	{
+		vbo_flat_t empty = { NULL, 0, 0 };
+		vbo_flat_slots.resize(index + 1, empty);
+	}
+
+	// Move to the end of the VBO if it doesn't fit
+	vbo_flat_t& slot = vbo_flat_slots[index];
+	unsigned size = poly->vboDataSize();
+	if (size > slot.size)
+	{
+		if (vbo_flats_used + size > vbo_flats_size)
+			return false;
+
+		slot.offset = vbo_flats_used;
+		slot.size = size;
+		vbo_flats_used += size;
+	}
+
+	// Write polygon (20 bytes per vertex)
+	poly->writeToVBO(slot.offset, slot.offset / 20);
+	slot.poly = poly;
+
+	return true;
+}
+
+/* MapRenderer2D::updateMaxThingRadius
+ * Updates the largest thing radius in the map (used to find things
+ * that could be visible), if any things have changed since it was
+ * last updated
+ *******************************************************************/
+void MapRenderer2D::updateMaxThingRadius()
+{
+	if (vis_thing_radius_updated >= 0 &&
+		map->thingsUpdated() <= vis_thing_radius_updated &&
+		!map->modifiedSince(vis_thing_radius_updated, MOBJ_THING))
+		return;
+
+	vis_thing_radius = 0;
+	for (unsigned a = 0; a < map->nThings(); a++)
+	{
+		ThingType* tt = theGameConfiguration->thingType(map->getThing(a)->getType());
+		if (tt->getRadius() > vis_thing_radius)
+			vis_thing_radius = tt->getRadius();
+	}
+
+	vis_thing_radius_updated = map->currentGeneration();
 }
 
 /* MapRenderer2D::updateVisibility
- * Updates map object visibility info depending on the current view
+ * Updates map object visibility info depending on the current view.
+ * Only objects within the view (found via the map's spatial index)
+ * are checked
  *******************************************************************/
 void MapRenderer2D::updateVisibility(fpoint2_t view_tl, fpoint2_t view_br)
 {
+	RenderPassTimer timer("Visibility");
+
 	// Sector visibility
 	if (map->nSectors() != vis_s.size())
 	{
 		// Number of sectors changed, reset array
-		vis_s.clear();
-		for (unsigned a = 0; a < map->nSectors(); a++)
-			vis_s.push_back(0);
+		vis_s.assign(map->nSectors(), VIS_OUTSIDE);
+		vis_list_s.clear();
 	}
-	for (unsigned a = 0; a < map->nSectors(); a++)
+	for (unsigned a = 0; a < vis_list_s.size(); a++)
+		vis_s[vis_list_s[a]] = VIS_OUTSIDE;
+	vis_list_s.clear();
+	map->getObjectsOverlapping(MOBJ_SECTOR, view_tl.x, view_tl.y, view_br.x, view_br.y, vis_list_s);
+	for (unsigned a = 0; a < vis_list_s.size(); a++)
 	{
-		// Check against sector bounding box
-		bbox_t bbox = map->getSector(a)->boundingBox();
-		vis_s[a] = 0;
-		if (bbox.max.x < view_tl.x) vis_s[a] = VIS_LEFT;
-		if (bbox.max.y < view_tl.y) vis_s[a] = VIS_ABOVE;
-		if (bbox.min.x > view_br.x) vis_s[a] = VIS_RIGHT;
-		if (bbox.min.y > view_br.y) vis_s[a] = VIS_BELOW;
+		unsigned index = vis_list_s[a];
+		vis_s[index] = 0;
 
 		// Check if the sector is worth drawing
+		bbox_t bbox = map->getSector(index)->boundingBox();
 		if ((bbox.max.x - bbox.min.x) * view_scale < 4 ||
 				(bbox.max.y - bbox.min.y) * view_scale < 4)
-			vis_s[a] = VIS_SMALL;
+			vis_s[index] = VIS_SMALL;
 	}
 
 	// Thing visibility
 	if (map->nThings() != vis_t.size())
 	{
 		// Number of things changed, reset array
-		vis_t.clear();
-		for (unsigned a = 0; a < map->nThings(); a++)
-			vis_t.push_back(0);
-	}
+		vis_t.assign(map->nThings(), VIS_OUTSIDE);
+		vis_list_t.clear();
+	}
+	for (unsigned a = 0; a < vis_list_t.size(); a++)
+		vis_t[vis_list_t[a]] = VIS_OUTSIDE;
+	vis_list_t.clear();
+
+	// Get things that could be within the view (allowing for the
+	// biggest thing radius), then check each against its own radius
+	updateMaxThingRadius();
+	vector<unsigned> things;
+	map->getObjectsOverlapping(MOBJ_THING, view_tl.x, view_tl.y, view_br.x, view_br.y, things, vis_thing_radius * 1.3);
 	double x, y;
 	double radius;
-	for (unsigned a = 0; a < vis_t.size(); a++)
+	for (unsigned a = 0; a < things.size(); a++)
 	{
-		vis_t[a] = 0;
-		x = map->getThing(a)->xPos();
-		y = map->getThing(a)->yPos();
+		unsigned index = things[a];
+		MapThing* thing = map->getThing(index);
+		x = thing->xPos();
+		y = thing->yPos();
 
 		// Get thing type properties from game configuration
-		ThingType* tt = theGameConfiguration->thingType(map->getThing(a)->getType());
+		ThingType* tt = theGameConfiguration->thingType(thing->getType());
 		radius = tt->getRadius() * 1.3;
 
 		// Ignore if outside of screen
 		if (x+radius < view_tl.x || x-radius > view_br.x || y+radius < view_tl.y || y-radius > view_br.y)
-			vis_t[a] = 1;
+			continue;
 
 		// Check if the thing is worth drawing
-		else if (radius*view_scale < 2)
-			vis_t[a] = VIS_SMALL;
+		vis_t[index] = 0;
+		if (radius*view_scale < 2)
+			vis_t[index] = VIS_SMALL;
+		vis_list_t.push_back(index);
 	}
+
+	timer.setCount(vis_list_s.size() + vis_list_t.size());
 }
 
 /* MapRenderer2D::forceUpdate
@@ -2945,6 +4016,8 @@ void MapRenderer2D::forceUpdate(float line_alpha)
 	this->view_scale_inv = 1.0 / view_scale;
 	tex_flats.clear();
 	thing_sprites.clear();
+	lod_lines_updated = -1;
+	lod_things_updated = -1;
 
 	if (OpenGL::vboSupport())
 	{
@@ -2,17 +2,34 @@
 #ifndef __MAP_RENDERER_2D__
 #define __MAP_RENDERER_2D__
 
+#include <map>
+
 // Forward declarations
 class ThingType;
 class GLTexture;
 class ObjectEditGroup;
 class SLADEMap;
+class MapVertex;
 class MapLine;
 class MapSector;
 class MapThing;
+class Polygon2D;
 
 class MapRenderer2D
 {
+public:
+	// Structs
+	struct glvert_t
+	{
+		float x, y;
+		float r, g, b, a;
+	};
+	struct glline_t
+	{
+		glvert_t v1, v2;	// The line itself
+		glvert_t dv1, dv2;	// Direction tab
+	};
+
 private:
 	SLADEMap*	map;
 	GLTexture*	tex_last;
@@ -37,23 +54,38 @@ private:
 	    VIS_ABOVE	= 4,
 	    VIS_BELOW	= 8,
 	    VIS_SMALL	= 16,
+	    VIS_OUTSIDE	= 32,	// Not in view (not checked in the last update)
 	};
 	vector<uint8_t>	vis_v;
 	vector<uint8_t>	vis_l;
 	vector<uint8_t>	vis_t;
 	vector<uint8_t>	vis_s;
 
-	// Structs
-	struct glvert_t
-	{
-		float x, y;
-		float r, g, b, a;
-	};
-	struct glline_t
+	// Objects within the view (from the map's spatial index) as of the
+	// last visibility update, in index order. The vis_* info above is
+	// only set for these, everything else is VIS_OUTSIDE
+	vector<unsigned>	vis_list_t;
+	vector<unsigned>	vis_list_s;
+	double				vis_thing_radius;	// Largest thing radius in the map
+	long				vis_thing_radius_updated;
+
+	// VBO slots. Each object is written to the slot for its index, and
+	// only slots for objects that were modified or created/removed
+	// since the last update need to be rewritten. The VBOs have room
+	// for more objects than are currently in the map, so adding objects
+	// doesn't need the whole buffer to be recreated
+	struct vbo_flat_t
 	{
-		glvert_t v1, v2;	// The line itself
-		glvert_t dv1, dv2;	// Direction tab
+		Polygon2D*	poly;
+		unsigned	offset;	// Offset in bytes
+		unsigned	size;	// Space available in bytes
 	};
+	vector<vbo_flat_t>	vbo_flat_slots;
+	unsigned			vbo_vertices_size;	// Max vertices/lines VBOs can hold
+	unsigned			vbo_lines_size;
+	unsigned			vbo_flats_size;		// Flats VBO size and space used (in bytes)
+	unsigned			vbo_flats_used;
+	float				lines_alpha;
 
 	// Other
 	bool	lines_dirs;
@@ -69,6 +101,52 @@ private:
 	vector<GLTexture*>	thing_sprites;
 	long				thing_sprites_updated;
 
+	// Thing batches (see buildThingBatches)
+	struct gltexvert_t
+	{
+		float x, y;
+		float tx, ty;
+		float r, g, b, a;
+	};
+	struct thing_batch_t
+	{
+		GLTexture*			texture;
+		vector<gltexvert_t>	verts;	// 4 per quad
+	};
+	struct thing_tex_t
+	{
+		unsigned	batch;
+		float		u1, v1, u2, v2;	// Area of the batch texture used (if in an atlas)
+	};
+	vector<thing_batch_t>			thing_batches;
+	std::map<GLTexture*, unsigned>	thing_batch_index;	// Batch for each (atlas page) texture in the current pass
+	vector<thing_tex_t>				thing_texs;			// Textures used in the current pass
+	std::map<GLTexture*, unsigned>	thing_tex_index;
+	unsigned						n_thing_batches;	// Batches used (the rest are kept for reuse)
+	vector<unsigned>				things_simple;		// Things with no texture, drawn separately
+	unsigned						n_thing_batches_base;	// Batches drawn before things_simple (shadows and things)
+
+	void		startThingPass();
+	unsigned	thingTexture(GLTexture* tex);
+	void		addThingQuad(unsigned ttex, double x, double y, double x1, double y1, double x2, double y2, double angle, const float* tc, float r, float g, float b, float a);
+	void		addRoundThing(unsigned index, double x, double y, double angle, ThingType* tt, float alpha, double radius_mult = 1.0);
+	void		addSpriteThing(GLTexture* tex, double x, double y, ThingType* tt, float alpha, bool fitradius);
+
+	// Level of detail (when zoomed out). Simplified lines are drawn
+	// instead of map lines, and things are drawn as density points.
+	// Both are built for a 'level' (power of 2 view scale) and rebuilt
+	// when the level or the map changes
+	vector<glvert_t>	lod_lines;		// Simplified lines (2 vertices each)
+	vector<float>		lod_lines_a;	// Alpha of each vertex before fading
+	float				lod_lines_alpha;
+	long				lod_lines_updated;
+	int					lod_lines_level;
+	vector<glvert_t>	lod_things;		// Thing density points
+	vector<float>		lod_things_a;
+	float				lod_things_alpha;
+	long				lod_things_updated;
+	int					lod_things_level;
+
 	// Thing paths
 	enum
 	{
@@ -119,12 +197,31 @@ public:
 	bool	renderSquareThing(double x, double y, double angle, ThingType* type, float alpha = 1.0f, bool showicon = true, bool framed = false);
 	void	renderThings(float alpha = 1.0f, bool force_dir = false);
 	void	renderThingsImmediate(float alpha);
+	void	renderThingsBatched(float alpha);
+	void	renderThingBatches(unsigned first, unsigned last);
+	void	buildThingBatches(float alpha);
+	void	getThingBatchCounts(unsigned& batches, unsigned& quads);
+	GLTexture*	getRoundThingTexture(ThingType* type, double angle, bool& rotate);
+	GLTexture*	getSquareThingTexture(ThingType* type, double angle, bool showicon, bool framed, int& tc_start);
+	GLTexture*	getThingSprite(ThingType* type, unsigned index);
 	void	renderThingHilight(int index, float fade);
 	void	renderThingSelection(vector<int>& selection, float fade = 1.0f);
 	void	renderTaggedThings(vector<MapThing*>& things, float fade);
 	void	renderTaggingThings(vector<MapThing*>& things, float fade);
 	void	renderPathedThings(vector<MapThing*>& things);
 
+	// Level of detail
+	int		lodLevel();
+	bool	lodLinesActive();
+	bool	lodThingsActive();
+	void	buildLODLines(int level);
+	void	buildLODThings(int level);
+	void	renderLinesLOD(float alpha);
+	void	renderThingsLOD(float alpha);
+
+	vector<glvert_t>&	getLODLines() { return lod_lines; }
+	vector<glvert_t>&	getLODThings() { return lod_things; }
+
 	// Flats (sectors)
 	void	renderFlats(int type = 0, bool texture = true, float alpha = 1.0f);
 	void	renderFlatsImmediate(int type, bool texture, float alpha);
@@ -150,10 +247,23 @@ public:
 	void	updateVerticesVBO();
 	void	updateLinesVBO(bool show_direction, float alpha);
 	void	updateFlatsVBO();
+	void	updateDirtyVertices();
+	void	updateDirtyLines(float alpha);
+	bool	updateFlatSlot(unsigned index, Polygon2D* poly);
+
+	// VBO data (CPU side only, no OpenGL calls)
+	void		getVertexVBOData(unsigned first, unsigned count, vector<float>& data);
+	void		getLineVBOData(unsigned first, unsigned count, bool show_direction, float alpha, vector<glvert_t>& data);
+	void		getDirtyVertices(vector<unsigned>& dirty);
+	void		getDirtyLines(vector<unsigned>& dirty);
+	void		setVBOsUpdated();
+	static void	getDirtyRanges(vector<unsigned>& dirty, vector<unsigned>& ranges);
 
 	// Misc
 	void	setScale(double scale) { view_scale = scale; view_scale_inv = 1.0 / scale; }
 	void	updateVisibility(fpoint2_t view_tl, fpoint2_t view_br);
+	void	updateMaxThingRadius();
+	void	getVisibleCounts(unsigned& sectors, unsigned& things) { sectors = vis_list_s.size(); things = vis_list_t.size(); }
 	void	forceUpdate(float line_alpha = 1.0f);
 	double	scaledRadius(int radius);
 	bool	visOK();
@@ -38,7 +38,9 @@
 #include "ResourceManager.h"
 #include "MainWindow.h"
 #include "OpenGL.h"
+#include "RenderProfiler.h"
 #include <SFML/System.hpp>
+#include <deque>
 
 
 /*******************************************************************
@@ -55,6 +57,10 @@ CVAR(Int, render_3d_things, 1, CVAR_SAVE)
 CVAR(Int, render_3d_things_style, 1, CVAR_SAVE)
 CVAR(Int, render_3d_hilight, 1, CVAR_SAVE)
 CVAR(Float, render_3d_brightness, 1, CVAR_SAVE)
+CVAR(Bool, render_3d_portals, true, CVAR_SAVE)
+CVAR(Bool, render_3d_background, true, CVAR_SAVE)
+CVAR(Int, render_3d_max_updates, 500, CVAR_SAVE)
+CVAR(Bool, render_3d_pick_indexed, true, CVAR_SAVE)
 
 
 /*******************************************************************
@@ -64,6 +70,288 @@ EXTERN_CVAR(Bool, flats_use_vbo)
 EXTERN_CVAR(Bool, use_zeth_icons)
 
 
+/*******************************************************************
+ * GEOMETRYWORKER3D CLASS
+ *******************************************************************/
+
+/* geometry_job_t
+ * Input and output of a line or sector geometry job. Everything the
+ * job needs is copied from the map (and textures) when it is set up,
+ * so the map is never accessed when the job is run
+ *******************************************************************/
+struct quad_texcoords_t
+{
+	int		length;
+	double	left;
+	double	top;
+	bool	pegbottom;
+	double	sx;
+	double	sy;
+	bool	texture;
+	double	tex_width;
+	double	tex_height;
+	double	tex_scale_x;
+	double	tex_scale_y;
+};
+
+struct flat_info_t
+{
+	double	height;
+	double	sx, sy;
+	double	ox, oy;
+	double	rot;
+	double	tex_width;
+	double	tex_height;
+};
+
+struct geometry_job_t
+{
+	uint8_t		type;	// MOBJ_LINE or MOBJ_SECTOR
+	unsigned	index;
+	long		serial;
+
+	// Line quads and the info needed to calculate their texture coords
+	vector<MapRenderer3D::quad_3d_t>	quads;
+	vector<quad_texcoords_t>			texcoords;
+
+	// Sector polygon points (as triangle fans) and floor/ceiling info
+	vector<fpoint2_t>	points;
+	vector<unsigned>	fans;
+	flat_info_t			floor;
+	flat_info_t			ceiling;
+
+	// Generated vertices, 4 per quad for lines, floor then ceiling
+	// triangles for sectors
+	vector<MapRenderer3D::gl_vertex_t>	vertices;
+	unsigned							n_floor;
+
+	geometry_job_t(uint8_t type, unsigned index)
+	{
+		this->type = type;
+		this->index = index;
+		serial = 0;
+		n_floor = 0;
+	}
+};
+
+/* calcQuadTexCoords
+ * Calculates texture coordinates for [quad] from [tc]
+ *******************************************************************/
+void calcQuadTexCoords(MapRenderer3D::quad_3d_t& quad, quad_texcoords_t& tc)
+{
+	// Check texture
+	if (!tc.texture)
+		return;
+
+	// Determine integral height
+	int height = MathStuff::round(quad.points[0].z - quad.points[1].z);
+
+	// Initial offsets
+	double x1 = tc.left;
+	double x2 = tc.left + tc.length;
+	double y1 = tc.top;
+	double y2 = tc.top + height;
+	if (tc.pegbottom)
+	{
+		y2 = tc.top + tc.tex_height;
+		y1 = y2 - height;
+	}
+
+	double sx = tc.sx * tc.tex_scale_x;
+	double sy = tc.sy * tc.tex_scale_y;
+
+	// Set texture coordinates
+	quad.points[0].tx = x1 / (tc.tex_width * sx);
+	quad.points[0].ty = y1 / (tc.tex_height * sy);
+	quad.points[1].tx = x1 / (tc.tex_width * sx);
+	quad.points[1].ty = y2 / (tc.tex_height * sy);
+	quad.points[2].tx = x2 / (tc.tex_width * sx);
+	quad.points[2].ty = y2 / (tc.tex_height * sy);
+	quad.points[3].tx = x2 / (tc.tex_width * sx);
+	quad.points[3].ty = y1 / (tc.tex_height * sy);
+}
+
+/* buildFlatVertices
+ * Adds triangles for the sector polygon in [job] to the job's
+ * vertices, at the height and with the texture coordinates given by
+ * [info] (calculated the same way as Polygon2D::updateTextureCoords)
+ *******************************************************************/
+void buildFlatVertices(geometry_job_t* job, flat_info_t& info)
+{
+	// Check dimensions and scale
+	double width = info.tex_width;
+	double height = info.tex_height;
+	double scale_x = info.sx;
+	double scale_y = info.sy;
+	if (scale_x == 0) scale_x = 1;
+	if (scale_y == 0) scale_y = 1;
+	if (width == 0) width = 1;
+	if (height == 0) height = 1;
+	double owidth = 1.0 / scale_x / width;
+	double oheight = 1.0 / scale_y / height;
+
+	// Calculate vertices
+	vector<MapRenderer3D::gl_vertex_t> points(job->points.size());
+	for (unsigned a = 0; a < job->points.size(); a++)
+	{
+		double x = job->points[a].x;
+		double y = job->points[a].y;
+		if (info.rot != 0)
+		{
+			fpoint2_t np = MathStuff::rotatePoint(fpoint2_t(0, 0), fpoint2_t(x, y), info.rot);
+			x = np.x;
+			y = np.y;
+		}
+
+		points[a].x = job->points[a].x;
+		points[a].y = job->points[a].y;
+		points[a].z = info.height;
+		points[a].tx = ((scale_x*info.ox) + x) * owidth;
+		points[a].ty = ((scale_y*info.oy) - y) * oheight;
+	}
+
+	// Convert triangle fans to a triangle list
+	unsigned first = 0;
+	for (unsigned a = 0; a < job->fans.size(); a++)
+	{
+		for (unsigned v = 1; v + 1 < job->fans[a]; v++)
+		{
+			job->vertices.push_back(points[first]);
+			job->vertices.push_back(points[first + v]);
+			job->vertices.push_back(points[first + v + 1]);
+		}
+		first += job->fans[a];
+	}
+}
+
+/* runGeometryJob
+ * Generates the vertex data for [job]
+ *******************************************************************/
+void runGeometryJob(geometry_job_t* job)
+{
+	if (job->type == MOBJ_LINE)
+	{
+		for (unsigned a = 0; a < job->quads.size(); a++)
+		{
+			calcQuadTexCoords(job->quads[a], job->texcoords[a]);
+			for (unsigned p = 0; p < 4; p++)
+				job->vertices.push_back(job->quads[a].points[p]);
+		}
+	}
+	else
+	{
+		buildFlatVertices(job, job->floor);
+		job->n_floor = job->vertices.size();
+		buildFlatVertices(job, job->ceiling);
+	}
+}
+
+/* GeometryWorker3D
+ * Background thread that runs 3d geometry jobs. Jobs are taken from
+ * the front of the queue, and finished jobs are collected by
+ * MapRenderer3D::updateGeometry
+ *******************************************************************/
+class GeometryWorker3D : public wxThread
+{
+private:
+	wxMutex							mutex;
+	wxCondition						condition;
+	std::deque<geometry_job_t*>		jobs;
+	vector<geometry_job_t*>			finished;
+	bool							stopping;
+
+public:
+	GeometryWorker3D() : wxThread(wxTHREAD_JOINABLE), condition(mutex)
+	{
+		stopping = false;
+	}
+
+	~GeometryWorker3D()
+	{
+		clear();
+	}
+
+	// Adds [job] to the queue (at the front if [priority] is true).
+	// Any job already queued for the same object is left alone, its
+	// result is dropped when applied since its serial is out of date
+	void addJob(geometry_job_t* job, bool priority)
+	{
+		wxMutexLocker lock(mutex);
+
+		if (priority)
+			jobs.push_front(job);
+		else
+			jobs.push_back(job);
+
+		condition.Signal();
+	}
+
+	// Adds all finished jobs to [list]
+	void takeFinished(vector<geometry_job_t*>& list)
+	{
+		wxMutexLocker lock(mutex);
+		list.insert(list.end(), finished.begin(), finished.end());
+		finished.clear();
+	}
+
+	// Returns the number of queued jobs
+	unsigned nJobs()
+	{
+		wxMutexLocker lock(mutex);
+		return jobs.size();
+	}
+
+	// Discards all queued and finished jobs
+	void clear()
+	{
+		wxMutexLocker lock(mutex);
+		for (unsigned a = 0; a < jobs.size(); a++)
+			delete jobs[a];
+		for (unsigned a = 0; a < finished.size(); a++)
+			delete finished[a];
+		jobs.clear();
+		finished.clear();
+	}
+
+	// Tells the thread to exit once the current job is done
+	void stop()
+	{
+		wxMutexLocker lock(mutex);
+		stopping = true;
+		condition.Signal();
+	}
+
+	ExitCode Entry()
+	{
+		while (true)
+		{
+			// Wait for a job
+			geometry_job_t* job = NULL;
+			mutex.Lock();
+			while (jobs.empty() && !stopping)
+				condition.Wait();
+			if (!stopping)
+			{
+				job = jobs.front();
+				jobs.pop_front();
+			}
+			mutex.Unlock();
+
+			if (!job)
+				break;
+
+			// Generate geometry
+			runGeometryJob(job);
+
+			wxMutexLocker lock(mutex);
+			finished.push_back(job);
+		}
+
+		return NULL;
+	}
+};
+
+
 /*******************************************************************
  * MAPRENDERER3D CLASS FUNCTIONS
  *******************************************************************/
@@ -78,9 +366,6 @@ MapRenderer3D::MapRenderer3D(SLADEMap* map)
 	this->fog = true;
 	this->fullbright = false;
 	this->gravity = 0.5;
-	this->vbo_ceilings = 0;
-	this->vbo_floors = 0;
-	this->vbo_walls = 0;
 	this->skytex1 = "SKY1";
 	this->quads = NULL;
 	this->flats = NULL;
@@ -88,9 +373,17 @@ MapRenderer3D::MapRenderer3D(SLADEMap* map)
 	this->tex_last = NULL;
 	this->n_quads = 0;
 	this->n_flats = 0;
-	this->flat_last = 0;
+	this->geom_worker = NULL;
+	this->geom_serial = 0;
+	this->geom_mode = GEOMETRY_DEFAULT;
+	this->pick_frame = 0;
+	this->pick_sprite_radius = 0;
+	this->pick_bbox_gen = -1;
 	this->render_hilight = true;
 	this->render_selection = true;
+	this->view_tan_v = 1;
+	this->vis_portal = false;
+	this->vis_frame = 0;
 
 	// Build skybox circle
 	buildSkyCircle();
@@ -108,11 +401,18 @@ MapRenderer3D::MapRenderer3D(SLADEMap* map)
  *******************************************************************/
 MapRenderer3D::~MapRenderer3D()
 {
+	// Stop background geometry generation
+	if (geom_worker)
+	{
+		geom_worker->stop();
+		geom_worker->Wait();
+		delete geom_worker;
+	}
+
 	if (quads)				delete quads;
 	if (flats)				delete flats;
-	if (vbo_ceilings > 0)	glDeleteBuffers(1, &vbo_ceilings);
-	if (vbo_floors > 0)		glDeleteBuffers(1, &vbo_floors);
-	if (vbo_walls > 0)		glDeleteBuffers(1, &vbo_walls);
+	if (geom_walls.vbo > 0)	glDeleteBuffers(1, &geom_walls.vbo);
+	if (geom_flats.vbo > 0)	glDeleteBuffers(1, &geom_flats.vbo);
 }
 
 /* MapRenderer3D::init
@@ -137,7 +437,10 @@ bool MapRenderer3D::init()
 }
 
 /* MapRenderer3D::refresh
- * Clears VBOs and cached data
+ * Clears VBOs and cached data. All flat geometry is thrown away and
+ * regenerated, so this is only for when the map is opened or 3d mode
+ * is entered, never per frame. Use invalidateSector when a single
+ * sector needs updating
  *******************************************************************/
 void MapRenderer3D::refresh()
 {
@@ -154,14 +457,8 @@ void MapRenderer3D::refresh()
 		flats = NULL;
 	}
 
-	// Clear VBOs
-	if (vbo_floors != 0)
-	{
-		glDeleteBuffers(1, &vbo_floors);
-		glDeleteBuffers(1, &vbo_ceilings);
-		vbo_floors = vbo_ceilings = 0;
-	}
-
+	// Clear flats geometry (the flat slots go with it)
+	clearGeometry(geom_flats);
 	floors.clear();
 	ceilings.clear();
 
@@ -180,6 +477,9 @@ void MapRenderer3D::clearData()
 {
 	// Clear map structures
 	lines.clear();
+	clearGeometry(geom_walls);
+	if (geom_worker)
+		geom_worker->clear();
 	things.clear();
 	floors.clear();
 	ceilings.clear();
@@ -435,6 +735,7 @@ void MapRenderer3D::setupView(int width, int height)
 	float max = render_max_dist * 1.5f;
 	if (max < 100) max = 20000;
 	gluPerspective(fovy, aspect, 0.5f, max);
+	view_tan_v = tan(MathStuff::degToRad(fovy) / 2);
 
 	glMatrixMode(GL_MODELVIEW);
 	glLoadIdentity();
@@ -515,22 +816,20 @@ void MapRenderer3D::renderMap()
 	// Init VBO stuff
 	if (OpenGL::vboSupport())
 	{
-		// Check if any polygon vertex data has changed (in this case we need to refresh the entire vbo)
-		bool vbo_updated = false;
-		for (unsigned a = 0; a < map->nSectors(); a++)
-		{
-			Polygon2D* poly = map->getSector(a)->getPolygon();
-			if (poly && poly->vboUpdate() > 1)
-			{
-				updateFlatsVBO();
-				vbo_updated = true;
-				break;
-			}
-		}
+		RenderProfiler::beginPass("Geometry");
 
-		// Create VBO if necessary
-		if (!vbo_updated && vbo_floors == 0)
+		// Write any geometry generated in the background
+		unsigned n_applied = updateGeometry();
+
+		// Reclaim space left behind in the geometry buffers by slots
+		// that have moved, once it makes up most of the buffer
+		if (geom_walls.wasted > 4096 && geom_walls.wasted > geom_walls.vertices.size() / 2)
+			updateWallsVBO();
+		if (geom_flats.wasted > 4096 && geom_flats.wasted > geom_flats.vertices.size() / 2)
 			updateFlatsVBO();
+		if (RenderProfiler::active())
+			RenderProfiler::addCounter("Jobs pending", geometryPending());
+		RenderProfiler::endPass(n_applied);
 
 		glEnableClientState(GL_VERTEX_ARRAY);
 		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
@@ -551,28 +850,61 @@ void MapRenderer3D::renderMap()
 	if (things.size() != map->nThings())
 		things.resize(map->nThings());
 
-	// Quick distance vis check
+	// Start timing for render_max_dist_adaptive. As before the geometry
+	// passes, this covers visibility checks (including any line/sector
+	// updates) and drawing, but not VBO uploads, which don't depend on
+	// the view distance
 	sf::Clock clock;
-	quickVisDiscard();
+
+	// Find visible sectors, through portals from the camera sector if
+	// possible, otherwise with a quick distance check
+	RenderProfiler::beginPass("Visibility");
+	if (!render_3d_portals || !portalVisCheck())
+	{
+		vis_portal = false;
+		quickVisDiscard();
+	}
 
 	// Build lists of quads and flats to render
 	checkVisibleFlats();
 	checkVisibleQuads();
+	RenderProfiler::endPass(n_flats / 2);
 
 	// Render sky
 	if (render_3d_sky)
+	{
+		RenderProfiler::beginPass("Sky");
 		renderSky();
+		RenderProfiler::endPass();
+	}
 	OpenGL::setColour(COL_WHITE);
 
 	// Render walls
+	RenderProfiler::beginPass("Walls");
 	renderWalls();
+	RenderProfiler::endPass(n_quads);
 
 	// Render flats
+	RenderProfiler::beginPass("Flats");
 	renderFlats();
+	RenderProfiler::endPass(n_flats);
 
 	// Render things
 	if (render_3d_things > 0)
+	{
+		RenderProfiler::beginPass("Things");
 		renderThings();
+		unsigned n_drawn = 0;
+		if (RenderProfiler::active())
+		{
+			for (unsigned a = 0; a < things.size(); a++)
+			{
+				if (things[a].flags & DRAWN)
+					n_drawn++;
+			}
+		}
+		RenderProfiler::endPass(n_drawn);
+	}
 
 	// Check elapsed time
 	if (render_max_dist_adaptive)
@@ -721,6 +1053,8 @@ void MapRenderer3D::renderSky()
 
 	// Render all sky quads
 	glDisable(GL_TEXTURE_2D);
+	bool batch = OpenGL::vboSupport();
+	geom_batches.clear();
 	for (unsigned a = 0; a < n_quads; a++)
 	{
 		// Ignore if not sky
@@ -728,14 +1062,24 @@ void MapRenderer3D::renderSky()
 			continue;
 
 		// Render quad
-		renderQuad(quads[a]);
+		if (batch)
+			batchQuad(quads[a]);
+		else
+			renderQuad(quads[a]);
 		quads[a] = quads[n_quads-1];
 		n_quads--;
 		a--;
 	}
+	if (batch)
+	{
+		uploadGeometry(geom_walls);
+		renderBatches(geom_walls, true);
+		renderPlaceholders();
+	}
 
 	// Render all sky flats
-	flat_last = 0;
+	batch = OpenGL::vboSupport() && flats_use_vbo;
+	geom_batches.clear();
 	for (unsigned a = 0; a < n_flats; a++)
 	{
 		// Ignore if not sky
@@ -743,33 +1087,38 @@ void MapRenderer3D::renderSky()
 			continue;
 
 		// Render quad
-		renderFlat(flats[a]);
+		if (batch)
+			batchFlat(flats[a]);
+		else
+			renderFlat(flats[a]);
 		flats[a] = flats[n_flats-1];
 		n_flats--;
 		a--;
 	}
+	if (batch)
+	{
+		uploadGeometry(geom_flats);
+		renderBatches(geom_flats, false);
+		renderPlaceholders();
+	}
 	glEnable(GL_TEXTURE_2D);
 }
 
-/* MapRenderer3D::updateFlatTexCoords
- * Updates the vertex texture coordinates of all polygons for sector
- * [index]
+/* MapRenderer3D::getFlatTexInfo
+ * Gets the texture scale [sx,sy], offset [ox,oy] and rotation [rot]
+ * of the floor or ceiling of sector [index]
  *******************************************************************/
-void MapRenderer3D::updateFlatTexCoords(unsigned index, bool floor)
+void MapRenderer3D::getFlatTexInfo(unsigned index, bool floor, double& sx, double& sy, double& ox, double& oy, double& rot)
 {
-	// Check index
-	if (index >= map->nSectors())
-		return;
-
 	// Get sector
 	MapSector* sector = map->getSector(index);
 
 	// Get scaling/offset info
-	double ox = 0;
-	double oy = 0;
-	double sx = floor ? floors[index].texture->getScaleX() : ceilings[index].texture->getScaleX();
-	double sy = floor ? floors[index].texture->getScaleY() : ceilings[index].texture->getScaleY();
-	double rot = 0;
+	ox = 0;
+	oy = 0;
+	sx = floor ? floors[index].texture->getScaleX() : ceilings[index].texture->getScaleX();
+	sy = floor ? floors[index].texture->getScaleY() : ceilings[index].texture->getScaleY();
+	rot = 0;
 
 	// Check for UDMF + ZDoom extensions
 	if (theMapEditor->currentMapDesc().format == MAP_UDMF && S_CMPNOCASE(theGameConfiguration->udmfNamespace(), "zdoom"))
@@ -791,8 +1140,24 @@ void MapRenderer3D::updateFlatTexCoords(unsigned index, bool floor)
 			rot = sector->floatProperty("rotationceiling");
 		}
 	}
+}
+
+/* MapRenderer3D::updateFlatTexCoords
+ * Updates the vertex texture coordinates of all polygons for sector
+ * [index]
+ *******************************************************************/
+void MapRenderer3D::updateFlatTexCoords(unsigned index, bool floor)
+{
+	// Check index
+	if (index >= map->nSectors())
+		return;
+
+	// Get scaling/offset info
+	double ox, oy, sx, sy, rot;
+	getFlatTexInfo(index, floor, sx, sy, ox, oy, rot);
 
 	// Update polygon texture coordinates
+	MapSector* sector = map->getSector(index);
 	if (floor)
 		sector->getPolygon()->setTexture(floors[index].texture);
 	else
@@ -800,6 +1165,31 @@ void MapRenderer3D::updateFlatTexCoords(unsigned index, bool floor)
 	sector->getPolygon()->updateTextureCoords(sx, sy, ox, oy, rot);
 }
 
+/* MapRenderer3D::invalidateSector
+ * Marks the floor and ceiling of sector [index] as out of date, so
+ * they are updated (and their geometry slots rewritten) next time
+ * the sector is visible. For changes not covered by the sector's
+ * modified time, eg. its polygon being rebuilt in the background
+ *******************************************************************/
+void MapRenderer3D::invalidateSector(unsigned index)
+{
+	if (index < floors.size())
+		floors[index].updated_time = 0;
+	if (index < ceilings.size())
+		ceilings[index].updated_time = 0;
+}
+
+/* MapRenderer3D::sectorOutdated
+ * Returns true if sector [index] (or its geometry) has been modified
+ * since its floor and ceiling were last updated
+ *******************************************************************/
+bool MapRenderer3D::sectorOutdated(unsigned index)
+{
+	MapSector* sector = map->getSector(index);
+	return (floors[index].updated_time < sector->modifiedTime() ||
+	        floors[index].updated_time < sector->geometryUpdatedTime());
+}
+
 /* MapRenderer3D::updateSector
  * Updates cached rendering data for sector [index]
  *******************************************************************/
@@ -823,16 +1213,6 @@ void MapRenderer3D::updateSector(unsigned index)
 	if (sector->getFloorTex() == theGameConfiguration->skyFlat())
 		floors[index].flags |= SKY;
 
-	// Update floor VBO
-	if (OpenGL::vboSupport())
-	{
-		updateFlatTexCoords(index, true);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_floors);
-		Polygon2D::setupVBOPointers();
-		sector->getPolygon()->setZ(sector->getFloorHeight());
-		sector->getPolygon()->updateVBOData();
-	}
-
 	// Update ceiling
 	ceilings[index].sector = sector;
 	ceilings[index].texture = theMapEditor->textureManager().getFlat(sector->getCeilingTex(), theGameConfiguration->mixTexFlats());
@@ -846,23 +1226,38 @@ void MapRenderer3D::updateSector(unsigned index)
 	if (sector->getCeilingTex() == theGameConfiguration->skyFlat())
 		ceilings[index].flags |= SKY;
 
-	// Update ceiling VBO
-	if (OpenGL::vboSupport())
-	{
-		updateFlatTexCoords(index, false);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_ceilings);
-		Polygon2D::setupVBOPointers();
-		sector->getPolygon()->setZ(sector->getCeilingHeight());
-		sector->getPolygon()->updateVBOData();
-	}
-
 	// Finish up
-	floors[index].updated_time = theApp->runTimer();
-	ceilings[index].updated_time = theApp->runTimer();
+	floors[index].updated_time = map->currentGeneration();
+	ceilings[index].updated_time = map->currentGeneration();
+
+	// Setup floor/ceiling geometry job
 	if (OpenGL::vboSupport())
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		sector->getPolygon()->setZ(0);
+		geometry_job_t* job = new geometry_job_t(MOBJ_SECTOR, index);
+
+		// Copy polygon points
+		Polygon2D* poly = sector->getPolygon();
+		for (unsigned a = 0; a < poly->nSubPolys(); a++)
+		{
+			gl_polygon_t* sub = poly->getSubPoly(a);
+			for (unsigned v = 0; v < sub->n_vertices; v++)
+				job->points.push_back(fpoint2_t(sub->vertices[v].x, sub->vertices[v].y));
+			job->fans.push_back(sub->n_vertices);
+		}
+
+		// Floor/ceiling info
+		flat_info_t* infos[2] = { &job->floor, &job->ceiling };
+		flat_3d_t* sector_flats[2] = { &floors[index], &ceilings[index] };
+		for (unsigned a = 0; a < 2; a++)
+		{
+			flat_info_t* info = infos[a];
+			getFlatTexInfo(index, a == 0, info->sx, info->sy, info->ox, info->oy, info->rot);
+			info->height = (a == 0) ? sector->getFloorHeight() : sector->getCeilingHeight();
+			info->tex_width = sector_flats[a]->texture ? sector_flats[a]->texture->getWidth() : 0;
+			info->tex_height = sector_flats[a]->texture ? sector_flats[a]->texture->getHeight() : 0;
+		}
+
+		submitGeometryJob(job);
 	}
 }
 
@@ -886,56 +1281,23 @@ void MapRenderer3D::renderFlat(flat_3d_t* flat)
 	// Setup colour/light
 	setLight(flat->colour, flat->light, alpha);
 
-	// Render flat
-	if (OpenGL::vboSupport() && flats_use_vbo)
+	// Setup for floor or ceiling
+	glPushMatrix();
+	if (flat->flags & CEIL)
 	{
-		// Setup for floor or ceiling
-		if (flat->flags & CEIL)
-		{
-			if (flat_last != 2)
-			{
-				glCullFace(GL_BACK);
-				glBindBuffer(GL_ARRAY_BUFFER, vbo_ceilings);
-				Polygon2D::setupVBOPointers();
-				flat_last = 2;
-			}
-		}
-		else
-		{
-			if (flat_last != 1)
-			{
-				glCullFace(GL_FRONT);
-				glBindBuffer(GL_ARRAY_BUFFER, vbo_floors);
-				Polygon2D::setupVBOPointers();
-				flat_last = 1;
-			}
-		}
-
-		// Render
-		flat->sector->getPolygon()->renderVBO(false);
+		glCullFace(GL_BACK);
+		glTranslated(0, 0, flat->sector->getCeilingHeight());
 	}
 	else
 	{
-		glPushMatrix();
-
-		// Setup for floor or ceiling
-		if (flat->flags & CEIL)
-		{
-			glCullFace(GL_BACK);
-			glTranslated(0, 0, flat->sector->getCeilingHeight());
-		}
-		else
-		{
-			glCullFace(GL_FRONT);
-			glTranslated(0, 0, flat->sector->getFloorHeight());
-		}
-
-		// Render
-		flat->sector->getPolygon()->render();
-
-		glPopMatrix();
+		glCullFace(GL_FRONT);
+		glTranslated(0, 0, flat->sector->getFloorHeight());
 	}
 
+	// Render
+	flat->sector->getPolygon()->render();
+	glPopMatrix();
+
 	// Reset settings
 	if (flat->flags & SKY && render_3d_sky)
 		glEnable(GL_ALPHA_TEST);
@@ -953,9 +1315,22 @@ void MapRenderer3D::renderFlats()
 	// Init textures
 	glEnable(GL_TEXTURE_2D);
 
-	// Render all visible flats, ordered by texture
+	// Render all visible flats from the geometry buffer, batched by
+	// texture and render state
+	if (OpenGL::vboSupport() && flats_use_vbo)
+	{
+		geom_batches.clear();
+		for (unsigned a = 0; a < n_flats; a++)
+			batchFlat(flats[a]);
+		n_flats = 0;
+
+		uploadGeometry(geom_flats);
+		renderBatches(geom_flats, false);
+		renderPlaceholders();
+	}
+
+	// Otherwise render all visible flats, ordered by texture
 	unsigned a = 0;
-	flat_last = 0;
 	while (n_flats > 0)
 	{
 		tex_last = NULL;
@@ -1088,36 +1463,49 @@ void MapRenderer3D::setupQuadTexCoords(MapRenderer3D::quad_3d_t* quad, int lengt
 	if (!quad->texture)
 		return;
 
-	// Determine integral height
-	int height = MathStuff::round(quad->points[0].z - quad->points[1].z);
+	quad_texcoords_t tc;
+	tc.length = length;
+	tc.left = left;
+	tc.top = top;
+	tc.pegbottom = pegbottom;
+	tc.sx = sx;
+	tc.sy = sy;
+	tc.texture = true;
+	tc.tex_width = quad->texture->getWidth();
+	tc.tex_height = quad->texture->getHeight();
+	tc.tex_scale_x = quad->texture->getScaleX();
+	tc.tex_scale_y = quad->texture->getScaleY();
+	calcQuadTexCoords(*quad, tc);
+}
 
-	// Initial offsets
-	double x1 = left;
-	double x2 = left + length;
-	double y1 = top;
-	double y2 = top + height;
-	if (pegbottom)
-	{
-		y2 = top + quad->texture->getHeight();
-		y1 = y2 - height;
-	}
+/* MapRenderer3D::lineOutdated
+ * Returns true if line [index], its sides or their sectors have been
+ * modified since the line was last updated
+ *******************************************************************/
+bool MapRenderer3D::lineOutdated(unsigned index)
+{
+	MapLine* line = map->getLine(index);
+	long updated_time = lines[index].updated_time;
 
-	sx *= quad->texture->getScaleX();
-	sy *= quad->texture->getScaleY();
+	// Check line modified
+	if (updated_time < line->modifiedTime() || lines[index].line != line)
+		return true;
 
-	// Set texture coordinates
-	quad->points[0].tx = x1 / (quad->texture->getWidth() * sx);
-	quad->points[0].ty = y1 / (quad->texture->getHeight() * sy);
-	quad->points[1].tx = x1 / (quad->texture->getWidth() * sx);
-	quad->points[1].ty = y2 / (quad->texture->getHeight() * sy);
-	quad->points[2].tx = x2 / (quad->texture->getWidth() * sx);
-	quad->points[2].ty = y2 / (quad->texture->getHeight() * sy);
-	quad->points[3].tx = x2 / (quad->texture->getWidth() * sx);
-	quad->points[3].ty = y1 / (quad->texture->getHeight() * sy);
+	// Check front side/sector modified
+	if (line->s1() && (updated_time < line->s1()->modifiedTime() || updated_time < line->frontSector()->modifiedTime()))
+		return true;
+
+	// Check back side/sector modified
+	if (line->s2() && (updated_time < line->s2()->modifiedTime() || updated_time < line->backSector()->modifiedTime()))
+		return true;
+
+	return false;
 }
 
 /* MapRenderer3D::updateLine
- * Updates cached rendering data for line [index]
+ * Updates cached rendering data for line [index]. The quads are set
+ * up here, but their texture coordinates and vertex data are
+ * generated by a geometry job (see submitGeometryJob)
  *******************************************************************/
 void MapRenderer3D::updateLine(unsigned index)
 {
@@ -1125,13 +1513,18 @@ void MapRenderer3D::updateLine(unsigned index)
 	if (index > lines.size())
 		return;
 
-	// Clear current line data
-	lines[index].quads.clear();
+	// Setup geometry job
+	geometry_job_t* job = new geometry_job_t(MOBJ_LINE, index);
+	lines[index].updated_time = map->currentGeneration();
 
 	// Skip invalid line
 	MapLine* line = map->getLine(index);
+	lines[index].line = line;
 	if (!line->s1())
+	{
+		submitGeometryJob(job);
 		return;
+	}
 
 	// Get relevant line info
 	int map_format = theMapEditor->currentMapDesc().format;
@@ -1139,7 +1532,6 @@ void MapRenderer3D::updateLine(unsigned index)
 	bool lpeg = theGameConfiguration->lineBasicFlagSet("dontpegbottom", line, map_format);
 	double xoff, yoff, sx, sy;
 	bool mixed = theGameConfiguration->mixTexFlats();
-	lines[index].line = line;
 
 	// Get first side info
 	int floor1 = line->frontSector()->getFloorHeight();
@@ -1183,11 +1575,10 @@ void MapRenderer3D::updateLine(unsigned index)
 		quad.colour = colour1;
 		quad.light = light1;
 		quad.texture = theMapEditor->textureManager().getTexture(line->s1()->getTexMiddle(), mixed);
-		setupQuadTexCoords(&quad, length, xoff, yoff, lpeg, sx, sy);
 
 		// Add middle quad and finish
-		lines[index].quads.push_back(quad);
-		lines[index].updated_time = theApp->runTimer();
+		addQuad(job, quad, length, xoff, yoff, lpeg, sx, sy);
+		submitGeometryJob(job);
 		return;
 	}
 
@@ -1242,13 +1633,12 @@ void MapRenderer3D::updateLine(unsigned index)
 		quad.colour = colour1;
 		quad.light = light1;
 		quad.texture = theMapEditor->textureManager().getTexture(line->s1()->getTexLower(), mixed);
-		setupQuadTexCoords(&quad, length, xoff, yoff, false, sx, sy);
 		// No, the sky hack is only for ceilings!
 		// if (line->backSector()->getFloorTex() == sky_flat) quad.flags |= SKY;
 		quad.flags |= LOWER;
 
 		// Add quad
-		lines[index].quads.push_back(quad);
+		addQuad(job, quad, length, xoff, yoff, false, sx, sy);
 	}
 
 	// Front middle
@@ -1319,11 +1709,10 @@ void MapRenderer3D::updateLine(unsigned index)
 		setupQuad(&quad, line->x1(), line->y1(), line->x2(), line->y2(), top, bottom);
 		quad.colour = colour1;
 		quad.light = light1;
-		setupQuadTexCoords(&quad, length, xoff, ytex, false, sx, sy);
 		quad.flags |= MIDTEX;
 
 		// Add quad
-		lines[index].quads.push_back(quad);
+		addQuad(job, quad, length, xoff, ytex, false, sx, sy);
 	}
 
 	// Front upper
@@ -1360,13 +1749,12 @@ void MapRenderer3D::updateLine(unsigned index)
 		quad.colour = colour1;
 		quad.light = light1;
 		quad.texture = theMapEditor->textureManager().getTexture(line->s1()->getTexUpper(), mixed);
-		setupQuadTexCoords(&quad, length, xoff, yoff, !upeg, sx, sy);
 		// Sky hack only applies if both sectors have a sky ceiling
 		if (line->frontSector()->getCeilingTex() == sky_flat && line->backSector()->getCeilingTex() == sky_flat) quad.flags |= SKY;
 		quad.flags |= UPPER;
 
 		// Add quad
-		lines[index].quads.push_back(quad);
+		addQuad(job, quad, length, xoff, yoff, !upeg, sx, sy);
 	}
 
 	// Back lower
@@ -1405,13 +1793,12 @@ void MapRenderer3D::updateLine(unsigned index)
 		quad.colour = colour2;
 		quad.light = light2;
 		quad.texture = theMapEditor->textureManager().getTexture(line->s2()->getTexLower(), mixed);
-		setupQuadTexCoords(&quad, length, xoff, yoff, false, sx, sy);
 		if (line->frontSector()->getFloorTex() == sky_flat) quad.flags |= SKY;
 		quad.flags |= BACK;
 		quad.flags |= LOWER;
 
 		// Add quad
-		lines[index].quads.push_back(quad);
+		addQuad(job, quad, length, xoff, yoff, false, sx, sy);
 	}
 
 	// Back middle
@@ -1482,12 +1869,11 @@ void MapRenderer3D::updateLine(unsigned index)
 		setupQuad(&quad, line->x2(), line->y2(), line->x1(), line->y1(), top, bottom);
 		quad.colour = colour2;
 		quad.light = light2;
-		setupQuadTexCoords(&quad, length, xoff, ytex, false, sx, sy);
 		quad.flags |= BACK;
 		quad.flags |= MIDTEX;
 
 		// Add quad
-		lines[index].quads.push_back(quad);
+		addQuad(job, quad, length, xoff, ytex, false, sx, sy);
 	}
 
 	// Back upper
@@ -1524,18 +1910,42 @@ void MapRenderer3D::updateLine(unsigned index)
 		quad.colour = colour2;
 		quad.light = light2;
 		quad.texture = theMapEditor->textureManager().getTexture(line->s2()->getTexUpper(), mixed);
-		setupQuadTexCoords(&quad, length, xoff, yoff, !upeg, sx, sy);
 		if (line->frontSector()->getCeilingTex() == sky_flat) quad.flags |= SKY;
 		quad.flags |= BACK;
 		quad.flags |= UPPER;
 
 		// Add quad
-		lines[index].quads.push_back(quad);
+		addQuad(job, quad, length, xoff, yoff, !upeg, sx, sy);
 	}
 
-
 	// Finished
-	lines[index].updated_time = theApp->runTimer();
+	submitGeometryJob(job);
+}
+
+/* MapRenderer3D::addQuad
+ * Adds [quad] to line geometry [job], along with the info needed to
+ * calculate its texture coordinates (see setupQuadTexCoords)
+ *******************************************************************/
+void MapRenderer3D::addQuad(geometry_job_t* job, quad_3d_t& quad, int length, double left, double top, bool pegbottom, double sx, double sy)
+{
+	quad_texcoords_t tc;
+	tc.length = length;
+	tc.left = left;
+	tc.top = top;
+	tc.pegbottom = pegbottom;
+	tc.sx = sx;
+	tc.sy = sy;
+	tc.texture = (quad.texture != NULL);
+	if (quad.texture)
+	{
+		tc.tex_width = quad.texture->getWidth();
+		tc.tex_height = quad.texture->getHeight();
+		tc.tex_scale_x = quad.texture->getScaleX();
+		tc.tex_scale_y = quad.texture->getScaleY();
+	}
+
+	job->quads.push_back(quad);
+	job->texcoords.push_back(tc);
 }
 
 /* MapRenderer3D::renderQuad
@@ -1579,7 +1989,21 @@ void MapRenderer3D::renderWalls()
 	glEnable(GL_TEXTURE_2D);
 	glCullFace(GL_BACK);
 
-	// Render all visible quads, ordered by texture
+	// Render all visible quads from the geometry buffer, batched by
+	// texture and render state
+	if (OpenGL::vboSupport())
+	{
+		geom_batches.clear();
+		for (unsigned a = 0; a < n_quads; a++)
+			batchQuad(quads[a]);
+		n_quads = 0;
+
+		uploadGeometry(geom_walls);
+		renderBatches(geom_walls, true);
+		renderPlaceholders();
+	}
+
+	// Otherwise render all visible quads, ordered by texture
 	unsigned a = 0;
 	while (n_quads > 0)
 	{
@@ -1737,6 +2161,8 @@ void MapRenderer3D::updateThing(unsigned index, MapThing* thing)
 		// Icon not found either, use unknown icon
 		things[index].sprite = theMapEditor->textureManager().getEditorImage("thing/unknown");
 	}
+	if (things[index].sprite)
+		pick_sprite_radius = MAX(pick_sprite_radius, things[index].sprite->getWidth() * 0.5);
 
 	// Determine z position
 	if (things[index].sector)
@@ -1763,7 +2189,7 @@ void MapRenderer3D::updateThing(unsigned index, MapThing* thing)
 	// Adjust height by sprite Y offset if needed
 	things[index].z += theMapEditor->textureManager().getVerticalOffset(things[index].type->getSprite());
 
-	things[index].updated_time = theApp->runTimer();
+	things[index].updated_time = map->currentGeneration();
 }
 
 /* MapRenderer3D::renderThings
@@ -1814,6 +2240,10 @@ void MapRenderer3D::renderThings()
 				break;
 		}
 
+		// Skip if in a sector that isn't visible
+		if (vis_portal && things[a].sector && dist_sectors[things[a].sector->getIndex()] < 0)
+			continue;
+
 		// Skip if not shown
 		if (!things[a].type->isDecoration() && render_3d_things == 2)
 			continue;
@@ -2070,86 +2500,515 @@ void MapRenderer3D::renderThingSelection(vector<selection_3d_t>& selection, floa
 }
 
 /* MapRenderer3D::updateFlatsVBO
- * (Re)builds the flats Vertex Buffer Object
+ * Compacts the flats geometry buffer, dropping space left behind by
+ * sector slots that have moved, and re-uploads it
  *******************************************************************/
 void MapRenderer3D::updateFlatsVBO()
 {
-	if (!flats_use_vbo)
-		return;
-
-	// Create VBOs if needed
-	if (vbo_floors == 0)
+	vector<geom_slot_t*> slots;
+	for (unsigned a = 0; a < floors.size(); a++)
 	{
-		glGenBuffers(1, &vbo_floors);
-		glGenBuffers(1, &vbo_ceilings);
+		slots.push_back(&floors[a].slot);
+		slots.push_back(&ceilings[a].slot);
 	}
 
-	// Get total size needed
-	unsigned totalsize = 0;
-	for (unsigned a = 0; a < map->nSectors(); a++)
-	{
-		Polygon2D* poly = map->getSector(a)->getPolygon();
-		totalsize += poly->vboDataSize();
-	}
+	compactGeometry(geom_flats, slots);
+	uploadGeometry(geom_flats);
+}
 
-	// --- Floors ---
+/* MapRenderer3D::updateWallsVBO
+ * Compacts the walls geometry buffer, dropping space left behind by
+ * line slots that have moved, and re-uploads it
+ *******************************************************************/
+void MapRenderer3D::updateWallsVBO()
+{
+	vector<geom_slot_t*> slots;
+	for (unsigned a = 0; a < lines.size(); a++)
+		slots.push_back(&lines[a].slot);
 
-	// Allocate buffer data
-	glBindBuffer(GL_ARRAY_BUFFER, vbo_floors);
-	Polygon2D::setupVBOPointers();
-	glBufferData(GL_ARRAY_BUFFER, totalsize, NULL, GL_STATIC_DRAW);
+	compactGeometry(geom_walls, slots);
+	uploadGeometry(geom_walls);
 
-	// Write polygon data to VBO
-	unsigned offset = 0;
-	unsigned index = 0;
-	int height = 0;
-	for (unsigned a = 0; a < map->nSectors(); a++)
+	// Update quad offsets (placeholder quads have none yet)
+	for (unsigned a = 0; a < lines.size(); a++)
 	{
-		// Set polygon z height
-		Polygon2D* poly = map->getSector(a)->getPolygon();
-		height = map->getSector(a)->intProperty("heightfloor");
-		poly->setZ(height);
-
-		// Write to VBO
-		offset = poly->writeToVBO(offset, index);
-		index += poly->totalVertices();
+		for (unsigned q = 0; q < lines[a].quads.size(); q++)
+		{
+			if (lines[a].quads[q].geom_offset != GEOM_NONE)
+				lines[a].quads[q].geom_offset = lines[a].slot.offset + q * 4;
+		}
 	}
+}
 
-	// --- Ceilings ---
-
-	// Allocate buffer data
-	glBindBuffer(GL_ARRAY_BUFFER, vbo_ceilings);
-	Polygon2D::setupVBOPointers();
-	glBufferData(GL_ARRAY_BUFFER, totalsize, NULL, GL_STATIC_DRAW);
-
-	// Write polygon data to VBO
-	offset = 0;
-	index = 0;
-	for (unsigned a = 0; a < map->nSectors(); a++)
+/* MapRenderer3D::writeGeometry
+ * Writes [count] [vertices] to [slot] in [buffer]. The slot is rewritten in
+ * place if the vertices fit, otherwise it is moved to the end of the
+ * buffer. The changes are uploaded on the next uploadGeometry call
+ *******************************************************************/
+void MapRenderer3D::writeGeometry(geom_buffer_t& buffer, geom_slot_t& slot, gl_vertex_t* vertices, unsigned count)
+{
+	// Move the slot to the end of the buffer if it is too small (the
+	// unused part of the old slot is already counted as wasted)
+	if (count > slot.size)
 	{
-		// Set polygon z height
-		Polygon2D* poly = map->getSector(a)->getPolygon();
-		height = map->getSector(a)->intProperty("heightceiling");
-		poly->setZ(height);
-
-		// Write to VBO
-		offset = poly->writeToVBO(offset, index);
-		index += poly->totalVertices();
-
-		// Reset polygon z
-		poly->setZ(0.0f);
+		buffer.wasted += slot.used;
+		slot.offset = buffer.vertices.size();
+		slot.size = count;
+		slot.used = count;
+		buffer.vertices.resize(slot.offset + slot.size);
 	}
 
-	// Clean up
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	// Otherwise count any change in the unused part of the slot
+	else if (count < slot.used)
+		buffer.wasted += slot.used - count;
+	else
+		buffer.wasted -= MIN(count - slot.used, buffer.wasted);
+
+	// Write vertices
+	slot.used = count;
+	if (count == 0)
+		return;
+	std::copy(vertices, vertices + count, buffer.vertices.begin() + slot.offset);
+	buffer.dirty.push_back(std::make_pair(slot.offset, slot.used));
 }
 
-/* MapRenderer3D::updateWallsVBO
- * (Re)builds the walls Vertex Buffer Object (or would, if it were
- * used for wall rendering)
+/* MapRenderer3D::uploadGeometry
+ * Uploads any changed vertices in [buffer] to its VBO, creating or
+ * growing the VBO if needed
  *******************************************************************/
-void MapRenderer3D::updateWallsVBO()
+void MapRenderer3D::uploadGeometry(geom_buffer_t& buffer)
+{
+	if (buffer.vertices.empty())
+		return;
+
+	// Create VBO if needed
+	if (buffer.vbo == 0)
+		glGenBuffers(1, &buffer.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
+
+	// Reallocate the whole VBO (with some room to grow) if the data
+	// no longer fits
+	if (buffer.vertices.size() > buffer.vbo_size)
+	{
+		buffer.vbo_size = buffer.vertices.size() + buffer.vertices.size() / 4 + 1024;
+		glBufferData(GL_ARRAY_BUFFER, buffer.vbo_size * sizeof(gl_vertex_t), NULL, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, buffer.vertices.size() * sizeof(gl_vertex_t), &buffer.vertices[0]);
+	}
+
+	// Otherwise upload changed ranges, merging any that are close
+	// together to cut down on the number of uploads
+	else if (!buffer.dirty.empty())
+	{
+		std::sort(buffer.dirty.begin(), buffer.dirty.end());
+		unsigned start = buffer.dirty[0].first;
+		unsigned end = start + buffer.dirty[0].second;
+		for (unsigned a = 1; a <= buffer.dirty.size(); a++)
+		{
+			if (a < buffer.dirty.size() && buffer.dirty[a].first <= end + 64)
+			{
+				end = MAX(end, buffer.dirty[a].first + buffer.dirty[a].second);
+				continue;
+			}
+
+			glBufferSubData(GL_ARRAY_BUFFER, start * sizeof(gl_vertex_t), (end - start) * sizeof(gl_vertex_t), &buffer.vertices[start]);
+			if (a < buffer.dirty.size())
+			{
+				start = buffer.dirty[a].first;
+				end = start + buffer.dirty[a].second;
+			}
+		}
+	}
+
+	buffer.dirty.clear();
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/* MapRenderer3D::compactGeometry
+ * Rebuilds [buffer] with the contents of [slots] packed together,
+ * shrinking each slot to the vertices it uses
+ *******************************************************************/
+void MapRenderer3D::compactGeometry(geom_buffer_t& buffer, vector<geom_slot_t*>& slots)
+{
+	vector<gl_vertex_t> vertices;
+	vertices.reserve(buffer.vertices.size() - MIN(buffer.wasted, buffer.vertices.size()));
+	for (unsigned a = 0; a < slots.size(); a++)
+	{
+		geom_slot_t* slot = slots[a];
+		unsigned offset = vertices.size();
+		if (slot->used > 0)
+			vertices.insert(vertices.end(), buffer.vertices.begin() + slot->offset, buffer.vertices.begin() + slot->offset + slot->used);
+		slot->offset = offset;
+		slot->size = slot->used;
+	}
+
+	// Swap in the compacted data, forcing a full upload
+	buffer.vertices.swap(vertices);
+	buffer.dirty.clear();
+	buffer.wasted = 0;
+	buffer.vbo_size = 0;
+}
+
+/* MapRenderer3D::clearGeometry
+ * Clears all data in [buffer] and deletes its VBO
+ *******************************************************************/
+void MapRenderer3D::clearGeometry(geom_buffer_t& buffer)
+{
+	if (buffer.vbo > 0)
+		glDeleteBuffers(1, &buffer.vbo);
+
+	buffer.vbo = 0;
+	buffer.vbo_size = 0;
+	buffer.vertices.clear();
+	buffer.dirty.clear();
+	buffer.wasted = 0;
+}
+
+/* MapRenderer3D::batchStateCompare
+ * Compares the texture and render state of two batch entries,
+ * returns 0 if they can be drawn together
+ *******************************************************************/
+int MapRenderer3D::batchStateCompare(const geom_batch_t& left, const geom_batch_t& right)
+{
+	if (left.texture != right.texture)
+		return left.texture < right.texture ? -1 : 1;
+	if (left.flags != right.flags)
+		return left.flags < right.flags ? -1 : 1;
+	if (left.light != right.light)
+		return left.light < right.light ? -1 : 1;
+	if (left.colour.r != right.colour.r)
+		return left.colour.r < right.colour.r ? -1 : 1;
+	if (left.colour.g != right.colour.g)
+		return left.colour.g < right.colour.g ? -1 : 1;
+	if (left.colour.b != right.colour.b)
+		return left.colour.b < right.colour.b ? -1 : 1;
+	if (left.colour.a != right.colour.a)
+		return left.colour.a < right.colour.a ? -1 : 1;
+	if (left.alpha != right.alpha)
+		return left.alpha < right.alpha ? -1 : 1;	// Already quantised, see batchAlpha
+
+	return 0;
+}
+
+/* MapRenderer3D::batchAlpha
+ * Returns distance fade [alpha] rounded to one of a few levels, so
+ * that quads and flats in the fade range can still be batched
+ * together rather than each having a unique alpha
+ *******************************************************************/
+float MapRenderer3D::batchAlpha(float alpha)
+{
+	return floor(alpha * 16.0f + 0.5f) / 16.0f;
+}
+
+/* MapRenderer3D::batchSortLess
+ * Sort function for batch entries, orders by render state and then
+ * by position in the geometry buffer
+ *******************************************************************/
+bool MapRenderer3D::batchSortLess(const geom_batch_t& left, const geom_batch_t& right)
+{
+	int cmp = batchStateCompare(left, right);
+	if (cmp != 0)
+		return cmp < 0;
+
+	return left.offset < right.offset;
+}
+
+/* MapRenderer3D::batchQuad
+ * Adds [quad] to the current batch list
+ *******************************************************************/
+void MapRenderer3D::batchQuad(quad_3d_t* quad)
+{
+	// Draw as a placeholder if the quad has no geometry yet
+	if (quad->geom_offset == GEOM_NONE)
+	{
+		placeholder_quads.push_back(quad);
+		return;
+	}
+
+	geom_batch_t batch;
+	batch.texture = quad->texture;
+	batch.colour = quad->colour;
+	batch.light = quad->light;
+	batch.flags = quad->flags & (SKY|MIDTEX);
+	batch.alpha = batchAlpha(quad->alpha);
+	batch.offset = quad->geom_offset;
+	batch.count = 4;
+	geom_batches.push_back(batch);
+}
+
+/* MapRenderer3D::batchFlat
+ * Adds [flat] to the current batch list
+ *******************************************************************/
+void MapRenderer3D::batchFlat(flat_3d_t* flat)
+{
+	// Skip if no sector or nothing to draw
+	if (!flat->sector)
+		return;
+	if (flat->slot.used == 0)
+	{
+		// Draw as a placeholder if the flat has no geometry yet
+		if (flat->pending)
+			placeholder_flats.push_back(flat);
+		return;
+	}
+
+	geom_batch_t batch;
+	batch.texture = flat->texture;
+	batch.colour = flat->colour;
+	batch.light = flat->light;
+	batch.flags = flat->flags & (SKY|CEIL);
+	batch.alpha = batchAlpha(flat->alpha);
+	batch.offset = flat->slot.offset;
+	batch.count = flat->slot.used;
+	geom_batches.push_back(batch);
+}
+
+/* MapRenderer3D::renderBatches
+ * Draws all entries in the current batch list from [buffer], with
+ * one draw call per texture and render state. If [walls] is true
+ * the entries are wall quads, otherwise flat triangles
+ *******************************************************************/
+void MapRenderer3D::renderBatches(geom_buffer_t& buffer, bool walls)
+{
+	if (geom_batches.empty() || buffer.vbo == 0)
+		return;
+
+	// Sort by texture and render state
+	std::sort(geom_batches.begin(), geom_batches.end(), batchSortLess);
+
+	// Setup vertex pointers
+	glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
+	glVertexPointer(3, GL_FLOAT, sizeof(gl_vertex_t), ((char*)NULL));
+	glTexCoordPointer(2, GL_FLOAT, sizeof(gl_vertex_t), ((char*)NULL + 12));
+
+	tex_last = NULL;
+	unsigned a = 0;
+	int n_calls = 0;
+	while (a < geom_batches.size())
+	{
+		// Gather indices of all entries sharing the same state
+		geom_batch_t& batch = geom_batches[a];
+		geom_indices.clear();
+		unsigned b = a;
+		for (; b < geom_batches.size() && batchStateCompare(batch, geom_batches[b]) == 0; b++)
+		{
+			unsigned offset = geom_batches[b].offset;
+			if (walls)
+			{
+				// Split quad into two triangles
+				geom_indices.push_back(offset);
+				geom_indices.push_back(offset + 1);
+				geom_indices.push_back(offset + 2);
+				geom_indices.push_back(offset);
+				geom_indices.push_back(offset + 2);
+				geom_indices.push_back(offset + 3);
+			}
+			else
+			{
+				for (unsigned v = 0; v < geom_batches[b].count; v++)
+					geom_indices.push_back(offset + v);
+			}
+		}
+
+		// Bind texture
+		if (batch.texture && batch.texture != tex_last)
+		{
+			batch.texture->bind();
+			tex_last = batch.texture;
+		}
+
+		// Setup special rendering options
+		float alpha = batch.alpha;
+		if (batch.flags & SKY && render_3d_sky)
+		{
+			alpha = 0;
+			glDisable(GL_ALPHA_TEST);
+		}
+		else if (walls && batch.flags & MIDTEX)
+			glAlphaFunc(GL_GREATER, 0.9f*alpha);
+		if (!walls)
+			glCullFace((batch.flags & CEIL) ? GL_BACK : GL_FRONT);
+
+		// Draw
+		setLight(batch.colour, batch.light, alpha);
+		glDrawElements(GL_TRIANGLES, geom_indices.size(), GL_UNSIGNED_INT, &geom_indices[0]);
+		n_calls++;
+
+		// Reset settings
+		if (batch.flags & SKY && render_3d_sky)
+			glEnable(GL_ALPHA_TEST);
+		else if (walls && batch.flags & MIDTEX)
+			glAlphaFunc(GL_GREATER, 0.0f);
+
+		a = b;
+	}
+
+	glCullFace(GL_BACK);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	geom_batches.clear();
+	RenderProfiler::addCounter("Draw calls", n_calls);
+}
+
+/* MapRenderer3D::submitGeometryJob
+ * Runs geometry [job] in the background if possible and enabled (see
+ * setGeometryMode), otherwise runs and applies it immediately
+ *******************************************************************/
+void MapRenderer3D::submitGeometryJob(geometry_job_t* job)
+{
+	job->serial = ++geom_serial;
+
+	// Check if the object already has geometry to show until the job
+	// is finished (edited objects are done first)
+	bool has_geometry = false;
+	if (job->type == MOBJ_LINE)
+	{
+		lines[job->index].serial = job->serial;
+		has_geometry = !lines[job->index].quads.empty() && lines[job->index].quads[0].geom_offset != GEOM_NONE;
+	}
+	else
+	{
+		floors[job->index].serial = job->serial;
+		has_geometry = floors[job->index].slot.used > 0 || ceilings[job->index].slot.used > 0;
+	}
+
+	// Start worker thread if needed
+	bool background = (geom_mode == GEOMETRY_BACKGROUND || (geom_mode == GEOMETRY_DEFAULT && render_3d_background));
+	if (background && OpenGL::vboSupport() && !geom_worker)
+	{
+		geom_worker = new GeometryWorker3D();
+		if (geom_worker->Run() != wxTHREAD_NO_ERROR)
+		{
+			delete geom_worker;
+			geom_worker = NULL;
+		}
+	}
+
+	// Run in the background
+	if (background && geom_worker)
+	{
+		if (job->type == MOBJ_LINE)
+		{
+			// Use the job's quads as placeholders if needed
+			if (!has_geometry)
+			{
+				lines[job->index].quads = job->quads;
+				for (unsigned a = 0; a < lines[job->index].quads.size(); a++)
+					lines[job->index].quads[a].geom_offset = GEOM_NONE;
+			}
+			lines[job->index].pending = true;
+		}
+		else
+		{
+			floors[job->index].pending = true;
+			ceilings[job->index].pending = true;
+		}
+
+		geom_worker->addJob(job, has_geometry);
+		return;
+	}
+
+	// Otherwise run now
+	runGeometryJob(job);
+	applyGeometryJob(job);
+	delete job;
+}
+
+/* MapRenderer3D::applyGeometryJob
+ * Writes the results of finished geometry [job] to its line or
+ * sector. Returns false if the job is out of date
+ *******************************************************************/
+bool MapRenderer3D::applyGeometryJob(geometry_job_t* job)
 {
+	if (job->type == MOBJ_LINE)
+	{
+		// Check the job is the latest for the line
+		if (job->index >= lines.size() || lines[job->index].serial != job->serial)
+			return false;
+
+		line_3d_t& line = lines[job->index];
+		line.quads.swap(job->quads);
+		line.pending = false;
+
+		// Write to the walls geometry buffer
+		if (OpenGL::vboSupport())
+		{
+			writeGeometry(geom_walls, line.slot, job->vertices.empty() ? NULL : &job->vertices[0], job->vertices.size());
+			for (unsigned q = 0; q < line.quads.size(); q++)
+				line.quads[q].geom_offset = line.slot.offset + q * 4;
+		}
+	}
+	else
+	{
+		// Check the job is the latest for the sector
+		if (job->index >= floors.size() || floors[job->index].serial != job->serial)
+			return false;
+
+		// Write to the flats geometry buffer
+		gl_vertex_t* vertices = job->vertices.empty() ? NULL : &job->vertices[0];
+		writeGeometry(geom_flats, floors[job->index].slot, vertices, job->n_floor);
+		writeGeometry(geom_flats, ceilings[job->index].slot, vertices + job->n_floor, job->vertices.size() - job->n_floor);
+		floors[job->index].pending = false;
+		ceilings[job->index].pending = false;
+	}
+
+	return true;
+}
+
+/* MapRenderer3D::updateGeometry
+ * Writes the results of any geometry jobs finished in the background.
+ * Returns the number of lines and sectors updated
+ *******************************************************************/
+unsigned MapRenderer3D::updateGeometry()
+{
+	if (!geom_worker)
+		return 0;
+
+	vector<geometry_job_t*> finished;
+	geom_worker->takeFinished(finished);
+
+	unsigned n_updated = 0;
+	for (unsigned a = 0; a < finished.size(); a++)
+	{
+		if (applyGeometryJob(finished[a]))
+			n_updated++;
+		delete finished[a];
+	}
+
+	return n_updated;
+}
+
+/* MapRenderer3D::geometryPending
+ * Returns the number of geometry jobs waiting to be run
+ *******************************************************************/
+unsigned MapRenderer3D::geometryPending()
+{
+	if (!geom_worker)
+		return 0;
+
+	return geom_worker->nJobs();
+}
+
+/* MapRenderer3D::renderPlaceholders
+ * Renders all quads and flats added to the placeholder lists since
+ * the last call, untextured
+ *******************************************************************/
+void MapRenderer3D::renderPlaceholders()
+{
+	if (placeholder_quads.empty() && placeholder_flats.empty())
+		return;
+
+	GLboolean texture = glIsEnabled(GL_TEXTURE_2D);
+	glDisable(GL_TEXTURE_2D);
+
+	for (unsigned a = 0; a < placeholder_quads.size(); a++)
+		renderQuad(placeholder_quads[a], placeholder_quads[a]->alpha);
+	for (unsigned a = 0; a < placeholder_flats.size(); a++)
+		renderFlat(placeholder_flats[a]);
+	glCullFace(GL_BACK);
+
+	if (texture)
+		glEnable(GL_TEXTURE_2D);
+	placeholder_quads.clear();
+	placeholder_flats.clear();
 }
 
 /* MapRenderer3D::quickVisDiscard
@@ -2221,6 +3080,203 @@ void MapRenderer3D::quickVisDiscard()
 	}
 }
 
+/* clipViewWindow
+ * Clips the view window [wl,wr] (angles relative to the camera
+ * direction) to the range of angles [pl,pr] covered by a line. If the
+ * line range is more than 180 degrees wide it is treated as wrapping
+ * around behind the camera. Returns false if nothing is left of the
+ * window, otherwise sets [l,r] to the clipped window
+ *******************************************************************/
+bool clipViewWindow(double wl, double wr, double pl, double pr, double& l, double& r)
+{
+	if (pr - pl <= PI)
+	{
+		l = max(wl, pl);
+		r = min(wr, pr);
+		return l < r;
+	}
+
+	// Line range wraps around, it's [pr,PI] and [-PI,pl]
+	bool a = max(wl, pr) < wr;
+	bool b = wl < min(wr, pl);
+	if (a && b)
+	{
+		l = wl;
+		r = wr;
+	}
+	else if (a)
+	{
+		l = max(wl, pr);
+		r = wr;
+	}
+	else if (b)
+	{
+		l = wl;
+		r = min(wr, pl);
+	}
+
+	return a || b;
+}
+
+/* MapRenderer3D::portalVisCheck
+ * Finds visible sectors and lines by flood filling from the sector
+ * the camera is in, through two-sided lines that are within the view
+ * (the range of view angles a sector is seen through narrows as it
+ * goes through each line) and not closed (no gap between floor and
+ * ceiling). Returns false if the camera isn't in a sector
+ *******************************************************************/
+bool MapRenderer3D::portalVisCheck()
+{
+	// Find the sector the camera is in (lowest index, as sectorAt does)
+	double cx = cam_position.x;
+	double cy = cam_position.y;
+	vector<unsigned> candidates;
+	map->getObjectsOverlapping(MOBJ_SECTOR, cx, cy, cx, cy, candidates);
+	int cam_sector = -1;
+	for (unsigned a = 0; a < candidates.size(); a++)
+	{
+		if (map->getSector(candidates[a])->isWithin(cx, cy))
+		{
+			cam_sector = candidates[a];
+			break;
+		}
+	}
+	if (cam_sector < 0)
+		return false;
+
+	// Init visibility arrays if needed
+	unsigned n_sectors = map->nSectors();
+	unsigned n_lines = map->nLines();
+	if (dist_sectors.size() != n_sectors || vis_sector_frame.size() != n_sectors || vis_line_frame.size() != n_lines)
+	{
+		dist_sectors.resize(n_sectors);
+		vis_sector_frame.assign(n_sectors, 0);
+		vis_window_l.resize(n_sectors);
+		vis_window_r.resize(n_sectors);
+		vis_line_frame.assign(n_lines, 0);
+		vis_portal = false;
+	}
+
+	// Clear visibility from the last check (everything if it wasn't a
+	// portal check)
+	if (vis_portal)
+	{
+		for (unsigned a = 0; a < vis_sectors.size(); a++)
+			dist_sectors[vis_sectors[a]] = -1.0f;
+		for (unsigned a = 0; a < vis_lines.size(); a++)
+			lines[vis_lines[a]].visible = false;
+	}
+	else
+	{
+		for (unsigned a = 0; a < n_sectors; a++)
+			dist_sectors[a] = -1.0f;
+		for (unsigned a = 0; a < n_lines; a++)
+			lines[a].visible = false;
+	}
+	vis_sectors.clear();
+	vis_lines.clear();
+	vis_frame++;
+	vis_portal = true;
+
+	// Get view window (half horizontal fov, which is wider when looking
+	// up or down, and everything when pitched far enough)
+	double cam_ang = atan2(cam_direction.y, cam_direction.x);
+	double p = fabs(cam_pitch);
+	double fx = cos(p) - view_tan_v * sin(p);
+	double half = PI;
+	if (fx > 0)
+		half = min(PI, atan2(1.0, fx) + 0.05);
+
+	// Start at the camera sector
+	vis_sector_frame[cam_sector] = vis_frame;
+	vis_window_l[cam_sector] = -half;
+	vis_window_r[cam_sector] = half;
+	dist_sectors[cam_sector] = 0.0f;
+	vis_sectors.push_back(cam_sector);
+	vis_queue.clear();
+	vis_queue.push_back(cam_sector);
+
+	// Flood fill
+	while (!vis_queue.empty())
+	{
+		unsigned s = vis_queue.back();
+		vis_queue.pop_back();
+		MapSector* sector = map->getSector(s);
+		double wl = vis_window_l[s];
+		double wr = vis_window_r[s];
+
+		vector<MapSide*>& sides = sector->connectedSides();
+		for (unsigned a = 0; a < sides.size(); a++)
+		{
+			MapLine* line = sides[a]->getParentLine();
+
+			// Check distance
+			double dist = MathStuff::distanceToLine(cx, cy, line->x1(), line->y1(), line->x2(), line->y2());
+			if (render_max_dist > 0 && dist > render_max_dist)
+				continue;
+
+			// Get range of view angles the line covers (all of it if
+			// the camera is practically on the line)
+			double l = wl;
+			double r = wr;
+			if (dist >= 1)
+			{
+				double a1 = atan2(line->y1() - cy, line->x1() - cx) - cam_ang;
+				double a2 = atan2(line->y2() - cy, line->x2() - cx) - cam_ang;
+				if (a1 > PI) a1 -= 2*PI;
+				if (a1 <= -PI) a1 += 2*PI;
+				if (a2 > PI) a2 -= 2*PI;
+				if (a2 <= -PI) a2 += 2*PI;
+				if (!clipViewWindow(wl, wr, min(a1, a2), max(a1, a2), l, r))
+					continue;
+			}
+
+			// Line is visible
+			unsigned li = line->getIndex();
+			if (vis_line_frame[li] != vis_frame)
+			{
+				vis_line_frame[li] = vis_frame;
+				vis_lines.push_back(li);
+				lines[li].visible = true;
+			}
+
+			// Check if the line is a portal to another sector
+			MapSide* other_side = (line->s1() == sides[a]) ? line->s2() : line->s1();
+			if (!other_side)
+				continue;
+			MapSector* other = other_side->getSector();
+			if (!other || other == sector)
+				continue;
+
+			// Check if closed
+			if (min(sector->getCeilingHeight(), other->getCeilingHeight()) <= max(sector->getFloorHeight(), other->getFloorHeight()))
+				continue;
+
+			// Add other sector, or widen its window and check it again
+			unsigned o = other->getIndex();
+			if (vis_sector_frame[o] != vis_frame)
+			{
+				vis_sector_frame[o] = vis_frame;
+				vis_window_l[o] = l;
+				vis_window_r[o] = r;
+				dist_sectors[o] = dist;
+				vis_sectors.push_back(o);
+				vis_queue.push_back(o);
+			}
+			else if (l < vis_window_l[o] || r > vis_window_r[o])
+			{
+				vis_window_l[o] = min(l, vis_window_l[o]);
+				vis_window_r[o] = max(r, vis_window_r[o]);
+				if (dist < dist_sectors[o])
+					dist_sectors[o] = dist;
+				vis_queue.push_back(o);
+			}
+		}
+	}
+
+	return true;
+}
+
 /* MapRenderer3D::calcDistFade
  * Calculates and returns the faded alpha value for [distance] from
  * the camera
@@ -2251,10 +3307,11 @@ void MapRenderer3D::checkVisibleQuads()
 	float distfade;
 	n_quads = 0;
 	unsigned updates = 0;
-	bool update = false;
 	fpoint2_t strafe(cam_position.x+cam_strafe.x, cam_position.y+cam_strafe.y);
-	for (unsigned a = 0; a < lines.size(); a++)
+	unsigned n_check = vis_portal ? vis_lines.size() : lines.size();
+	for (unsigned i = 0; i < n_check; i++)
 	{
+		unsigned a = vis_portal ? vis_lines[i] : i;
 		line = map->getLine(a);
 
 		// Skip if not visible
@@ -2275,32 +3332,12 @@ void MapRenderer3D::checkVisibleQuads()
 		else
 			distfade = 1.0f;
 
-		// Update line if needed
-		update = false;
-		if (lines[a].updated_time < line->modifiedTime())	// Check line modified
-			update = true;
-		if (lines[a].line != line)
-			update = true;
-		if (!update && line->s1())
-		{
-			// Check front side/sector modified
-			if (lines[a].updated_time < line->s1()->modifiedTime() ||
-			        lines[a].updated_time < line->frontSector()->modifiedTime())
-				update = true;
-		}
-		if (!update && line->s2())
-		{
-			// Check back side/sector modified
-			if (lines[a].updated_time < line->s2()->modifiedTime() ||
-			        lines[a].updated_time < line->backSector()->modifiedTime())
-				update = true;
-		}
-		if (update)
+		// Update line if needed (up to render_3d_max_updates per frame,
+		// any others keep their old quads until a later frame)
+		if (lineOutdated(a) && (render_3d_max_updates <= 0 || updates < (unsigned)render_3d_max_updates))
 		{
 			updateLine(a);
-			//updates++;
-			//if (updates > 500)
-			//	break;
+			updates++;
 		}
 
 		// Determine quads to be drawn
@@ -2332,8 +3369,11 @@ void MapRenderer3D::checkVisibleFlats()
 	MapSector* sector;
 	n_flats = 0;
 	float alpha;
-	for (unsigned a = 0; a < map->nSectors(); a++)
+	unsigned updates = 0;
+	unsigned n_check = vis_portal ? vis_sectors.size() : map->nSectors();
+	for (unsigned i = 0; i < n_check; i++)
 	{
+		unsigned a = vis_portal ? vis_sectors[i] : i;
 		sector = map->getSector(a);
 
 		// Skip if invisible
@@ -2354,9 +3394,19 @@ void MapRenderer3D::checkVisibleFlats()
 			}
 		}
 
-		// Update sector info if needed
-		if (floors[a].updated_time < sector->modifiedTime())
-			updateSector(a);
+		// Update sector info if needed (up to render_3d_max_updates per
+		// frame, sectors that have never been updated are skipped until
+		// a later frame)
+		if (sectorOutdated(a))
+		{
+			if (render_3d_max_updates <= 0 || updates < (unsigned)render_3d_max_updates)
+			{
+				updateSector(a);
+				updates++;
+			}
+			else if (!floors[a].sector)
+				continue;
+		}
 
 		// Set distance fade alpha
 		if (render_max_dist > 0)
@@ -2369,10 +3419,11 @@ void MapRenderer3D::checkVisibleFlats()
 		// Add floor flat
 		flats[n_flats++] = &(floors[a]);
 	}
-	for (unsigned a = 0; a < map->nSectors(); a++)
+	for (unsigned i = 0; i < n_check; i++)
 	{
 		// Skip if invisible
-		if (dist_sectors[a] < 0)
+		unsigned a = vis_portal ? vis_sectors[i] : i;
+		if (dist_sectors[a] < 0 || !ceilings[a].sector)
 			continue;
 
 		// Add ceiling flat
@@ -2380,177 +3431,470 @@ void MapRenderer3D::checkVisibleFlats()
 	}
 }
 
+/* MapRenderer3D::pickHit
+ * Sets [pick] to [item] at [dist] along the view vector if it is
+ * closer than the current pick. Ties go to the lowest [order], so
+ * the result doesn't depend on the order items are checked in
+ *******************************************************************/
+void MapRenderer3D::pickHit(pick_t& pick, double dist, unsigned order, selection_3d_t item)
+{
+	if (dist < pick.dist || (dist == pick.dist && order < pick.order))
+	{
+		pick.item = item;
+		pick.dist = dist;
+		pick.order = order;
+	}
+}
+
+/* MapRenderer3D::pickLine
+ * Checks the view vector against the quads of line [index]
+ *******************************************************************/
+void MapRenderer3D::pickLine(unsigned index, pick_t& pick)
+{
+	// Ignore if not visible
+	if (!lines[index].visible)
+		return;
+
+	MapLine* line = map->getLine(index);
+
+	// Find (2d) distance to line
+	double dist = MathStuff::distanceRayLine(fpoint2_t(cam_position.x, cam_position.y),
+	                                         fpoint2_t(cam_position.x+cam_dir3d.x, cam_position.y+cam_dir3d.y),
+	                                         line->x1(), line->y1(), line->x2(), line->y2());
+
+	// Ignore if no intersection or something was closer
+	if (dist < 0 || dist > pick.dist)
+		return;
+
+	// Find quad intersect if any
+	double height = cam_position.z + cam_dir3d.z*dist;
+	selection_3d_t current;
+	for (unsigned q = 0; q < lines[index].quads.size(); q++)
+	{
+		quad_3d_t* quad = &lines[index].quads[q];
+
+		// Check side of camera
+		if (MathStuff::lineSide(cam_position.x, cam_position.y, quad->points[0].x, quad->points[0].y, quad->points[2].x, quad->points[2].y) < 0)
+			continue;
+
+		// Check intersection height
+		if (height >= quad->points[1].z && height <= quad->points[0].z)
+		{
+			// Determine selected item from quad flags
+
+			// Side index
+			if (quad->flags & BACK)
+				current.index = line->s2Index();
+			else
+				current.index = line->s1Index();
+
+			// Side part
+			if (quad->flags & UPPER)
+				current.type = MapEditor::SEL_SIDE_TOP;
+			else if (quad->flags & LOWER)
+				current.type = MapEditor::SEL_SIDE_BOTTOM;
+			else
+				current.type = MapEditor::SEL_SIDE_MIDDLE;
+		}
+	}
+
+	if (current.index >= 0)
+		pickHit(pick, dist, index, current);
+}
+
+/* MapRenderer3D::pickSector
+ * Checks the view vector against the floor and ceiling of sector
+ * [index]
+ *******************************************************************/
+void MapRenderer3D::pickSector(unsigned index, pick_t& pick)
+{
+	// Ignore if not visible
+	if (dist_sectors[index] < 0)
+		return;
+
+	unsigned order = map->nLines() + index * 2;
+
+	// Check distance to floor plane
+	double dist = MathStuff::distanceRayPlane(cam_position, cam_dir3d, floors[index].plane);
+	if (dist >= 0 && dist <= pick.dist)
+	{
+		// Check if on the correct side of the plane
+		if (cam_position.z > floors[index].plane.height_at(cam_position.x, cam_position.y))
+		{
+			// Check if intersection is within sector
+			if (map->getSector(index)->isWithin(cam_position.x + cam_dir3d.x*dist, cam_position.y + cam_dir3d.y*dist))
+				pickHit(pick, dist, order, selection_3d_t(index, MapEditor::SEL_FLOOR));
+		}
+	}
+
+	// Check distance to ceiling plane
+	dist = MathStuff::distanceRayPlane(cam_position, cam_dir3d, ceilings[index].plane);
+	if (dist >= 0 && dist <= pick.dist)
+	{
+		// Check if on the correct side of the plane
+		if (cam_position.z < ceilings[index].plane.height_at(cam_position.x, cam_position.y))
+		{
+			// Check if intersection is within sector
+			if (map->getSector(index)->isWithin(cam_position.x + cam_dir3d.x*dist, cam_position.y + cam_dir3d.y*dist))
+				pickHit(pick, dist, order + 1, selection_3d_t(index, MapEditor::SEL_CEILING));
+		}
+	}
+}
+
+/* MapRenderer3D::pickThing
+ * Checks the view vector against the sprite of thing [index]
+ *******************************************************************/
+void MapRenderer3D::pickThing(unsigned index, fpoint2_t& strafe, pick_t& pick)
+{
+	// Ignore if no sprite
+	if (!things[index].sprite)
+		return;
+
+	// Ignore if not visible
+	MapThing* thing = map->getThing(index);
+	if (MathStuff::lineSide(thing->xPos(), thing->yPos(), cam_position.x, cam_position.y, strafe.x, strafe.y) > 0)
+		return;
+
+	// Ignore if not shown
+	if (!things[index].type->isDecoration() && render_3d_things == 2)
+		return;
+
+	// Find distance to thing sprite
+	double halfwidth = things[index].sprite->getWidth() * 0.5;
+	if (things[index].flags & ICON)
+		halfwidth = render_thing_icon_size*0.5;
+	double dist = MathStuff::distanceRayLine(fpoint2_t(cam_position.x, cam_position.y),
+	                                         fpoint2_t(cam_position.x+cam_dir3d.x, cam_position.y+cam_dir3d.y),
+	                                         thing->xPos() - cam_strafe.x * halfwidth, thing->yPos() - cam_strafe.y * halfwidth,
+	                                         thing->xPos() + cam_strafe.x * halfwidth, thing->yPos() + cam_strafe.y * halfwidth);
+
+	// Ignore if no intersection or something was closer
+	if (dist < 0 || dist > pick.dist)
+		return;
+
+	// Check intersection height
+	double theight = things[index].sprite->getHeight();
+	double height = cam_position.z + cam_dir3d.z*dist;
+	if (things[index].flags & ICON)
+		theight = render_thing_icon_size;
+	if (height >= things[index].z && height <= things[index].z + theight)
+		pickHit(pick, dist, map->nLines() + map->nSectors() * 2 + index, selection_3d_t(index, MapEditor::SEL_THING));
+}
+
 /* MapRenderer3D::determineHilight
  * Finds the closest wall/flat/thing to the camera along the view
  * vector
  *******************************************************************/
 selection_3d_t MapRenderer3D::determineHilight()
+{
+	if (render_3d_pick_indexed)
+		return pickIndexed();
+	else
+		return pickBruteForce();
+}
+
+/* MapRenderer3D::pickBruteForce
+ * Finds the closest wall/flat/thing to the camera along the view
+ * vector by checking every line, sector and thing in the map
+ *******************************************************************/
+selection_3d_t MapRenderer3D::pickBruteForce()
 {
 	// Init
-	double min_dist = 9999999;
-	selection_3d_t current;
+	pick_t pick;
 	fpoint2_t strafe(cam_position.x+cam_strafe.x, cam_position.y+cam_strafe.y);
 
 	// Check for required map structures
 	if (!map || lines.size() != map->nLines() ||
 	        floors.size() != map->nSectors() ||
-	        things.size() != map->nThings())
-		return current;
+	        things.size() != map->nThings() ||
+	        dist_sectors.size() != map->nSectors())
+		return pick.item;
 
 	// Check lines
-	double height, dist;
-	quad_3d_t* quad;
 	for (unsigned a = 0; a < map->nLines(); a++)
-	{
-		// Ignore if not visible
-		if (!lines[a].visible)
-			continue;
+		pickLine(a, pick);
 
-		MapLine* line = map->getLine(a);
-
-		// Find (2d) distance to line
-		dist = MathStuff::distanceRayLine(fpoint2_t(cam_position.x, cam_position.y),
-		                                  fpoint2_t(cam_position.x+cam_dir3d.x, cam_position.y+cam_dir3d.y),
-		                                  line->x1(), line->y1(), line->x2(), line->y2());
-
-		// Ignore if no intersection or something was closer
-		if (dist < 0 || dist >= min_dist)
-			continue;
+	// Check sectors
+	for (unsigned a = 0; a < map->nSectors(); a++)
+		pickSector(a, pick);
 
-		// Find quad intersect if any
-		height = cam_position.z + cam_dir3d.z*dist;
-		for (unsigned q = 0; q < lines[a].quads.size(); q++)
-		{
-			quad = &lines[a].quads[q];
+	// Update item distance
+	if (pick.dist >= 9999999 || pick.dist < 0)
+		item_dist = -1;
+	else
+		item_dist = MathStuff::round(pick.dist);
 
-			// Check side of camera
-			if (MathStuff::lineSide(cam_position.x, cam_position.y, quad->points[0].x, quad->points[0].y, quad->points[2].x, quad->points[2].y) < 0)
-				continue;
+	// Check things (if visible)
+	if (render_3d_things == 0)
+		return pick.item;
+	for (unsigned a = 0; a < map->nThings(); a++)
+		pickThing(a, strafe, pick);
 
-			// Check intersection height
-			if (height >= quad->points[1].z && height <= quad->points[0].z)
-			{
-				// Determine selected item from quad flags
+	// Update item distance
+	if (pick.dist >= 9999999 || pick.dist < 0)
+		item_dist = -1;
+	else
+		item_dist = MathStuff::round(pick.dist);
 
-				// Side index
-				if (quad->flags & BACK)
-					current.index = line->s2Index();
-				else
-					current.index = line->s1Index();
+	return pick.item;
+}
 
-				// Side part
-				if (quad->flags & UPPER)
-					current.type = MapEditor::SEL_SIDE_TOP;
-				else if (quad->flags & LOWER)
-					current.type = MapEditor::SEL_SIDE_BOTTOM;
-				else
-					current.type = MapEditor::SEL_SIDE_MIDDLE;
+/* MapRenderer3D::pickIndexed
+ * Finds the closest wall/flat/thing to the camera along the view
+ * vector. Steps along the vector in segments, using the map's
+ * spatial index to check only objects overlapping each segment, and
+ * stops once something is hit before the start of a segment. Walls
+ * and flats are checked first, then things, as in pickBruteForce,
+ * and the result is the same
+ *******************************************************************/
+selection_3d_t MapRenderer3D::pickIndexed()
+{
+	// Init
+	pick_t pick;
+	fpoint2_t strafe(cam_position.x+cam_strafe.x, cam_position.y+cam_strafe.y);
 
-				min_dist = dist;
-			}
-		}
+	// Check for required map structures
+	if (!map || lines.size() != map->nLines() ||
+	        floors.size() != map->nSectors() ||
+	        things.size() != map->nThings() ||
+	        dist_sectors.size() != map->nSectors())
+		return pick.item;
+
+	// Init checked object lists
+	pick_frame++;
+	if (pick_line_frame.size() != map->nLines())
+		pick_line_frame.assign(map->nLines(), 0);
+	if (pick_sector_frame.size() != map->nSectors())
+		pick_sector_frame.assign(map->nSectors(), 0);
+	if (pick_thing_frame.size() != map->nThings())
+		pick_thing_frame.assign(map->nThings(), 0);
+
+	// Update bounds of everything that can be picked if the map has
+	// changed (things can be outside the map bounds)
+	if (pick_bbox_gen != map->currentGeneration())
+	{
+		pick_bbox = map->getMapBBox();
+		for (unsigned a = 0; a < map->nThings(); a++)
+			pick_bbox.extend(map->getThing(a)->xPos(), map->getThing(a)->yPos());
+		pick_bbox_gen = map->currentGeneration();
 	}
-
-	// Check sectors
-	for (unsigned a = 0; a < map->nSectors(); a++)
+	double margin = MAX(pick_sprite_radius, render_thing_icon_size * 0.5) + 1;
+
+	// Clip the view vector to the bounds
+	double pos[2] = { cam_position.x, cam_position.y };
+	double dir[2] = { cam_dir3d.x, cam_dir3d.y };
+	double bmin[2] = { pick_bbox.min.x - margin, pick_bbox.min.y - margin };
+	double bmax[2] = { pick_bbox.max.x + margin, pick_bbox.max.y + margin };
+	double t_min = 0;
+	double t_max = pick.dist;
+	for (unsigned a = 0; a < 2; a++)
 	{
-		// Ignore if not visible
-		if (dist_sectors[a] < 0)
+		if (fabs(dir[a]) < 0.000001)
+		{
+			if (pos[a] < bmin[a] || pos[a] > bmax[a])
+				t_max = -1;
 			continue;
+		}
 
-		// Check distance to floor plane
-		dist = MathStuff::distanceRayPlane(cam_position, cam_dir3d, floors[a].plane);
-		if (dist >= 0 && dist < min_dist)
+		double t1 = (bmin[a] - pos[a]) / dir[a];
+		double t2 = (bmax[a] - pos[a]) / dir[a];
+		t_min = MAX(t_min, MIN(t1, t2));
+		t_max = MIN(t_max, MAX(t1, t2));
+	}
+
+	// Step along the view vector about 512 units (in 2d) at a time,
+	// or all at once if looking (almost) straight up or down. Walls
+	// and flats are checked on the first pass, things on the second
+	double len = sqrt(dir[0]*dir[0] + dir[1]*dir[1]);
+	double step = (len > 0.0001) ? 512.0 / len : t_max - t_min;
+	for (unsigned pass = 0; pass < 2; pass++)
+	{
+		for (double t0 = t_min; t0 <= t_max && t0 < pick.dist; t0 += step)
 		{
-			// Check if on the correct side of the plane
-			if (cam_position.z > floors[a].plane.height_at(cam_position.x, cam_position.y))
+			// Get segment bounds
+			double t1 = MIN(t0 + step, t_max);
+			double xmin = MIN(pos[0] + dir[0]*t0, pos[0] + dir[0]*t1) - 1;
+			double ymin = MIN(pos[1] + dir[1]*t0, pos[1] + dir[1]*t1) - 1;
+			double xmax = MAX(pos[0] + dir[0]*t0, pos[0] + dir[0]*t1) + 1;
+			double ymax = MAX(pos[1] + dir[1]*t0, pos[1] + dir[1]*t1) + 1;
+
+			if (pass == 0)
 			{
-				// Check if intersection is within sector
-				if (map->getSector(a)->isWithin(cam_position.x + cam_dir3d.x*dist, cam_position.y + cam_dir3d.y*dist))
+				// Check lines
+				pick_list.clear();
+				map->getObjectsOverlapping(MOBJ_LINE, xmin, ymin, xmax, ymax, pick_list);
+				for (unsigned a = 0; a < pick_list.size(); a++)
 				{
-					current.index = a;
-					current.type = MapEditor::SEL_FLOOR;
-					min_dist = dist;
+					if (pick_line_frame[pick_list[a]] == pick_frame)
+						continue;
+					pick_line_frame[pick_list[a]] = pick_frame;
+					pickLine(pick_list[a], pick);
 				}
-			}
-		}
 
-		// Check distance to ceiling plane
-		dist = MathStuff::distanceRayPlane(cam_position, cam_dir3d, ceilings[a].plane);
-		if (dist >= 0 && dist < min_dist)
-		{
-			// Check if on the correct side of the plane
-			if (cam_position.z < ceilings[a].plane.height_at(cam_position.x, cam_position.y))
+				// Check sectors
+				pick_list.clear();
+				map->getObjectsOverlapping(MOBJ_SECTOR, xmin, ymin, xmax, ymax, pick_list);
+				for (unsigned a = 0; a < pick_list.size(); a++)
+				{
+					if (pick_sector_frame[pick_list[a]] == pick_frame)
+						continue;
+					pick_sector_frame[pick_list[a]] = pick_frame;
+					pickSector(pick_list[a], pick);
+				}
+			}
+			else
 			{
-				// Check if intersection is within sector
-				if (map->getSector(a)->isWithin(cam_position.x + cam_dir3d.x*dist, cam_position.y + cam_dir3d.y*dist))
+				// Check things
+				pick_list.clear();
+				map->getObjectsOverlapping(MOBJ_THING, xmin, ymin, xmax, ymax, pick_list, margin);
+				for (unsigned a = 0; a < pick_list.size(); a++)
 				{
-					current.index = a;
-					current.type = MapEditor::SEL_CEILING;
-					min_dist = dist;
+					if (pick_thing_frame[pick_list[a]] == pick_frame)
+						continue;
+					pick_thing_frame[pick_list[a]] = pick_frame;
+					pickThing(pick_list[a], strafe, pick);
 				}
 			}
+
+			if (step <= 0)
+				break;
 		}
-	}
 
-	// Update item distance
-	if (min_dist >= 9999999 || min_dist < 0)
-		item_dist = -1;
-	else
-		item_dist = MathStuff::round(min_dist);
+		// Update item distance
+		if (pick.dist >= 9999999 || pick.dist < 0)
+			item_dist = -1;
+		else
+			item_dist = MathStuff::round(pick.dist);
 
-	// Check things (if visible)
-	if (render_3d_things == 0)
-		return current;
-	double halfwidth, theight;
-	for (unsigned a = 0; a < map->nThings(); a++)
-	{
-		// Ignore if no sprite
-		if (!things[a].sprite)
-			continue;
+		// Check things (if visible)
+		if (render_3d_things == 0)
+			break;
+	}
 
-		// Ignore if not visible
-		MapThing* thing = map->getThing(a);
-		if (MathStuff::lineSide(thing->xPos(), thing->yPos(), cam_position.x, cam_position.y, strafe.x, strafe.y) > 0)
-			continue;
+	return pick.item;
+}
 
-		// Ignore if not shown
-		if (!things[a].type->isDecoration() && render_3d_things == 2)
-			continue;
+/* MapRenderer3D::buildPickData
+ * Updates all lines, sectors and things in the map and marks every
+ * sector visible, so the whole map can be picked from without
+ * rendering it (for testing)
+ *******************************************************************/
+void MapRenderer3D::buildPickData()
+{
+	lines.resize(map->nLines());
+	floors.resize(map->nSectors());
+	ceilings.resize(map->nSectors());
+	things.resize(map->nThings());
+	dist_sectors.assign(map->nSectors(), 0);
 
-		// Find distance to thing sprite
-		halfwidth = things[a].sprite->getWidth() * 0.5;
-		if (things[a].flags & ICON)
-			halfwidth = render_thing_icon_size*0.5;
-		dist = MathStuff::distanceRayLine(fpoint2_t(cam_position.x, cam_position.y),
-		                                  fpoint2_t(cam_position.x+cam_dir3d.x, cam_position.y+cam_dir3d.y),
-		                                  thing->xPos() - cam_strafe.x * halfwidth, thing->yPos() - cam_strafe.y * halfwidth,
-		                                  thing->xPos() + cam_strafe.x * halfwidth, thing->yPos() + cam_strafe.y * halfwidth);
+	for (unsigned a = 0; a < map->nLines(); a++)
+		updateLine(a);
+	for (unsigned a = 0; a < map->nSectors(); a++)
+		updateSector(a);
+	for (unsigned a = 0; a < map->nThings(); a++)
+		updateThing(a, map->getThing(a));
+}
 
-		// Ignore if no intersection or something was closer
-		if (dist < 0 || dist >= min_dist)
-			continue;
+/* MapRenderer3D::updateOutdated
+ * Updates every line and sector modified since it was last updated,
+ * not just visible ones (for testing, after buildPickData). Returns
+ * the number of lines and sectors updated
+ *******************************************************************/
+unsigned MapRenderer3D::updateOutdated()
+{
+	if (lines.size() != map->nLines() || floors.size() != map->nSectors())
+		return 0;
 
-		// Check intersection height
-		theight = things[a].sprite->getHeight();
-		height = cam_position.z + cam_dir3d.z*dist;
-		if (things[a].flags & ICON)
-			theight = render_thing_icon_size;
-		if (height >= things[a].z && height <= things[a].z + theight)
+	unsigned n_updated = 0;
+	for (unsigned a = 0; a < map->nLines(); a++)
+	{
+		if (lineOutdated(a))
 		{
-			current.index = a;
-			current.type = MapEditor::SEL_THING;
-			min_dist = dist;
+			updateLine(a);
+			n_updated++;
+		}
+	}
+	for (unsigned a = 0; a < map->nSectors(); a++)
+	{
+		if (sectorOutdated(a))
+		{
+			updateSector(a);
+			n_updated++;
 		}
 	}
 
-	// Update item distance
-	if (min_dist >= 9999999 || min_dist < 0)
-		item_dist = -1;
-	else
-		item_dist = MathStuff::round(min_dist);
+	return n_updated;
+}
+
+/* MapRenderer3D::finishGeometry
+ * Waits for all background geometry jobs to finish and writes their
+ * results (for testing). Returns false if they weren't all finished
+ * within [timeout] milliseconds
+ *******************************************************************/
+bool MapRenderer3D::finishGeometry(unsigned timeout)
+{
+	sf::Clock clock;
+	while (true)
+	{
+		updateGeometry();
+
+		// Check for lines or sectors still waiting
+		bool pending = false;
+		for (unsigned a = 0; !pending && a < lines.size(); a++)
+			pending = lines[a].pending;
+		for (unsigned a = 0; !pending && a < floors.size(); a++)
+			pending = floors[a].pending;
+		if (!pending)
+			return true;
+
+		if (clock.getElapsedTime().asMilliseconds() > (int)timeout)
+			return false;
+		sf::sleep(sf::milliseconds(1));
+	}
+}
+
+/* sameGeometry
+ * Returns true if the vertices in [slot1] of [vertices1] are the same
+ * as those in [slot2] of [vertices2]
+ *******************************************************************/
+bool sameGeometry(vector<MapRenderer3D::gl_vertex_t>& vertices1, MapRenderer3D::geom_slot_t& slot1, vector<MapRenderer3D::gl_vertex_t>& vertices2, MapRenderer3D::geom_slot_t& slot2)
+{
+	if (slot1.used != slot2.used)
+		return false;
+
+	for (unsigned a = 0; a < slot1.used; a++)
+	{
+		MapRenderer3D::gl_vertex_t& v1 = vertices1[slot1.offset + a];
+		MapRenderer3D::gl_vertex_t& v2 = vertices2[slot2.offset + a];
+		if (v1.x != v2.x || v1.y != v2.y || v1.z != v2.z || v1.tx != v2.tx || v1.ty != v2.ty)
+			return false;
+	}
+
+	return true;
+}
+
+/* MapRenderer3D::compareGeometry
+ * Compares the wall and flat geometry of every line and sector with
+ * [other] (for testing). Returns the number of lines and sectors
+ * whose geometry is different
+ *******************************************************************/
+unsigned MapRenderer3D::compareGeometry(MapRenderer3D& other)
+{
+	unsigned n_diff = 0;
+	for (unsigned a = 0; a < lines.size(); a++)
+	{
+		if (a >= other.lines.size() || !sameGeometry(geom_walls.vertices, lines[a].slot, other.geom_walls.vertices, other.lines[a].slot))
+			n_diff++;
+	}
+	for (unsigned a = 0; a < floors.size(); a++)
+	{
+		if (a >= other.floors.size() ||
+			!sameGeometry(geom_flats.vertices, floors[a].slot, other.geom_flats.vertices, other.floors[a].slot) ||
+			!sameGeometry(geom_flats.vertices, ceilings[a].slot, other.geom_flats.vertices, other.ceilings[a].slot))
+			n_diff++;
+	}
 
-	return current;
+	return n_diff;
 }
 
 /* MapRenderer3D::renderHilight
@@ -2748,6 +4092,7 @@ void MapRenderer3D::onAnnouncement(Announcer* announcer, string event_name, MemC
 				lines[a].quads[q].texture = NULL;
 
 			lines[a].updated_time = 0;
+			lines[a].serial = 0;
 		}
 
 		// Refresh flats
@@ -2755,6 +4100,7 @@ void MapRenderer3D::onAnnouncement(Announcer* announcer, string event_name, MemC
 		{
 			floors[a].texture = NULL;
 			floors[a].updated_time = 0;
+			floors[a].serial = 0;
 		}
 		for (unsigned a = 0; a < ceilings.size(); a++)
 		{
@@ -7,6 +7,8 @@
 
 class GLTexture;
 class Polygon2D;
+class GeometryWorker3D;
+struct geometry_job_t;
 class MapRenderer3D : public Listener
 {
 public:
@@ -33,11 +35,27 @@ public:
 	    DRAWN	= 8,
 		ZETH	= 16,
 	};
+	// Geometry generation modes (see setGeometryMode)
+	enum
+	{
+		GEOMETRY_DEFAULT,		// In the background if render_3d_background is on
+		GEOMETRY_BACKGROUND,	// Always in the background (if supported)
+		GEOMETRY_IMMEDIATE,		// Never in the background
+	};
 	struct gl_vertex_t
 	{
 		float x, y, z;
 		float tx, ty;
 	};
+	static const unsigned GEOM_NONE = 0xFFFFFFFF;	// Quad has no geometry written yet
+	struct geom_slot_t
+	{
+		unsigned	offset;	// First vertex in the geometry buffer
+		unsigned	size;	// Number of vertices reserved
+		unsigned	used;	// Number of vertices currently written
+
+		geom_slot_t() { offset = size = used = 0; }
+	};
 	struct quad_3d_t
 	{
 		gl_vertex_t	points[4];
@@ -46,12 +64,14 @@ public:
 		GLTexture*	texture;
 		uint8_t		flags;
 		float		alpha;
+		unsigned	geom_offset;	// First vertex in the walls geometry buffer
 
 		quad_3d_t()
 		{
 			colour.set(255, 255, 255, 255, 0);
 			texture = NULL;
 			flags = 0;
+			geom_offset = 0;
 		}
 	};
 	struct line_3d_t
@@ -60,8 +80,11 @@ public:
 		long				updated_time;
 		bool				visible;
 		MapLine*			line;
+		geom_slot_t			slot;
+		long				serial;		// Serial of the latest geometry job
+		bool				pending;	// Waiting for a geometry job to finish
 
-		line_3d_t() { updated_time = 0; visible = true; }
+		line_3d_t() { updated_time = 0; visible = true; serial = 0; pending = false; }
 	};
 	struct thing_3d_t
 	{
@@ -93,9 +116,14 @@ public:
 		float		alpha;
 		MapSector*	sector;
 		long		updated_time;
+		geom_slot_t	slot;
+		long		serial;
+		bool		pending;
 
 		flat_3d_t()
 		{
+			serial = 0;
+			pending = false;
 			light = 255;
 			texture = NULL;
 			updated_time = 0;
@@ -115,6 +143,7 @@ public:
 	int		itemDistance() { return item_dist; }
 	void	enableHilight(bool render) { render_hilight = render; }
 	void	enableSelection(bool render) { render_selection = render; }
+	void	setGeometryMode(int mode) { geom_mode = mode; }
 
 	bool	init();
 	void	refresh();
@@ -147,7 +176,9 @@ public:
 
 	// Flats
 	void	updateFlatTexCoords(unsigned index, bool floor);
+	bool	sectorOutdated(unsigned index);
 	void	updateSector(unsigned index);
+	void	invalidateSector(unsigned index);
 	void	renderFlat(flat_3d_t* flat);
 	void	renderFlats();
 	void	renderFlatSelection(vector<selection_3d_t>& selection, float alpha = 1.0f);
@@ -155,6 +186,7 @@ public:
 	// Walls
 	void	setupQuad(quad_3d_t* quad, double x1, double y1, double x2, double y2, double top, double bottom);
 	void	setupQuadTexCoords(quad_3d_t* quad, int length, double left, double top, bool pegbottom = false, double sx = 1, double sy = 1);
+	bool	lineOutdated(unsigned index);
 	void	updateLine(unsigned index);
 	void	renderQuad(quad_3d_t* quad, float alpha = 1.0f);
 	void	renderWalls();
@@ -166,19 +198,32 @@ public:
 	void	renderThingSelection(vector<selection_3d_t>& selection, float alpha = 1.0f);
 
 	// VBO stuff
-	void	updateFlatsVBO();
-	void	updateWallsVBO();
+	void		updateFlatsVBO();
+	void		updateWallsVBO();
+
+	// Background geometry generation
+	unsigned	updateGeometry();
+	unsigned	geometryPending();
 
 	// Visibility checking
 	void	quickVisDiscard();
+	bool	portalVisCheck();
 	float	calcDistFade(double distance, double max = -1);
 	void	checkVisibleQuads();
 	void	checkVisibleFlats();
 
 	// Hilight
 	selection_3d_t	determineHilight();
+	selection_3d_t	pickBruteForce();
+	selection_3d_t	pickIndexed();
+	void			buildPickData();
 	void			renderHilight(selection_3d_t hilight, float alpha = 1.0f);
 
+	// Geometry checks (for testing)
+	unsigned	updateOutdated();
+	bool		finishGeometry(unsigned timeout = 10000);
+	unsigned	compareGeometry(MapRenderer3D& other);
+
 	// Listener stuff
 	void	onAnnouncement(Announcer* announcer, string event_name, MemChunk& event_data);
 
@@ -191,12 +236,23 @@ private:
 	GLTexture*	tex_last;
 	unsigned	n_quads;
 	unsigned	n_flats;
-	int			flat_last;
 	bool		render_hilight;
 	bool		render_selection;
 
 	// Visibility
 	vector<float>	dist_sectors;
+	double			view_tan_v;	// Tangent of half the vertical fov
+
+	// Portal visibility (see portalVisCheck)
+	bool				vis_portal;			// True if the last check was a portal check
+	unsigned			vis_frame;
+	vector<unsigned>	vis_sectors;		// Sectors and lines found visible
+	vector<unsigned>	vis_lines;
+	vector<unsigned>	vis_sector_frame;	// Frame each sector/line was last found visible
+	vector<unsigned>	vis_line_frame;
+	vector<double>		vis_window_l;		// Range of view angles each sector is seen through
+	vector<double>		vis_window_r;
+	vector<unsigned>	vis_queue;
 
 	// Camera
 	fpoint3_t	cam_position;
@@ -216,10 +272,87 @@ private:
 	vector<flat_3d_t>	ceilings;
 	flat_3d_t**			flats;
 
-	// VBOs
-	unsigned	vbo_floors;
-	unsigned	vbo_ceilings;
-	unsigned	vbo_walls;
+	// Geometry buffers. Each line/sector keeps a slot in the walls/flats
+	// buffer that is rewritten in place when the object is modified, or
+	// moved to the end of the buffer if its geometry no longer fits
+	struct geom_buffer_t
+	{
+		unsigned			vbo;
+		unsigned			vbo_size;	// Vertices allocated in the VBO
+		vector<gl_vertex_t>	vertices;	// Copy of the VBO data
+		vector<std::pair<unsigned, unsigned> >	dirty;	// Ranges (offset, count) not yet uploaded
+		unsigned			wasted;		// Vertices left behind by slots that moved or shrank
+
+		geom_buffer_t() { vbo = 0; vbo_size = 0; wasted = 0; }
+	};
+	geom_buffer_t	geom_walls;
+	geom_buffer_t	geom_flats;
+
+	void	writeGeometry(geom_buffer_t& buffer, geom_slot_t& slot, gl_vertex_t* vertices, unsigned count);
+	void	uploadGeometry(geom_buffer_t& buffer);
+	void	compactGeometry(geom_buffer_t& buffer, vector<geom_slot_t*>& slots);
+	void	clearGeometry(geom_buffer_t& buffer);
+
+	// Batched drawing, visible quads/flats sharing a texture and render
+	// state are drawn with a single call (see renderBatches)
+	struct geom_batch_t
+	{
+		GLTexture*	texture;
+		rgba_t		colour;
+		uint8_t		light;
+		uint8_t		flags;
+		float		alpha;
+		unsigned	offset;	// First vertex in the geometry buffer
+		unsigned	count;	// Number of vertices (4 per quad, 3 per flat triangle)
+	};
+	vector<geom_batch_t>	geom_batches;
+	vector<unsigned>		geom_indices;
+
+	static int		batchStateCompare(const geom_batch_t& left, const geom_batch_t& right);
+	static float	batchAlpha(float alpha);
+	static bool		batchSortLess(const geom_batch_t& left, const geom_batch_t& right);
+	void			batchQuad(quad_3d_t* quad);
+	void			batchFlat(flat_3d_t* flat);
+	void			renderBatches(geom_buffer_t& buffer, bool walls);
+
+	// Background geometry generation. Lines and sectors are set up on
+	// the main thread, then their vertex data is generated by a worker
+	// thread and written to the geometry buffers when finished. Objects
+	// with no geometry yet are drawn untextured until then
+	GeometryWorker3D*	geom_worker;
+	long				geom_serial;
+	int					geom_mode;
+	vector<quad_3d_t*>	placeholder_quads;
+	vector<flat_3d_t*>	placeholder_flats;
+
+	void	addQuad(geometry_job_t* job, quad_3d_t& quad, int length, double left, double top, bool pegbottom, double sx, double sy);
+	void	getFlatTexInfo(unsigned index, bool floor, double& sx, double& sy, double& ox, double& oy, double& rot);
+	void	submitGeometryJob(geometry_job_t* job);
+	bool	applyGeometryJob(geometry_job_t* job);
+	void	renderPlaceholders();
+
+	// Hilight picking (see pickIndexed)
+	struct pick_t
+	{
+		selection_3d_t	item;
+		double			dist;
+		unsigned		order;	// Position in the brute force check order
+
+		pick_t() { dist = 9999999; order = 0xFFFFFFFF; }
+	};
+	unsigned			pick_frame;
+	vector<unsigned>	pick_line_frame;	// Frame each object was last checked
+	vector<unsigned>	pick_sector_frame;
+	vector<unsigned>	pick_thing_frame;
+	vector<unsigned>	pick_list;
+	double				pick_sprite_radius;	// Largest thing sprite half width
+	bbox_t				pick_bbox;
+	long				pick_bbox_gen;
+
+	void	pickHit(pick_t& pick, double dist, unsigned order, selection_3d_t item);
+	void	pickLine(unsigned index, pick_t& pick);
+	void	pickSector(unsigned index, pick_t& pick);
+	void	pickThing(unsigned index, fpoint2_t& strafe, pick_t& pick);
 
 	// Sky
 	struct gl_vertex_ex_t
@@ -29,6 +29,7 @@
  *******************************************************************/
 #include "Main.h"
 #include "MapSector.h"
+#include "ObjectPool.h"
 #include "MapLine.h"
 #include "MapSide.h"
 #include "MapVertex.h"
@@ -38,6 +39,12 @@
 #include <wx/colour.h>
 
 
+/*******************************************************************
+ * VARIABLES
+ *******************************************************************/
+OBJECT_POOL(MapSector, sector_pool)
+
+
 /*******************************************************************
  * MAPSECTOR CLASS FUNCTIONS
  *******************************************************************/
@@ -51,7 +58,8 @@ MapSector::MapSector(SLADEMap* parent) : MapObject(MOBJ_SECTOR, parent)
 	this->special = 0;
 	this->tag = 0;
 	poly_needsupdate = true;
-	geometry_updated = theApp->runTimer();
+	poly_serial = 0;
+	geometry_updated = newGeneration();
 }
 
 /* MapSector::MapSector
@@ -65,7 +73,8 @@ MapSector::MapSector(string f_tex, string c_tex, SLADEMap* parent) : MapObject(M
 	this->special = 0;
 	this->tag = 0;
 	poly_needsupdate = true;
-	geometry_updated = theApp->runTimer();
+	poly_serial = 0;
+	geometry_updated = newGeneration();
 }
 
 /* MapSector::~MapSector
@@ -247,7 +256,7 @@ void MapSector::updateBBox()
 	}
 
 	text_point.set(0, 0);
-	geometry_updated = theApp->runTimer();
+	geometry_updated = newGeneration();
 }
 
 /* MapSector::boundingBox
@@ -263,14 +272,25 @@ bbox_t MapSector::boundingBox()
 }
 
 /* MapSector::getPolygon
- * Returns the sector polygon, updating it if necessary
+ * Returns the sector polygon, updating it if necessary. If the sector
+ * already has a polygon, the update is done in the background and
+ * the existing polygon is returned until it is ready
  *******************************************************************/
 Polygon2D* MapSector::getPolygon()
 {
 	if (poly_needsupdate)
 	{
-		polygon.openSector(this);
 		poly_needsupdate = false;
+
+		// If there is an existing polygon, keep using it while the new
+		// one is built in the background
+		if (polygon.hasPolygon() && parent_map && parent_map->requestSectorPolygon(this))
+			return &polygon;
+
+		// Otherwise build it now
+		polygon.openSector(this);
+		if (parent_map)
+			poly_serial = parent_map->polygonSerial();
 	}
 
 	return &polygon;
@@ -522,8 +542,15 @@ rgba_t MapSector::getColour(int where, bool fullbright)
 	// Check for UDMF+ZDoom namespace
 	if (parent_map->currentFormat() == MAP_UDMF && S_CMPNOCASE(parent_map->udmfNamespace(), "zdoom"))
 	{
+		// Property name atoms (this is called for every sector each frame)
+		static unsigned atom_lightcolor = MobjPropertyList::atom("lightcolor");
+		static unsigned atom_lightfloor = MobjPropertyList::atom("lightfloor");
+		static unsigned atom_lightfloorabs = MobjPropertyList::atom("lightfloorabsolute");
+		static unsigned atom_lightceiling = MobjPropertyList::atom("lightceiling");
+		static unsigned atom_lightceilingabs = MobjPropertyList::atom("lightceilingabsolute");
+
 		// Get sector light colour
-		int intcol = MapObject::intProperty("lightcolor");
+		int intcol = intPropertyAtom(atom_lightcolor);
 		wxColour wxcol(intcol);
 
 		// Ignore light level if fullbright
@@ -537,8 +564,8 @@ rgba_t MapSector::getColour(int where, bool fullbright)
 		if (where == 1)
 		{
 			// Floor
-			int fl = MapObject::intProperty("lightfloor");
-			if (boolProperty("lightfloorabsolute"))
+			int fl = intPropertyAtom(atom_lightfloor);
+			if (boolPropertyAtom(atom_lightfloorabs))
 				ll = fl;
 			else
 				ll += fl;
@@ -546,8 +573,8 @@ rgba_t MapSector::getColour(int where, bool fullbright)
 		else if (where == 2)
 		{
 			// Ceiling
-			int cl = MapObject::intProperty("lightceiling");
-			if (boolProperty("lightceilingabsolute"))
+			int cl = intPropertyAtom(atom_lightceiling);
+			if (boolPropertyAtom(atom_lightceilingabs))
 				ll = cl;
 			else
 				ll += cl;
@@ -593,7 +620,7 @@ void MapSector::connectSide(MapSide* side)
 	poly_needsupdate = true;
 	bbox.reset();
 	setModified();
-	geometry_updated = theApp->runTimer();
+	geometry_updated = newGeneration();
 }
 
 /* MapSector::disconnectSide
@@ -613,7 +640,7 @@ void MapSector::disconnectSide(MapSide* side)
 	setModified();
 	poly_needsupdate = true;
 	bbox.reset();
-	geometry_updated = theApp->runTimer();
+	geometry_updated = newGeneration();
 }
 
 /* MapSector::writeBackup
@@ -654,5 +681,5 @@ void MapSector::readBackup(mobj_backup_t* backup)
 	// Update geometry info
 	poly_needsupdate = true;
 	bbox.reset();
-	geometry_updated = theApp->runTimer();
+	geometry_updated = newGeneration();
 }
@@ -51,6 +51,7 @@ private:
 	bbox_t				bbox;
 	Polygon2D			polygon;
 	bool				poly_needsupdate;
+	long				poly_serial;
 	long				geometry_updated;
 	fpoint2_t			text_point;
 
@@ -59,6 +60,10 @@ public:
 	MapSector(string f_tex, string c_tex, SLADEMap* parent = NULL);
 	~MapSector();
 
+	// Pooled allocation
+	static void*	operator new(size_t size);
+	static void		operator delete(void* ptr, size_t size);
+
 	void	copy(MapObject* copy);
 
 	string		getFloorTex() { return f_tex; }
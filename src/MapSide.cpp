@@ -29,11 +29,18 @@
  *******************************************************************/
 #include "Main.h"
 #include "MapSide.h"
+#include "ObjectPool.h"
 #include "MapSector.h"
 #include "SLADEMap.h"
 #include "MainApp.h"
 
 
+/*******************************************************************
+ * VARIABLES
+ *******************************************************************/
+OBJECT_POOL(MapSide, side_pool)
+
+
 /*******************************************************************
  * MAPSIDE CLASS FUNCTIONS
  *******************************************************************/
@@ -46,6 +46,10 @@ public:
 	MapSide(SLADEMap* parent);
 	~MapSide();
 
+	// Pooled allocation
+	static void*	operator new(size_t size);
+	static void		operator delete(void* ptr, size_t size);
+
 	void	copy(MapObject* c);
 
 	bool	isOk() { return !!sector; }
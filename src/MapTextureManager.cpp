@@ -38,12 +38,14 @@
 #include "OpenGL.h"
 #include "SImage.h"
 #include "Misc.h"
+#include "Console.h"
 
 
 /*******************************************************************
  * VARIABLES
  *******************************************************************/
 CVAR(Int, map_tex_filter, 0, CVAR_SAVE)
+CVAR(Bool, map_tex_atlas, true, CVAR_SAVE)
 
 
 /*******************************************************************
@@ -54,11 +56,13 @@ CVAR(Int, map_tex_filter, 0, CVAR_SAVE)
  * MapTextureManager class constructor
  *******************************************************************/
 MapTextureManager::MapTextureManager(Archive* archive)
+: atlas_sprites(1024, 4, 2, 256), atlas_images(1024, 2, 4, 128)
 {
 	// Init variables
 	this->archive = archive;
 	editor_images_loaded = false;
 	palette = new Palette8bit();
+	atlas_images.setFilter(GLTexture::MIPMAP);
 
 	// Listen to the various managers
 	listenTo(theResourceManager);
@@ -311,6 +315,7 @@ GLTexture* MapTextureManager::getSprite(string name, string translation, string
 		else
 		{
 			// Otherwise, reload the texture
+			atlas_sprites.removeImage(mtex.texture);
 			delete mtex.texture;
 			mtex.texture = NULL;
 		}
@@ -371,6 +376,21 @@ GLTexture* MapTextureManager::getSprite(string name, string translation, string
 		mtex.texture->setFilter(filter);
 		mtex.texture->setTiling(false);
 		mtex.texture->loadImage(&image, pal);
+
+		// Add to sprite atlas. The sprite keeps its own texture as well,
+		// since the 3d view and immediate mode 2d rendering draw it
+		// directly. The atlas isn't cleared here as batches being built
+		// may still refer to its pages, so the space used by sprites
+		// reloaded with a new filter is only reclaimed when all
+		// resources are refreshed
+		if (map_tex_atlas)
+		{
+			atlas_sprites.setFilter(filter);
+			MemChunk rgba;
+			if (image.getRGBAData(rgba, pal))
+				atlas_sprites.addImage(mtex.texture, rgba.getData(), image.getWidth(), image.getHeight());
+		}
+
 		return mtex.texture;
 	}
 	else if (name.EndsWith("?"))
@@ -428,9 +448,9 @@ int MapTextureManager::getVerticalOffset(string name)
 
 /* MapTextureManager::importEditorImages
  * Loads all editor images (thing icons, etc) from the program
- * resource archive
+ * resource archive, adding them to [atlas] if it is given
  *******************************************************************/
-void importEditorImages(MapTexHashMap& map, ArchiveTreeNode* dir, string path)
+void importEditorImages(MapTexHashMap& map, ArchiveTreeNode* dir, string path, TextureAtlas* atlas)
 {
 	SImage image;
 
@@ -449,6 +469,10 @@ void importEditorImages(MapTexHashMap& map, ArchiveTreeNode* dir, string path)
 			mtex.texture = new GLTexture(false);
 			mtex.texture->setFilter(GLTexture::MIPMAP);
 			mtex.texture->loadImage(&image);
+
+			MemChunk rgba;
+			if (atlas && image.getRGBAData(rgba))
+				atlas->addImage(mtex.texture, rgba.getData(), image.getWidth(), image.getHeight());
 		}
 	}
 
@@ -456,7 +480,7 @@ void importEditorImages(MapTexHashMap& map, ArchiveTreeNode* dir, string path)
 	for (unsigned a = 0; a < dir->nChildren(); a++)
 	{
 		ArchiveTreeNode* subdir = (ArchiveTreeNode*)dir->getChild(a);
-		importEditorImages(map, subdir, path + subdir->getName() + "/");
+		importEditorImages(map, subdir, path + subdir->getName() + "/", atlas);
 	}
 }
 
@@ -475,7 +499,7 @@ GLTexture* MapTextureManager::getEditorImage(string name)
 		Archive* slade_pk3 = theArchiveManager->programResourceArchive();
 		ArchiveTreeNode* dir = slade_pk3->getDir("images");
 		if (dir)
-			importEditorImages(editor_images, dir, "");
+			importEditorImages(editor_images, dir, "", map_tex_atlas ? &atlas_images : NULL);
 
 		editor_images_loaded = true;
 	}
@@ -483,6 +507,34 @@ GLTexture* MapTextureManager::getEditorImage(string name)
 	return editor_images[name].texture;
 }
 
+/* MapTextureManager::getAtlasEntry
+ * Returns the atlas entry for sprite or editor image [texture], or
+ * NULL if it isn't in an atlas (or atlases are disabled)
+ *******************************************************************/
+TextureAtlas::entry_t* MapTextureManager::getAtlasEntry(GLTexture* texture)
+{
+	if (!map_tex_atlas || !texture)
+		return NULL;
+
+	TextureAtlas::entry_t* entry = atlas_sprites.getEntry(texture);
+	if (!entry)
+		entry = atlas_images.getEntry(texture);
+
+	return entry;
+}
+
+/* MapTextureManager::getAtlasReport
+ * Adds lines describing the contents and packing efficiency of the
+ * sprite and editor image atlases to [lines]
+ *******************************************************************/
+void MapTextureManager::getAtlasReport(vector<string>& lines)
+{
+	lines.push_back("Sprites:");
+	atlas_sprites.getReport(lines);
+	lines.push_back("Editor images:");
+	atlas_images.getReport(lines);
+}
+
 /* MapTextureManager::refreshResources
  * Unloads all cached textures, flats and sprites
  *******************************************************************/
@@ -492,6 +544,7 @@ void MapTextureManager::refreshResources()
 	textures.clear();
 	flats.clear();
 	sprites.clear();
+	atlas_sprites.clear();
 	thePaletteChooser->setGlobalFromArchive(archive);
 	theMapEditor->forceRefresh(true);
 	palette = getResourcePalette();
@@ -616,3 +669,16 @@ void MapTextureManager::onAnnouncement(Announcer* announcer, string event_name,
 	if (event_name == "main_palette_changed")
 		refreshResources();
 }
+
+
+/*******************************************************************
+ * CONSOLE COMMANDS
+ *******************************************************************/
+
+CONSOLE_COMMAND(map_tex_atlas_report, 0, true)
+{
+	vector<string> lines;
+	theMapEditor->textureManager().getAtlasReport(lines);
+	for (unsigned a = 0; a < lines.size(); a++)
+		theConsole->logMessage(lines[a]);
+}
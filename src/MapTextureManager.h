@@ -3,6 +3,7 @@
 #define __MAP_TEXTURE_MANAGER_H__
 
 #include "GLTexture.h"
+#include "TextureAtlas.h"
 #include "ListenerAnnouncer.h"
 #include <map>
 
@@ -48,6 +49,10 @@ private:
 	vector<map_texinfo_t>	tex_info;
 	vector<map_texinfo_t>	flat_info;
 
+	// Atlases for sprites and editor images (see getAtlasEntry)
+	TextureAtlas			atlas_sprites;
+	TextureAtlas			atlas_images;
+
 public:
 	enum
 	{
@@ -72,6 +77,9 @@ public:
 	GLTexture*		getSprite(string name, string translation = "", string palette = "");
 	GLTexture*		getEditorImage(string name);
 	int				getVerticalOffset(string name);
+
+	TextureAtlas::entry_t*	getAtlasEntry(GLTexture* texture);
+	void					getAtlasReport(vector<string>& lines);
 	
 	vector<map_texinfo_t>&	getAllTexturesInfo() { return tex_info; }
 	vector<map_texinfo_t>&	getAllFlatsInfo() { return flat_info; }
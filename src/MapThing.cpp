@@ -29,9 +29,16 @@
  *******************************************************************/
 #include "Main.h"
 #include "MapThing.h"
+#include "ObjectPool.h"
 #include "MainApp.h"
 
 
+/*******************************************************************
+ * VARIABLES
+ *******************************************************************/
+OBJECT_POOL(MapThing, thing_pool)
+
+
 /*******************************************************************
  * MAPTHING CLASS FUNCTIONS
  *******************************************************************/
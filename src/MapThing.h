@@ -52,6 +52,10 @@ public:
 	MapThing(double x, double y, short type, SLADEMap* parent = NULL);
 	~MapThing();
 
+	// Pooled allocation
+	static void*	operator new(size_t size);
+	static void		operator delete(void* ptr, size_t size);
+
 	double		xPos() { return x; }
 	double		yPos() { return y; }
 	void		setPos(double x, double y) { this->x = x; this->y = y; }
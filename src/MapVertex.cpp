@@ -29,10 +29,17 @@
  *******************************************************************/
 #include "Main.h"
 #include "MapVertex.h"
+#include "ObjectPool.h"
 #include "MapLine.h"
 #include "MainApp.h"
 
 
+/*******************************************************************
+ * VARIABLES
+ *******************************************************************/
+OBJECT_POOL(MapVertex, vertex_pool)
+
+
 /*******************************************************************
  * MAPVERTEX CLASS FUNCTIONS
  *******************************************************************/
@@ -35,6 +35,10 @@ public:
 	MapVertex(double x, double y, SLADEMap* parent = NULL);
 	~MapVertex();
 
+	// Pooled allocation
+	static void*	operator new(size_t size);
+	static void		operator delete(void* ptr, size_t size);
+
 	double		xPos() { return x; }
 	double		yPos() { return y; }
 
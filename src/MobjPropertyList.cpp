@@ -6,7 +6,9 @@
  * Web:         http://slade.mancubus.net
  * Filename:    MobjPropertyList.cpp
  * Description: A special version of the PropertyList class that
- *              uses a vector rather than a map to store properties
+ *              uses a vector rather than a map to store properties.
+ *              Property names are interned as integer 'atoms' so
+ *              that lookups only need to compare integers
  *
  * This program is free software; you can redistribute it and/or
  * modify it under the terms of the GNU General Public License
@@ -29,6 +31,43 @@
  *******************************************************************/
 #include "Main.h"
 #include "MobjPropertyList.h"
+#include <wx/thread.h>
+#include <deque>
+
+
+/*******************************************************************
+ * VARIABLES
+ *******************************************************************/
+WX_DECLARE_STRING_HASH_MAP(unsigned, AtomMap);
+
+
+/*******************************************************************
+ * FUNCTIONS
+ *******************************************************************/
+
+/* atomMap, atomNames, atomMutex
+ * Return the name->atom map, atom->name list and the mutex guarding
+ * them. These are function statics so that atoms can safely be
+ * interned during static initialisation in other files. A deque is
+ * used for names so that references returned by atomName stay valid
+ * as atoms are added. Atoms can be looked up and interned from any
+ * thread (eg. the UDMF writer threads), so all access is locked
+ *******************************************************************/
+static AtomMap& atomMap()
+{
+	static AtomMap map;
+	return map;
+}
+static std::deque<string>& atomNames()
+{
+	static std::deque<string> names;
+	return names;
+}
+static wxMutex& atomMutex()
+{
+	static wxMutex mutex;
+	return mutex;
+}
 
 
 /*******************************************************************
@@ -49,31 +88,29 @@ MobjPropertyList::~MobjPropertyList()
 {
 }
 
-/* MobjPropertyList::propertyExists
- * Returns true if a property with the given name exists, false
- * otherwise
+/* MobjPropertyList::getProperty
+ * Returns the property with the given name, or NULL if it doesn't
+ * exist
  *******************************************************************/
-bool MobjPropertyList::propertyExists(string key)
+Property* MobjPropertyList::getProperty(string key)
 {
-	for (unsigned a = 0; a < properties.size(); ++a)
-	{
-		if (properties[a].name == key)
-			return true;
-	}
+	// If the name was never interned, no list can have the property
+	int atom = findAtom(key);
+	if (atom < 0)
+		return NULL;
 
-	return false;
+	return getProperty((unsigned)atom);
 }
 
 /* MobjPropertyList::removeProperty
- * Removes a property value, returns true if [key] was removed
- * or false if key didn't exist
+ * Removes a property value, returns true if [atom] was removed
+ * or false if it didn't exist
  *******************************************************************/
-bool MobjPropertyList::removeProperty(string key)
+bool MobjPropertyList::removeProperty(unsigned atom)
 {
-	//return properties.erase(key) > 0;
 	for (unsigned a = 0; a < properties.size(); ++a)
 	{
-		if (properties[a].name == key)
+		if (properties[a].atom == atom)
 		{
 			properties[a] = properties.back();
 			properties.pop_back();
@@ -84,6 +121,19 @@ bool MobjPropertyList::removeProperty(string key)
 	return false;
 }
 
+/* MobjPropertyList::removeProperty
+ * Removes a property value, returns true if [key] was removed
+ * or false if key didn't exist
+ *******************************************************************/
+bool MobjPropertyList::removeProperty(string key)
+{
+	int atom = findAtom(key);
+	if (atom < 0)
+		return false;
+
+	return removeProperty((unsigned)atom);
+}
+
 /* MobjPropertyList::copyTo
  * Copies all properties to [list]
  *******************************************************************/
@@ -93,7 +143,7 @@ void MobjPropertyList::copyTo(MobjPropertyList& list)
 	list.clear();
 
 	for (unsigned a = 0; a < properties.size(); ++a)
-		list.properties.push_back(prop_t(properties[a].name, properties[a].value));
+		list.properties.push_back(prop_t(properties[a].atom, properties[a].value));
 }
 
 /* MobjPropertyList::addFlag
@@ -102,7 +152,7 @@ void MobjPropertyList::copyTo(MobjPropertyList& list)
 void MobjPropertyList::addFlag(string key)
 {
 	Property flag;
-	properties.push_back(prop_t(key, flag));
+	properties.push_back(prop_t(atom(key), flag));
 }
 
 /* MobjPropertyList::toString
@@ -120,7 +170,7 @@ string MobjPropertyList::toString(bool condensed)
 			continue;
 
 		// Add "key = value;\n" to the return string
-		string key = properties[a].name;
+		string key = properties[a].name();
 		string val = properties[a].value.getStringValue();
 
 		if (properties[a].value.getType() == PROP_STRING)
@@ -134,3 +184,56 @@ string MobjPropertyList::toString(bool condensed)
 
 	return ret;
 }
+
+/* MobjPropertyList::atom (static)
+ * Returns the atom for property name [name], interning it if it
+ * hasn't been seen before
+ *******************************************************************/
+unsigned MobjPropertyList::atom(string name)
+{
+	wxMutexLocker lock(atomMutex());
+	AtomMap& map = atomMap();
+	AtomMap::iterator i = map.find(name);
+	if (i != map.end())
+		return i->second;
+
+	// Add new atom
+	unsigned atom = atomNames().size();
+	atomNames().push_back(name);
+	map[name] = atom;
+
+	return atom;
+}
+
+/* MobjPropertyList::findAtom (static)
+ * Returns the atom for property name [name], or -1 if it hasn't
+ * been interned. Unlike atom, this never modifies the atom table
+ *******************************************************************/
+int MobjPropertyList::findAtom(string name)
+{
+	wxMutexLocker lock(atomMutex());
+	AtomMap& map = atomMap();
+	AtomMap::iterator i = map.find(name);
+	if (i != map.end())
+		return i->second;
+
+	return -1;
+}
+
+/* MobjPropertyList::atomName (static)
+ * Returns the property name for [atom]
+ *******************************************************************/
+const string& MobjPropertyList::atomName(unsigned atom)
+{
+	wxMutexLocker lock(atomMutex());
+	return atomNames()[atom];
+}
+
+/* MobjPropertyList::nAtoms (static)
+ * Returns the number of interned property names
+ *******************************************************************/
+unsigned MobjPropertyList::nAtoms()
+{
+	wxMutexLocker lock(atomMutex());
+	return atomNames().size();
+}
@@ -7,39 +7,61 @@
 class MobjPropertyList
 {
 public:
+	// Property names are interned as small integer 'atoms', each
+	// property is stored with its name's atom rather than a string
 	struct prop_t
 	{
-		string		name;
+		unsigned	atom;
 		Property	value;
 
-		prop_t(string name) { this->name = name; }
-		prop_t(string name, Property value)
+		prop_t(unsigned atom) { this->atom = atom; }
+		prop_t(unsigned atom, Property value)
 		{
-			this->name = name;
+			this->atom = atom;
 			this->value = value;
 		}
+
+		const string&	name() const { return MobjPropertyList::atomName(atom); }
 	};
 
 	MobjPropertyList();
 	~MobjPropertyList();
 
-	// Operator for direct access to hash map
-	Property& operator[](string key)
+	// Operator for direct access to property [atom], adds it if it doesn't exist
+	Property& operator[](unsigned atom)
 	{
 		for (unsigned a = 0; a < properties.size(); ++a)
 		{
-			if (properties[a].name == key)
+			if (properties[a].atom == atom)
 				return properties[a].value;
 		}
 
-		properties.push_back(prop_t(key));
+		properties.push_back(prop_t(atom));
 		return properties.back().value;
 	}
 
+	// Operator for direct access to property [key], adds it if it doesn't exist
+	Property& operator[](string key) { return (*this)[atom(key)]; }
+
 	vector<prop_t>&	allProperties() { return properties; }
 
+	// Returns property [atom], or NULL if it doesn't exist
+	Property* getProperty(unsigned atom)
+	{
+		for (unsigned a = 0; a < properties.size(); ++a)
+		{
+			if (properties[a].atom == atom)
+				return &properties[a].value;
+		}
+
+		return NULL;
+	}
+	Property*	getProperty(string key);
+
 	void	clear() { properties.clear(); }
-	bool	propertyExists(string key);
+	bool	propertyExists(unsigned atom) { return getProperty(atom) != NULL; }
+	bool	propertyExists(string key) { return getProperty(key) != NULL; }
+	bool	removeProperty(unsigned atom);
 	bool	removeProperty(string key);
 	void	copyTo(MobjPropertyList& list);
 	void	addFlag(string key);
@@ -47,6 +69,12 @@ public:
 
 	string	toString(bool condensed = false);
 
+	// Property name atoms
+	static unsigned			atom(string name);
+	static int				findAtom(string name);
+	static const string&	atomName(unsigned atom);
+	static unsigned			nAtoms();
+
 private:
 	vector<prop_t>	properties;
 };
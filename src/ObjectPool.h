@@ -0,0 +1,125 @@
+
+#ifndef __OBJECT_POOL_H__
+#define __OBJECT_POOL_H__
+
+/* ObjectPool
+ * A simple slab allocator for objects of type T. Memory is allocated
+ * in slabs of [slab_size] objects, and freed objects go into a free
+ * list to be reused. Objects never move, so pointers to them stay
+ * valid until they are freed. Once every object allocated from the
+ * pool has been freed, all slabs are released.
+ *
+ * Intended to be used from a class's operator new/delete (see
+ * OBJECT_POOL below). Only plain pointers and integers are used internally,
+ * so there is nothing to destroy when the program exits (in case any
+ * pooled objects outlive the pool's static destruction)
+ *******************************************************************/
+template<class T, unsigned slab_size = 1024>
+class ObjectPool
+{
+private:
+	// Slot size, rounded up to keep 8-byte alignment
+	static const unsigned slot_size = (sizeof(T) + 7) & ~7u;
+
+	// Each slab starts with a pointer to the previous slab
+	static const unsigned slab_header = 8;
+
+	char*		slab_first;	// Most recently allocated slab
+	unsigned	slab_next;	// Next unused slot in slab_first
+	void*		free_list;	// Freed slots
+	unsigned	n_slabs;
+	unsigned	n_used;
+
+public:
+	ObjectPool()
+	{
+		slab_first = NULL;
+		slab_next = slab_size;
+		free_list = NULL;
+		n_slabs = 0;
+		n_used = 0;
+	}
+
+	unsigned	nSlabs() { return n_slabs; }
+	unsigned	nUsed() { return n_used; }
+	unsigned	memoryUsage() { return n_slabs * (slab_header + slot_size * slab_size); }
+
+	// Returns memory for a single T
+	void* allocate()
+	{
+		n_used++;
+
+		// Reuse a freed slot if possible
+		if (free_list)
+		{
+			void* slot = free_list;
+			free_list = *(void**)slot;
+			return slot;
+		}
+
+		// Allocate a new slab if the current one is full
+		if (slab_next == slab_size)
+		{
+			char* slab = (char*)::operator new(slab_header + slot_size * slab_size);
+			*(char**)slab = slab_first;
+			slab_first = slab;
+			slab_next = 0;
+			n_slabs++;
+		}
+
+		return slab_first + slab_header + slot_size * slab_next++;
+	}
+
+	// Returns [slot] (previously from allocate) to the pool
+	void free(void* slot)
+	{
+		*(void**)slot = free_list;
+		free_list = slot;
+
+		// Release all memory once nothing is using it
+		if (--n_used == 0)
+			releaseAll();
+	}
+
+	// Releases all slabs. Should only be called when no objects from
+	// the pool are in use
+	void releaseAll()
+	{
+		while (slab_first)
+		{
+			char* prev = *(char**)slab_first;
+			::operator delete(slab_first);
+			slab_first = prev;
+		}
+
+		slab_next = slab_size;
+		free_list = NULL;
+		n_slabs = 0;
+	}
+};
+
+/* OBJECT_POOL
+ * Defines ObjectPool [pool] for class [cls], and [cls]'s operator
+ * new/delete (which must be declared in the class) to allocate from
+ * it. Allocations of any other size (ie. for a derived class) use
+ * the global operators instead
+ *******************************************************************/
+#define OBJECT_POOL(cls, pool) \
+	ObjectPool<cls> pool; \
+	void* cls::operator new(size_t size) \
+	{ \
+		if (size != sizeof(cls)) \
+			return ::operator new(size); \
+		return pool.allocate(); \
+	} \
+	void cls::operator delete(void* ptr, size_t size) \
+	{ \
+		if (!ptr) \
+			return; \
+		if (size != sizeof(cls)) \
+			::operator delete(ptr); \
+		else \
+			pool.free(ptr); \
+	}
+
+#endif//__OBJECT_POOL_H__
@@ -98,34 +98,48 @@ bool Polygon2D::openSector(MapSector* sector)
 	if (!sector)
 		return false;
 
-	// Init
-	PolygonSplitter splitter;
-	clear();
+	// Get sector outline edges
+	vector<fpoint2_t> edges;
+	getSectorEdges(sector, edges);
 
-	// Get list of sides connected to this sector
-	vector<MapSide*>& sides = sector->connectedSides();
+	return openEdges(edges);
+}
 
-	// Go through sides
-	MapLine* line;
-	for (unsigned a = 0; a < sides.size(); a++)
-	{
-		line = sides[a]->getParentLine();
+bool Polygon2D::openEdges(vector<fpoint2_t>& edges)
+{
+	// Init
+	clear();
 
-		// Ignore this side if its parent line has the same sector on both sides
-		if (!line || line->doubleSector())
-			continue;
+	// Triangulate the edges and merge into convex sub-polygons
+	PolygonTriangulator triangulator;
+	for (unsigned a = 0; a + 1 < edges.size(); a += 2)
+		triangulator.addEdge(edges[a].x, edges[a].y, edges[a+1].x, edges[a+1].y);
+	if (triangulator.triangulate(this))
+		return true;
 
-		// Add the edge to the splitter (direction depends on what side of the line this is)
-		if (line->s1() == sides[a])
-			splitter.addEdge(line->v1()->xPos(), line->v1()->yPos(), line->v2()->xPos(), line->v2()->yPos());
-		else
-			splitter.addEdge(line->v2()->xPos(), line->v2()->yPos(), line->v1()->xPos(), line->v1()->yPos());
-	}
+	// Triangulation failed (eg. unclosed sector), fall back to the
+	// (slower but more forgiving) polygon splitter
+	clear();
+	PolygonSplitter splitter;
+	for (unsigned a = 0; a + 1 < edges.size(); a += 2)
+		splitter.addEdge(edges[a].x, edges[a].y, edges[a+1].x, edges[a+1].y);
 
 	// Split the polygon into convex sub-polygons
 	return splitter.doSplitting(this);
 }
 
+void Polygon2D::swapPolygon(Polygon2D* other)
+{
+	// Swap polygon data
+	subpolys.swap(other->subpolys);
+
+	// Both need texture coords and VBO data updated
+	texture = NULL;
+	other->texture = NULL;
+	vbo_update = 2;
+	other->vbo_update = 2;
+}
+
 void Polygon2D::updateTextureCoords(double scale_x, double scale_y, double offset_x, double offset_y, double rotation)
 {
 	// Can't do this if there is no texture
@@ -268,6 +282,33 @@ void Polygon2D::setupVBOPointers()
 	glDisableClientState(GL_COLOR_ARRAY);
 }
 
+void Polygon2D::getSectorEdges(MapSector* sector, vector<fpoint2_t>& edges)
+{
+	// Go through sides connected to the sector
+	vector<MapSide*>& sides = sector->connectedSides();
+	MapLine* line;
+	for (unsigned a = 0; a < sides.size(); a++)
+	{
+		line = sides[a]->getParentLine();
+
+		// Ignore this side if its parent line has the same sector on both sides
+		if (!line || line->doubleSector())
+			continue;
+
+		// Add the edge (direction depends on what side of the line this is)
+		if (line->s1() == sides[a])
+		{
+			edges.push_back(fpoint2_t(line->v1()->xPos(), line->v1()->yPos()));
+			edges.push_back(fpoint2_t(line->v2()->xPos(), line->v2()->yPos()));
+		}
+		else
+		{
+			edges.push_back(fpoint2_t(line->v2()->xPos(), line->v2()->yPos()));
+			edges.push_back(fpoint2_t(line->v1()->xPos(), line->v1()->yPos()));
+		}
+	}
+}
+
 
 
 
@@ -1050,3 +1091,873 @@ void PolygonSplitter::testRender()
 	}
 	glEnd();
 }
+
+
+
+
+/*
+** The hole elimination and ear clipping parts of PolygonTriangulator
+** below (from insertNode to clipEars, and pointInTriangle) are adapted
+** from earcut by Mapbox (https://github.com/mapbox/earcut).
+**
+**---------------------------------------------------------------------------
+** ISC License
+**
+** Copyright (c) 2016, Mapbox
+**
+** Permission to use, copy, modify, and/or distribute this software for any purpose
+** with or without fee is hereby granted, provided that the above copyright notice
+** and this permission notice appear in all copies.
+**
+** THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH REGARD TO
+** THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS.
+** IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+** CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+** OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+** ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+**---------------------------------------------------------------------------
+*/
+
+/* pointInTriangle
+ * Returns true if [px,py] is within (or on the edge of) the
+ * triangle [a,b,c]
+ *******************************************************************/
+static bool pointInTriangle(double ax, double ay, double bx, double by, double cx, double cy, double px, double py)
+{
+	return	(cx - px) * (ay - py) >= (ax - px) * (cy - py) &&
+			(ax - px) * (by - py) >= (bx - px) * (ay - py) &&
+			(bx - px) * (cy - py) >= (cx - px) * (by - py);
+}
+
+// Sorting helper for hole rings (by leftmost node position)
+struct hole_t
+{
+	double	x, y;
+	int		node;
+	hole_t(double x, double y, int node) { this->x = x; this->y = y; this->node = node; }
+	bool operator<(const hole_t& right) const { return x < right.x || (x == right.x && y < right.y); }
+};
+
+/* PolygonTriangulator::PolygonTriangulator
+ * PolygonTriangulator class constructor
+ *******************************************************************/
+PolygonTriangulator::PolygonTriangulator()
+{
+}
+
+/* PolygonTriangulator::~PolygonTriangulator
+ * PolygonTriangulator class destructor
+ *******************************************************************/
+PolygonTriangulator::~PolygonTriangulator()
+{
+}
+
+/* PolygonTriangulator::clear
+ * Clears all vertices, edges, outlines and triangles
+ *******************************************************************/
+void PolygonTriangulator::clear()
+{
+	vertices.clear();
+	edges.clear();
+	vertex_map.clear();
+	outlines.clear();
+	nodes.clear();
+	triangles.clear();
+}
+
+/* PolygonTriangulator::addVertex
+ * Adds a vertex at [x,y], or finds an existing vertex at that
+ * position. Returns the vertex index
+ *******************************************************************/
+int PolygonTriangulator::addVertex(double x, double y)
+{
+	// Check vertex doesn't exist
+	std::pair<double, double> pos(x, y);
+	std::map<std::pair<double, double>, int>::iterator i = vertex_map.find(pos);
+	if (i != vertex_map.end())
+		return i->second;
+
+	// Add vertex
+	vertices.push_back(vertex_t(x, y));
+	vertex_map[pos] = vertices.size() - 1;
+	return vertices.size() - 1;
+}
+
+/* PolygonTriangulator::addEdge
+ * Adds an edge from [x1,y1] to [x2,y2]. Returns the edge index, or
+ * -1 if the edge has zero length
+ *******************************************************************/
+int PolygonTriangulator::addEdge(double x1, double y1, double x2, double y2)
+{
+	// Add edge vertices
+	int v1 = addVertex(x1, y1);
+	int v2 = addVertex(x2, y2);
+
+	// Ignore zero-length edges
+	if (v1 == v2)
+		return -1;
+
+	// Check for duplicate edge
+	for (unsigned a = 0; a < vertices[v1].edges_out.size(); a++)
+	{
+		if (edges[vertices[v1].edges_out[a]].v2 == v2)
+			return vertices[v1].edges_out[a];
+	}
+
+	// Add edge
+	edge_t edge;
+	edge.v1 = v1;
+	edge.v2 = v2;
+	edge.used = false;
+	edges.push_back(edge);
+	vertices[v1].edges_out.push_back(edges.size() - 1);
+
+	return edges.size() - 1;
+}
+
+/* PolygonTriangulator::nextEdge
+ * Returns the unused edge continuing on from [edge] with the
+ * smallest angle, or -1 if there is none
+ *******************************************************************/
+int PolygonTriangulator::nextEdge(int edge)
+{
+	edge_t& e = edges[edge];
+	vertex_t& v1 = vertices[e.v1];
+	vertex_t& v2 = vertices[e.v2];
+
+	// Find the unused edge starting from the end of this one with the
+	// lowest angle (same as PolygonSplitter::findNextEdge)
+	double min_angle = 2*PI;
+	int next = -1;
+	for (unsigned a = 0; a < v2.edges_out.size(); a++)
+	{
+		edge_t& out = edges[v2.edges_out[a]];
+
+		// Ignore used edges and edges on the reverse-side of this
+		if (out.used || out.v2 == e.v1)
+			continue;
+
+		double angle = MathStuff::angle2DRad(fpoint2_t(v1.x, v1.y), fpoint2_t(v2.x, v2.y), fpoint2_t(vertices[out.v2].x, vertices[out.v2].y));
+		if (angle < min_angle)
+		{
+			min_angle = angle;
+			next = v2.edges_out[a];
+		}
+	}
+
+	return next;
+}
+
+/* PolygonTriangulator::traceOutline
+ * Traces a closed outline starting from [edge_start] and adds it to
+ * the outlines list. Returns false if the outline isn't closed
+ *******************************************************************/
+bool PolygonTriangulator::traceOutline(int edge_start)
+{
+	outline_t outline;
+	outline.area = 0;
+
+	// An outline can't have more edges than there are in total
+	int edge = edge_start;
+	for (unsigned a = 0; a <= edges.size(); a++)
+	{
+		int v1 = edges[edge].v1;
+		int v2 = edges[edge].v2;
+
+		// Add edge start vertex
+		// (bbox_t::extend can't be used here since it treats a bbox at
+		// 0,0 as unset)
+		vertex_t& vert = vertices[v1];
+		if (a == 0)
+		{
+			outline.bbox.min.set(vert.x, vert.y);
+			outline.bbox.max.set(vert.x, vert.y);
+		}
+		else
+		{
+			outline.bbox.min.set(MIN(outline.bbox.min.x, vert.x), MIN(outline.bbox.min.y, vert.y));
+			outline.bbox.max.set(MAX(outline.bbox.max.x, vert.x), MAX(outline.bbox.max.y, vert.y));
+		}
+		outline.verts.push_back(v1);
+		outline.area += vertices[v1].x * vertices[v2].y - vertices[v2].x * vertices[v1].y;
+		if (edge != edge_start)
+			edges[edge].used = true;
+
+		// Get next edge, abort if there isn't one (unclosed)
+		int next = nextEdge(edge);
+		if (next < 0)
+			return false;
+
+		// Done if we're back at the start
+		if (next == edge_start)
+		{
+			edges[edge_start].used = true;
+			outline.area *= 0.5;
+			outlines.push_back(outline);
+			return true;
+		}
+
+		edge = next;
+	}
+
+	return false;
+}
+
+/* PolygonTriangulator::pointInOutline
+ * Returns true if [x,y] is inside [outline]
+ *******************************************************************/
+bool PolygonTriangulator::pointInOutline(double x, double y, outline_t& outline)
+{
+	bool inside = false;
+	unsigned n = outline.verts.size();
+	for (unsigned a = 0, b = n - 1; a < n; b = a++)
+	{
+		vertex_t& p1 = vertices[outline.verts[a]];
+		vertex_t& p2 = vertices[outline.verts[b]];
+		if ((p1.y > y) != (p2.y > y) && x < (p2.x - p1.x) * (y - p1.y) / (p2.y - p1.y) + p1.x)
+			inside = !inside;
+	}
+
+	return inside;
+}
+
+/* PolygonTriangulator::findOuterOutline
+ * Returns the index of the smallest outer outline containing the
+ * [inner] outline, or -1 if it isn't within one
+ *******************************************************************/
+int PolygonTriangulator::findOuterOutline(int inner)
+{
+	outline_t& hole = outlines[inner];
+
+	// Outer outlines are clockwise (negative area)
+	int outer = -1;
+	for (unsigned a = 0; a < outlines.size(); a++)
+	{
+		outline_t& o = outlines[a];
+		if (o.area >= 0 || (outer >= 0 && o.area <= outlines[outer].area))
+			continue;
+
+		// Check bounding box first
+		if (hole.bbox.min.x < o.bbox.min.x || hole.bbox.max.x > o.bbox.max.x ||
+			hole.bbox.min.y < o.bbox.min.y || hole.bbox.max.y > o.bbox.max.y)
+			continue;
+
+		// Test with a vertex of the hole that isn't shared with the outline
+		for (unsigned b = 0; b < hole.verts.size(); b++)
+		{
+			if (VECTOR_EXISTS(o.verts, hole.verts[b]))
+				continue;
+
+			if (pointInOutline(vertices[hole.verts[b]].x, vertices[hole.verts[b]].y, o))
+				outer = a;
+			break;
+		}
+	}
+
+	return outer;
+}
+
+/* PolygonTriangulator::insertNode
+ * Adds a ring node for [vertex] after the node [last] (or as a new
+ * ring if [last] is -1). Returns the new node index
+ *******************************************************************/
+int PolygonTriangulator::insertNode(int vertex, int last)
+{
+	node_t node;
+	node.vertex = vertex;
+	node.x = vertices[vertex].x;
+	node.y = vertices[vertex].y;
+	node.steiner = false;
+
+	int index = nodes.size();
+	if (last < 0)
+	{
+		node.prev = index;
+		node.next = index;
+	}
+	else
+	{
+		node.prev = last;
+		node.next = nodes[last].next;
+		nodes[nodes[last].next].prev = index;
+		nodes[last].next = index;
+	}
+
+	nodes.push_back(node);
+	return index;
+}
+
+/* PolygonTriangulator::copyNode
+ * Adds a copy of [node] and returns its index
+ *******************************************************************/
+int PolygonTriangulator::copyNode(int node)
+{
+	node_t copy = nodes[node];
+	nodes.push_back(copy);
+	return nodes.size() - 1;
+}
+
+/* PolygonTriangulator::removeNode
+ * Unlinks [node] from its ring
+ *******************************************************************/
+void PolygonTriangulator::removeNode(int node)
+{
+	nodes[nodes[node].next].prev = nodes[node].prev;
+	nodes[nodes[node].prev].next = nodes[node].next;
+}
+
+/* PolygonTriangulator::createRing
+ * Creates a ring of nodes from [outline], in reverse order. Returns
+ * the last node added
+ *******************************************************************/
+int PolygonTriangulator::createRing(outline_t& outline)
+{
+	// Outer outlines are clockwise and inner anticlockwise, the ear
+	// clipping needs the opposite so add the vertices in reverse
+	int last = -1;
+	for (int a = (int)outline.verts.size() - 1; a >= 0; a--)
+		last = insertNode(outline.verts[a], last);
+
+	return last;
+}
+
+/* PolygonTriangulator::area
+ * Returns twice the signed area of the triangle formed by nodes
+ * [p], [q] and [r], negative if it turns left
+ *******************************************************************/
+double PolygonTriangulator::area(int p, int q, int r)
+{
+	node_t& np = nodes[p];
+	node_t& nq = nodes[q];
+	node_t& nr = nodes[r];
+	return (nq.y - np.y) * (nr.x - nq.x) - (nq.x - np.x) * (nr.y - nq.y);
+}
+
+/* PolygonTriangulator::equals
+ * Returns true if nodes [a] and [b] are at the same position
+ *******************************************************************/
+bool PolygonTriangulator::equals(int a, int b)
+{
+	return nodes[a].x == nodes[b].x && nodes[a].y == nodes[b].y;
+}
+
+/* sign
+ * Returns -1, 0 or 1 depending on the sign of [value]
+ *******************************************************************/
+static int sign(double value)
+{
+	return (value > 0) - (value < 0);
+}
+
+/* onSegment
+ * Returns true if [q] lies on segment [p,r], given they are collinear
+ *******************************************************************/
+static bool onSegment(double px, double py, double qx, double qy, double rx, double ry)
+{
+	return qx <= MAX(px, rx) && qx >= MIN(px, rx) && qy <= MAX(py, ry) && qy >= MIN(py, ry);
+}
+
+/* PolygonTriangulator::intersects
+ * Returns true if segment [p1,q1] intersects segment [p2,q2]
+ *******************************************************************/
+bool PolygonTriangulator::intersects(int p1, int q1, int p2, int q2)
+{
+	int o1 = sign(area(p1, q1, p2));
+	int o2 = sign(area(p1, q1, q2));
+	int o3 = sign(area(p2, q2, p1));
+	int o4 = sign(area(p2, q2, q1));
+
+	if (o1 != o2 && o3 != o4)
+		return true;
+
+	// Collinear cases
+	node_t& np1 = nodes[p1];
+	node_t& nq1 = nodes[q1];
+	node_t& np2 = nodes[p2];
+	node_t& nq2 = nodes[q2];
+	if (o1 == 0 && onSegment(np1.x, np1.y, np2.x, np2.y, nq1.x, nq1.y)) return true;
+	if (o2 == 0 && onSegment(np1.x, np1.y, nq2.x, nq2.y, nq1.x, nq1.y)) return true;
+	if (o3 == 0 && onSegment(np2.x, np2.y, np1.x, np1.y, nq2.x, nq2.y)) return true;
+	if (o4 == 0 && onSegment(np2.x, np2.y, nq1.x, nq1.y, nq2.x, nq2.y)) return true;
+
+	return false;
+}
+
+/* PolygonTriangulator::locallyInside
+ * Returns true if a diagonal from node [a] to [b] starts off inside
+ * the ring
+ *******************************************************************/
+bool PolygonTriangulator::locallyInside(int a, int b)
+{
+	node_t& na = nodes[a];
+	if (area(na.prev, a, na.next) < 0)
+		return area(a, b, na.next) >= 0 && area(a, na.prev, b) >= 0;
+	else
+		return area(a, b, na.prev) < 0 || area(a, na.next, b) < 0;
+}
+
+/* PolygonTriangulator::wedgeContains
+ * Returns true if the ring angle at node [m] contains the one at [p]
+ *******************************************************************/
+bool PolygonTriangulator::wedgeContains(int m, int p)
+{
+	return area(nodes[m].prev, m, nodes[p].prev) < 0 && area(nodes[p].next, m, nodes[m].next) < 0;
+}
+
+/* PolygonTriangulator::filterPoints
+ * Removes duplicate and collinear nodes from the ring between
+ * [start] and [end]. Returns the last node checked
+ *******************************************************************/
+int PolygonTriangulator::filterPoints(int start, int end)
+{
+	if (start < 0)
+		return start;
+	if (end < 0)
+		end = start;
+
+	int p = start;
+	bool again;
+	do
+	{
+		again = false;
+		if (!nodes[p].steiner && (equals(p, nodes[p].next) || area(nodes[p].prev, p, nodes[p].next) == 0))
+		{
+			removeNode(p);
+			p = end = nodes[p].prev;
+			if (p == nodes[p].next)
+				break;
+			again = true;
+		}
+		else
+			p = nodes[p].next;
+	}
+	while (again || p != end);
+
+	return end;
+}
+
+/* PolygonTriangulator::leftmostNode
+ * Returns the leftmost (then lowest) node in the ring with [start]
+ *******************************************************************/
+int PolygonTriangulator::leftmostNode(int start)
+{
+	int p = start;
+	int leftmost = start;
+	do
+	{
+		if (nodes[p].x < nodes[leftmost].x || (nodes[p].x == nodes[leftmost].x && nodes[p].y < nodes[leftmost].y))
+			leftmost = p;
+		p = nodes[p].next;
+	}
+	while (p != start);
+
+	return leftmost;
+}
+
+/* PolygonTriangulator::splitRing
+ * Links node [a] to [b] with a bridge, splitting a ring in two or
+ * joining two rings. Returns the node at the start of the reverse
+ * side of the bridge
+ *******************************************************************/
+int PolygonTriangulator::splitRing(int a, int b)
+{
+	int a2 = copyNode(a);
+	int b2 = copyNode(b);
+	int an = nodes[a].next;
+	int bp = nodes[b].prev;
+
+	nodes[a].next = b;
+	nodes[b].prev = a;
+
+	nodes[a2].next = an;
+	nodes[an].prev = a2;
+
+	nodes[b2].next = a2;
+	nodes[a2].prev = b2;
+
+	nodes[bp].next = b2;
+	nodes[b2].prev = bp;
+
+	return b2;
+}
+
+/* PolygonTriangulator::findHoleBridge
+ * Finds a node in the [outer] ring that the [hole] node can be
+ * bridged to. Returns -1 if there is none
+ *******************************************************************/
+int PolygonTriangulator::findHoleBridge(int hole, int outer)
+{
+	double hx = nodes[hole].x;
+	double hy = nodes[hole].y;
+	double qx = 0;
+	int m = -1;
+
+	// Find the nearest outer edge intersected by a ray from the hole's
+	// leftmost point to the left. The edge's endpoint with the lesser x
+	// is the potential bridge point
+	int p = outer;
+	do
+	{
+		node_t& pn = nodes[p];
+		node_t& nn = nodes[pn.next];
+		if (hy <= pn.y && hy >= nn.y && nn.y != pn.y)
+		{
+			double x = pn.x + (hy - pn.y) * (nn.x - pn.x) / (nn.y - pn.y);
+			if (x <= hx && (m < 0 || x > qx))
+			{
+				qx = x;
+				m = (pn.x < nn.x) ? p : pn.next;
+
+				// Hole touches the outer edge
+				if (x == hx)
+					return m;
+			}
+		}
+		p = pn.next;
+	}
+	while (p != outer);
+
+	if (m < 0)
+		return -1;
+
+	// Look for points inside the triangle of the hole point, edge
+	// intersection and endpoint. If there are any, use the one with the
+	// smallest angle to the ray instead
+	int stop = m;
+	double mx = nodes[m].x;
+	double my = nodes[m].y;
+	double tan_min = -1;
+	p = m;
+	do
+	{
+		node_t& pn = nodes[p];
+		if (hx >= pn.x && pn.x >= mx && hx != pn.x &&
+			pointInTriangle(hy < my ? hx : qx, hy, mx, my, hy < my ? qx : hx, hy, pn.x, pn.y))
+		{
+			double tan = fabs(hy - pn.y) / (hx - pn.x);
+			if (locallyInside(p, hole) &&
+				(tan_min < 0 || tan < tan_min || (tan == tan_min && (pn.x > nodes[m].x || (pn.x == nodes[m].x && wedgeContains(m, p))))))
+			{
+				m = p;
+				tan_min = tan;
+			}
+		}
+		p = pn.next;
+	}
+	while (p != stop);
+
+	return m;
+}
+
+/* PolygonTriangulator::eliminateHole
+ * Joins the ring with the [hole] node into the [outer] ring. Returns
+ * a node in the joined ring, or -1 on failure
+ *******************************************************************/
+int PolygonTriangulator::eliminateHole(int hole, int outer)
+{
+	// Find a bridge from the hole to the outer ring
+	int bridge = findHoleBridge(hole, outer);
+	if (bridge < 0)
+		return -1;
+
+	// Join the hole into the outer ring
+	int bridge_reverse = splitRing(bridge, hole);
+	filterPoints(bridge_reverse, nodes[bridge_reverse].next);
+	return filterPoints(bridge, nodes[bridge].next);
+}
+
+/* PolygonTriangulator::isEar
+ * Returns true if the triangle at node [ear] can be clipped off
+ *******************************************************************/
+bool PolygonTriangulator::isEar(int ear)
+{
+	int a = nodes[ear].prev;
+	int c = nodes[ear].next;
+
+	// Reflex, can't be an ear
+	if (area(a, ear, c) >= 0)
+		return false;
+
+	// Triangle bbox
+	node_t& na = nodes[a];
+	node_t& nb = nodes[ear];
+	node_t& nc = nodes[c];
+	double x0 = MIN(na.x, MIN(nb.x, nc.x));
+	double y0 = MIN(na.y, MIN(nb.y, nc.y));
+	double x1 = MAX(na.x, MAX(nb.x, nc.x));
+	double y1 = MAX(na.y, MAX(nb.y, nc.y));
+
+	// Make sure there are no other (reflex) points inside the ear
+	int p = nc.next;
+	while (p != a)
+	{
+		node_t& np = nodes[p];
+		if (np.x >= x0 && np.x <= x1 && np.y >= y0 && np.y <= y1 &&
+			!(np.x == na.x && np.y == na.y) &&
+			pointInTriangle(na.x, na.y, nb.x, nb.y, nc.x, nc.y, np.x, np.y) &&
+			area(np.prev, p, np.next) >= 0)
+			return false;
+		p = np.next;
+	}
+
+	return true;
+}
+
+/* PolygonTriangulator::cureLocalIntersections
+ * Clips off small self-intersections in the ring with [start].
+ * Returns a node in the remaining ring
+ *******************************************************************/
+int PolygonTriangulator::cureLocalIntersections(int start)
+{
+	// Look for a-p-n-b where a-p and n-b intersect
+	int p = start;
+	do
+	{
+		int a = nodes[p].prev;
+		int b = nodes[nodes[p].next].next;
+
+		if (!equals(a, b) && intersects(a, p, nodes[p].next, b) && locallyInside(a, b) && locallyInside(b, a))
+		{
+			triangles.push_back(nodes[a].vertex);
+			triangles.push_back(nodes[p].vertex);
+			triangles.push_back(nodes[b].vertex);
+
+			removeNode(p);
+			removeNode(nodes[p].next);
+
+			p = start = b;
+		}
+		p = nodes[p].next;
+	}
+	while (p != start);
+
+	return filterPoints(p);
+}
+
+/* PolygonTriangulator::clipEars
+ * Clips triangles off the ring with [ear] until none are left. On
+ * failure, [pass] 0 and 1 retry after filtering points and curing
+ * self-intersections respectively. Returns false if the ring
+ * couldn't be fully triangulated
+ *******************************************************************/
+bool PolygonTriangulator::clipEars(int ear, int pass)
+{
+	if (ear < 0)
+		return true;
+
+	// Keep clipping ears until only two nodes are left
+	int stop = ear;
+	while (nodes[ear].prev != nodes[ear].next)
+	{
+		int prev = nodes[ear].prev;
+		int next = nodes[ear].next;
+
+		if (isEar(ear))
+		{
+			triangles.push_back(nodes[prev].vertex);
+			triangles.push_back(nodes[ear].vertex);
+			triangles.push_back(nodes[next].vertex);
+
+			removeNode(ear);
+
+			// Skip the next vertex, it's usually a bad ear
+			ear = stop = nodes[next].next;
+			continue;
+		}
+
+		ear = next;
+
+		// Gone all the way around without finding an ear
+		if (ear == stop)
+		{
+			// Try filtering points and curing small self-intersections,
+			// otherwise give up
+			if (pass == 0)
+				return clipEars(filterPoints(ear), 1);
+			else if (pass == 1)
+				return clipEars(cureLocalIntersections(filterPoints(ear)), 2);
+			else
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/* turnsLeft
+ * Returns true if [v1->v2->v3] doesn't turn right (vertex positions)
+ *******************************************************************/
+static bool turnsLeft(double x1, double y1, double x2, double y2, double x3, double y3)
+{
+	return (x2 - x1) * (y3 - y1) - (y2 - y1) * (x3 - x1) >= 0;
+}
+
+/* PolygonTriangulator::mergeTriangles
+ * Merges the clipped triangles into convex polygons where possible,
+ * and adds them to [poly] as subpolys
+ *******************************************************************/
+void PolygonTriangulator::mergeTriangles(Polygon2D* poly)
+{
+	// Start with each triangle as a polygon
+	unsigned n_tris = triangles.size() / 3;
+	vector< vector<int> > polys(n_tris);
+	std::map<std::pair<int, int>, unsigned> edge_polys;
+	for (unsigned a = 0; a < n_tris; a++)
+	{
+		for (unsigned b = 0; b < 3; b++)
+		{
+			polys[a].push_back(triangles[a*3 + b]);
+			edge_polys[std::make_pair(triangles[a*3 + b], triangles[a*3 + (b+1)%3])] = a;
+		}
+	}
+
+	// Remove diagonals between polygons where the result is still convex
+	for (unsigned t = 0; t < triangles.size(); t++)
+	{
+		int va = triangles[t];
+		int vb = triangles[(t % 3 == 2) ? t - 2 : t + 1];
+
+		// Find the polygons on either side of the diagonal
+		std::map<std::pair<int, int>, unsigned>::iterator ip = edge_polys.find(std::make_pair(va, vb));
+		std::map<std::pair<int, int>, unsigned>::iterator iq = edge_polys.find(std::make_pair(vb, va));
+		if (ip == edge_polys.end() || iq == edge_polys.end() || ip->second == iq->second)
+			continue;
+		vector<int>& p = polys[ip->second];
+		vector<int>& q = polys[iq->second];
+
+		// Find the diagonal in each polygon
+		int np = p.size();
+		int nq = q.size();
+		int ia = -1;
+		int ib = -1;
+		for (int a = 0; a < np; a++)
+		{
+			if (p[a] == va && p[(a+1) % np] == vb)
+				ia = a;
+		}
+		for (int a = 0; a < nq; a++)
+		{
+			if (q[a] == vb && q[(a+1) % nq] == va)
+				ib = a;
+		}
+		if (ia < 0 || ib < 0)
+			continue;
+
+		// Check the merged polygon would be convex at both ends of the diagonal
+		vertex_t& a_prev = vertices[p[(ia + np - 1) % np]];
+		vertex_t& a_next = vertices[q[(ib + 2) % nq]];
+		vertex_t& b_prev = vertices[q[(ib + nq - 1) % nq]];
+		vertex_t& b_next = vertices[p[(ia + 2) % np]];
+		if (!turnsLeft(a_prev.x, a_prev.y, vertices[va].x, vertices[va].y, a_next.x, a_next.y) ||
+			!turnsLeft(b_prev.x, b_prev.y, vertices[vb].x, vertices[vb].y, b_next.x, b_next.y))
+			continue;
+
+		// Merge (b ... a from p, then the rest of q)
+		vector<int> merged;
+		for (int a = 1; a <= np; a++)
+			merged.push_back(p[(ia + a) % np]);
+		for (int a = 2; a < nq; a++)
+			merged.push_back(q[(ib + a) % nq]);
+
+		// Update polygons
+		unsigned index = ip->second;
+		edge_polys.erase(ip);
+		edge_polys.erase(iq);
+		q.clear();
+		p = merged;
+		for (unsigned a = 0; a < merged.size(); a++)
+		{
+			std::pair<int, int> edge(merged[a], merged[(a+1) % merged.size()]);
+			if (edge_polys.find(edge) != edge_polys.end())
+				edge_polys[edge] = index;
+		}
+	}
+
+	// Add polygons (reversed, so they are clockwise like the sector's edges)
+	for (unsigned a = 0; a < polys.size(); a++)
+	{
+		if (polys[a].size() < 3)
+			continue;
+
+		poly->addSubPoly();
+		gl_polygon_t* sub = poly->getSubPoly(poly->nSubPolys() - 1);
+		sub->n_vertices = polys[a].size();
+		sub->vertices = new gl_vertex_t[sub->n_vertices];
+		for (unsigned b = 0; b < polys[a].size(); b++)
+		{
+			vertex_t& v = vertices[polys[a][polys[a].size() - 1 - b]];
+			sub->vertices[b].x = v.x;
+			sub->vertices[b].y = v.y;
+		}
+	}
+}
+
+/* PolygonTriangulator::triangulate
+ * Traces outlines from the added edges and triangulates them (with
+ * any holes), adding the resulting convex polygons to [poly].
+ * Returns false if the edges are invalid
+ *******************************************************************/
+bool PolygonTriangulator::triangulate(Polygon2D* poly)
+{
+	// Trace all outlines, abort if any edges aren't part of one
+	for (unsigned a = 0; a < edges.size(); a++)
+	{
+		if (!edges[a].used && !traceOutline(a))
+			return false;
+	}
+
+	// Find the outer outline each inner (anticlockwise) outline is
+	// within. Inner outlines not within anything are invalid and ignored
+	vector< vector<int> > holes(outlines.size());
+	for (unsigned a = 0; a < outlines.size(); a++)
+	{
+		if (outlines[a].area <= 0)
+			continue;
+
+		int outer = findOuterOutline(a);
+		if (outer >= 0)
+			holes[outer].push_back(a);
+	}
+
+	// Triangulate each outer outline along with its holes
+	triangles.clear();
+	for (unsigned a = 0; a < outlines.size(); a++)
+	{
+		if (outlines[a].area >= 0 || outlines[a].verts.size() < 3)
+			continue;
+
+		nodes.clear();
+		int ring = createRing(outlines[a]);
+
+		// Join holes into the ring, left to right
+		if (!holes[a].empty())
+		{
+			vector<hole_t> queue;
+			for (unsigned b = 0; b < holes[a].size(); b++)
+			{
+				int hole_ring = createRing(outlines[holes[a][b]]);
+				if (hole_ring == nodes[hole_ring].next)
+					nodes[hole_ring].steiner = true;
+				int leftmost = leftmostNode(hole_ring);
+				queue.push_back(hole_t(nodes[leftmost].x, nodes[leftmost].y, leftmost));
+			}
+			std::sort(queue.begin(), queue.end());
+
+			for (unsigned b = 0; b < queue.size(); b++)
+			{
+				ring = eliminateHole(queue[b].node, ring);
+				if (ring < 0)
+					return false;
+			}
+		}
+
+		// Clip into triangles
+		if (!clipEars(ring, 0))
+			return false;
+	}
+
+	// Merge triangles into convex polygons
+	mergeTriangles(poly);
+
+	return true;
+}
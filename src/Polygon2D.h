@@ -2,6 +2,8 @@
 #ifndef __POLYGON_2D_H__
 #define __POLYGON_2D_H__
 
+#include <map>
+
 struct gl_vertex_t
 {
 	float x, y, z;
@@ -64,6 +66,8 @@ public:
 	unsigned		totalVertices();
 
 	bool	openSector(MapSector* sector);
+	bool	openEdges(vector<fpoint2_t>& edges);
+	void	swapPolygon(Polygon2D* other);
 	void	updateTextureCoords(double scale_x = 1, double scale_y = 1, double offset_x = 0, double offset_y = 0, double rotation = 0);
 
 	unsigned	vboDataSize();
@@ -76,6 +80,7 @@ public:
 	void	renderWireframeVBO(bool colour = true);
 
 	static void	setupVBOPointers();
+	static void	getSectorEdges(MapSector* sector, vector<fpoint2_t>& edges);
 };
 
 
@@ -147,4 +152,99 @@ public:
 	void	testRender();
 };
 
+
+/* PolygonTriangulator
+ * Builds convex sub-polygons for a sector by tracing its outlines,
+ * bridging any holes into the outer outline containing them, ear
+ * clipping the result into triangles and then merging the triangles
+ * back into convex polygons (so there are about as many sub-polygons
+ * as with PolygonSplitter, at a fraction of the cost).
+ *
+ * triangulate() returns false if the outlines can't be handled (eg.
+ * unclosed or badly self-intersecting sectors), in which case the
+ * caller should fall back to PolygonSplitter
+ *
+ * The ear clipping is adapted from Mapbox's earcut (ISC licence, see
+ * Polygon2D.cpp)
+ */
+class PolygonTriangulator
+{
+private:
+	// Structs
+	struct vertex_t
+	{
+		double		x, y;
+		vector<int>	edges_out;
+		vertex_t(double x = 0, double y = 0) { this->x = x; this->y = y; }
+	};
+	struct edge_t
+	{
+		int		v1, v2;
+		bool	used;
+	};
+	struct outline_t
+	{
+		vector<int>	verts;
+		bbox_t		bbox;
+		double		area;
+	};
+	struct node_t
+	{
+		int		vertex;
+		double	x, y;
+		int		prev, next;
+		bool	steiner;
+	};
+
+	// Triangulator data
+	vector<vertex_t>						vertices;
+	vector<edge_t>							edges;
+	std::map<std::pair<double, double>, int>	vertex_map;
+	vector<outline_t>						outlines;
+	vector<node_t>							nodes;
+	vector<int>								triangles;
+
+	// Outline tracing
+	int		nextEdge(int edge);
+	bool	traceOutline(int edge_start);
+	bool	pointInOutline(double x, double y, outline_t& outline);
+	int		findOuterOutline(int inner);
+
+	// Vertex rings (doubly-linked lists of nodes)
+	int		insertNode(int vertex, int last);
+	int		copyNode(int node);
+	void	removeNode(int node);
+	int		createRing(outline_t& outline);
+	double	area(int p, int q, int r);
+	bool	equals(int a, int b);
+	bool	intersects(int p1, int q1, int p2, int q2);
+	bool	locallyInside(int a, int b);
+	bool	wedgeContains(int m, int p);
+	int		filterPoints(int start, int end = -1);
+	int		leftmostNode(int start);
+	int		splitRing(int a, int b);
+
+	// Holes
+	int		findHoleBridge(int hole, int outer);
+	int		eliminateHole(int hole, int outer);
+
+	// Ear clipping
+	bool	isEar(int ear);
+	int		cureLocalIntersections(int start);
+	bool	clipEars(int ear, int pass);
+
+	void	mergeTriangles(Polygon2D* poly);
+
+public:
+	PolygonTriangulator();
+	~PolygonTriangulator();
+
+	void	clear();
+
+	int		addVertex(double x, double y);
+	int		addEdge(double x1, double y1, double x2, double y2);
+
+	bool	triangulate(Polygon2D* poly);
+};
+
 #endif//__POLYGON_2D_H__
@@ -55,7 +55,7 @@ Property::Property(uint8_t type)
 	else if (type == PROP_FLOAT)
 		value.Floating = 0.0f;
 	else if (type == PROP_STRING)
-		val_string = wxEmptyString;
+		value.String = new string();
 	else if (type == PROP_FLAG)
 		value.Boolean = true;
 	else if (type == PROP_UINT)
@@ -74,9 +74,13 @@ Property::Property(uint8_t type)
 Property::Property(const Property& copy)
 {
 	this->type = copy.type;
-	this->value = copy.value;
-	this->val_string = copy.val_string;
 	this->has_value = copy.has_value;
+
+	// Copy value (string values need their own copy)
+	if (type == PROP_STRING)
+		this->value.String = new string(*copy.value.String);
+	else
+		this->value = copy.value;
 }
 
 /* Property::Property
@@ -119,7 +123,7 @@ Property::Property(string value)
 {
 	// Init string property
 	this->type = PROP_STRING;
-	this->val_string = value;
+	this->value.String = new string(value);
 	this->has_value = true;
 }
 
@@ -139,6 +143,36 @@ Property::Property(unsigned value)
  *******************************************************************/
 Property::~Property()
 {
+	if (type == PROP_STRING)
+		delete value.String;
+}
+
+/* Property::operator=
+ * Copies the type and value of [copy] to this property
+ *******************************************************************/
+Property& Property::operator= (const Property& copy)
+{
+	if (&copy == this)
+		return *this;
+
+	// Reuse the string if both are string properties
+	if (type == PROP_STRING && copy.type == PROP_STRING)
+		*value.String = *copy.value.String;
+	else
+	{
+		if (type == PROP_STRING)
+			delete value.String;
+
+		if (copy.type == PROP_STRING)
+			value.String = new string(*copy.value.String);
+		else
+			value = copy.value;
+	}
+
+	type = copy.type;
+	has_value = copy.has_value;
+
+	return *this;
 }
 
 /* Property::getBoolValue
@@ -172,7 +206,7 @@ bool Property::getBoolValue(bool warn_wrong_type) const
 	else if (type == PROP_STRING)
 	{
 		// Anything except "0", "no" or "false" is considered true
-		if (!val_string.Cmp("0") || !val_string.CmpNoCase("no") || !val_string.CmpNoCase("false"))
+		if (!value.String->Cmp("0") || !value.String->CmpNoCase("no") || !value.String->CmpNoCase("false"))
 			return false;
 		else
 			return true;
@@ -211,7 +245,7 @@ int Property::getIntValue(bool warn_wrong_type) const
 	else if (type == PROP_FLOAT)
 		return (int)value.Floating;
 	else if (type == PROP_STRING)
-		return atoi(CHR(val_string));
+		return atoi(CHR(*value.String));
 
 	// Return default integer value
 	return 0;
@@ -246,7 +280,7 @@ double Property::getFloatValue(bool warn_wrong_type) const
 	else if (type == PROP_UINT)
 		return (double)value.Unsigned;
 	else if (type == PROP_STRING)
-		return (double)atof(CHR(val_string));
+		return (double)atof(CHR(*value.String));
 
 	// Return default float value
 	return 0.0f;
@@ -273,7 +307,7 @@ string Property::getStringValue(bool warn_wrong_type) const
 
 	// Return value (convert if needed)
 	if (type == PROP_STRING)
-		return val_string;
+		return *value.String;
 	else if (type == PROP_INT)
 		return S_FMT("%d", value.Integer);
 	else if (type == PROP_UINT)
@@ -319,7 +353,7 @@ unsigned Property::getUnsignedValue(bool warn_wrong_type) const
 	else if (type == PROP_FLOAT)
 		return (int)value.Floating;
 	else if (type == PROP_STRING)
-		return atoi(CHR(val_string));
+		return atoi(CHR(*value.String));
 	else if (type == PROP_UINT)
 		return value.Unsigned;
 
@@ -383,7 +417,7 @@ void Property::setValue(string val)
 		changeType(PROP_STRING);
 
 	// Set value
-	val_string = val;
+	*value.String = val;
 	has_value = true;
 }
 
@@ -411,9 +445,9 @@ void Property::changeType(uint8_t newtype)
 	if (type == newtype)
 		return;
 
-	// Clear string data if changing from string
+	// Free string data if changing from string
 	if (type == PROP_STRING)
-		val_string.Clear();
+		delete value.String;
 
 	// Update type
 	type = newtype;
@@ -426,7 +460,7 @@ void Property::changeType(uint8_t newtype)
 	else if (type == PROP_FLOAT)
 		value.Floating = 0.0f;
 	else if (type == PROP_STRING)
-		val_string = wxEmptyString;
+		value.String = new string();
 	else if (type == PROP_FLAG)
 		value.Boolean = true;
 	else if (type == PROP_UINT)
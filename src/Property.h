@@ -10,15 +10,15 @@
 #define PROP_FLAG	4	// The 'flag' property type mimics a boolean property that is always true
 #define PROP_UINT	5
 
-// Union for (most) property values
-union prop_value { bool Boolean; int Integer; double Floating; unsigned Unsigned; };
+// Union for property values. String values are allocated separately,
+// so that non-string properties don't need to carry an empty string
+union prop_value { bool Boolean; int Integer; double Floating; unsigned Unsigned; string* String; };
 
 class Property
 {
 private:
 	uint8_t		type;
 	prop_value	value;
-	string		val_string;	// I *would* put this in the union but i'm not sure about using const char* there
 	bool		has_value;
 
 public:
@@ -46,6 +46,8 @@ public:
 	inline operator string () { return getStringValue(); }
 	inline operator unsigned () { return getUnsignedValue(); }
 
+	Property& operator= (const Property& copy);
+
 	inline bool operator= (bool val) { setValue(val); return val; }
 	inline int operator= (int val) { setValue(val); return val; }
 	inline float operator= (float val) { setValue((double)val); return val; }
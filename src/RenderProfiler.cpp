@@ -0,0 +1,421 @@
+
+/*******************************************************************
+ * SLADE - It's a Doom Editor
+ * Copyright (C) 2008-2014 Simon Judd
+ *
+ * Email:       sirjuddington@gmail.com
+ * Web:         http://slade.mancubus.net
+ * Filename:    RenderProfiler.cpp
+ * Description: Functions for timing the passes that make up a map
+ *              editor frame (see RenderPassTimer), showing them in
+ *              an overlay and saving them to a CSV or trace file
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *******************************************************************/
+
+
+/*******************************************************************
+ * INCLUDES
+ *******************************************************************/
+#include "Main.h"
+#include "RenderProfiler.h"
+#include "OpenGL.h"
+#include "Drawing.h"
+#include "Console.h"
+#include <SFML/System.hpp>
+#include <wx/file.h>
+#include <deque>
+
+
+/*******************************************************************
+ * VARIABLES
+ *******************************************************************/
+CVAR(Bool, map_show_profiler, false, CVAR_SAVE)
+CVAR(Int, map_profiler_history, 1000, CVAR_SAVE)
+namespace RenderProfiler
+{
+	sf::Clock					profile_clock;
+	bool						frame_open = false;
+	unsigned					frame_number = 0;
+	frame_t						frame_current;
+	vector<unsigned>			pass_stack;		// Passes not yet ended in the current frame
+	std::deque<frame_t>			history;
+	unsigned					capture_left = 0;	// Frames left to capture (see startCapture)
+	const unsigned				overlay_avg = 20;	// Frames to average overlay times over
+}
+
+
+/*******************************************************************
+ * RENDERPROFILER NAMESPACE FUNCTIONS
+ *******************************************************************/
+
+/* RenderProfiler::now
+ * Returns the current profiler clock time in microseconds
+ *******************************************************************/
+namespace RenderProfiler
+{
+	long now()
+	{
+		return (long)profile_clock.getElapsedTime().asMicroseconds();
+	}
+}
+
+/* RenderProfiler::active
+ * Returns true if a profiled frame is in progress. Passes are only
+ * recorded while the overlay is shown or frames are being captured
+ *******************************************************************/
+bool RenderProfiler::active()
+{
+	return frame_open;
+}
+
+/* RenderProfiler::beginFrame
+ * Starts a new profiled frame in editor [mode], if profiling is
+ * enabled. Does nothing if a frame is already in progress (eg. when
+ * the canvas is redrawn after MapCanvas::update started the frame)
+ *******************************************************************/
+void RenderProfiler::beginFrame(string mode)
+{
+	if (frame_open)
+		return;
+	if (!map_show_profiler && capture_left == 0)
+		return;
+
+	frame_current.number = frame_number++;
+	frame_current.mode = mode;
+	frame_current.start = now();
+	frame_current.time = 0;
+	frame_current.passes.clear();
+	pass_stack.clear();
+	frame_open = true;
+}
+
+/* RenderProfiler::endFrame
+ * Ends the current profiled frame and adds it to the history
+ *******************************************************************/
+void RenderProfiler::endFrame()
+{
+	if (!frame_open)
+		return;
+
+	// End any passes left open
+	while (!pass_stack.empty())
+		endPass();
+
+	frame_current.time = now() - frame_current.start;
+	frame_open = false;
+
+	// Add to history
+	history.push_back(frame_current);
+	unsigned max = map_profiler_history < 1 ? 1 : map_profiler_history;
+	while (history.size() > max)
+		history.pop_front();
+
+	// Check for capture end
+	if (capture_left > 0)
+	{
+		capture_left--;
+		if (capture_left == 0)
+			theConsole->logMessage(S_FMT("Captured %lu frames, use map_profile_dump to save them", (unsigned long)history.size()));
+	}
+}
+
+/* RenderProfiler::beginPass
+ * Starts timing a pass called [name] in the current frame, nested
+ * within any pass that hasn't ended yet. [name] must stay valid for
+ * as long as the frame is kept in the history (ie. a literal)
+ *******************************************************************/
+void RenderProfiler::beginPass(const char* name)
+{
+	if (!frame_open)
+		return;
+
+	pass_t pass;
+	pass.name = name;
+	pass.depth = pass_stack.size();
+	pass.start = now() - frame_current.start;
+	pass.time = 0;
+	pass.count = -1;
+	pass.counter = false;
+	pass_stack.push_back(frame_current.passes.size());
+	frame_current.passes.push_back(pass);
+}
+
+/* RenderProfiler::endPass
+ * Ends the most recently started pass, recording [count] objects
+ * processed in it (-1 for none)
+ *******************************************************************/
+void RenderProfiler::endPass(int count)
+{
+	if (!frame_open || pass_stack.empty())
+		return;
+
+	pass_t& pass = frame_current.passes[pass_stack.back()];
+	pass.time = now() - frame_current.start - pass.start;
+	pass.count = count;
+	pass_stack.pop_back();
+}
+
+/* RenderProfiler::addCounter
+ * Records [value] for a counter called [name] in the current frame,
+ * nested within any pass that hasn't ended yet. Counters are for
+ * things that aren't timed, eg. draw calls or queued jobs. [name]
+ * must stay valid as for beginPass
+ *******************************************************************/
+void RenderProfiler::addCounter(const char* name, int value)
+{
+	if (!frame_open)
+		return;
+
+	pass_t pass;
+	pass.name = name;
+	pass.depth = pass_stack.size();
+	pass.start = now() - frame_current.start;
+	pass.time = 0;
+	pass.count = value;
+	pass.counter = true;
+	frame_current.passes.push_back(pass);
+}
+
+/* RenderProfiler::nFrames
+ * Returns the number of frames in the history
+ *******************************************************************/
+unsigned RenderProfiler::nFrames()
+{
+	return history.size();
+}
+
+/* RenderProfiler::getFrame
+ * Returns the frame at [index] in the history (oldest first), or
+ * NULL if [index] is out of range
+ *******************************************************************/
+RenderProfiler::frame_t* RenderProfiler::getFrame(unsigned index)
+{
+	if (index >= history.size())
+		return NULL;
+
+	return &history[index];
+}
+
+/* RenderProfiler::clearHistory
+ * Clears all frames from the history
+ *******************************************************************/
+void RenderProfiler::clearHistory()
+{
+	history.clear();
+}
+
+/* RenderProfiler::startCapture
+ * Clears the history and profiles the next [frames] frames, whether
+ * or not the overlay is shown
+ *******************************************************************/
+void RenderProfiler::startCapture(unsigned frames)
+{
+	clearHistory();
+	capture_left = frames;
+}
+
+/* RenderProfiler::writeCSV
+ * Writes all frames in the history to [filename] as CSV, one row per
+ * pass. Returns false if the file couldn't be opened
+ *******************************************************************/
+bool RenderProfiler::writeCSV(string filename)
+{
+	wxFile file(filename, wxFile::write);
+	if (!file.IsOpened())
+	{
+		Global::error = S_FMT("Unable to open file %s for writing", filename);
+		return false;
+	}
+
+	file.Write("frame,mode,frame_ms,pass,depth,start_ms,ms,count\n");
+	for (unsigned a = 0; a < history.size(); a++)
+	{
+		frame_t& frame = history[a];
+		for (unsigned p = 0; p < frame.passes.size(); p++)
+		{
+			pass_t& pass = frame.passes[p];
+			if (pass.counter)
+				file.Write(S_FMT("%d,%s,%1.3f,%s,%d,%1.3f,,%d\n", frame.number, frame.mode, frame.time * 0.001,
+				                 pass.name, pass.depth, pass.start * 0.001, pass.count));
+			else
+				file.Write(S_FMT("%d,%s,%1.3f,%s,%d,%1.3f,%1.3f,%d\n", frame.number, frame.mode, frame.time * 0.001,
+				                 pass.name, pass.depth, pass.start * 0.001, pass.time * 0.001, pass.count));
+		}
+	}
+
+	return true;
+}
+
+/* RenderProfiler::writeTrace
+ * Writes all frames in the history to [filename] in the trace event
+ * JSON format (as read by chrome://tracing and similar viewers).
+ * Returns false if the file couldn't be opened
+ *******************************************************************/
+bool RenderProfiler::writeTrace(string filename)
+{
+	wxFile file(filename, wxFile::write);
+	if (!file.IsOpened())
+	{
+		Global::error = S_FMT("Unable to open file %s for writing", filename);
+		return false;
+	}
+
+	file.Write("{\"traceEvents\":[\n");
+	bool first = true;
+	for (unsigned a = 0; a < history.size(); a++)
+	{
+		frame_t& frame = history[a];
+
+		// Frame
+		file.Write(S_FMT("%s{\"name\":\"Frame (%s)\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%ld,\"dur\":%ld,\"args\":{\"frame\":%d}}",
+		                 first ? "" : ",\n", frame.mode, frame.start, frame.time, frame.number));
+		first = false;
+
+		// Passes
+		for (unsigned p = 0; p < frame.passes.size(); p++)
+		{
+			pass_t& pass = frame.passes[p];
+			if (pass.counter)
+				file.Write(S_FMT(",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":1,\"ts\":%ld,\"args\":{\"value\":%d}}",
+				                 pass.name, frame.start + pass.start, pass.count));
+			else
+				file.Write(S_FMT(",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%ld,\"dur\":%ld,\"args\":{\"count\":%d}}",
+				                 pass.name, frame.start + pass.start, pass.time, pass.count));
+		}
+	}
+	file.Write("\n]}\n");
+
+	return true;
+}
+
+/* RenderProfiler::drawOverlay
+ * Draws the time taken by each pass in the last frame, averaged over
+ * recent frames (and the value of each counter), with its top left
+ * at [x,y]. Assumes an orthographic
+ * projection is set up in screen coordinates
+ *******************************************************************/
+void RenderProfiler::drawOverlay(int x, int y)
+{
+	if (!map_show_profiler || history.empty())
+		return;
+
+	// Get recent frames in the same mode as the last one
+	frame_t& last = history.back();
+	vector<frame_t*> frames;
+	for (int a = (int)history.size() - 1; a >= 0 && frames.size() < overlay_avg; a--)
+	{
+		if (history[a].mode == last.mode)
+			frames.push_back(&history[a]);
+	}
+
+	// Build text for each line
+	vector<string> text;
+	double frame_ms = 0;
+	for (unsigned a = 0; a < frames.size(); a++)
+		frame_ms += frames[a]->time;
+	text.push_back(S_FMT("Frame (%s): %1.2fms", last.mode, frame_ms * 0.001 / frames.size()));
+	for (unsigned p = 0; p < last.passes.size(); p++)
+	{
+		pass_t& pass = last.passes[p];
+
+		// Counters just show the last value
+		if (pass.counter)
+		{
+			text.push_back(string(' ', pass.depth * 4 + 2) + S_FMT("%s: %d", pass.name, pass.count));
+			continue;
+		}
+
+		// Average time for this pass over the recent frames
+		double total = 0;
+		for (unsigned a = 0; a < frames.size(); a++)
+		{
+			for (unsigned b = 0; b < frames[a]->passes.size(); b++)
+			{
+				pass_t& other = frames[a]->passes[b];
+				if (!other.counter && other.depth == pass.depth && strcmp(other.name, pass.name) == 0)
+					total += other.time;
+			}
+		}
+
+		string line = string(' ', pass.depth * 4 + 2) + S_FMT("%s: %1.2fms", pass.name, total * 0.001 / frames.size());
+		if (pass.count >= 0)
+			line += S_FMT(" (%d)", pass.count);
+		text.push_back(line);
+	}
+
+	// Determine size
+	double width = 0;
+	for (unsigned a = 0; a < text.size(); a++)
+	{
+		fpoint2_t size = Drawing::textExtents(text[a], Drawing::FONT_MONOSPACE);
+		if (size.x > width)
+			width = size.x;
+	}
+	int line_height = 16;
+
+	// Background
+	glDisable(GL_TEXTURE_2D);
+	OpenGL::setColour(rgba_t(0, 0, 0, 160, 0));
+	Drawing::drawFilledRect(x, y, x + width + 8, y + text.size() * line_height + 8);
+
+	// Text
+	glEnable(GL_TEXTURE_2D);
+	for (unsigned a = 0; a < text.size(); a++)
+		Drawing::drawText(text[a], x + 4, y + 4 + a * line_height, COL_WHITE, Drawing::FONT_MONOSPACE);
+}
+
+
+/*******************************************************************
+ * CONSOLE COMMANDS
+ *******************************************************************/
+
+CONSOLE_COMMAND(map_profile_capture, 0, true)
+{
+	long frames = 300;
+	if (args.size() > 0)
+		args[0].ToLong(&frames);
+	if (frames < 1)
+		frames = 1;
+	if (frames > map_profiler_history)
+		map_profiler_history = frames;
+
+	RenderProfiler::startCapture(frames);
+	theConsole->logMessage(S_FMT("Capturing %ld frames", frames));
+}
+
+CONSOLE_COMMAND(map_profile_dump, 0, true)
+{
+	if (RenderProfiler::nFrames() == 0)
+	{
+		theConsole->logMessage("No frames to dump, use map_profile_capture or enable map_show_profiler first");
+		return;
+	}
+
+	// Write as a trace if the filename ends in .json, otherwise csv
+	string filename = appPath("render_profile.csv", DIR_USER);
+	if (args.size() > 0)
+		filename = args[0];
+	bool ok;
+	if (filename.Lower().EndsWith(".json"))
+		ok = RenderProfiler::writeTrace(filename);
+	else
+		ok = RenderProfiler::writeCSV(filename);
+
+	if (ok)
+		theConsole->logMessage(S_FMT("Wrote %d frames to %s", RenderProfiler::nFrames(), filename));
+	else
+		theConsole->logMessage(Global::error);
+}
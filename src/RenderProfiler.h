@@ -0,0 +1,69 @@
+
+#ifndef __RENDER_PROFILER_H__
+#define __RENDER_PROFILER_H__
+
+namespace RenderProfiler
+{
+	struct pass_t
+	{
+		const char*	name;
+		unsigned	depth;	// Nesting level (0 = top level pass)
+		long		start;	// Start time relative to the frame start (us)
+		long		time;	// Time taken (us)
+		int			count;	// Number of objects processed (-1 if none)
+		bool		counter;	// Only a value (count), not timed (see addCounter)
+	};
+	struct frame_t
+	{
+		unsigned		number;
+		string			mode;
+		long			start;	// Profiler clock time at frame start (us)
+		long			time;	// Time from frame start to end (us)
+		vector<pass_t>	passes;
+	};
+
+	bool	active();
+	void	beginFrame(string mode);
+	void	endFrame();
+	void	beginPass(const char* name);
+	void	endPass(int count = -1);
+	void	addCounter(const char* name, int value);
+
+	// History
+	unsigned	nFrames();
+	frame_t*	getFrame(unsigned index);
+	void		clearHistory();
+	void		startCapture(unsigned frames);
+	bool		writeCSV(string filename);
+	bool		writeTrace(string filename);
+
+	// Overlay
+	void	drawOverlay(int x, int y);
+}
+
+// Times the enclosing scope as a profiler pass, if the profiler is
+// active. Passes started within the scope are nested under it
+class RenderPassTimer
+{
+private:
+	bool	started;
+	int		count;
+
+public:
+	RenderPassTimer(const char* name)
+	{
+		count = -1;
+		started = RenderProfiler::active();
+		if (started)
+			RenderProfiler::beginPass(name);
+	}
+	~RenderPassTimer()
+	{
+		if (started)
+			RenderProfiler::endPass(count);
+	}
+
+	void	setCount(int count) { this->count = count; }
+};
+
+#endif//__RENDER_PROFILER_H__
@@ -29,7 +29,6 @@
  *******************************************************************/
 #include "Main.h"
 #include "SLADEMap.h"
-#include "Parser.h"
 #include "MathStuff.h"
 #include "ResourceManager.h"
 #include "GameConfiguration.h"
@@ -40,9 +39,735 @@
 #include "SectorBuilder.h"
 #include "SplashWindow.h"
 #include <locale.h>
+#include <wx/thread.h>
+#include <wx/hashmap.h>
 #include <wx/colour.h>
+#include <map>
+#include <deque>
 
-#define IDEQ(x) (((x) != 0) && ((x) == id))
+
+/*******************************************************************
+ * VARIABLES
+ *******************************************************************/
+CVAR(Bool, map_udmf_write_threads, false, CVAR_SAVE)
+CVAR(Bool, map_polygon_threads, true, CVAR_SAVE)
+CVAR(Bool, map_polygon_background, true, CVAR_SAVE)
+
+
+/*******************************************************************
+ * UDMFSCANNER CLASS
+ *******************************************************************/
+
+/* UDMFScanner
+ * A minimal tokenizer for UDMF TEXTMAP data. Reads keys and values
+ * straight from the entry data, so that map objects can be created
+ * as each definition block is read rather than building a parse
+ * tree of the entire TEXTMAP first
+ *******************************************************************/
+class UDMFScanner
+{
+private:
+	const char*	start;
+	const char*	current;
+	const char*	end;
+	const char*	key_start;
+	unsigned	key_length;
+	std::string	token;
+
+	// Property name atoms for keys seen so far, by raw key text
+	std::map<std::string, unsigned>	key_atoms;
+
+	// Moves past any whitespace and comments
+	void skipWhitespace()
+	{
+		while (current < end)
+		{
+			if (*current == ' ' || *current == '\t' || *current == '\n' || *current == '\r')
+				current++;
+
+			// Line comment
+			else if (*current == '/' && current + 1 < end && current[1] == '/')
+			{
+				while (current < end && *current != '\n')
+					current++;
+			}
+
+			// Block comment
+			else if (*current == '/' && current + 1 < end && current[1] == '*')
+			{
+				current += 2;
+				while (current + 1 < end && !(current[0] == '*' && current[1] == '/'))
+					current++;
+				current = MIN(current + 2, end);
+			}
+
+			else
+				return;
+		}
+	}
+
+public:
+	UDMFScanner(const uint8_t* data, unsigned size)
+	{
+		start = current = (const char*)data;
+		end = start + size;
+		key_start = start;
+		key_length = 0;
+	}
+
+	unsigned	position() { return current - start; }
+	bool		atEnd() { skipWhitespace(); return current >= end; }
+
+	// Returns the line number at the current position (for errors)
+	unsigned lineNo()
+	{
+		return std::count(start, current, '\n') + 1;
+	}
+
+	// Moves past the next token if it is the character [c], returns
+	// false (and stays put) otherwise
+	bool checkChar(char c)
+	{
+		skipWhitespace();
+		if (current < end && *current == c)
+		{
+			current++;
+			return true;
+		}
+
+		return false;
+	}
+
+	// Reads an identifier (block or field name). Returns false if
+	// there isn't one at the current position
+	bool readKey()
+	{
+		skipWhitespace();
+		key_start = current;
+		while (current < end && (isalnum((uint8_t)*current) || *current == '_'))
+			current++;
+		key_length = current - key_start;
+
+		return key_length > 0;
+	}
+
+	// Returns true if the last key read matches [name] (which must be
+	// lowercase), ignoring case
+	bool keyIs(const char* name)
+	{
+		unsigned a = 0;
+		for (; a < key_length; a++)
+		{
+			if (name[a] == 0 || tolower((uint8_t)key_start[a]) != name[a])
+				return false;
+		}
+
+		return name[a] == 0;
+	}
+
+	// Returns the last key read as a string
+	string key()
+	{
+		return wxString::FromAscii(key_start, key_length);
+	}
+
+	// Returns the property name atom for the last key read. The key
+	// only needs converting to a string the first time it is seen
+	unsigned keyAtom()
+	{
+		token.assign(key_start, key_length);
+		std::map<std::string, unsigned>::iterator i = key_atoms.find(token);
+		if (i != key_atoms.end())
+			return i->second;
+
+		unsigned atom = MobjPropertyList::atom(key());
+		key_atoms[token] = atom;
+		return atom;
+	}
+
+	// Reads a value and its terminating ';' into [value]. The value
+	// type is detected the same way as in Parser: quoted strings,
+	// true/false, decimal or hex integers, floats, and anything else
+	// as an unquoted string
+	bool readValue(Property& value)
+	{
+		skipWhitespace();
+		token.clear();
+
+		// Quoted string
+		if (current < end && *current == '\"')
+		{
+			current++;
+			while (current < end && *current != '\"')
+			{
+				if (*current == '\\' && current + 1 < end)
+					current++;
+				token += *current++;
+			}
+			if (current >= end)
+				return false;
+			current++;
+
+			string str = wxString::FromUTF8(token.data(), token.size());
+			if (str.IsEmpty() && !token.empty())
+				str = wxString::From8BitData(token.data(), token.size());
+			value = str;
+
+			return checkChar(';');
+		}
+
+		// Unquoted value
+		while (current < end && *current != ';' && *current != ' ' && *current != '\t' &&
+		        *current != '\n' && *current != '\r' && *current != '/')
+			token += *current++;
+		if (token.empty())
+			return false;
+
+		const char* str = token.c_str();
+		char* str_end = NULL;
+		if (wxStricmp(str, "true") == 0)
+			value = true;
+		else if (wxStricmp(str, "false") == 0)
+			value = false;
+		else if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X'))
+		{
+			long val = strtol(str, &str_end, 16);
+			if (*str_end == 0)
+				value = (int)val;
+			else
+				value = wxString::FromAscii(str);
+		}
+		else
+		{
+			long val = strtol(str, &str_end, 10);
+			if (*str_end == 0)
+				value = (int)val;
+			else
+			{
+				double fval = strtod(str, &str_end);
+				if (*str_end == 0)
+					value = fval;
+				else
+					value = wxString::FromAscii(str);
+			}
+		}
+
+		return checkChar(';');
+	}
+
+	// Reads a 'key = value;' field within a block
+	bool readField(Property& value)
+	{
+		return readKey() && checkChar('=') && readValue(value);
+	}
+
+	// Skips all fields up to the end of the current block
+	bool skipBlock()
+	{
+		Property value;
+		while (!checkChar('}'))
+		{
+			if (!readField(value))
+				return false;
+		}
+
+		return true;
+	}
+};
+
+
+/*******************************************************************
+ * UDMFWRITER CLASS
+ *******************************************************************/
+
+/* UDMFWriter
+ * Formats map objects as UDMF text into a growable memory buffer.
+ * Numbers are formatted by hand rather than via printf, so output is
+ * the same regardless of the current locale (and a lot quicker)
+ *******************************************************************/
+class UDMFWriter
+{
+private:
+	std::string	buffer;
+
+public:
+	std::string&	data() { return buffer; }
+	void			reserve(unsigned size) { buffer.reserve(size); }
+
+	void	write(const char* text) { buffer.append(text); }
+	void	write(const std::string& text) { buffer.append(text); }
+
+	// Writes [text] as UTF-8
+	void write(const string& text)
+	{
+		wxScopedCharBuffer utf8 = text.utf8_str();
+		buffer.append(utf8.data(), utf8.length());
+	}
+
+	// Writes [text] as a quoted string, escaping as needed
+	void writeQuoted(const string& text)
+	{
+		wxScopedCharBuffer utf8 = text.utf8_str();
+		const char* c = utf8.data();
+		buffer += '\"';
+		for (unsigned a = 0; a < utf8.length(); a++)
+		{
+			if (c[a] == '\"' || c[a] == '\\')
+				buffer += '\\';
+			buffer += c[a];
+		}
+		buffer += '\"';
+	}
+
+	// Writes [value] in decimal
+	void writeUnsigned(uint64_t value)
+	{
+		char digits[24];
+		int n = 0;
+		do
+		{
+			digits[n++] = '0' + (value % 10);
+			value /= 10;
+		}
+		while (value > 0);
+
+		while (n > 0)
+			buffer += digits[--n];
+	}
+
+	// Writes the (positive, finite) whole number [value] in decimal,
+	// for values too large to convert to fixed-point
+	void writeWhole(double value)
+	{
+		char digits[400];
+		int n = 0;
+		value = floor(value + 0.5);
+		do
+		{
+			digits[n++] = '0' + (char)fmod(value, 10);
+			value = floor(value / 10);
+		}
+		while (value >= 1 && n < 400);
+
+		while (n > 0)
+			buffer += digits[--n];
+	}
+
+	// Writes [value] in decimal
+	void writeInt(int value)
+	{
+		if (value < 0)
+		{
+			buffer += '-';
+			writeUnsigned(0 - (int64_t)value);
+		}
+		else
+			writeUnsigned(value);
+	}
+
+	// Writes [value] with [decimals] digits after the decimal point,
+	// equivalent to printf's %1.<decimals>f
+	void writeFloat(double value, int decimals)
+	{
+		static const uint64_t scales[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+		if (decimals < 0) decimals = 0;
+		if (decimals > 6) decimals = 6;
+
+		// Values too large for fixed-point conversion are written without
+		// a fractional part, inf/nan aren't valid UDMF so are written as 0
+		if (!(fabs(value) < 1e12))
+		{
+			if (value - value != 0)
+				buffer += '0';
+			else
+			{
+				if (value < 0)
+					buffer += '-';
+				writeWhole(fabs(value));
+			}
+			return;
+		}
+
+		uint64_t scale = scales[decimals];
+		uint64_t fixed = (uint64_t)(fabs(value) * scale + 0.5);
+		if (value < 0)
+			buffer += '-';
+		writeUnsigned(fixed / scale);
+		if (decimals == 0)
+			return;
+
+		buffer += '.';
+		uint64_t frac = fixed % scale;
+		for (uint64_t div = scale / 10; div > 0; div /= 10)
+		{
+			buffer += '0' + (char)(frac / div);
+			frac %= div;
+		}
+	}
+
+	// Writes all properties in [props] that have a value
+	void writeProperties(MobjPropertyList& props)
+	{
+		vector<MobjPropertyList::prop_t>& list = props.allProperties();
+		for (unsigned a = 0; a < list.size(); a++)
+		{
+			Property& value = list[a].value;
+			if (!value.hasValue())
+				continue;
+
+			write(list[a].name());
+			buffer += '=';
+			switch (value.getType())
+			{
+			case PROP_BOOL:
+				write(value.getBoolValue() ? "true" : "false"); break;
+			case PROP_INT:
+				writeInt(value.getIntValue()); break;
+			case PROP_UINT:
+				writeUnsigned(value.getUnsignedValue()); break;
+			case PROP_FLOAT:
+				writeFloat(value.getFloatValue(), 6); break;
+			case PROP_STRING:
+				writeQuoted(value.getStringValue()); break;
+			default:
+				write(value.getStringValue()); break;
+			}
+			write(";\n");
+		}
+	}
+
+	// Writes an object's UDMF properties (see prepareObjects)
+	void writeObjectProperties(MapObject* object)
+	{
+		if (!object->props().isEmpty())
+			writeProperties(object->props());
+	}
+
+	void writeThing(MapThing* thing, unsigned index)
+	{
+		write("thing//#"); writeUnsigned(index); write("\n{\n");
+
+		// Basic properties
+		write("x="); writeFloat(thing->xPos(), 3);
+		write(";\ny="); writeFloat(thing->yPos(), 3);
+		write(";\ntype="); writeInt(thing->getType());
+		write(";\n");
+		if (thing->getAngle() != 0) { write("angle="); writeInt(thing->getAngle()); write(";\n"); }
+
+		// Other properties
+		writeObjectProperties(thing);
+
+		write("}\n\n");
+	}
+
+	void writeLine(MapLine* line, unsigned index)
+	{
+		write("linedef//#"); writeUnsigned(index); write("\n{\n");
+
+		// Basic properties
+		write("v1="); writeInt(line->v1Index());
+		write(";\nv2="); writeInt(line->v2Index());
+		write(";\nsidefront="); writeInt(line->s1Index());
+		write(";\n");
+		if (line->s2()) { write("sideback="); writeInt(line->s2Index()); write(";\n"); }
+		if (line->getSpecial() != 0) { write("special="); writeInt(line->getSpecial()); write(";\n"); }
+
+		// Other properties
+		writeObjectProperties(line);
+
+		write("}\n\n");
+	}
+
+	void writeSide(MapSide* side, unsigned index)
+	{
+		write("sidedef//#"); writeUnsigned(index); write("\n{\n");
+
+		// Basic properties
+		write("sector="); writeUnsigned(side->getSector()->getIndex()); write(";\n");
+		if (side->getTexUpper() != "-") { write("texturetop="); writeQuoted(side->getTexUpper()); write(";\n"); }
+		if (side->getTexMiddle() != "-") { write("texturemiddle="); writeQuoted(side->getTexMiddle()); write(";\n"); }
+		if (side->getTexLower() != "-") { write("texturebottom="); writeQuoted(side->getTexLower()); write(";\n"); }
+		if (side->getOffsetX() != 0) { write("offsetx="); writeInt(side->getOffsetX()); write(";\n"); }
+		if (side->getOffsetY() != 0) { write("offsety="); writeInt(side->getOffsetY()); write(";\n"); }
+
+		// Other properties
+		writeObjectProperties(side);
+
+		write("}\n\n");
+	}
+
+	void writeVertex(MapVertex* vertex, unsigned index)
+	{
+		write("vertex//#"); writeUnsigned(index); write("\n{\n");
+
+		// Basic properties
+		write("x="); writeFloat(vertex->xPos(), 3);
+		write(";\ny="); writeFloat(vertex->yPos(), 3);
+		write(";\n");
+
+		// Other properties
+		writeObjectProperties(vertex);
+
+		write("}\n\n");
+	}
+
+	void writeSector(MapSector* sector, unsigned index)
+	{
+		write("sector//#"); writeUnsigned(index); write("\n{\n");
+
+		// Basic properties
+		write("texturefloor="); writeQuoted(sector->getFloorTex());
+		write(";\ntextureceiling="); writeQuoted(sector->getCeilingTex());
+		write(";\n");
+		if (sector->getFloorHeight() != 0) { write("heightfloor="); writeInt(sector->getFloorHeight()); write(";\n"); }
+		if (sector->getCeilingHeight() != 0) { write("heightceiling="); writeInt(sector->getCeilingHeight()); write(";\n"); }
+		if (sector->getLightLevel() != 160) { write("lightlevel="); writeInt(sector->getLightLevel()); write(";\n"); }
+		if (sector->getSpecial() != 0) { write("special="); writeInt(sector->getSpecial()); write(";\n"); }
+		if (sector->getTag() != 0) { write("id="); writeInt(sector->getTag()); write(";\n"); }
+
+		// Other properties
+		writeObjectProperties(sector);
+
+		write("}\n\n");
+	}
+
+	// Removes internal and default value properties from all objects
+	// in [map], so they aren't written. Must be called (from the main
+	// thread) before writing objects, since it modifies them
+	static void prepareObjects(SLADEMap* map)
+	{
+		// Remove internal 'flags' property if it exists
+		for (unsigned a = 0; a < map->nThings(); a++)
+			map->getThing(a)->props().removeProperty("flags");
+		for (unsigned a = 0; a < map->nLines(); a++)
+			map->getLine(a)->props().removeProperty("flags");
+
+		// Remove properties with default values
+		for (unsigned a = 0; a < map->nThings(); a++)
+			cleanProps(map->getThing(a));
+		for (unsigned a = 0; a < map->nLines(); a++)
+			cleanProps(map->getLine(a));
+		for (unsigned a = 0; a < map->nSides(); a++)
+			cleanProps(map->getSide(a));
+		for (unsigned a = 0; a < map->nVertices(); a++)
+			cleanProps(map->getVertex(a));
+		for (unsigned a = 0; a < map->nSectors(); a++)
+			cleanProps(map->getSector(a));
+	}
+
+	static void cleanProps(MapObject* object)
+	{
+		if (!object->props().isEmpty())
+			theGameConfiguration->cleanObjectUDMFProps(object);
+	}
+
+	// Writes all objects of [type] in [map]
+	void writeObjects(SLADEMap* map, uint8_t type)
+	{
+		if (type == MOBJ_THING)
+		{
+			for (unsigned a = 0; a < map->nThings(); a++)
+				writeThing(map->getThing(a), a);
+		}
+		else if (type == MOBJ_LINE)
+		{
+			for (unsigned a = 0; a < map->nLines(); a++)
+				writeLine(map->getLine(a), a);
+		}
+		else if (type == MOBJ_SIDE)
+		{
+			for (unsigned a = 0; a < map->nSides(); a++)
+				writeSide(map->getSide(a), a);
+		}
+		else if (type == MOBJ_VERTEX)
+		{
+			for (unsigned a = 0; a < map->nVertices(); a++)
+				writeVertex(map->getVertex(a), a);
+		}
+		else if (type == MOBJ_SECTOR)
+		{
+			for (unsigned a = 0; a < map->nSectors(); a++)
+				writeSector(map->getSector(a), a);
+		}
+	}
+};
+
+/* UDMFWriteThread
+ * Worker thread that formats all map objects of one type with its
+ * own UDMFWriter, for parallel UDMF saving
+ *******************************************************************/
+class UDMFWriteThread : public wxThread
+{
+private:
+	SLADEMap*	map;
+	uint8_t		type;
+
+public:
+	UDMFWriter	writer;
+
+	UDMFWriteThread(SLADEMap* map, uint8_t type) : wxThread(wxTHREAD_JOINABLE)
+	{
+		this->map = map;
+		this->type = type;
+	}
+
+	ExitCode Entry()
+	{
+		writer.writeObjects(map, type);
+		return NULL;
+	}
+};
+
+// Outline edges copied from a sector, and the polygon built from them
+struct polygon_job_t
+{
+	unsigned			sector_id;
+	long				serial;
+	vector<fpoint2_t>	edges;
+	Polygon2D			polygon;
+};
+
+/* SectorPolygonThread
+ * Worker thread that builds the polygons for every [step]th job in
+ * [jobs], starting from [start]. The jobs hold outline edges copied
+ * from the map, so sectors can be done in parallel when the map is
+ * opened without the map being accessed from the thread
+ *******************************************************************/
+class SectorPolygonThread : public wxThread
+{
+private:
+	vector<polygon_job_t*>*	jobs;
+	unsigned				start;
+	unsigned				step;
+
+public:
+	SectorPolygonThread(vector<polygon_job_t*>* jobs, unsigned start, unsigned step) : wxThread(wxTHREAD_JOINABLE)
+	{
+		this->jobs = jobs;
+		this->start = start;
+		this->step = step;
+	}
+
+	static void buildPolygons(vector<polygon_job_t*>& jobs, unsigned start, unsigned step)
+	{
+		for (unsigned a = start; a < jobs.size(); a += step)
+			jobs[a]->polygon.openEdges(jobs[a]->edges);
+	}
+
+	ExitCode Entry()
+	{
+		buildPolygons(*jobs, start, step);
+		return NULL;
+	}
+};
+
+/* SectorPolygonWorker
+ * Background thread that builds sector polygons from outline edges
+ * copied from the map, so the map itself is never accessed from the
+ * thread. Jobs are taken from the front of the queue, and finished
+ * jobs are collected by SLADEMap::updateSectorPolygons
+ *******************************************************************/
+class SectorPolygonWorker : public wxThread
+{
+private:
+	wxMutex						mutex;
+	wxCondition					condition;
+	std::deque<polygon_job_t*>	jobs;
+	vector<polygon_job_t*>		finished;
+	bool						stopping;
+
+public:
+	SectorPolygonWorker() : wxThread(wxTHREAD_JOINABLE), condition(mutex)
+	{
+		stopping = false;
+	}
+
+	~SectorPolygonWorker()
+	{
+		clear();
+	}
+
+	// Adds [job] to the queue (at the front if [priority] is true),
+	// replacing any queued job for the same sector
+	void addJob(polygon_job_t* job, bool priority)
+	{
+		wxMutexLocker lock(mutex);
+
+		for (unsigned a = 0; a < jobs.size(); a++)
+		{
+			if (jobs[a]->sector_id == job->sector_id)
+			{
+				delete jobs[a];
+				jobs.erase(jobs.begin() + a);
+				break;
+			}
+		}
+
+		if (priority)
+			jobs.push_front(job);
+		else
+			jobs.push_back(job);
+
+		condition.Signal();
+	}
+
+	// Adds all finished jobs to [list]
+	void takeFinished(vector<polygon_job_t*>& list)
+	{
+		wxMutexLocker lock(mutex);
+		list.insert(list.end(), finished.begin(), finished.end());
+		finished.clear();
+	}
+
+	// Discards all queued and finished jobs
+	void clear()
+	{
+		wxMutexLocker lock(mutex);
+		for (unsigned a = 0; a < jobs.size(); a++)
+			delete jobs[a];
+		for (unsigned a = 0; a < finished.size(); a++)
+			delete finished[a];
+		jobs.clear();
+		finished.clear();
+	}
+
+	// Tells the thread to exit once the current job is done
+	void stop()
+	{
+		wxMutexLocker lock(mutex);
+		stopping = true;
+		condition.Signal();
+	}
+
+	ExitCode Entry()
+	{
+		while (true)
+		{
+			// Wait for a job
+			polygon_job_t* job = NULL;
+			mutex.Lock();
+			while (jobs.empty() && !stopping)
+				condition.Wait();
+			if (!stopping)
+			{
+				job = jobs.front();
+				jobs.pop_front();
+			}
+			mutex.Unlock();
+
+			if (!job)
+				break;
+
+			// Build polygon
+			job->polygon.openEdges(job->edges);
+
+			wxMutexLocker lock(mutex);
+			finished.push_back(job);
+		}
+
+		return NULL;
+	}
+};
 
 
 /*******************************************************************
@@ -55,12 +780,25 @@
 SLADEMap::SLADEMap()
 {
 	// Init variables
+	this->edit_generation = 0;
 	this->geometry_updated = 0;
+	this->things_updated = 0;
 	this->position_frac = false;
 
 	// Object id 0 is always null
 	all_objects.push_back(mobj_holder_t(NULL, false));
 
+	for (unsigned a = 0; a < 5; a++)
+	{
+		modified_compact_size[a] = 0;
+		index_log_start[a] = 0;
+	}
+	clearTagIndex();
+	list_changes = 0;
+	polygon_worker = NULL;
+	polygon_serial = 0;
+	polygon_background = true;
+
 	// Init opened time so it's not random leftover garbage values
 	setOpenedTime();
 }
@@ -70,6 +808,14 @@ SLADEMap::SLADEMap()
  *******************************************************************/
 SLADEMap::~SLADEMap()
 {
+	// Stop background polygon building
+	if (polygon_worker)
+	{
+		polygon_worker->stop();
+		polygon_worker->Wait();
+		delete polygon_worker;
+	}
+
 	clearMap();
 }
 
@@ -154,65 +900,404 @@ MapObject* SLADEMap::getObject(uint8_t type, unsigned index)
 }
 
 /* SLADEMap::setGeometryUpdated
- * Sets the geometry last updated time to now
+ * Marks the map geometry as updated (at a new edit generation)
  *******************************************************************/
 void SLADEMap::setGeometryUpdated()
 {
-	geometry_updated = theApp->runTimer();
+	geometry_updated = nextGeneration();
+}
+
+/* SLADEMap::setThingsUpdated
+ * Marks the thing list as updated (at a new edit generation)
+ *******************************************************************/
+void SLADEMap::setThingsUpdated()
+{
+	things_updated = nextGeneration();
+}
+
+/* SLADEMap::refreshIndices
+ * Refreshes all map object indices
+ *******************************************************************/
+void SLADEMap::refreshIndices()
+{
+	// Vertex indices
+	for (unsigned a = 0; a < vertices.size(); a++)
+	{
+		if (vertices[a]->index != a)
+		{
+			vertices[a]->index = a;
+			indexChanged(MOBJ_VERTEX, a);
+		}
+	}
+
+	// Side indices
+	for (unsigned a = 0; a < sides.size(); a++)
+	{
+		if (sides[a]->index != a)
+		{
+			sides[a]->index = a;
+			indexChanged(MOBJ_SIDE, a);
+		}
+	}
+
+	// Line indices
+	for (unsigned a = 0; a < lines.size(); a++)
+	{
+		if (lines[a]->index != a)
+		{
+			lines[a]->index = a;
+			indexChanged(MOBJ_LINE, a);
+		}
+	}
+
+	// Sector indices
+	for (unsigned a = 0; a < sectors.size(); a++)
+	{
+		if (sectors[a]->index != a)
+		{
+			sectors[a]->index = a;
+			indexChanged(MOBJ_SECTOR, a);
+		}
+	}
+
+	// Thing indices
+	for (unsigned a = 0; a < things.size(); a++)
+	{
+		if (things[a]->index != a)
+		{
+			things[a]->index = a;
+			indexChanged(MOBJ_THING, a);
+		}
+	}
+}
+
+/* SLADEMap::addMapObject
+ * Adds [object] to the map objects list
+ *******************************************************************/
+void SLADEMap::addMapObject(MapObject* object)
+{
+	all_objects.push_back(mobj_holder_t(object, true));
+	object->id = all_objects.size() - 1;
+	created_deleted_objects.push_back(mobj_cd_t(object->id, true));
+	objectModified(object);
+}
+
+/* SLADEMap::removeMapObject
+ * Removes [object] from the map (keeps it in the objects list, but
+ * removes the 'in map' flag)
+ *******************************************************************/
+void SLADEMap::removeMapObject(MapObject* object)
+{
+	all_objects[object->id].in_map = false;
+	created_deleted_objects.push_back(mobj_cd_t(object->id, false, object->index));
+}
+
+/* SLADEMap::objectModified
+ * Adds [object] to the modified objects log for its type. Called
+ * whenever an object's modified time changes
+ *******************************************************************/
+void SLADEMap::objectModified(MapObject* object)
+{
+	if (object->type < MOBJ_VERTEX || object->type > MOBJ_THING || object->id == 0)
+		return;
+
+	unsigned type_index = object->type - MOBJ_VERTEX;
+	modified_log[type_index].push_back(mobj_mod_t(object->id, object->modified_time));
+
+	// Remove old entries from the log if it's getting large
+	if (modified_log[type_index].size() >= MAX(1024u, modified_compact_size[type_index] * 2))
+		compactModifiedLog(type_index);
+}
+
+/* SLADEMap::firstModified
+ * Returns the index of the first entry in [log] modified at or after
+ * generation [since]
+ *******************************************************************/
+unsigned SLADEMap::firstModified(vector<mobj_mod_t>& log, long since)
+{
+	unsigned low = 0;
+	unsigned high = log.size();
+	while (low < high)
+	{
+		unsigned mid = (low + high) / 2;
+		if (log[mid].generation < since)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/* SLADEMap::isLatestModification
+ * Returns true if [mod] is the most recent modification of its
+ * object (ie. there are no later entries for it in the log)
+ *******************************************************************/
+bool SLADEMap::isLatestModification(mobj_mod_t& mod)
+{
+	MapObject* object = all_objects[mod.id].mobj;
+	return object && object->modified_time == mod.generation;
+}
+
+/* SLADEMap::compactModifiedLog
+ * Removes all entries from the modified objects log for
+ * [type_index] that have been superseded by later modifications
+ *******************************************************************/
+void SLADEMap::compactModifiedLog(unsigned type_index)
+{
+	vector<mobj_mod_t>& log = modified_log[type_index];
+	unsigned n = 0;
+	for (unsigned a = 0; a < log.size(); a++)
+	{
+		if (isLatestModification(log[a]))
+			log[n++] = log[a];
+	}
+	log.resize(n, mobj_mod_t(0, 0));
+
+	modified_compact_size[type_index] = n;
+}
+
+/* SLADEMap::indexChanged
+ * Adds [index] in the list for object [type] to the index change log,
+ * at a new edit generation
+ *******************************************************************/
+void SLADEMap::indexChanged(uint8_t type, unsigned index)
+{
+	if (type < MOBJ_VERTEX || type > MOBJ_THING)
+		return;
+
+	// Drop the log if it's getting large, anything checking for changes
+	// from before now will have to assume everything changed
+	vector<mobj_slot_t>& log = index_log[type - MOBJ_VERTEX];
+	if (log.size() >= 65536)
+	{
+		log.clear();
+		index_log_start[type - MOBJ_VERTEX] = edit_generation;
+	}
+
+	log.push_back(mobj_slot_t(index, nextGeneration()));
+}
+
+/* SLADEMap::resetIndexLog
+ * Clears the index change logs, for when object lists are rebuilt
+ *******************************************************************/
+void SLADEMap::resetIndexLog()
+{
+	long generation = nextGeneration();
+	for (unsigned a = 0; a < 5; a++)
+	{
+		index_log[a].clear();
+		index_log_start[a] = generation;
+	}
+}
+
+/* SLADEMap::discardObject
+ * Deletes [object], which was created while reading the map but was
+ * found to be invalid and never added to it
+ *******************************************************************/
+void SLADEMap::discardObject(MapObject* object)
+{
+	all_objects[object->id].set(NULL, false);
+	delete object;
+}
+
+/* SLADEMap::insertIntoList
+ * Adds [object] to the end of [list]. If [index] is given, the
+ * object currently at [index] is moved to the end and [object] takes
+ * its place (this reverses a removal at [index])
+ *******************************************************************/
+template<class T> void SLADEMap::insertIntoList(vector<T*>& list, T* object, int index)
+{
+	object->index = list.size();
+	list.push_back(object);
+	indexChanged(object->getObjType(), object->index);
+
+	if (index >= 0 && (unsigned)index < list.size() - 1)
+	{
+		list.back() = list[index];
+		list.back()->index = list.size() - 1;
+		list[index] = object;
+		object->index = index;
+		indexChanged(object->getObjType(), index);
+	}
+
+	all_objects[object->id].in_map = true;
+	list_changes++;
+}
+
+/* SLADEMap::removeFromList
+ * Removes [object] from [list], moving the last object in the list
+ * into its place (the same way objects are removed when editing)
+ *******************************************************************/
+template<class T> void SLADEMap::removeFromList(vector<T*>& list, T* object)
+{
+	unsigned index = object->index;
+	if (index >= list.size() || list[index] != object)
+		return;
+
+	list[index] = list.back();
+	list[index]->index = index;
+	list.pop_back();
+	indexChanged(object->getObjType(), index);
+
+	all_objects[object->id].in_map = false;
+	list_changes++;
+}
+
+/* SLADEMap::restoreObjectById
+ * Puts the object with [id] back into the map, at [index] in its
+ * type's list if given (see insertIntoList)
+ *******************************************************************/
+void SLADEMap::restoreObjectById(unsigned id, int index)
+{
+	MapObject* object = all_objects[id].mobj;
+	if (!object || all_objects[id].in_map)
+		return;
+
+	switch (object->getObjType())
+	{
+	case MOBJ_VERTEX:
+		insertIntoList(vertices, (MapVertex*)object, index); break;
+	case MOBJ_LINE:
+		insertIntoList(lines, (MapLine*)object, index); break;
+	case MOBJ_SIDE:
+		insertIntoList(sides, (MapSide*)object, index); break;
+	case MOBJ_SECTOR:
+		insertIntoList(sectors, (MapSector*)object, index); break;
+	case MOBJ_THING:
+		insertIntoList(things, (MapThing*)object, index); break;
+	default:
+		break;
+	}
+}
+
+/* SLADEMap::removeObjectById
+ * Takes the object with [id] out of the map (the object itself is
+ * kept so it can be restored later)
+ *******************************************************************/
+void SLADEMap::removeObjectById(unsigned id)
+{
+	MapObject* object = all_objects[id].mobj;
+	if (!object || !all_objects[id].in_map)
+		return;
+
+	switch (object->getObjType())
+	{
+	case MOBJ_VERTEX:
+		removeFromList(vertices, (MapVertex*)object); break;
+	case MOBJ_LINE:
+		removeFromList(lines, (MapLine*)object); break;
+	case MOBJ_SIDE:
+		removeFromList(sides, (MapSide*)object); break;
+	case MOBJ_SECTOR:
+		removeFromList(sectors, (MapSector*)object); break;
+	case MOBJ_THING:
+		removeFromList(things, (MapThing*)object); break;
+	default:
+		break;
+	}
 }
 
-/* SLADEMap::setThingsUpdated
- * Sets the things last updated time to now
+/* SLADEMap::keepObject
+ * Marks [object] as not to be freed by reclaimObjects, and adds it
+ * to [check] so that any objects it links to are kept as well
  *******************************************************************/
-void SLADEMap::setThingsUpdated()
+void SLADEMap::keepObject(MapObject* object, vector<bool>& keep, vector<MapObject*>& check)
 {
-	things_updated = theApp->runTimer();
+	if (!object || object->id >= keep.size() || keep[object->id])
+		return;
+
+	keep[object->id] = true;
+	check.push_back(object);
 }
 
-/* SLADEMap::refreshIndices
- * Refreshes all map object indices
+/* SLADEMap::reclaimObjects
+ * Frees all objects that have been removed from the map and can no
+ * longer be restored. Objects in the map, objects with ids in
+ * [referenced] (eg. from undo history), objects in the current
+ * created/deleted log, and any objects linked to from those are
+ * kept. Returns the number of objects freed
  *******************************************************************/
-void SLADEMap::refreshIndices()
+unsigned SLADEMap::reclaimObjects(vector<unsigned>& referenced)
 {
-	// Vertex indices
-	for (unsigned a = 0; a < vertices.size(); a++)
-		vertices[a]->index = a;
+	vector<bool> keep(all_objects.size(), false);
+	vector<MapObject*> check;
 
-	// Side indices
-	for (unsigned a = 0; a < sides.size(); a++)
-		sides[a]->index = a;
+	// Keep objects in the map
+	for (unsigned a = 1; a < all_objects.size(); a++)
+	{
+		if (all_objects[a].in_map)
+			keepObject(all_objects[a].mobj, keep, check);
+	}
 
-	// Line indices
-	for (unsigned a = 0; a < lines.size(); a++)
-		lines[a]->index = a;
+	// Keep referenced objects
+	for (unsigned a = 0; a < referenced.size(); a++)
+	{
+		if (referenced[a] < all_objects.size())
+			keepObject(all_objects[referenced[a]].mobj, keep, check);
+	}
+	for (unsigned a = 0; a < created_deleted_objects.size(); a++)
+	{
+		if (created_deleted_objects[a].id < all_objects.size())
+			keepObject(all_objects[created_deleted_objects[a].id].mobj, keep, check);
+	}
 
-	// Sector indices
-	for (unsigned a = 0; a < sectors.size(); a++)
-		sectors[a]->index = a;
+	// Keep anything linked to from a kept object
+	while (!check.empty())
+	{
+		MapObject* object = check.back();
+		check.pop_back();
 
-	// Thing indices
-	for (unsigned a = 0; a < things.size(); a++)
-		things[a]->index = a;
-}
+		if (object->type == MOBJ_VERTEX)
+		{
+			MapVertex* vertex = (MapVertex*)object;
+			for (unsigned a = 0; a < vertex->connected_lines.size(); a++)
+				keepObject(vertex->connected_lines[a], keep, check);
+		}
+		else if (object->type == MOBJ_LINE)
+		{
+			MapLine* line = (MapLine*)object;
+			keepObject(line->vertex1, keep, check);
+			keepObject(line->vertex2, keep, check);
+			keepObject(line->side1, keep, check);
+			keepObject(line->side2, keep, check);
+		}
+		else if (object->type == MOBJ_SIDE)
+		{
+			MapSide* side = (MapSide*)object;
+			keepObject(side->sector, keep, check);
+			keepObject(side->parent, keep, check);
+		}
+		else if (object->type == MOBJ_SECTOR)
+		{
+			MapSector* sector = (MapSector*)object;
+			for (unsigned a = 0; a < sector->connected_sides.size(); a++)
+				keepObject(sector->connected_sides[a], keep, check);
+		}
+	}
 
-/* SLADEMap::addMapObject
- * Adds [object] to the map objects list
- *******************************************************************/
-void SLADEMap::addMapObject(MapObject* object)
-{
-	all_objects.push_back(mobj_holder_t(object, true));
-	object->id = all_objects.size() - 1;
-	created_deleted_objects.push_back(mobj_cd_t(object->id, true));
-}
+	// Free everything else (the object's backup goes with it)
+	unsigned freed = 0;
+	for (unsigned a = 1; a < all_objects.size(); a++)
+	{
+		if (all_objects[a].mobj && !keep[a])
+		{
+			delete all_objects[a].mobj;
+			all_objects[a].set(NULL, false);
+			freed++;
+		}
+	}
 
-/* SLADEMap::removeMapObject
- * Removes [object] from the map (keeps it in the objects list, but
- * removes the 'in map' flag)
- *******************************************************************/
-void SLADEMap::removeMapObject(MapObject* object)
-{
-	all_objects[object->id].in_map = false;
-	created_deleted_objects.push_back(mobj_cd_t(object->id, false));
+	// Remove log entries for freed objects
+	if (freed > 0)
+	{
+		for (unsigned a = 0; a < 5; a++)
+			compactModifiedLog(a);
+	}
+
+	LOG_MESSAGE(3, "Reclaimed %d map objects", freed);
+
+	return freed;
 }
 
 /* SLADEMap::getObjectIdList
@@ -328,6 +1413,9 @@ void SLADEMap::restoreObjectIdList(uint8_t type, vector<unsigned>& list)
 			things.back()->index = things.size() - 1;
 		}
 	}
+
+	// Every index may have changed
+	resetIndexLog();
 }
 
 /* SLADEMap::readMap
@@ -375,9 +1463,9 @@ bool SLADEMap::readMap(Archive::mapdesc_t map)
 	if (ok)
 		current_format = map.format;
 
-	opened_time = theApp->runTimer() + 10;
+	initSectorPolygons(map_polygon_threads);
 
-	initSectorPolygons();
+	opened_time = edit_generation;
 
 	return ok;
 }
@@ -912,7 +2000,7 @@ bool SLADEMap::readDoomMap(Archive::mapdesc_t map)
 		sectors[a]->updateBBox();
 
 	// Update variables
-	geometry_updated = theApp->runTimer();
+	setGeometryUpdated();
 
 	return true;
 }
@@ -1400,30 +2488,45 @@ bool SLADEMap::readDoom64Map(Archive::mapdesc_t map)
 }
 
 /* SLADEMap::addVertex
- * Adds a vertex to the map from parsed UDMF vertex definition [def]
+ * Reads a UDMF vertex definition block from [udmf] and adds the
+ * vertex to the map. Returns false on a syntax error
  *******************************************************************/
-bool SLADEMap::addVertex(ParseTreeNode* def)
+bool SLADEMap::addVertex(UDMFScanner& udmf)
 {
-	// Check for required properties
-	ParseTreeNode* prop_x = (ParseTreeNode*)def->getChild("x");
-	ParseTreeNode* prop_y = (ParseTreeNode*)def->getChild("y");
-	if (!prop_x || !prop_y)
-		return false;
-
 	// Create new vertex
-	MapVertex* nv = new MapVertex(prop_x->getFloatValue(), prop_y->getFloatValue(), this);
+	MapVertex* nv = new MapVertex(this);
 
-	// Add extra vertex info
-	ParseTreeNode* prop = NULL;
-	for (unsigned a = 0; a < def->nChildren(); a++)
+	// Read vertex info
+	bool has_x = false;
+	bool has_y = false;
+	Property value;
+	while (!udmf.checkChar('}'))
 	{
-		prop = (ParseTreeNode*)def->getChild(a);
+		if (!udmf.readField(value))
+		{
+			discardObject(nv);
+			return false;
+		}
 
-		// Skip required properties
-		if (prop == prop_x || prop == prop_y)
-			continue;
+		if (udmf.keyIs("x"))
+		{
+			nv->x = value.getFloatValue();
+			has_x = true;
+		}
+		else if (udmf.keyIs("y"))
+		{
+			nv->y = value.getFloatValue();
+			has_y = true;
+		}
+		else
+			nv->properties[udmf.keyAtom()] = value;
+	}
 
-		nv->properties[prop->getName()] = prop->getValue();
+	// Check for required properties
+	if (!has_x || !has_y)
+	{
+		discardObject(nv);
+		return true;
 	}
 
 	// Add vertex to map
@@ -1433,22 +2536,15 @@ bool SLADEMap::addVertex(ParseTreeNode* def)
 }
 
 /* SLADEMap::addSide
- * Adds a side to the map from parsed UDMF side definition [def]
+ * Reads a UDMF side definition block from [udmf] and adds the side
+ * to the map. The side's sector index is added to [sector_refs], to
+ * be resolved once all sectors have been read. Returns false on a
+ * syntax error
  *******************************************************************/
-bool SLADEMap::addSide(ParseTreeNode* def)
+bool SLADEMap::addSide(UDMFScanner& udmf, vector<int>& sector_refs)
 {
-	// Check for required properties
-	ParseTreeNode* prop_sector = (ParseTreeNode*)def->getChild("sector");
-	if (!prop_sector)
-		return false;
-
-	// Check sector index
-	int sector = prop_sector->getIntValue();
-	if (sector < 0 || sector >= (int)sectors.size())
-		return false;
-
 	// Create new side
-	MapSide* ns = new MapSide(sectors[sector], this);
+	MapSide* ns = new MapSide(this);
 
 	// Set defaults
 	ns->offset_x = 0;
@@ -1457,113 +2553,100 @@ bool SLADEMap::addSide(ParseTreeNode* def)
 	ns->tex_middle = "-";
 	ns->tex_lower = "-";
 
-	// Add extra side info
-	ParseTreeNode* prop = NULL;
-	for (unsigned a = 0; a < def->nChildren(); a++)
+	// Read side info
+	int sector = -1;
+	Property value;
+	while (!udmf.checkChar('}'))
 	{
-		prop = (ParseTreeNode*)def->getChild(a);
-
-		// Skip required properties
-		if (prop == prop_sector)
-			continue;
+		if (!udmf.readField(value))
+		{
+			discardObject(ns);
+			return false;
+		}
 
-		if (S_CMPNOCASE(prop->getName(), "texturetop"))
-			ns->tex_upper = prop->getStringValue();
-		else if (S_CMPNOCASE(prop->getName(), "texturemiddle"))
-			ns->tex_middle = prop->getStringValue();
-		else if (S_CMPNOCASE(prop->getName(), "texturebottom"))
-			ns->tex_lower = prop->getStringValue();
-		else if (S_CMPNOCASE(prop->getName(), "offsetx"))
-			ns->offset_x = prop->getIntValue();
-		else if (S_CMPNOCASE(prop->getName(), "offsety"))
-			ns->offset_y = prop->getIntValue();
+		if (udmf.keyIs("sector"))
+			sector = value.getIntValue();
+		else if (udmf.keyIs("texturetop"))
+			ns->tex_upper = value.getStringValue();
+		else if (udmf.keyIs("texturemiddle"))
+			ns->tex_middle = value.getStringValue();
+		else if (udmf.keyIs("texturebottom"))
+			ns->tex_lower = value.getStringValue();
+		else if (udmf.keyIs("offsetx"))
+			ns->offset_x = value.getIntValue();
+		else if (udmf.keyIs("offsety"))
+			ns->offset_y = value.getIntValue();
 		else
-			ns->properties[prop->getName()] = prop->getValue();
-		//wxLogMessage("Property %s type %s (%s)", prop->getName(), prop->getValue().typeString(), prop->getValue().getStringValue());
+			ns->properties[udmf.keyAtom()] = value;
 	}
 
-	// Update texture counts
-	usage_tex[ns->tex_upper.Upper()] += 1;
-	usage_tex[ns->tex_middle.Upper()] += 1;
-	usage_tex[ns->tex_lower.Upper()] += 1;
-
-	// Add side to map
+	// Add side to map (sector is checked later)
 	sides.push_back(ns);
+	sector_refs.push_back(sector);
 
 	return true;
 }
 
 /* SLADEMap::addLine
- * Adds a line to the map from parsed UDMF line definition [def]
+ * Reads a UDMF line definition block from [udmf] and adds the line
+ * to the map. The line's v1, v2, sidefront and sideback indices are
+ * added to [refs], to be resolved once all vertices and sides have
+ * been read. Returns false on a syntax error
  *******************************************************************/
-bool SLADEMap::addLine(ParseTreeNode* def)
+bool SLADEMap::addLine(UDMFScanner& udmf, vector<int>& refs)
 {
-	// Check for required properties
-	ParseTreeNode* prop_v1 = (ParseTreeNode*)def->getChild("v1");
-	ParseTreeNode* prop_v2 = (ParseTreeNode*)def->getChild("v2");
-	ParseTreeNode* prop_s1 = (ParseTreeNode*)def->getChild("sidefront");
-	if (!prop_v1 || !prop_v2 || !prop_s1)
-		return false;
-
-	// Check indices
-	int v1 = prop_v1->getIntValue();
-	int v2 = prop_v2->getIntValue();
-	int s1 = prop_s1->getIntValue();
-	if (v1 < 0 || v1 >= (int)vertices.size())
-		return false;
-	if (v2 < 0 || v2 >= (int)vertices.size())
-		return false;
-	if (s1 < 0 || s1 >= (int)sides.size())
-		return false;
-
-	// Get second side if any
-	MapSide* side2 = NULL;
-	ParseTreeNode* prop_s2 = (ParseTreeNode*)def->getChild("sideback");
-	if (prop_s2) side2 = getSide(prop_s2->getIntValue());
-
 	// Create new line
-	MapLine* nl = new MapLine(vertices[v1], vertices[v2], sides[s1], side2, this);
+	MapLine* nl = new MapLine(this);
 
 	// Set defaults
 	nl->special = 0;
 
-	// Add extra line info
-	ParseTreeNode* prop = NULL;
-	for (unsigned a = 0; a < def->nChildren(); a++)
+	// Read line info
+	int v1 = -1;
+	int v2 = -1;
+	int s1 = -1;
+	int s2 = -1;
+	Property value;
+	while (!udmf.checkChar('}'))
 	{
-		prop = (ParseTreeNode*)def->getChild(a);
-
-		// Skip required properties
-		if (prop == prop_v1 || prop == prop_v2 || prop == prop_s1 || prop == prop_s2)
-			continue;
+		if (!udmf.readField(value))
+		{
+			discardObject(nl);
+			return false;
+		}
 
-		if (prop->getName() == "special")
-			nl->special = prop->getIntValue();
+		if (udmf.keyIs("v1"))
+			v1 = value.getIntValue();
+		else if (udmf.keyIs("v2"))
+			v2 = value.getIntValue();
+		else if (udmf.keyIs("sidefront"))
+			s1 = value.getIntValue();
+		else if (udmf.keyIs("sideback"))
+			s2 = value.getIntValue();
+		else if (udmf.keyIs("special"))
+			nl->special = value.getIntValue();
 		else
-			nl->properties[prop->getName()] = prop->getValue();
+			nl->properties[udmf.keyAtom()] = value;
 	}
 
-	// Add line to map
+	// Add line to map (vertices and sides are checked later)
 	lines.push_back(nl);
+	refs.push_back(v1);
+	refs.push_back(v2);
+	refs.push_back(s1);
+	refs.push_back(s2);
 
 	return true;
 }
 
 /* SLADEMap::addSector
- * Adds a sector to the map from parsed UDMF sector definition [def]
+ * Reads a UDMF sector definition block from [udmf] and adds the
+ * sector to the map. Returns false on a syntax error
  *******************************************************************/
-bool SLADEMap::addSector(ParseTreeNode* def)
+bool SLADEMap::addSector(UDMFScanner& udmf)
 {
-	// Check for required properties
-	ParseTreeNode* prop_ftex = (ParseTreeNode*)def->getChild("texturefloor");
-	ParseTreeNode* prop_ctex = (ParseTreeNode*)def->getChild("textureceiling");
-	if (!prop_ftex || !prop_ctex)
-		return false;
-
 	// Create new sector
-	MapSector* ns = new MapSector(prop_ftex->getStringValue(), prop_ctex->getStringValue(), this);
-	usage_flat[ns->f_tex.Upper()] += 1;
-	usage_flat[ns->c_tex.Upper()] += 1;
+	MapSector* ns = new MapSector(this);
 
 	// Set defaults
 	ns->f_height = 0;
@@ -1572,30 +2655,53 @@ bool SLADEMap::addSector(ParseTreeNode* def)
 	ns->special = 0;
 	ns->tag = 0;
 
-	// Add extra sector info
-	ParseTreeNode* prop = NULL;
-	for (unsigned a = 0; a < def->nChildren(); a++)
+	// Read sector info
+	bool has_ftex = false;
+	bool has_ctex = false;
+	Property value;
+	while (!udmf.checkChar('}'))
 	{
-		prop = (ParseTreeNode*)def->getChild(a);
-
-		// Skip required properties
-		if (prop == prop_ftex || prop == prop_ctex)
-			continue;
+		if (!udmf.readField(value))
+		{
+			discardObject(ns);
+			return false;
+		}
 
-		if (S_CMPNOCASE(prop->getName(), "heightfloor"))
-			ns->f_height = prop->getIntValue();
-		else if (S_CMPNOCASE(prop->getName(), "heightceiling"))
-			ns->c_height = prop->getIntValue();
-		else if (S_CMPNOCASE(prop->getName(), "lightlevel"))
-			ns->light = prop->getIntValue();
-		else if (S_CMPNOCASE(prop->getName(), "special"))
-			ns->special = prop->getIntValue();
-		else if (S_CMPNOCASE(prop->getName(), "id"))
-			ns->tag = prop->getIntValue();
+		if (udmf.keyIs("texturefloor"))
+		{
+			ns->f_tex = value.getStringValue();
+			has_ftex = true;
+		}
+		else if (udmf.keyIs("textureceiling"))
+		{
+			ns->c_tex = value.getStringValue();
+			has_ctex = true;
+		}
+		else if (udmf.keyIs("heightfloor"))
+			ns->f_height = value.getIntValue();
+		else if (udmf.keyIs("heightceiling"))
+			ns->c_height = value.getIntValue();
+		else if (udmf.keyIs("lightlevel"))
+			ns->light = value.getIntValue();
+		else if (udmf.keyIs("special"))
+			ns->special = value.getIntValue();
+		else if (udmf.keyIs("id"))
+			ns->tag = value.getIntValue();
 		else
-			ns->properties[prop->getName()] = prop->getValue();
+			ns->properties[udmf.keyAtom()] = value;
+	}
+
+	// Check for required properties
+	if (!has_ftex || !has_ctex)
+	{
+		discardObject(ns);
+		return true;
 	}
 
+	// Update flat counts
+	usage_flat[ns->f_tex.Upper()] += 1;
+	usage_flat[ns->c_tex.Upper()] += 1;
+
 	// Add sector to map
 	sectors.push_back(ns);
 
@@ -1603,35 +2709,53 @@ bool SLADEMap::addSector(ParseTreeNode* def)
 }
 
 /* SLADEMap::addThing
- * Adds a thing to the map from parsed UDMF thing definition [def]
+ * Reads a UDMF thing definition block from [udmf] and adds the
+ * thing to the map. Returns false on a syntax error
  *******************************************************************/
-bool SLADEMap::addThing(ParseTreeNode* def)
+bool SLADEMap::addThing(UDMFScanner& udmf)
 {
-	// Check for required properties
-	ParseTreeNode* prop_x = (ParseTreeNode*)def->getChild("x");
-	ParseTreeNode* prop_y = (ParseTreeNode*)def->getChild("y");
-	ParseTreeNode* prop_type = (ParseTreeNode*)def->getChild("type");
-	if (!prop_x || !prop_y || !prop_type)
-		return false;
-
 	// Create new thing
-	MapThing* nt = new MapThing(prop_x->getFloatValue(), prop_y->getFloatValue(), prop_type->getIntValue(), this);
+	MapThing* nt = new MapThing(this);
 
-	// Add extra thing info
-	ParseTreeNode* prop = NULL;
-	for (unsigned a = 0; a < def->nChildren(); a++)
+	// Read thing info
+	bool has_x = false;
+	bool has_y = false;
+	bool has_type = false;
+	Property value;
+	while (!udmf.checkChar('}'))
 	{
-		prop = (ParseTreeNode*)def->getChild(a);
-
-		// Skip required properties
-		if (prop == prop_x || prop == prop_y || prop == prop_type)
-			continue;
+		if (!udmf.readField(value))
+		{
+			discardObject(nt);
+			return false;
+		}
 
-		// Builtin properties
-		if (S_CMPNOCASE(prop->getName(), "angle"))
-			nt->angle = prop->getIntValue();
+		if (udmf.keyIs("x"))
+		{
+			nt->x = value.getFloatValue();
+			has_x = true;
+		}
+		else if (udmf.keyIs("y"))
+		{
+			nt->y = value.getFloatValue();
+			has_y = true;
+		}
+		else if (udmf.keyIs("type"))
+		{
+			nt->type = value.getIntValue();
+			has_type = true;
+		}
+		else if (udmf.keyIs("angle"))
+			nt->angle = value.getIntValue();
 		else
-			nt->properties[prop->getName()] = prop->getValue();
+			nt->properties[udmf.keyAtom()] = value;
+	}
+
+	// Check for required properties
+	if (!has_x || !has_y || !has_type)
+	{
+		discardObject(nt);
+		return true;
 	}
 
 	// Add thing to map
@@ -1640,111 +2764,133 @@ bool SLADEMap::addThing(ParseTreeNode* def)
 	return true;
 }
 
-/* SLADEMap::readDoomMap
+/* SLADEMap::readUDMFMap
  * Reads a UDMF format map using info in [map]
  *******************************************************************/
 bool SLADEMap::readUDMFMap(Archive::mapdesc_t map)
 {
 	// Get TEXTMAP entry (will always be after the 'head' entry)
 	ArchiveEntry* textmap = map.head->nextEntry();
+	MemChunk& data = textmap->getMCData();
 
-	// --- Parse UDMF text ---
-	theSplashWindow->setProgressMessage("Parsing TEXTMAP");
-	theSplashWindow->setProgress(-100.0f);
-	Parser parser;
-	if (!parser.parseText(textmap->getMCData()))
-		return false;
-
-	// --- Process parsed data ---
-
-	// First we have to sort the definition blocks by type so they can
-	// be created in the correct order (verts->sides->lines->sectors->things),
-	// even if they aren't defined in that order.
-	// Unknown definitions are also kept, just in case
-	theSplashWindow->setProgressMessage("Sorting definitions");
-	ParseTreeNode* root = parser.parseTreeRoot();
-	vector<ParseTreeNode*> defs_vertices;
-	vector<ParseTreeNode*> defs_lines;
-	vector<ParseTreeNode*> defs_sides;
-	vector<ParseTreeNode*> defs_sectors;
-	vector<ParseTreeNode*> defs_things;
-	vector<ParseTreeNode*> defs_other;
-	for (unsigned a = 0; a < root->nChildren(); a++)
-	{
-		theSplashWindow->setProgress((float)a / root->nChildren());
-
-		ParseTreeNode* node = (ParseTreeNode*)root->getChild(a);
-
-		// Vertex definition
-		if (S_CMPNOCASE(node->getName(), "vertex"))
-			defs_vertices.push_back(node);
-
-		// Line definition
-		else if (S_CMPNOCASE(node->getName(), "linedef"))
-			defs_lines.push_back(node);
+	// --- Read UDMF text ---
 
-		// Side definition
-		else if (S_CMPNOCASE(node->getName(), "sidedef"))
-			defs_sides.push_back(node);
-
-		// Sector definition
-		else if (S_CMPNOCASE(node->getName(), "sector"))
-			defs_sectors.push_back(node);
+	// Map objects are created as each definition block is read. Blocks
+	// can be defined in any order, so side->sector and line->vertex/side
+	// references are recorded as indices and resolved afterwards
+	theSplashWindow->setProgressMessage("Reading TEXTMAP");
+	theSplashWindow->setProgress(0.0f);
+	UDMFScanner udmf(data.getData(), data.getSize());
+	vector<int> side_refs;
+	vector<int> line_refs;
+	Property value;
+	unsigned n_blocks = 0;
+	bool ok = true;
+	while (ok && !udmf.atEnd())
+	{
+		if (++n_blocks % 1000 == 0)
+			theSplashWindow->setProgress((float)udmf.position() / (float)data.getSize());
+
+		// Read block (or global property) name
+		if (!udmf.readKey())
+		{
+			ok = false;
+			break;
+		}
 
-		// Thing definition
-		else if (S_CMPNOCASE(node->getName(), "thing"))
-			defs_things.push_back(node);
+		// Global property
+		if (udmf.checkChar('='))
+		{
+			ok = udmf.readValue(value);
+			if (ok && udmf.keyIs("namespace"))
+				udmf_namespace = value.getStringValue();
+		}
 
-		// Namespace
-		else if (S_CMPNOCASE(node->getName(), "namespace"))
-			udmf_namespace = node->getStringValue();
+		// Definition block
+		else if (udmf.checkChar('{'))
+		{
+			if (udmf.keyIs("vertex"))
+				ok = addVertex(udmf);
+			else if (udmf.keyIs("sidedef"))
+				ok = addSide(udmf, side_refs);
+			else if (udmf.keyIs("linedef"))
+				ok = addLine(udmf, line_refs);
+			else if (udmf.keyIs("sector"))
+				ok = addSector(udmf);
+			else if (udmf.keyIs("thing"))
+				ok = addThing(udmf);
+			else
+				ok = udmf.skipBlock();	// Unknown
+		}
 
-		// Unknown
 		else
-			defs_other.push_back(node);
+			ok = false;
 	}
 
-	// Now create map structures from parsed data, in the right order
-
-	// Create vertices from parsed data
-	theSplashWindow->setProgressMessage("Reading Vertices");
-	for (unsigned a = 0; a < defs_vertices.size(); a++)
+	if (!ok)
 	{
-		theSplashWindow->setProgress(((float)a / defs_vertices.size()) * 0.2f);
-		addVertex(defs_vertices[a]);
+		wxLogMessage("Error reading UDMF map: Syntax error in %s (line %d)", textmap->getName(), udmf.lineNo());
+		return false;
 	}
 
-	// Create sectors from parsed data
-	theSplashWindow->setProgressMessage("Reading Sectors");
-	for (unsigned a = 0; a < defs_sectors.size(); a++)
-	{
-		theSplashWindow->setProgress(0.2f + ((float)a / defs_sectors.size()) * 0.2f);
-		addSector(defs_sectors[a]);
-	}
+	// --- Resolve references ---
+	theSplashWindow->setProgressMessage("Resolving references");
+	theSplashWindow->setProgress(1.0f);
 
-	// Create sides from parsed data
-	theSplashWindow->setProgressMessage("Reading Sides");
-	for (unsigned a = 0; a < defs_sides.size(); a++)
+	// Connect sides to sectors, discarding any with an invalid sector
+	unsigned n_valid = 0;
+	for (unsigned a = 0; a < sides.size(); a++)
 	{
-		theSplashWindow->setProgress(0.4f + ((float)a / defs_sides.size()) * 0.2f);
-		addSide(defs_sides[a]);
-	}
+		MapSide* side = sides[a];
+		int sector = side_refs[a];
+		if (sector < 0 || sector >= (int)sectors.size())
+		{
+			discardObject(side);
+			continue;
+		}
 
-	// Create lines from parsed data
-	theSplashWindow->setProgressMessage("Reading Lines");
-	for (unsigned a = 0; a < defs_lines.size(); a++)
-	{
-		theSplashWindow->setProgress(0.6f + ((float)a / defs_lines.size()) * 0.2f);
-		addLine(defs_lines[a]);
+		side->sector = sectors[sector];
+		sectors[sector]->connectSide(side);
+
+		// Update texture counts
+		usage_tex[side->tex_upper.Upper()] += 1;
+		usage_tex[side->tex_middle.Upper()] += 1;
+		usage_tex[side->tex_lower.Upper()] += 1;
+
+		sides[n_valid++] = side;
 	}
+	sides.resize(n_valid);
 
-	// Create things from parsed data
-	theSplashWindow->setProgressMessage("Reading Things");
-	for (unsigned a = 0; a < defs_things.size(); a++)
+	// Connect lines to vertices and sides, discarding any with invalid
+	// vertices or front side
+	n_valid = 0;
+	for (unsigned a = 0; a < lines.size(); a++)
 	{
-		theSplashWindow->setProgress(0.8f + ((float)a / defs_things.size()) * 0.2f);
-		addThing(defs_things[a]);
+		MapLine* line = lines[a];
+		int v1 = line_refs[a * 4];
+		int v2 = line_refs[a * 4 + 1];
+		int s1 = line_refs[a * 4 + 2];
+		int s2 = line_refs[a * 4 + 3];
+		if (v1 < 0 || v1 >= (int)vertices.size() ||
+		        v2 < 0 || v2 >= (int)vertices.size() ||
+		        s1 < 0 || s1 >= (int)sides.size())
+		{
+			discardObject(line);
+			continue;
+		}
+
+		line->vertex1 = vertices[v1];
+		line->vertex2 = vertices[v2];
+		line->side1 = sides[s1];
+		line->side2 = (s2 >= 0) ? getSide(s2) : NULL;
+		line->vertex1->connectLine(line);
+		line->vertex2->connectLine(line);
+		line->side1->parent = line;
+		if (line->side2) line->side2->parent = line;
+
+		lines[n_valid++] = line;
 	}
+	lines.resize(n_valid);
 
 	theSplashWindow->setProgressMessage("Init map data");
 
@@ -2333,157 +3479,62 @@ bool SLADEMap::writeUDMFMap(ArchiveEntry* textmap)
 	if (!textmap)
 		return false;
 
-	// Open temp text file
-	wxFile tempfile(appPath("sladetemp.txt", DIR_TEMP), wxFile::write);
-
 	// When creating a new map, retrieve UDMF namespace information from the configuration
 	if (udmf_namespace.IsEmpty()) udmf_namespace = theGameConfiguration->udmfNamespace();
 
 	// Write map namespace
-	tempfile.Write("// Written by SLADE3\n");
-	tempfile.Write(S_FMT("namespace=\"%s\";\n", udmf_namespace));
-
-	//sf::Clock clock;
-
-	// Locale for float number format
-	setlocale(LC_NUMERIC, "C");
-
-	// Write things
-	string object_def;
-	for (unsigned a = 0; a < things.size(); a++)
-	{
-		object_def = S_FMT("thing//#%u\n{\n", a);
-
-		// Basic properties
-		object_def += S_FMT("x=%1.3f;\ny=%1.3f;\ntype=%d;\n", things[a]->x, things[a]->y, things[a]->type);
-		if (things[a]->angle != 0) object_def += S_FMT("angle=%d;\n", things[a]->angle);
-
-		// Remove internal 'flags' property if it exists
-		things[a]->props().removeProperty("flags");
-
-		// Other properties
-		if (!things[a]->properties.isEmpty())
-		{
-			theGameConfiguration->cleanObjectUDMFProps(things[a]);
-			object_def += things[a]->properties.toString(true);
-		}
-
-		object_def += "}\n\n";
-		tempfile.Write(object_def);
-	}
-	//wxLogMessage("Writing things took %dms", clock.getElapsedTime().asMilliseconds());
-
-	// Write lines
-	//clock.restart();
-	for (unsigned a = 0; a < lines.size(); a++)
-	{
-		object_def = S_FMT("linedef//#%u\n{\n", a);
-
-		// Basic properties
-		object_def += S_FMT("v1=%d;\nv2=%d;\nsidefront=%d;\n", lines[a]->v1Index(), lines[a]->v2Index(), lines[a]->s1Index());
-		if (lines[a]->s2())
-			object_def += S_FMT("sideback=%d;\n", lines[a]->s2Index());
-		if (lines[a]->special != 0)
-			object_def += S_FMT("special=%d;\n", lines[a]->special);
-
-		// Remove internal 'flags' property if it exists
-		lines[a]->props().removeProperty("flags");
-
-		// Other properties
-		if (!lines[a]->properties.isEmpty())
-		{
-			theGameConfiguration->cleanObjectUDMFProps(lines[a]);
-			object_def += lines[a]->properties.toString(true);
-		}
-
-		object_def += "}\n\n";
-		tempfile.Write(object_def);
-	}
-	//wxLogMessage("Writing lines took %dms", clock.getElapsedTime().asMilliseconds());
-
-	// Write sides
-	//clock.restart();
-	for (unsigned a = 0; a < sides.size(); a++)
-	{
-		object_def = S_FMT("sidedef//#%u\n{\n", a);
-
-		// Basic properties
-		object_def += S_FMT("sector=%u;\n", sides[a]->sector->getIndex());
-		if (sides[a]->tex_upper != "-")
-			object_def += S_FMT("texturetop=\"%s\";\n", sides[a]->tex_upper);
-		if (sides[a]->tex_middle != "-")
-			object_def += S_FMT("texturemiddle=\"%s\";\n", sides[a]->tex_middle);
-		if (sides[a]->tex_lower != "-")
-			object_def += S_FMT("texturebottom=\"%s\";\n", sides[a]->tex_lower);
-		if (sides[a]->offset_x != 0)
-			object_def += S_FMT("offsetx=%d;\n", sides[a]->offset_x);
-		if (sides[a]->offset_y != 0)
-			object_def += S_FMT("offsety=%d;\n", sides[a]->offset_y);
-
-		// Other properties
-		if (!sides[a]->properties.isEmpty())
-		{
-			theGameConfiguration->cleanObjectUDMFProps(sides[a]);
-			object_def += sides[a]->properties.toString(true);
-		}
-
-		object_def += "}\n\n";
-		tempfile.Write(object_def);
-	}
-	//wxLogMessage("Writing sides took %dms", clock.getElapsedTime().asMilliseconds());
-
-	// Write vertices
-	//clock.restart();
-	for (unsigned a = 0; a < vertices.size(); a++)
-	{
-		object_def = S_FMT("vertex//#%u\n{\n", a);
-
-		// Basic properties
-		object_def += S_FMT("x=%1.3f;\ny=%1.3f;\n", vertices[a]->x, vertices[a]->y);
-
-		// Other properties
-		if (!vertices[a]->properties.isEmpty())
+	UDMFWriter udmf;
+	udmf.reserve(128 + (things.size() + lines.size() + sides.size() + vertices.size() + sectors.size()) * 96);
+	udmf.write("// Written by SLADE3\n");
+	udmf.write("namespace=");
+	udmf.writeQuoted(udmf_namespace);
+	udmf.write(";\n");
+
+	// Clean up object properties before writing (possibly from other
+	// threads, which only read the map)
+	UDMFWriter::prepareObjects(this);
+
+	// Object blocks are written in this order
+	uint8_t types[] = { MOBJ_THING, MOBJ_LINE, MOBJ_SIDE, MOBJ_VERTEX, MOBJ_SECTOR };
+
+	// Format each object type in its own thread if enabled, then
+	// append the results in order
+	if (map_udmf_write_threads)
+	{
+		UDMFWriteThread* threads[5];
+		for (unsigned a = 0; a < 5; a++)
 		{
-			theGameConfiguration->cleanObjectUDMFProps(vertices[a]);
-			object_def += vertices[a]->properties.toString(true);
+			threads[a] = new UDMFWriteThread(this, types[a]);
+			if (threads[a]->Run() != wxTHREAD_NO_ERROR)
+			{
+				delete threads[a];
+				threads[a] = NULL;
+			}
 		}
 
-		object_def += "}\n\n";
-		tempfile.Write(object_def);
-	}
-	//wxLogMessage("Writing vertices took %dms", clock.getElapsedTime().asMilliseconds());
-
-	// Write sectors
-	//clock.restart();
-	for (unsigned a = 0; a < sectors.size(); a++)
-	{
-		object_def = S_FMT("sector//#%u\n{\n", a);
-
-		// Basic properties
-		object_def += S_FMT("texturefloor=\"%s\";\ntextureceiling=\"%s\";\n", sectors[a]->f_tex, sectors[a]->c_tex);
-		if (sectors[a]->f_height != 0) object_def += S_FMT("heightfloor=%d;\n", sectors[a]->f_height);
-		if (sectors[a]->c_height != 0) object_def += S_FMT("heightceiling=%d;\n", sectors[a]->c_height);
-		if (sectors[a]->light != 160) object_def += S_FMT("lightlevel=%d;\n", sectors[a]->light);
-		if (sectors[a]->special != 0) object_def += S_FMT("special=%d;\n", sectors[a]->special);
-		if (sectors[a]->tag != 0) object_def += S_FMT("id=%d;\n", sectors[a]->tag);
-
-		// Other properties
-		if (!sectors[a]->properties.isEmpty())
+		for (unsigned a = 0; a < 5; a++)
 		{
-			theGameConfiguration->cleanObjectUDMFProps(sectors[a]);
-			object_def += sectors[a]->properties.toString(true);
+			if (threads[a])
+			{
+				threads[a]->Wait();
+				udmf.write(threads[a]->writer.data());
+				delete threads[a];
+			}
+			else
+			{
+				// Thread couldn't be started, write here instead
+				udmf.writeObjects(this, types[a]);
+			}
 		}
-
-		object_def += "}\n\n";
-		tempfile.Write(object_def);
 	}
-	//wxLogMessage("Writing sectors took %dms", clock.getElapsedTime().asMilliseconds());
-
-	// Close file
-	tempfile.Close();
+	else
+	{
+		for (unsigned a = 0; a < 5; a++)
+			udmf.writeObjects(this, types[a]);
+	}
 
-	// Load file to entry
-	textmap->importFile(appPath("sladetemp.txt", DIR_TEMP));
+	// Write text to entry
+	textmap->importMem(udmf.data().data(), udmf.data().size());
 
 	return true;
 }
@@ -2507,6 +3558,21 @@ void SLADEMap::clearMap()
 			delete all_objects[a].mobj;
 	}
 	all_objects.clear();
+	created_deleted_objects.clear();
+	for (unsigned a = 0; a < 5; a++)
+	{
+		modified_log[a].clear();
+		modified_compact_size[a] = 0;
+	}
+	resetIndexLog();
+	clearTagIndex();
+	for (unsigned a = 0; a < 5; a++)
+		spatial_index[a] = mobj_grid_t();
+
+	// Discard any pending background polygons (any still being built
+	// will have an older serial than the new sectors' polygons)
+	if (polygon_worker)
+		polygon_worker->clear();
 
 	// Object id 0 is always null
 	all_objects.push_back(mobj_holder_t(NULL, false));
@@ -2552,10 +3618,11 @@ bool SLADEMap::removeVertex(unsigned index)
 	removeMapObject(vertices[index]);
 	vertices[index] = vertices.back();
 	vertices[index]->index = index;
+	indexChanged(MOBJ_VERTEX, index);
 	//vertices[index]->modified_time = theApp->runTimer();
 	vertices.pop_back();
 
-	geometry_updated = theApp->runTimer();
+	setGeometryUpdated();
 
 	return true;
 }
@@ -2602,10 +3669,11 @@ bool SLADEMap::removeLine(unsigned index)
 	removeMapObject(lines[index]);
 	lines[index] = lines[lines.size()-1];
 	lines[index]->index = index;
+	indexChanged(MOBJ_LINE, index);
 	//lines[index]->modified_time = theApp->runTimer();
 	lines.pop_back();
 
-	geometry_updated = theApp->runTimer();
+	setGeometryUpdated();
 
 	return true;
 }
@@ -2668,6 +3736,7 @@ bool SLADEMap::removeSide(unsigned index, bool remove_from_line)
 	removeMapObject(sides[index]);
 	sides[index] = sides.back();
 	sides[index]->index = index;
+	indexChanged(MOBJ_SIDE, index);
 	//sides[index]->modified_time = theApp->runTimer();
 	sides.pop_back();
 
@@ -2707,6 +3776,7 @@ bool SLADEMap::removeSector(unsigned index)
 	removeMapObject(sectors[index]);
 	sectors[index] = sectors.back();
 	sectors[index]->index = index;
+	indexChanged(MOBJ_SECTOR, index);
 	//sectors[index]->modified_time = theApp->runTimer();
 	sectors.pop_back();
 
@@ -2738,10 +3808,11 @@ bool SLADEMap::removeThing(unsigned index)
 	removeMapObject(things[index]);
 	things[index] = things.back();
 	things[index]->index = index;
+	indexChanged(MOBJ_THING, index);
 	//things[index]->modified_time = theApp->runTimer();
 	things.pop_back();
 
-	things_updated = theApp->runTimer();
+	setThingsUpdated();
 
 	return true;
 }
@@ -2948,6 +4019,296 @@ bbox_t SLADEMap::getMapBBox()
 	return bbox;
 }
 
+/* SLADEMap::spatialIndexValid
+ * Returns true if the spatial index for [type] is up to date, ie.
+ * nothing it depends on has been added, removed or modified since it
+ * was built
+ *******************************************************************/
+bool SLADEMap::spatialIndexValid(uint8_t type)
+{
+	mobj_grid_t& grid = spatial_index[type - MOBJ_VERTEX];
+	if (grid.generation < 0 || grid.list_changes != list_changes)
+		return false;
+
+	// Check object count
+	size_t count = 0;
+	switch (type)
+	{
+	case MOBJ_VERTEX: count = vertices.size(); break;
+	case MOBJ_LINE: count = lines.size(); break;
+	case MOBJ_SECTOR: count = sectors.size(); break;
+	case MOBJ_THING: count = things.size(); break;
+	default: return false;
+	}
+	if (count != grid.n_objects)
+		return false;
+
+	// Check for added/removed objects
+	if (type == MOBJ_THING && things_updated > grid.generation)
+		return false;
+	if (type != MOBJ_THING && geometry_updated > grid.generation)
+		return false;
+
+	// Check for modified objects. Lines depend on their vertices, and
+	// sectors on their sides, lines and vertices
+	uint8_t first = (type == MOBJ_THING) ? MOBJ_THING : MOBJ_VERTEX;
+	for (uint8_t t = first; t <= type; t++)
+	{
+		vector<mobj_mod_t>& log = modified_log[t - MOBJ_VERTEX];
+		if (!log.empty() && log.back().generation > grid.generation)
+			return false;
+	}
+
+	return true;
+}
+
+// Returns the grid cell (column or row) containing [pos], clamped to
+// the grid
+static unsigned gridCell(double pos, double origin, double cell_size, unsigned count)
+{
+	double cell = (pos - origin) / cell_size;
+	if (cell < 1)
+		return 0;
+	if (cell >= count)
+		return count - 1;
+	return (unsigned)cell;
+}
+
+/* SLADEMap::getIndexBounds
+ * Gets the bounds used for the object of [type] at [index] in the
+ * spatial index (for vertices and things, min and max are both the
+ * object's position)
+ *******************************************************************/
+void SLADEMap::getIndexBounds(uint8_t type, unsigned index, bbox_t& bounds)
+{
+	if (type == MOBJ_VERTEX)
+	{
+		bounds.min.set(vertices[index]->x, vertices[index]->y);
+		bounds.max = bounds.min;
+	}
+	else if (type == MOBJ_LINE)
+	{
+		MapVertex* v1 = lines[index]->vertex1;
+		MapVertex* v2 = lines[index]->vertex2;
+		bounds.min.set(MIN(v1->x, v2->x), MIN(v1->y, v2->y));
+		bounds.max.set(MAX(v1->x, v2->x), MAX(v1->y, v2->y));
+	}
+	else if (type == MOBJ_SECTOR)
+		bounds = sectors[index]->boundingBox();
+	else if (type == MOBJ_THING)
+	{
+		bounds.min.set(things[index]->x, things[index]->y);
+		bounds.max = bounds.min;
+	}
+}
+
+/* SLADEMap::updateSpatialIndex
+ * Rebuilds the spatial index for objects of [type] if needed
+ *******************************************************************/
+void SLADEMap::updateSpatialIndex(uint8_t type)
+{
+	if (spatialIndexValid(type))
+		return;
+
+	mobj_grid_t& grid = spatial_index[type - MOBJ_VERTEX];
+	grid.generation = edit_generation;
+	grid.list_changes = list_changes;
+	grid.objects.clear();
+	grid.cell_start.clear();
+	grid.large.clear();
+	grid.max_width = 0;
+	grid.max_height = 0;
+
+	switch (type)
+	{
+	case MOBJ_VERTEX: grid.n_objects = vertices.size(); break;
+	case MOBJ_LINE: grid.n_objects = lines.size(); break;
+	case MOBJ_SECTOR: grid.n_objects = sectors.size(); break;
+	case MOBJ_THING: grid.n_objects = things.size(); break;
+	default: grid.n_objects = 0; break;
+	}
+
+	// Get object bounds, and the extents of their minimum corners
+	vector<bbox_t> bounds(grid.n_objects);
+	double min_x = 0, min_y = 0, max_x = 0, max_y = 0;
+	for (unsigned a = 0; a < grid.n_objects; a++)
+	{
+		getIndexBounds(type, a, bounds[a]);
+		fpoint2_t& p = bounds[a].min;
+
+		if (a == 0)
+		{
+			min_x = max_x = p.x;
+			min_y = max_y = p.y;
+		}
+		else
+		{
+			min_x = MIN(min_x, p.x);
+			min_y = MIN(min_y, p.y);
+			max_x = MAX(max_x, p.x);
+			max_y = MAX(max_y, p.y);
+		}
+	}
+
+	// Setup grid (roughly 4 objects per cell)
+	unsigned size = (unsigned)ceil(sqrt(grid.n_objects / 4.0));
+	size = MAX(1u, MIN(size, 1024u));
+	grid.x = min_x;
+	grid.y = min_y;
+	grid.cols = grid.rows = size;
+	grid.cell_width = MAX((max_x - min_x) / size, 1.0);
+	grid.cell_height = MAX((max_y - min_y) / size, 1.0);
+
+	// Get cell for each object and count objects per cell
+	vector<int> cells(grid.n_objects, -1);
+	grid.cell_start.assign(grid.cols * grid.rows + 1, 0);
+	for (unsigned a = 0; a < grid.n_objects; a++)
+	{
+		double width = bounds[a].max.x - bounds[a].min.x;
+		double height = bounds[a].max.y - bounds[a].min.y;
+
+		// Objects spanning a lot of cells would make every area query
+		// check lots of cells, so keep them separate
+		if (width > grid.cell_width * 4 || height > grid.cell_height * 4)
+		{
+			grid.large.push_back(a);
+			continue;
+		}
+		grid.max_width = MAX(grid.max_width, width);
+		grid.max_height = MAX(grid.max_height, height);
+
+		unsigned cx = gridCell(bounds[a].min.x, grid.x, grid.cell_width, grid.cols);
+		unsigned cy = gridCell(bounds[a].min.y, grid.y, grid.cell_height, grid.rows);
+		cells[a] = cy * grid.cols + cx;
+		grid.cell_start[cells[a] + 1]++;
+	}
+	for (unsigned a = 1; a < grid.cell_start.size(); a++)
+		grid.cell_start[a] += grid.cell_start[a - 1];
+
+	// Add objects to cells
+	vector<unsigned> fill(grid.cell_start.begin(), grid.cell_start.end() - 1);
+	grid.objects.resize(grid.cell_start.back());
+	for (unsigned a = 0; a < grid.n_objects; a++)
+	{
+		if (cells[a] >= 0)
+			grid.objects[fill[cells[a]]++] = a;
+	}
+}
+
+/* SLADEMap::getObjectsWithin
+ * Adds the indices of all objects of [type] that are completely within
+ * the box from [xmin,ymin] to [xmax,ymax] to [list], in index order.
+ * Vertices and things are within the box if their position is, lines
+ * if both their vertices are and sectors if their bounding box is
+ *******************************************************************/
+void SLADEMap::getObjectsWithin(uint8_t type, double xmin, double ymin, double xmax, double ymax, vector<unsigned>& list)
+{
+	if (type != MOBJ_VERTEX && type != MOBJ_LINE && type != MOBJ_SECTOR && type != MOBJ_THING)
+		return;
+
+	updateSpatialIndex(type);
+	mobj_grid_t& grid = spatial_index[type - MOBJ_VERTEX];
+	unsigned start = list.size();
+	bbox_t bounds;
+
+	// Check large objects
+	for (unsigned a = 0; a < grid.large.size(); a++)
+	{
+		getIndexBounds(type, grid.large[a], bounds);
+		if (bounds.min.x >= xmin && bounds.max.x <= xmax && bounds.min.y >= ymin && bounds.max.y <= ymax)
+			list.push_back(grid.large[a]);
+	}
+
+	// Get range of cells that could contain objects within the box
+	// (objects are in the cell containing their minimum corner, so
+	// only cells overlapping the box need checking)
+	if (!grid.objects.empty() && xmax >= grid.x && ymax >= grid.y)
+	{
+		unsigned cx1 = gridCell(xmin, grid.x, grid.cell_width, grid.cols);
+		unsigned cy1 = gridCell(ymin, grid.y, grid.cell_height, grid.rows);
+		unsigned cx2 = gridCell(xmax, grid.x, grid.cell_width, grid.cols);
+		unsigned cy2 = gridCell(ymax, grid.y, grid.cell_height, grid.rows);
+
+		// Check objects in each cell
+		for (unsigned cy = cy1; cy <= cy2; cy++)
+		{
+			for (unsigned cx = cx1; cx <= cx2; cx++)
+			{
+				unsigned cell = cy * grid.cols + cx;
+				for (unsigned a = grid.cell_start[cell]; a < grid.cell_start[cell + 1]; a++)
+				{
+					getIndexBounds(type, grid.objects[a], bounds);
+					if (bounds.min.x >= xmin && bounds.max.x <= xmax && bounds.min.y >= ymin && bounds.max.y <= ymax)
+						list.push_back(grid.objects[a]);
+				}
+			}
+		}
+	}
+
+	// Sort by index
+	std::sort(list.begin() + start, list.end());
+}
+
+/* SLADEMap::getObjectsOverlapping
+ * Adds the indices of all objects of [type] that overlap the box from
+ * [xmin,ymin] to [xmax,ymax] to [list], in index order. If [margin] is
+ * given, objects are treated as being that much bigger on each side
+ * (eg. to include the radius of things)
+ *******************************************************************/
+void SLADEMap::getObjectsOverlapping(uint8_t type, double xmin, double ymin, double xmax, double ymax, vector<unsigned>& list, double margin)
+{
+	if (type != MOBJ_VERTEX && type != MOBJ_LINE && type != MOBJ_SECTOR && type != MOBJ_THING)
+		return;
+
+	updateSpatialIndex(type);
+	mobj_grid_t& grid = spatial_index[type - MOBJ_VERTEX];
+	unsigned start = list.size();
+	bbox_t bounds;
+
+	// Apply margin to the box instead of each object
+	xmin -= margin;
+	ymin -= margin;
+	xmax += margin;
+	ymax += margin;
+
+	// Check large objects
+	for (unsigned a = 0; a < grid.large.size(); a++)
+	{
+		getIndexBounds(type, grid.large[a], bounds);
+		if (bounds.max.x >= xmin && bounds.min.x <= xmax && bounds.max.y >= ymin && bounds.min.y <= ymax)
+			list.push_back(grid.large[a]);
+	}
+
+	// Get range of cells that could contain objects overlapping the
+	// box (objects can extend past their cell by up to the largest
+	// object size)
+	if (!grid.objects.empty() && xmax >= grid.x && ymax >= grid.y)
+	{
+		unsigned cx1 = gridCell(xmin - grid.max_width, grid.x, grid.cell_width, grid.cols);
+		unsigned cy1 = gridCell(ymin - grid.max_height, grid.y, grid.cell_height, grid.rows);
+		unsigned cx2 = gridCell(xmax, grid.x, grid.cell_width, grid.cols);
+		unsigned cy2 = gridCell(ymax, grid.y, grid.cell_height, grid.rows);
+
+		// Check objects in each cell
+		for (unsigned cy = cy1; cy <= cy2; cy++)
+		{
+			for (unsigned cx = cx1; cx <= cx2; cx++)
+			{
+				unsigned cell = cy * grid.cols + cx;
+				for (unsigned a = grid.cell_start[cell]; a < grid.cell_start[cell + 1]; a++)
+				{
+					getIndexBounds(type, grid.objects[a], bounds);
+					if (bounds.max.x >= xmin && bounds.min.x <= xmax && bounds.max.y >= ymin && bounds.min.y <= ymax)
+						list.push_back(grid.objects[a]);
+				}
+			}
+		}
+	}
+
+	// Sort by index
+	std::sort(list.begin() + start, list.end());
+}
+
 /* SLADEMap::vertexAt
  * Returns the vertex at [x,y], or NULL if none there
  *******************************************************************/
@@ -3087,30 +4448,32 @@ MapVertex* SLADEMap::lineCrossVertex(double x1, double y1, double x2, double y2)
  *******************************************************************/
 void SLADEMap::updateGeometryInfo(long modified_time)
 {
-	for (unsigned a = 0; a < vertices.size(); a++)
+	vector<mobj_mod_t>& log = modified_log[MOBJ_VERTEX - 1];
+	for (unsigned a = firstModified(log, modified_time + 1); a < log.size(); a++)
 	{
-		if (vertices[a]->modifiedTime() > modified_time)
+		if (!all_objects[log[a].id].in_map || !isLatestModification(log[a]))
+			continue;
+
+		MapVertex* vertex = (MapVertex*)all_objects[log[a].id].mobj;
+		for (unsigned l = 0; l < vertex->connected_lines.size(); l++)
 		{
-			for (unsigned l = 0; l < vertices[a]->connected_lines.size(); l++)
-			{
-				MapLine* line = vertices[a]->connected_lines[l];
+			MapLine* line = vertex->connected_lines[l];
 
-				// Update line geometry
-				line->resetInternals();
+			// Update line geometry
+			line->resetInternals();
 
-				// Update front sector
-				if (line->frontSector())
-				{
-					line->frontSector()->resetPolygon();
-					line->frontSector()->updateBBox();
-				}
+			// Update front sector
+			if (line->frontSector())
+			{
+				line->frontSector()->resetPolygon();
+				line->frontSector()->updateBBox();
+			}
 
-				// Update back sector
-				if (line->backSector())
-				{
-					line->backSector()->resetPolygon();
-					line->backSector()->updateBBox();
-				}
+			// Update back sector
+			if (line->backSector())
+			{
+				line->backSector()->resetPolygon();
+				line->backSector()->updateBBox();
 			}
 		}
 	}
@@ -3155,48 +4518,473 @@ void SLADEMap::findSectorTextPoint(MapSector* sector)
 
 		if (dist < min_dist)
 		{
-			min_dist = dist;
-			mid_side = sector->connected_sides[a];
+			min_dist = dist;
+			mid_side = sector->connected_sides[a];
+		}
+	}
+
+	// Calculate ray
+	fpoint2_t r_o = mid_side->parent->getPoint(MOBJ_POINT_MID);
+	fpoint2_t r_d = mid_side->parent->frontVector();
+	if (mid_side == mid_side->parent->side1)
+		r_d.set(-r_d.x, -r_d.y);
+
+	// Find nearest intersecting line
+	min_dist = 9999999999.0;
+	for (unsigned a = 0; a < sector->connected_sides.size(); a++)
+	{
+		if (sector->connected_sides[a] == mid_side)
+			continue;
+
+		MapLine* line = sector->connected_sides[a]->parent;
+		double dist = MathStuff::distanceRayLine(r_o, r_o + r_d, line->x1(), line->y1(), line->x2(), line->y2());
+
+		if (dist > 0 && dist < min_dist)
+			min_dist = dist;
+	}
+
+	// Set text point to halfway between the two lines
+	sector->text_point.set(r_o.x + (r_d.x * min_dist * 0.5), r_o.y + (r_d.y * min_dist * 0.5));
+}
+
+/* SLADEMap::initSectorPolygons
+ * Forces building of polygons for all sectors, split between worker
+ * threads if [use_threads] is true
+ *******************************************************************/
+void SLADEMap::initSectorPolygons(bool use_threads)
+{
+	theSplashWindow->setProgressMessage("Building sector polygons");
+	theSplashWindow->setProgress(0.0f);
+
+	// Copy the outline edges of each sector needing a polygon, so the
+	// worker threads don't access the map
+	vector<polygon_job_t*> jobs;
+	vector<MapSector*> job_sectors;
+	for (unsigned a = 0; a < sectors.size(); a++)
+	{
+		if (!sectors[a]->poly_needsupdate)
+			continue;
+
+		polygon_job_t* job = new polygon_job_t();
+		job->sector_id = sectors[a]->getId();
+		job->serial = polygon_serial;
+		Polygon2D::getSectorEdges(sectors[a], job->edges);
+		jobs.push_back(job);
+		job_sectors.push_back(sectors[a]);
+	}
+
+	// Split jobs between worker threads if enabled, this thread does
+	// every [n_threads]th job from 0 and updates progress
+	vector<SectorPolygonThread*> threads;
+	unsigned n_threads = 1;
+	if (use_threads && jobs.size() > 64)
+	{
+		int n_cpus = wxThread::GetCPUCount();
+		if (n_cpus > 1)
+			n_threads = n_cpus;
+
+		for (unsigned a = 1; a < n_threads; a++)
+		{
+			SectorPolygonThread* thread = new SectorPolygonThread(&jobs, a, n_threads);
+			if (thread->Run() != wxTHREAD_NO_ERROR)
+			{
+				delete thread;
+				thread = NULL;
+			}
+			threads.push_back(thread);
+		}
+	}
+
+	for (unsigned a = 0; a < jobs.size(); a += n_threads)
+	{
+		theSplashWindow->setProgress((float)a / (float)jobs.size());
+		jobs[a]->polygon.openEdges(jobs[a]->edges);
+	}
+
+	// Wait for worker threads to finish
+	for (unsigned a = 0; a < threads.size(); a++)
+	{
+		if (threads[a])
+		{
+			threads[a]->Wait();
+			delete threads[a];
+		}
+		else
+		{
+			// Thread couldn't be started, do its jobs here instead
+			SectorPolygonThread::buildPolygons(jobs, a + 1, n_threads);
+		}
+	}
+
+	// Give the polygons to their sectors
+	for (unsigned a = 0; a < jobs.size(); a++)
+	{
+		job_sectors[a]->polygon.swapPolygon(&jobs[a]->polygon);
+		job_sectors[a]->poly_needsupdate = false;
+		job_sectors[a]->poly_serial = jobs[a]->serial;
+		delete jobs[a];
+	}
+
+	theSplashWindow->setProgress(1.0f);
+}
+
+/* SLADEMap::requestSectorPolygon
+ * Queues [sector]'s polygon to be rebuilt in the background. The
+ * new polygon is given to the sector in updateSectorPolygons. Returns
+ * false if background building is disabled or unavailable
+ *******************************************************************/
+bool SLADEMap::requestSectorPolygon(MapSector* sector)
+{
+	if (!map_polygon_background || !polygon_background || !sector)
+		return false;
+
+	// Start worker thread if needed
+	if (!polygon_worker)
+	{
+		polygon_worker = new SectorPolygonWorker();
+		if (polygon_worker->Run() != wxTHREAD_NO_ERROR)
+		{
+			delete polygon_worker;
+			polygon_worker = NULL;
+			return false;
+		}
+	}
+
+	// Setup job
+	polygon_job_t* job = new polygon_job_t();
+	job->sector_id = sector->getId();
+	job->serial = ++polygon_serial;
+	Polygon2D::getSectorEdges(sector, job->edges);
+
+	// Sectors within the priority area (usually the current view) go
+	// to the front of the queue
+	bbox_t bbox = sector->boundingBox();
+	bool priority = (bbox.max.x >= polygon_priority.min.x && bbox.min.x <= polygon_priority.max.x &&
+					 bbox.max.y >= polygon_priority.min.y && bbox.min.y <= polygon_priority.max.y);
+
+	polygon_worker->addJob(job, priority);
+
+	return true;
+}
+
+/* SLADEMap::setPolygonPriorityArea
+ * Sets the area (usually the current view) within which sector
+ * polygons are built first when requested
+ *******************************************************************/
+void SLADEMap::setPolygonPriorityArea(fpoint2_t tl, fpoint2_t br)
+{
+	polygon_priority.min.set(MIN(tl.x, br.x), MIN(tl.y, br.y));
+	polygon_priority.max.set(MAX(tl.x, br.x), MAX(tl.y, br.y));
+}
+
+/* SLADEMap::updateSectorPolygons
+ * Gives any polygons finished in the background to their sectors.
+ * Should be called before rendering rather than during it, since
+ * sector polygon sizes can change. If [updated] is given, the index
+ * of each sector that got a new polygon is added to it. Returns the
+ * number of sector polygons updated
+ *******************************************************************/
+unsigned SLADEMap::updateSectorPolygons(vector<unsigned>* updated)
+{
+	if (!polygon_worker)
+		return 0;
+
+	vector<polygon_job_t*> finished;
+	polygon_worker->takeFinished(finished);
+
+	unsigned n_updated = 0;
+	for (unsigned a = 0; a < finished.size(); a++)
+	{
+		polygon_job_t* job = finished[a];
+
+		// Check the sector still exists
+		MapObject* object = NULL;
+		if (job->sector_id < all_objects.size() && all_objects[job->sector_id].in_map)
+			object = all_objects[job->sector_id].mobj;
+
+		// Use the polygon if it's newer than the sector's current one
+		if (object && object->getObjType() == MOBJ_SECTOR)
+		{
+			MapSector* sector = (MapSector*)object;
+			if (job->serial > sector->poly_serial)
+			{
+				sector->polygon.swapPolygon(&job->polygon);
+				sector->poly_serial = job->serial;
+				if (updated)
+					updated->push_back(sector->getIndex());
+				n_updated++;
+			}
+		}
+
+		delete job;
+	}
+
+	return n_updated;
+}
+
+/* compareIndex
+ * Returns true if [left] comes before [right] in its map list
+ *******************************************************************/
+bool compareIndex(MapObject* left, MapObject* right)
+{
+	return left->getIndex() < right->getIndex();
+}
+
+/* sortFound
+ * Sorts the objects in [list] from [start] onwards by index and
+ * removes any duplicates, so index lookups give the same results as
+ * searching the whole object list would
+ *******************************************************************/
+template<class T> void sortFound(vector<T*>& list, unsigned start)
+{
+	std::sort(list.begin() + start, list.end(), compareIndex);
+	list.erase(std::unique(list.begin() + start, list.end()), list.end());
+}
+
+/* addIndexEntry
+ * Adds [id] to [index] under [key], if it isn't already there.
+ * Returns true if an entry was added
+ *******************************************************************/
+template<class K> bool addIndexEntry(std::multimap<K, unsigned>& index, const K& key, unsigned id)
+{
+	typedef typename std::multimap<K, unsigned>::iterator iter_t;
+	std::pair<iter_t, iter_t> range = index.equal_range(key);
+	for (iter_t i = range.first; i != range.second; ++i)
+	{
+		if (i->second == id)
+			return false;
+	}
+
+	index.insert(range.second, std::make_pair(key, id));
+	return true;
+}
+
+/* SLADEMap::clearTagIndex
+ * Clears all tag/id indexes, they will be rebuilt the next time they
+ * are used
+ *******************************************************************/
+void SLADEMap::clearTagIndex()
+{
+	sector_tag_index.clear();
+	line_id_index.clear();
+	thing_id_index.clear();
+	tagging_line_index.clear();
+	tagging_thing_index.clear();
+	tag_index_generation = -1;
+	tag_index_size = 0;
+}
+
+/* SLADEMap::updateTagIndex
+ * Brings the tag/id indexes up to date with any objects modified
+ * since they were last updated
+ *******************************************************************/
+void SLADEMap::updateTagIndex()
+{
+	// Already up to date
+	if (tag_index_generation == edit_generation)
+		return;
+
+	// Rebuild from scratch if the indexes haven't been built yet, or
+	// have collected a lot of stale entries. Objects not currently in
+	// the map are included, since undo/redo can restore them without
+	// modifying them
+	if (tag_index_generation < 0 || tag_index_size > 2 * all_objects.size() + 1024)
+	{
+		clearTagIndex();
+		for (unsigned a = 1; a < all_objects.size(); a++)
+		{
+			if (all_objects[a].mobj)
+				indexObjectTags(all_objects[a].mobj);
 		}
 	}
 
-	// Calculate ray
-	fpoint2_t r_o = mid_side->parent->getPoint(MOBJ_POINT_MID);
-	fpoint2_t r_d = mid_side->parent->frontVector();
-	if (mid_side == mid_side->parent->side1)
-		r_d.set(-r_d.x, -r_d.y);
-
-	// Find nearest intersecting line
-	min_dist = 9999999999.0;
-	for (unsigned a = 0; a < sector->connected_sides.size(); a++)
+	// Otherwise just add anything modified since the last update
+	else
 	{
-		if (sector->connected_sides[a] == mid_side)
-			continue;
+		vector<MapObject*> modified = getAllModifiedObjects(tag_index_generation + 1);
+		for (unsigned a = 0; a < modified.size(); a++)
+			indexObjectTags(modified[a]);
+	}
 
-		MapLine* line = sector->connected_sides[a]->parent;
-		double dist = MathStuff::distanceRayLine(r_o, r_o + r_d, line->x1(), line->y1(), line->x2(), line->y2());
+	tag_index_generation = edit_generation;
+}
 
-		if (dist > 0 && dist < min_dist)
-			min_dist = dist;
+/* SLADEMap::indexObjectTags
+ * Adds [object] to the tag/id indexes under its current values
+ *******************************************************************/
+void SLADEMap::indexObjectTags(MapObject* object)
+{
+	uint8_t type = object->getObjType();
+	if (type != MOBJ_SECTOR && type != MOBJ_LINE && type != MOBJ_THING)
+		return;
+
+	// Tag/id
+	int id = object->intProperty("id");
+	if (id != 0)
+	{
+		if (type == MOBJ_SECTOR && addIndexEntry(sector_tag_index, id, object->id))
+			tag_index_size++;
+		else if (type == MOBJ_LINE && addIndexEntry(line_id_index, id, object->id))
+			tag_index_size++;
+		else if (type == MOBJ_THING && addIndexEntry(thing_id_index, id, object->id))
+			tag_index_size++;
 	}
 
-	// Set text point to halfway between the two lines
-	sector->text_point.set(r_o.x + (r_d.x * min_dist * 0.5), r_o.y + (r_d.y * min_dist * 0.5));
+	// Special targets
+	if (type == MOBJ_SECTOR)
+		return;
+	vector<tag_key_t> targets;
+	getTaggingTargets(object, targets);
+	std::multimap<tag_key_t, unsigned>& index = (type == MOBJ_LINE) ? tagging_line_index : tagging_thing_index;
+	for (unsigned a = 0; a < targets.size(); a++)
+	{
+		if (addIndexEntry(index, targets[a], object->id))
+			tag_index_size++;
+	}
 }
 
-/* SLADEMap::initSectorPolygons
- * Forces building of polygons for all sectors
+/* SLADEMap::getTaggingTargets
+ * Adds the [type, id] of everything the special on [object] (a line
+ * or thing) affects to [targets]. Things with no specific target
+ * that affect things of the same type and TID are added with a type
+ * of -1 - <needed tag type>
  *******************************************************************/
-void SLADEMap::initSectorPolygons()
+void SLADEMap::getTaggingTargets(MapObject* object, vector<tag_key_t>& targets)
 {
-	theSplashWindow->setProgressMessage("Building sector polygons");
-	theSplashWindow->setProgress(0.0f);
-	for (unsigned a = 0; a < sectors.size(); a++)
+	// Get the type of tag the special needs
+	int needs_tag = 0;
+	ThingType* tt = NULL;
+	if (object->getObjType() == MOBJ_LINE)
+	{
+		MapLine* line = (MapLine*)object;
+		if (!line->special)
+			return;
+
+		needs_tag = theGameConfiguration->actionSpecial(line->special)->needsTag();
+	}
+	else if (object->getObjType() == MOBJ_THING)
 	{
-		theSplashWindow->setProgress((float)a / (float)sectors.size());
-		sectors[a]->getPolygon();
+		MapThing* thing = (MapThing*)object;
+		tt = theGameConfiguration->thingType(thing->type);
+		int special = thing->intProperty("special");
+		if (!tt->needsTag() && !(special && !(tt->getFlags() & THING_SCRIPT)))
+			return;
+
+		needs_tag = tt->needsTag() ? tt->needsTag() : theGameConfiguration->actionSpecial(special)->needsTag();
 	}
-	theSplashWindow->setProgress(1.0f);
+	else
+		return;
+
+	// Get args
+	int arg[5];
+	string prop = "arg_";
+	for (int a = 0; a < 5; a++)
+	{
+		prop[3] = ('0' + a);
+		arg[a] = object->intProperty(prop);
+	}
+
+	// Add targets
+	switch (needs_tag)
+	{
+	case AS_TT_SECTOR:
+	case AS_TT_SECTOR_OR_BACK:
+	case AS_TT_SECTOR_AND_BACK:
+		targets.push_back(tag_key_t(SECTORS, arg[0]));
+		break;
+	case AS_TT_LINE_NEGATIVE:
+		targets.push_back(tag_key_t(LINEDEFS, abs(arg[0])));
+		break;
+	case AS_TT_LINE:
+		targets.push_back(tag_key_t(LINEDEFS, arg[0]));
+		break;
+	case AS_TT_THING:
+		targets.push_back(tag_key_t(THINGS, arg[0]));
+		break;
+	case AS_TT_1THING_2SECTOR:
+		targets.push_back(tag_key_t(THINGS, arg[0]));
+		targets.push_back(tag_key_t(SECTORS, arg[1]));
+		break;
+	case AS_TT_1THING_3SECTOR:
+		targets.push_back(tag_key_t(THINGS, arg[0]));
+		targets.push_back(tag_key_t(SECTORS, arg[2]));
+		break;
+	case AS_TT_1THING_2THING:
+		targets.push_back(tag_key_t(THINGS, arg[0]));
+		targets.push_back(tag_key_t(THINGS, arg[1]));
+		break;
+	case AS_TT_1THING_4THING:
+		targets.push_back(tag_key_t(THINGS, arg[0]));
+		targets.push_back(tag_key_t(THINGS, arg[3]));
+		break;
+	case AS_TT_1THING_2THING_3THING:
+		targets.push_back(tag_key_t(THINGS, arg[0]));
+		targets.push_back(tag_key_t(THINGS, arg[1]));
+		targets.push_back(tag_key_t(THINGS, arg[2]));
+		break;
+	case AS_TT_1SECTOR_2THING_3THING_5THING:
+		targets.push_back(tag_key_t(SECTORS, arg[0]));
+		targets.push_back(tag_key_t(THINGS, arg[1]));
+		targets.push_back(tag_key_t(THINGS, arg[2]));
+		targets.push_back(tag_key_t(THINGS, arg[4]));
+		break;
+	case AS_TT_1LINEID_2LINE:
+		targets.push_back(tag_key_t(LINEDEFS, arg[1]));
+		break;
+	case AS_TT_4THING:
+		targets.push_back(tag_key_t(THINGS, arg[3]));
+		break;
+	case AS_TT_5THING:
+		targets.push_back(tag_key_t(THINGS, arg[4]));
+		break;
+	case AS_TT_1LINE_2SECTOR:
+		targets.push_back(tag_key_t(LINEDEFS, arg[0]));
+		targets.push_back(tag_key_t(SECTORS, arg[1]));
+		break;
+	case AS_TT_1SECTOR_2SECTOR:
+		targets.push_back(tag_key_t(SECTORS, arg[0]));
+		targets.push_back(tag_key_t(SECTORS, arg[1]));
+		break;
+	case AS_TT_1SECTOR_2SECTOR_3SECTOR_4SECTOR:
+		targets.push_back(tag_key_t(SECTORS, arg[0]));
+		targets.push_back(tag_key_t(SECTORS, arg[1]));
+		targets.push_back(tag_key_t(SECTORS, arg[2]));
+		targets.push_back(tag_key_t(SECTORS, arg[3]));
+		break;
+	case AS_TT_SECTOR_2IS3_LINE:
+		targets.push_back(tag_key_t(arg[1] == 3 ? LINEDEFS : SECTORS, arg[0]));
+		break;
+	case AS_TT_1SECTOR_2THING:
+		targets.push_back(tag_key_t(SECTORS, arg[0]));
+		targets.push_back(tag_key_t(THINGS, arg[1]));
+		break;
+	default:
+		// Kind of a hack here. Patrol points and interpolation points only tag
+		// certain thing types with the same TID as themselves (see
+		// getTaggingThingsById)
+		if (tt && tt->needsTag() == needs_tag)
+			targets.push_back(tag_key_t(-1 - needs_tag, object->intProperty("id")));
+		break;
+	}
+
+	// Nothing can have an id of 0
+	for (int a = (int)targets.size() - 1; a >= 0; a--)
+	{
+		if (targets[a].second == 0)
+			targets.erase(targets.begin() + a);
+	}
+}
+
+/* SLADEMap::indexedObject
+ * Returns the object with [id] if it is currently in the map, or
+ * NULL otherwise (for checking index entries)
+ *******************************************************************/
+MapObject* SLADEMap::indexedObject(unsigned id)
+{
+	if (id >= all_objects.size() || !all_objects[id].in_map)
+		return NULL;
+
+	return all_objects[id].mobj;
 }
 
 /* SLADEMap::getSectorsByTag
@@ -3208,11 +4996,16 @@ void SLADEMap::getSectorsByTag(int tag, vector<MapSector*>& list)
 		return;
 
 	// Find sectors with matching tag
-	for (unsigned a = 0; a < sectors.size(); a++)
+	updateTagIndex();
+	unsigned start = list.size();
+	std::pair<std::multimap<int, unsigned>::iterator, std::multimap<int, unsigned>::iterator> range = sector_tag_index.equal_range(tag);
+	for (std::multimap<int, unsigned>::iterator i = range.first; i != range.second; ++i)
 	{
-		if (sectors[a]->intProperty("id") == tag)
-			list.push_back(sectors[a]);
+		MapObject* object = indexedObject(i->second);
+		if (object && object->intProperty("id") == tag)
+			list.push_back((MapSector*)object);
 	}
+	sortFound(list, start);
 }
 
 /* SLADEMap::getThingsById
@@ -3225,11 +5018,16 @@ void SLADEMap::getThingsById(int id, vector<MapThing*>& list, unsigned start, in
 		return;
 
 	// Find things with matching id
-	for (unsigned a = start; a < things.size(); a++)
+	updateTagIndex();
+	unsigned list_start = list.size();
+	std::pair<std::multimap<int, unsigned>::iterator, std::multimap<int, unsigned>::iterator> range = thing_id_index.equal_range(id);
+	for (std::multimap<int, unsigned>::iterator i = range.first; i != range.second; ++i)
 	{
-		if (things[a]->intProperty("id") == id && (type == 0 || things[a]->type == type))
-			list.push_back(things[a]);
+		MapThing* thing = (MapThing*)indexedObject(i->second);
+		if (thing && thing->index >= start && thing->intProperty("id") == id && (type == 0 || thing->type == type))
+			list.push_back(thing);
 	}
+	sortFound(list, list_start);
 }
 
 /* SLADEMap::getFirstThingWithId
@@ -3241,11 +5039,13 @@ MapThing* SLADEMap::getFirstThingWithId(int id)
 		return NULL;
 
 	// Find things with matching id, but ignore dragons, we don't want them!
-	for (unsigned a = 0; a < things.size(); a++)
+	vector<MapThing*> found;
+	getThingsById(id, found);
+	for (unsigned a = 0; a < found.size(); a++)
 	{
-		ThingType* tt = theGameConfiguration->thingType(things[a]->getType());
-		if (things[a]->intProperty("id") == id && !(tt->getFlags() & THING_DRAGON))
-			return things[a];
+		ThingType* tt = theGameConfiguration->thingType(found[a]->getType());
+		if (!(tt->getFlags() & THING_DRAGON))
+			return found[a];
 	}
 	return NULL;
 }
@@ -3259,16 +5059,27 @@ void SLADEMap::getThingsByIdInSectorTag(int id, int tag, vector<MapThing*>& list
 	if (id==0 && tag==0)
 		return;
 
+	// Get things with matching id (all things if id is 0, these
+	// aren't indexed)
+	vector<MapThing*> found;
+	if (id != 0)
+		getThingsById(id, found);
+	else
+	{
+		for (unsigned a = 0; a < things.size(); a++)
+		{
+			if (things[a]->intProperty("id") == 0)
+				found.push_back(things[a]);
+		}
+	}
+
 	// Find things with matching id contained in sector with matching tag
-	for (unsigned a = 0; a < things.size(); a++)
+	for (unsigned a = 0; a < found.size(); a++)
 	{
-		if (things[a]->intProperty("id") == id)
+		int si = sectorAt(found[a]->xPos(), found[a]->yPos());
+		if (si > -1 && (unsigned)si < sectors.size() && sectors[si]->intProperty("id") == tag)
 		{
-			int si = sectorAt(things[a]->xPos(), things[a]->yPos());
-			if (si > -1 && (unsigned)si < sectors.size() && sectors[si]->intProperty("id") == tag)
-			{
-				list.push_back(things[a]);
-			}
+			list.push_back(found[a]);
 		}
 	}
 }
@@ -3323,11 +5134,16 @@ void SLADEMap::getLinesById(int id, vector<MapLine*>& list)
 		return;
 
 	// Find lines with matching id
-	for (unsigned a = 0; a < lines.size(); a++)
+	updateTagIndex();
+	unsigned start = list.size();
+	std::pair<std::multimap<int, unsigned>::iterator, std::multimap<int, unsigned>::iterator> range = line_id_index.equal_range(id);
+	for (std::multimap<int, unsigned>::iterator i = range.first; i != range.second; ++i)
 	{
-		if (lines[a]->intProperty("id") == id)
-			list.push_back(lines[a]);
+		MapObject* object = indexedObject(i->second);
+		if (object && object->intProperty("id") == id)
+			list.push_back((MapLine*)object);
 	}
+	sortFound(list, start);
 }
 
 /* SLADEMap::getTaggingThingsById
@@ -3335,106 +5151,33 @@ void SLADEMap::getLinesById(int id, vector<MapLine*>& list)
  *******************************************************************/
 void SLADEMap::getTaggingThingsById(int id, int type, vector<MapThing*>& list, int ttype)
 {
-	// Find things with special affecting matching id
-	int needs_tag, tag, arg2, arg3, arg4, arg5, tid;
-	for (unsigned a = 0; a < things.size(); a++)
-	{
-		ThingType* tt = theGameConfiguration->thingType(things[a]->getType());
-		if (tt->needsTag() || (things[a]->intProperty("special") && !(tt->getFlags() & THING_SCRIPT)))
+	if (id == 0)
+		return;
+
+	// Find things with special affecting matching id (either by
+	// targeting [type] with it, or by tagging things of [ttype]
+	// with the same TID)
+	updateTagIndex();
+	unsigned start = list.size();
+	tag_key_t keys[2] = { tag_key_t(type, id), tag_key_t(-1 - ttype, id) };
+	vector<tag_key_t> targets;
+	for (unsigned k = 0; k < 2; k++)
+	{
+		std::pair<std::multimap<tag_key_t, unsigned>::iterator, std::multimap<tag_key_t, unsigned>::iterator> range = tagging_thing_index.equal_range(keys[k]);
+		for (std::multimap<tag_key_t, unsigned>::iterator i = range.first; i != range.second; ++i)
 		{
-			needs_tag = tt->needsTag() ? tt->needsTag() : theGameConfiguration->actionSpecial(things[a]->intProperty("special"))->needsTag();
-			tag = things[a]->intProperty("arg0");
-			bool fits = false;
-			switch (needs_tag)
-			{
-			case AS_TT_SECTOR:
-			case AS_TT_SECTOR_OR_BACK:
-			case AS_TT_SECTOR_AND_BACK:
-				fits = (IDEQ(tag) && type == SECTORS);
-				break;
-			case AS_TT_LINE_NEGATIVE:
-				tag = abs(tag);
-			case AS_TT_LINE:
-				fits = (IDEQ(tag) && type == LINEDEFS);
-				break;
-			case AS_TT_THING:
-				fits = (IDEQ(tag) && type == THINGS);
-				break;
-			case AS_TT_1THING_2SECTOR:
-				arg2 = things[a]->intProperty("arg1");
-				fits = (type == THINGS ? IDEQ(tag) : (IDEQ(arg2) && type == SECTORS));
-				break;
-			case AS_TT_1THING_3SECTOR:
-				arg3 = things[a]->intProperty("arg2");
-				fits = (type == THINGS ? IDEQ(tag) : (IDEQ(arg3) && type == SECTORS));
-				break;
-			case AS_TT_1THING_2THING:
-				arg2 = things[a]->intProperty("arg1");
-				fits = (type == THINGS && (IDEQ(tag) || IDEQ(arg2)));
-				break;
-			case AS_TT_1THING_4THING:
-				arg4 = things[a]->intProperty("arg3");
-				fits = (type == THINGS && (IDEQ(tag) || IDEQ(arg4)));
-				break;
-			case AS_TT_1THING_2THING_3THING:
-				arg2 = things[a]->intProperty("arg1");
-				arg3 = things[a]->intProperty("arg2");
-				fits = (type == THINGS && (IDEQ(tag) || IDEQ(arg2) || IDEQ(arg3)));
-				break;
-			case AS_TT_1SECTOR_2THING_3THING_5THING:
-				arg2 = things[a]->intProperty("arg1");
-				arg3 = things[a]->intProperty("arg2");
-				arg5 = things[a]->intProperty("arg4");
-				fits = (type == SECTORS ? (IDEQ(tag)) : (type == THINGS &&
-						(IDEQ(arg2) || IDEQ(arg3) || IDEQ(arg5))));
-				break;
-			case AS_TT_1LINEID_2LINE:
-				arg2 = things[a]->intProperty("arg1");
-				fits = (type == LINEDEFS && IDEQ(arg2));
-				break;
-			case AS_TT_4THING:
-				arg4 = things[a]->intProperty("arg3");
-				fits = (type == THINGS && IDEQ(arg4));
-				break;
-			case AS_TT_5THING:
-				arg5 = things[a]->intProperty("arg4");
-				fits = (type == THINGS && IDEQ(arg5));
-				break;
-			case AS_TT_1LINE_2SECTOR:
-				arg2 = things[a]->intProperty("arg1");
-				fits = (type == LINEDEFS ? (IDEQ(tag)) : (IDEQ(arg2) && type == SECTORS));
-				break;
-			case AS_TT_1SECTOR_2SECTOR:
-				arg2 = things[a]->intProperty("arg1");
-				fits = (type == SECTORS && (IDEQ(tag) || IDEQ(arg2)));
-				break;
-			case AS_TT_1SECTOR_2SECTOR_3SECTOR_4SECTOR:
-				arg2 = things[a]->intProperty("arg1");
-				arg3 = things[a]->intProperty("arg2");
-				arg4 = things[a]->intProperty("arg3");
-				fits = (type == SECTORS && (IDEQ(tag) || IDEQ(arg2) || IDEQ(arg3) || IDEQ(arg4)));
-				break;
-			case AS_TT_SECTOR_2IS3_LINE:
-				arg2 = things[a]->intProperty("arg1");
-				fits = (IDEQ(tag) && (arg2 == 3 ? type == LINEDEFS : type == SECTORS));
-				break;
-			case AS_TT_1SECTOR_2THING:
-				arg2 = things[a]->intProperty("arg1");
-				fits = (type == SECTORS ? (IDEQ(tag)) : (IDEQ(arg2) && type == THINGS));
-				break;
-			default:
-				// Kind of a hack here. Patrol points and interpolation points only tag
-				// certain thing types with the same TID as themselves. Fortunately,
-				// the thing types in question are in the 9000 range, and the TagTypes
-				// enum is quite unlikely to reach that far. :p
-				tid = things[a]->intProperty("id");
-				ThingType* tt = theGameConfiguration->thingType(things[a]->getType());
-				fits = ((needs_tag == ttype) && (IDEQ(tid)) && (tt->needsTag() == needs_tag));
-				break;
-			}
-			if (fits) list.push_back(things[a]);
+			MapObject* object = indexedObject(i->second);
+			if (!object)
+				continue;
+
+			// Check the entry is still valid
+			targets.clear();
+			getTaggingTargets(object, targets);
+			if (VECTOR_EXISTS(targets, keys[k]))
+				list.push_back((MapThing*)object);
 		}
 	}
+	sortFound(list, start);
 }
 
 /* SLADEMap::getTaggingLinesById
@@ -3442,99 +5185,28 @@ void SLADEMap::getTaggingThingsById(int id, int type, vector<MapThing*>& list, i
  *******************************************************************/
 void SLADEMap::getTaggingLinesById(int id, int type, vector<MapLine*>& list)
 {
+	if (id == 0)
+		return;
+
 	// Find lines with special affecting matching id
-	int needs_tag, tag, arg2, arg3, arg4, arg5;
-	for (unsigned a = 0; a < lines.size(); a++)
-	{
-		int special = lines[a]->special;
-		if (special)
-		{
-			needs_tag = theGameConfiguration->actionSpecial(lines[a]->special)->needsTag();
-			tag = lines[a]->intProperty("arg0");
-			bool fits = false;
-			switch (needs_tag)
-			{
-			case AS_TT_SECTOR:
-			case AS_TT_SECTOR_OR_BACK:
-			case AS_TT_SECTOR_AND_BACK:
-				fits = (IDEQ(tag) && type == SECTORS);
-				break;
-			case AS_TT_LINE_NEGATIVE:
-				tag = abs(tag);
-			case AS_TT_LINE:
-				fits = (IDEQ(tag) && type == LINEDEFS);
-				break;
-			case AS_TT_THING:
-				fits = (IDEQ(tag) && type == THINGS);
-				break;
-			case AS_TT_1THING_2SECTOR:
-				arg2 = lines[a]->intProperty("arg1");
-				fits = (type == THINGS ? IDEQ(tag) : (IDEQ(arg2) && type == SECTORS));
-				break;
-			case AS_TT_1THING_3SECTOR:
-				arg3 = lines[a]->intProperty("arg2");
-				fits = (type == THINGS ? IDEQ(tag) : (IDEQ(arg3) && type == SECTORS));
-				break;
-			case AS_TT_1THING_2THING:
-				arg2 = lines[a]->intProperty("arg1");
-				fits = (type == THINGS && (IDEQ(tag) || IDEQ(arg2)));
-				break;
-			case AS_TT_1THING_4THING:
-				arg4 = lines[a]->intProperty("arg3");
-				fits = (type == THINGS && (IDEQ(tag) || IDEQ(arg4)));
-				break;
-			case AS_TT_1THING_2THING_3THING:
-				arg2 = lines[a]->intProperty("arg1");
-				arg3 = lines[a]->intProperty("arg2");
-				fits = (type == THINGS && (IDEQ(tag) || IDEQ(arg2) || IDEQ(arg3)));
-				break;
-			case AS_TT_1SECTOR_2THING_3THING_5THING:
-				arg2 = lines[a]->intProperty("arg1");
-				arg3 = lines[a]->intProperty("arg2");
-				arg5 = lines[a]->intProperty("arg4");
-				fits = (type == SECTORS ? (IDEQ(tag)) : (type == THINGS &&
-						(IDEQ(arg2) || IDEQ(arg3) || IDEQ(arg5))));
-				break;
-			case AS_TT_1LINEID_2LINE:
-				arg2 = lines[a]->intProperty("arg1");
-				fits = (type == LINEDEFS && IDEQ(arg2));
-				break;
-			case AS_TT_4THING:
-				arg4 = lines[a]->intProperty("arg3");
-				fits = (type == THINGS && IDEQ(arg4));
-				break;
-			case AS_TT_5THING:
-				arg5 = lines[a]->intProperty("arg4");
-				fits = (type == THINGS && IDEQ(arg5));
-				break;
-			case AS_TT_1LINE_2SECTOR:
-				arg2 = lines[a]->intProperty("arg1");
-				fits = (type == LINEDEFS ? (IDEQ(tag)) : (IDEQ(arg2) && type == SECTORS));
-				break;
-			case AS_TT_1SECTOR_2SECTOR:
-				arg2 = lines[a]->intProperty("arg1");
-				fits = (type == SECTORS && (IDEQ(tag) || IDEQ(arg2)));
-				break;
-			case AS_TT_1SECTOR_2SECTOR_3SECTOR_4SECTOR:
-				arg2 = lines[a]->intProperty("arg1");
-				arg3 = lines[a]->intProperty("arg2");
-				arg4 = lines[a]->intProperty("arg3");
-				fits = (type == SECTORS && (IDEQ(tag) || IDEQ(arg2) || IDEQ(arg3) || IDEQ(arg4)));
-				break;
-			case AS_TT_SECTOR_2IS3_LINE:
-				arg2 = lines[a]->intProperty("arg1");
-				fits = (IDEQ(tag) && (arg2 == 3 ? type == LINEDEFS : type == SECTORS));
-				break;
-			case AS_TT_1SECTOR_2THING:
-				arg2 = lines[a]->intProperty("arg1");
-				fits = (type == SECTORS ? (IDEQ(tag)) : (IDEQ(arg2) && type == THINGS));
-				break;
-			default:
-				break;
-			}
-			if (fits) list.push_back(lines[a]);
-		}
+	updateTagIndex();
+	unsigned start = list.size();
+	tag_key_t key(type, id);
+	vector<tag_key_t> targets;
+	std::pair<std::multimap<tag_key_t, unsigned>::iterator, std::multimap<tag_key_t, unsigned>::iterator> range = tagging_line_index.equal_range(key);
+	for (std::multimap<tag_key_t, unsigned>::iterator i = range.first; i != range.second; ++i)
+	{
+		MapObject* object = indexedObject(i->second);
+		if (!object)
+			continue;
+
+		// Check the entry is still valid
+		targets.clear();
+		getTaggingTargets(object, targets);
+		if (VECTOR_EXISTS(targets, key))
+			list.push_back((MapLine*)object);
 	}
+	sortFound(list, start);
 }
 
 /* SLADEMap::findUnusedSectorTag
@@ -3771,53 +5443,17 @@ vector<MapObject*> SLADEMap::getModifiedObjects(long since, int type)
 {
 	vector<MapObject*> modified_objects;
 
-	// Vertices
-	if (type < 0 || type == MOBJ_VERTEX)
-	{
-		for (unsigned a = 0; a < vertices.size(); a++)
-		{
-			if (vertices[a]->modifiedTime() >= since)
-				modified_objects.push_back(vertices[a]);
-		}
-	}
-
-	// Sides
-	if (type < 0 || type == MOBJ_SIDE)
-	{
-		for (unsigned a = 0; a < sides.size(); a++)
-		{
-			if (sides[a]->modifiedTime() >= since)
-				modified_objects.push_back(sides[a]);
-		}
-	}
-
-	// Lines
-	if (type < 0 || type == MOBJ_LINE)
-	{
-		for (unsigned a = 0; a < lines.size(); a++)
-		{
-			if (lines[a]->modifiedTime() >= since)
-				modified_objects.push_back(lines[a]);
-		}
-	}
-
-	// Sectors
-	if (type < 0 || type == MOBJ_SECTOR)
+	for (int t = MOBJ_VERTEX; t <= MOBJ_THING; t++)
 	{
-		for (unsigned a = 0; a < sectors.size(); a++)
-		{
-			if (sectors[a]->modifiedTime() >= since)
-				modified_objects.push_back(sectors[a]);
-		}
-	}
+		if (type >= 0 && type != t)
+			continue;
 
-	// Things
-	if (type < 0 || type == MOBJ_THING)
-	{
-		for (unsigned a = 0; a < things.size(); a++)
+		// Go through the log from the first object modified since [since]
+		vector<mobj_mod_t>& log = modified_log[t - MOBJ_VERTEX];
+		for (unsigned a = firstModified(log, since); a < log.size(); a++)
 		{
-			if (things[a]->modifiedTime() >= since)
-				modified_objects.push_back(things[a]);
+			if (all_objects[log[a].id].in_map && isLatestModification(log[a]))
+				modified_objects.push_back(all_objects[log[a].id].mobj);
 		}
 	}
 
@@ -3826,32 +5462,46 @@ vector<MapObject*> SLADEMap::getModifiedObjects(long since, int type)
 
 /* SLADEMap::getAllModifiedObjects
  * Returns a list of objects that have a modified time later than
- * [since]
+ * [since] (including objects no longer in the map)
  *******************************************************************/
 vector<MapObject*> SLADEMap::getAllModifiedObjects(long since)
 {
 	vector<MapObject*> modified_objects;
 
-	for (unsigned a = 0; a < all_objects.size(); a++)
+	for (unsigned t = 0; t < 5; t++)
 	{
-		if (all_objects[a].mobj && all_objects[a].mobj->modifiedTime() >= since)
-			modified_objects.push_back(all_objects[a].mobj);
+		vector<mobj_mod_t>& log = modified_log[t];
+		for (unsigned a = firstModified(log, since); a < log.size(); a++)
+		{
+			if (isLatestModification(log[a]))
+				modified_objects.push_back(all_objects[log[a].id].mobj);
+		}
 	}
 
 	return modified_objects;
 }
 
 /* SLADEMap::getLastModifiedTime
- * Returns the newest modified time on any map object
+ * Returns the newest modified generation on any map object
  *******************************************************************/
 long SLADEMap::getLastModifiedTime()
 {
 	long mod_time = 0;
 
-	for (unsigned a = 0; a < all_objects.size(); a++)
+	// The newest entry in each log is the latest modification of
+	// its object, unless the object has since been deleted
+	for (unsigned t = 0; t < 5; t++)
 	{
-		if (all_objects[a].mobj && all_objects[a].mobj->modifiedTime() > mod_time)
-			mod_time = all_objects[a].mobj->modifiedTime();
+		vector<mobj_mod_t>& log = modified_log[t];
+		for (int a = (int)log.size() - 1; a >= 0; a--)
+		{
+			if (isLatestModification(log[a]))
+			{
+				if (log[a].generation > mod_time)
+					mod_time = log[a].generation;
+				break;
+			}
+		}
 	}
 
 	return mod_time;
@@ -3870,11 +5520,11 @@ bool SLADEMap::isModified()
 }
 
 /* SLADEMap::setOpenedTime
- * Sets the map opened time to now
+ * Sets the map opened time to the current edit generation
  *******************************************************************/
 void SLADEMap::setOpenedTime()
 {
-	opened_time = theApp->runTimer();
+	opened_time = edit_generation;
 }
 
 /* SLADEMap::modifiedSince
@@ -3887,57 +5537,39 @@ bool SLADEMap::modifiedSince(long since, int type)
 	if (type < 0)
 		return getLastModifiedTime() > since;
 
-	// Vertices
-	else if (type == MOBJ_VERTEX)
-	{
-		for (unsigned a = 0; a < vertices.size(); a++)
-		{
-			if (vertices[a]->modified_time > since)
-				return true;
-		}
-	}
+	if (type < MOBJ_VERTEX || type > MOBJ_THING)
+		return false;
 
-	// Lines
-	else if (type == MOBJ_LINE)
+	// Check the log (newest first) for any objects in the map
+	vector<mobj_mod_t>& log = modified_log[type - MOBJ_VERTEX];
+	for (int a = (int)log.size() - 1; a >= 0 && log[a].generation > since; a--)
 	{
-		for (unsigned a = 0; a < lines.size(); a++)
-		{
-			if (lines[a]->modified_time > since)
-				return true;
-		}
+		if (all_objects[log[a].id].in_map && isLatestModification(log[a]))
+			return true;
 	}
 
-	// Sides
-	else if (type == MOBJ_SIDE)
-	{
-		for (unsigned a = 0; a < sides.size(); a++)
-		{
-			if (sides[a]->modified_time > since)
-				return true;
-		}
-	}
+	return false;
+}
 
-	// Sectors
-	else if (type == MOBJ_SECTOR)
-	{
-		for (unsigned a = 0; a < sectors.size(); a++)
-		{
-			if (sectors[a]->modified_time > since)
-				return true;
-		}
-	}
+/* SLADEMap::getChangedIndices
+ * Adds the indices in the list for object [type] that have had a
+ * different object put in them since [since] to [indices] (may have
+ * duplicates, and indices no longer in the list). Returns false if
+ * the log doesn't go back that far, in which case any index may have
+ * changed
+ *******************************************************************/
+bool SLADEMap::getChangedIndices(long since, int type, vector<unsigned>& indices)
+{
+	if (type < MOBJ_VERTEX || type > MOBJ_THING)
+		return false;
+	if (since < index_log_start[type - MOBJ_VERTEX])
+		return false;
 
-	// Things
-	else if (type == MOBJ_THING)
-	{
-		for (unsigned a = 0; a < things.size(); a++)
-		{
-			if (things[a]->modified_time > since)
-				return true;
-		}
-	}
+	vector<mobj_slot_t>& log = index_log[type - MOBJ_VERTEX];
+	for (int a = (int)log.size() - 1; a >= 0 && log[a].generation > since; a--)
+		indices.push_back(log[a].index);
 
-	return false;
+	return true;
 }
 
 /* SLADEMap::createVertex
@@ -3963,6 +5595,7 @@ MapVertex* SLADEMap::createVertex(double x, double y, double split_dist)
 	// Create the vertex
 	MapVertex* nv = new MapVertex(x, y, this);
 	nv->index = vertices.size();
+	indexChanged(MOBJ_VERTEX, nv->index);
 	vertices.push_back(nv);
 
 	// Check if this vertex splits any lines (if needed)
@@ -3984,7 +5617,7 @@ MapVertex* SLADEMap::createVertex(double x, double y, double split_dist)
 	}
 
 	// Set geometry age
-	geometry_updated = theApp->runTimer();
+	setGeometryUpdated();
 
 	return nv;
 }
@@ -4045,6 +5678,7 @@ MapLine* SLADEMap::createLine(MapVertex* vertex1, MapVertex* vertex2, bool force
 	// Create new line between vertices
 	MapLine* nl = new MapLine(vertex1, vertex2, NULL, NULL, this);
 	nl->index = lines.size();
+	indexChanged(MOBJ_LINE, nl->index);
 	lines.push_back(nl);
 
 	// Connect line to vertices
@@ -4052,7 +5686,7 @@ MapLine* SLADEMap::createLine(MapVertex* vertex1, MapVertex* vertex2, bool force
 	vertex2->connectLine(nl);
 
 	// Set geometry age
-	geometry_updated = theApp->runTimer();
+	setGeometryUpdated();
 
 	return nl;
 }
@@ -4069,11 +5703,12 @@ MapThing* SLADEMap::createThing(double x, double y)
 	nt->x = x;
 	nt->y = y;
 	nt->index = things.size();
+	indexChanged(MOBJ_THING, nt->index);
 	nt->type = 1;
 
 	// Add to things
 	things.push_back(nt);
-	things_updated = theApp->runTimer();
+	setThingsUpdated();
 
 	return nt;
 }
@@ -4088,6 +5723,7 @@ MapSector* SLADEMap::createSector()
 
 	// Setup initial values
 	ns->index = sectors.size();
+	indexChanged(MOBJ_SECTOR, ns->index);
 
 	// Add to sectors
 	sectors.push_back(ns);
@@ -4109,6 +5745,7 @@ MapSide* SLADEMap::createSide(MapSector* sector)
 
 	// Setup initial values
 	side->index = sides.size();
+	indexChanged(MOBJ_SIDE, side->index);
 	side->tex_middle = "-";
 	side->tex_upper = "-";
 	side->tex_lower = "-";
@@ -4139,7 +5776,7 @@ void SLADEMap::moveVertex(unsigned vertex, double nx, double ny)
 	for (unsigned a = 0; a < v->connected_lines.size(); a++)
 		v->connected_lines[a]->resetInternals();
 
-	geometry_updated = theApp->runTimer();
+	setGeometryUpdated();
 }
 
 /* SLADEMap::mergeVertices
@@ -4187,6 +5824,7 @@ void SLADEMap::mergeVertices(unsigned vertex1, unsigned vertex2)
 	removeMapObject(v2);
 	vertices[vertex2] = vertices.back();
 	vertices[vertex2]->index = vertex2;
+	indexChanged(MOBJ_VERTEX, vertex2);
 	vertices.pop_back();
 
 	// Delete any resulting zero-length lines
@@ -4196,7 +5834,7 @@ void SLADEMap::mergeVertices(unsigned vertex1, unsigned vertex2)
 		removeLine(zlines[a]);
 	}
 
-	geometry_updated = theApp->runTimer();
+	setGeometryUpdated();
 }
 
 /* SLADEMap::mergeVerticesPoint
@@ -4225,7 +5863,7 @@ MapVertex* SLADEMap::mergeVerticesPoint(double x, double y)
 		a--;
 	}
 
-	geometry_updated = theApp->runTimer();
+	setGeometryUpdated();
 
 	// Return the final merged vertex
 	return getVertex(merge);
@@ -4264,6 +5902,7 @@ void SLADEMap::splitLine(MapLine* l, MapVertex* v)
 
 		// Add side
 		s1->index = sides.size();
+		indexChanged(MOBJ_SIDE, s1->index);
 		sides.push_back(s1);
 
 		// Update texture counts
@@ -4285,6 +5924,7 @@ void SLADEMap::splitLine(MapLine* l, MapVertex* v)
 
 		// Add side
 		s2->index = sides.size();
+		indexChanged(MOBJ_SIDE, s2->index);
 		sides.push_back(s2);
 
 		// Update texture counts
@@ -4297,6 +5937,7 @@ void SLADEMap::splitLine(MapLine* l, MapVertex* v)
 	MapLine* nl = new MapLine(v, v2, s1, s2, this);
 	nl->copy(l);
 	nl->index = lines.size();
+	indexChanged(MOBJ_LINE, nl->index);
 	nl->setModified();
 	lines.push_back(nl);
 
@@ -4306,7 +5947,7 @@ void SLADEMap::splitLine(MapLine* l, MapVertex* v)
 	nl->setIntProperty("side1.offsetx", xoff1 + l->getLength());
 	l->setIntProperty("side2.offsetx", xoff2 + nl->getLength());
 
-	geometry_updated = theApp->runTimer();
+	setGeometryUpdated();
 }
 
 /* SLADEMap::moveThing
@@ -4758,9 +6399,11 @@ struct me_ls_t
 };
 
 /* SLADEMap::correctSectors
- * Corrects/builds sectors for all lines in [lines]
+ * Corrects/builds sectors for all lines in [lines]. If [use_index]
+ * is false, sectors are traced without the SectorBuilder geometry
+ * index (for testing)
  *******************************************************************/
-void SLADEMap::correctSectors(vector<MapLine*> lines, bool existing_only)
+void SLADEMap::correctSectors(vector<MapLine*> lines, bool existing_only, bool use_index)
 {
 	// Create a list of line sides (edges) to perform sector creation with
 	vector<me_ls_t> edges;
@@ -4795,6 +6438,7 @@ void SLADEMap::correctSectors(vector<MapLine*> lines, bool existing_only)
 
 	// Build sectors
 	SectorBuilder builder;
+	builder.setUseIndex(use_index);
 	int runs = 0;
 	unsigned ns_start = sectors.size();
 	unsigned nsd_start = sides.size();
@@ -4956,10 +6600,149 @@ void SLADEMap::correctSectors(vector<MapLine*> lines, bool existing_only)
  *******************************************************************/
 void SLADEMap::mapOpenChecks()
 {
-	int rverts = removeDetachedVertices();
-	int rsides = removeDetachedSides();
-	int rsec = removeDetachedSectors();
-	int risides = removeInvalidSides();
+	// This is equivalent to calling removeDetachedVertices,
+	// removeDetachedSides, removeDetachedSectors and removeInvalidSides
+	// in turn, but works out everything to remove in a single pass and
+	// then compacts each list once (in the same order as the individual
+	// functions would), rather than refreshing all indices after each
+	int rverts = 0;
+	int rsides = 0;
+	int rsec = 0;
+	int risides = 0;
+
+	// Object indices aren't set up yet when a map is being read
+	refreshIndices();
+
+	// Find vertices not attached to any lines
+	vector<uint8_t> remove_vertex(vertices.size(), 0);
+	for (unsigned a = 0; a < vertices.size(); a++)
+	{
+		if (vertices[a]->nConnectedLines() == 0)
+		{
+			remove_vertex[a] = 1;
+			rverts++;
+		}
+	}
+
+	// Find sides with no parent line, and sides referencing no sector
+	// (detached sides take precedence, as they are removed first)
+	vector<uint8_t> remove_side(sides.size(), 0);
+	vector<uint8_t> sector_touched(sectors.size(), 0);
+	for (unsigned a = 0; a < sides.size(); a++)
+	{
+		if (!sides[a]->parent)
+		{
+			remove_side[a] = 1;
+			rsides++;
+
+			// Sector will need this side removed from its list
+			if (sides[a]->sector)
+				sector_touched[sides[a]->sector->index] = 1;
+		}
+		else if (!sides[a]->sector)
+		{
+			remove_side[a] = 2;
+			risides++;
+		}
+	}
+
+	// Remove detached sides from their sectors' side lists, and find
+	// sectors that are no longer referenced by any sides
+	vector<uint8_t> remove_sector(sectors.size(), 0);
+	for (unsigned a = 0; a < sectors.size(); a++)
+	{
+		vector<MapSide*>& csides = sectors[a]->connected_sides;
+		if (sector_touched[a])
+		{
+			unsigned keep = 0;
+			for (unsigned b = 0; b < csides.size(); b++)
+			{
+				MapSide* side = csides[b];
+				if (side->sector == sectors[a] && remove_side[side->index] == 1)
+					continue;
+				csides[keep++] = side;
+			}
+			csides.resize(keep);
+		}
+
+		if (csides.empty())
+		{
+			remove_sector[a] = 1;
+			rsec++;
+		}
+	}
+
+	// Remove vertices
+	for (int a = vertices.size() - 1; a >= 0; a--)
+	{
+		if (remove_vertex[vertices[a]->index])
+		{
+			removeMapObject(vertices[a]);
+			vertices[a] = vertices.back();
+			vertices.pop_back();
+		}
+	}
+	if (rverts > 0)
+		setGeometryUpdated();
+
+	// Remove detached sides
+	for (int a = sides.size() - 1; a >= 0; a--)
+	{
+		MapSide* side = sides[a];
+		if (remove_side[side->index] != 1)
+			continue;
+
+		usage_tex[side->tex_lower.Upper()] -= 1;
+		usage_tex[side->tex_middle.Upper()] -= 1;
+		usage_tex[side->tex_upper.Upper()] -= 1;
+
+		removeMapObject(side);
+		sides[a] = sides.back();
+		sides.pop_back();
+	}
+
+	// Remove detached sectors
+	for (int a = sectors.size() - 1; a >= 0; a--)
+	{
+		MapSector* sector = sectors[a];
+		if (!remove_sector[sector->index])
+			continue;
+
+		usage_flat[sector->f_tex.Upper()] -= 1;
+		usage_flat[sector->c_tex.Upper()] -= 1;
+
+		removeMapObject(sector);
+		sectors[a] = sectors.back();
+		sectors.pop_back();
+	}
+
+	// Remove invalid sides (these are also removed from their lines)
+	for (unsigned a = 0; a < sides.size(); a++)
+	{
+		MapSide* side = sides[a];
+		if (remove_side[side->index] != 2)
+			continue;
+
+		MapLine* l = side->parent;
+		l->setModified();
+		if (l->side1 == side)
+			l->side1 = NULL;
+		if (l->side2 == side)
+			l->side2 = NULL;
+		theGameConfiguration->setLineBasicFlag("blocking", l, current_format, true);
+		theGameConfiguration->setLineBasicFlag("twosided", l, current_format, false);
+
+		usage_tex[side->tex_lower.Upper()] -= 1;
+		usage_tex[side->tex_middle.Upper()] -= 1;
+		usage_tex[side->tex_upper.Upper()] -= 1;
+
+		removeMapObject(side);
+		sides[a] = sides.back();
+		sides.pop_back();
+		a--;
+	}
+
+	refreshIndices();
 
 	wxLogMessage("Removed %d detached vertices, %d detached sides, %d invalid sides and %d detached sectors", rverts, rsides, risides, rsec);
 }
@@ -29,15 +29,75 @@ struct mobj_cd_t
 {
 	unsigned	id;
 	bool		created;
+	unsigned	index;	// Index the object was removed from (if deleted)
 
-	mobj_cd_t(unsigned id, bool created)
+	mobj_cd_t(unsigned id, bool created, unsigned index = 0)
 	{
 		this->id = id;
 		this->created = created;
+		this->index = index;
 	}
 };
 
-class ParseTreeNode;
+struct mobj_mod_t
+{
+	unsigned	id;
+	long		generation;
+
+	mobj_mod_t(unsigned id, long generation)
+	{
+		this->id = id;
+		this->generation = generation;
+	}
+};
+
+struct mobj_slot_t
+{
+	unsigned	index;
+	long		generation;
+
+	mobj_slot_t(unsigned index, long generation)
+	{
+		this->index = index;
+		this->generation = generation;
+	}
+};
+
+// Grid of map object indices by position, for finding objects within
+// an area. Each object goes in the one cell containing the minimum
+// corner of its bounding box (or its position). Objects much larger
+// than a cell are kept in a separate list that is always checked
+struct mobj_grid_t
+{
+	double				x;
+	double				y;
+	double				cell_width;
+	double				cell_height;
+	unsigned			cols;
+	unsigned			rows;
+	vector<unsigned>	cell_start;	// Start of each cell in [objects] (plus end)
+	vector<unsigned>	objects;
+	vector<unsigned>	large;
+	double				max_width;	// Largest object size (not counting [large])
+	double				max_height;
+	long				generation;	// Edit generation when built
+	unsigned			list_changes;
+	unsigned			n_objects;
+
+	mobj_grid_t()
+	{
+		x = y = 0;
+		cell_width = cell_height = 1;
+		cols = rows = 0;
+		max_width = max_height = 0;
+		generation = -1;
+		list_changes = 0;
+		n_objects = 0;
+	}
+};
+
+class UDMFScanner;
+class SectorPolygonWorker;
 class SLADEMap
 {
 	friend class MapEditor;
@@ -62,9 +122,23 @@ private:
 	vector<unsigned>		created_objects;
 	vector<mobj_cd_t>		created_deleted_objects;
 
-	// The last time the map geometry was updated
+	// Log of modified objects for each object type (in generation
+	// order), so modification queries don't need to check every object
+	vector<mobj_mod_t>		modified_log[5];
+	unsigned				modified_compact_size[5];
+
+	// Log of list indices that had a different object put in them (by
+	// objects being created, removed or restored) for each object type,
+	// in generation order. Changes before index_log_start aren't logged
+	vector<mobj_slot_t>		index_log[5];
+	long					index_log_start[5];
+
+	// Edit generation, incremented every time anything in the map
+	// changes. Modification times are all in terms of this
+	long	edit_generation;
+	// The generation the map geometry was last updated
 	long	geometry_updated;
-	// The last time the thing list was modified
+	// The generation the thing list was last modified
 	long	things_updated;
 
 	// Usage counts
@@ -72,6 +146,34 @@ private:
 	std::map<string, int>	usage_flat;
 	std::map<int, int>		usage_thing_type;
 
+	// Tag/id indexes (map object ids by sector tag, line id and thing
+	// TID, and by the [type, id] targets of line/thing specials). These
+	// are updated from the modified object logs when queried, and
+	// entries are checked against the object when looked up, so stale
+	// entries don't need to be removed straight away
+	typedef std::pair<int, int>		tag_key_t;
+	std::multimap<int, unsigned>		sector_tag_index;
+	std::multimap<int, unsigned>		line_id_index;
+	std::multimap<int, unsigned>		thing_id_index;
+	std::multimap<tag_key_t, unsigned>	tagging_line_index;
+	std::multimap<tag_key_t, unsigned>	tagging_thing_index;
+	long								tag_index_generation;
+	unsigned							tag_index_size;
+
+	// Spatial index for each object type (indexed the same as the
+	// modified logs, sides aren't indexed). Rebuilt when queried if
+	// anything it depends on has changed since it was built
+	mobj_grid_t	spatial_index[5];
+	unsigned	list_changes;	// Incremented when objects are restored/removed by id
+
+	// Background sector polygon building. Each polygon request gets a
+	// new serial number, so that a finished polygon is only used if
+	// it's newer than what the sector already has
+	SectorPolygonWorker*	polygon_worker;
+	long					polygon_serial;
+	bbox_t					polygon_priority;
+	bool					polygon_background;	// If false, always build polygons immediately
+
 	// Doom format
 	bool	addVertex(doomvertex_t& v);
 	bool	addSide(doomside_t& s);
@@ -121,11 +223,40 @@ private:
 	bool	writeDoom64Things(ArchiveEntry* entry);
 
 	// UDMF
-	bool	addVertex(ParseTreeNode* def);
-	bool	addSide(ParseTreeNode* def);
-	bool	addLine(ParseTreeNode* def);
-	bool	addSector(ParseTreeNode* def);
-	bool	addThing(ParseTreeNode* def);
+	bool	addVertex(UDMFScanner& udmf);
+	bool	addSide(UDMFScanner& udmf, vector<int>& sector_refs);
+	bool	addLine(UDMFScanner& udmf, vector<int>& refs);
+	bool	addSector(UDMFScanner& udmf);
+	bool	addThing(UDMFScanner& udmf);
+	void	discardObject(MapObject* object);
+
+	// Modified object log
+	unsigned	firstModified(vector<mobj_mod_t>& log, long since);
+	bool		isLatestModification(mobj_mod_t& mod);
+	void		compactModifiedLog(unsigned type_index);
+
+	// Index change log
+	void		indexChanged(uint8_t type, unsigned index);
+	void		resetIndexLog();
+
+	// Object list manipulation (for undo/redo)
+	template<class T> void	insertIntoList(vector<T*>& list, T* object, int index);
+	template<class T> void	removeFromList(vector<T*>& list, T* object);
+
+	// Tag/id indexes
+	void		clearTagIndex();
+	void		updateTagIndex();
+	void		indexObjectTags(MapObject* object);
+	void		getTaggingTargets(MapObject* object, vector<tag_key_t>& targets);
+	MapObject*	indexedObject(unsigned id);
+
+	// Spatial index
+	bool	spatialIndexValid(uint8_t type);
+	void	getIndexBounds(uint8_t type, unsigned index, bbox_t& bounds);
+	void	updateSpatialIndex(uint8_t type);
+
+	// Object reclaiming
+	void	keepObject(MapObject* object, vector<bool>& keep, vector<MapObject*>& check);
 
 public:
 	SLADEMap();
@@ -155,6 +286,8 @@ public:
 	size_t		nSides() { return sides.size(); }
 	size_t		nSectors() { return sectors.size(); }
 	size_t		nThings() { return things.size(); }
+	long		currentGeneration() { return edit_generation; }
+	long		nextGeneration() { return ++edit_generation; }
 	long		geometryUpdated() { return geometry_updated; }
 	long		thingsUpdated() { return things_updated; }
 	void		setGeometryUpdated();
@@ -165,11 +298,15 @@ public:
 	// MapObject id stuff (used for undo/redo)
 	void				addMapObject(MapObject* object);
 	void				removeMapObject(MapObject* object);
+	void				objectModified(MapObject* object);
 	MapObject*			getObjectById(unsigned id) { return all_objects[id].mobj; }
-	//void				restoreObjectById(unsigned id);
-	//void				removeObjectById(unsigned id);
-	//vector<mobj_cd_t>&	createdDeletedObjectIds() { return created_deleted_objects; }
-	//void				clearCreatedDeletedOjbectIds() { created_deleted_objects.clear(); }
+	size_t				nObjectIds() { return all_objects.size(); }
+	bool				objectInMap(unsigned id) { return all_objects[id].in_map; }
+	void				restoreObjectById(unsigned id, int index = -1);
+	void				removeObjectById(unsigned id);
+	vector<mobj_cd_t>&	createdDeletedObjectIds() { return created_deleted_objects; }
+	void				clearCreatedDeletedObjectIds() { created_deleted_objects.clear(); }
+	unsigned			reclaimObjects(vector<unsigned>& referenced);
 
 	void				getObjectIdList(uint8_t type, vector<unsigned>& list);
 	void				restoreObjectIdList(uint8_t type, vector<unsigned>& list);
@@ -215,7 +352,16 @@ public:
 	void				updateGeometryInfo(long modified_time);
 	bool				linesIntersect(MapLine* line1, MapLine* line2, double& x, double& y);
 	void				findSectorTextPoint(MapSector* sector);
-	void				initSectorPolygons();
+	void				getObjectsWithin(uint8_t type, double xmin, double ymin, double xmax, double ymax, vector<unsigned>& list);
+	void				getObjectsOverlapping(uint8_t type, double xmin, double ymin, double xmax, double ymax, vector<unsigned>& list, double margin = 0);
+	void				initSectorPolygons(bool use_threads);
+
+	// Background sector polygon building
+	long		polygonSerial() { return polygon_serial; }
+	void		setPolygonBackground(bool background) { polygon_background = background; }
+	bool		requestSectorPolygon(MapSector* sector);
+	void		setPolygonPriorityArea(fpoint2_t tl, fpoint2_t br);
+	unsigned	updateSectorPolygons(vector<unsigned>* updated = NULL);
 
 	// Tags/Ids
 	MapThing* getFirstThingWithId(int id);
@@ -240,6 +386,7 @@ public:
 	bool				isModified();
 	void				setOpenedTime();
 	bool				modifiedSince(long since, int type = -1);
+	bool				getChangedIndices(long since, int type, vector<unsigned>& indices);
 
 	// Creation
 	MapVertex*	createVertex(double x, double y, double split_dist = -1);
@@ -264,7 +411,7 @@ public:
 	// Merge
 	bool		mergeArch(vector<MapVertex*> vertices);
 	MapLine*	mergeOverlappingLines(MapLine* line1, MapLine* line2);
-	void		correctSectors(vector<MapLine*> lines, bool existing_only = false);
+	void		correctSectors(vector<MapLine*> lines, bool existing_only = false, bool use_index = true);
 
 	// Checks
 	void	mapOpenChecks();
@@ -49,6 +49,16 @@ SectorBuilder::SectorBuilder()
 	// Init variables
 	vertex_right = NULL;
 	map = NULL;
+	use_index = true;
+	index_map = NULL;
+	index_generation = 0;
+	row_top = 0;
+	row_height = 1;
+	trace_count = 0;
+	inner_pos = 0;
+	grid_x = grid_y = 0;
+	grid_cell_w = grid_cell_h = 1;
+	grid_cols = grid_rows = 0;
 }
 
 /* SectorBuilder::~SectorBuilder
@@ -96,11 +106,204 @@ bool SectorBuilder::edgeSideCreated(unsigned index)
 	return sector_edges[index].side_created;
 }
 
+/* SectorBuilder::updateIndex
+ * Checks the map geometry index is up to date with the current map,
+ * and rebuilds it if any lines or vertices have changed since it was
+ * built. Only objects modified since the index was last checked (by
+ * map edit generation) are compared
+ *******************************************************************/
+void SectorBuilder::updateIndex()
+{
+	unsigned n_lines = map->nLines();
+	unsigned n_vertices = map->nVertices();
+
+	// Check if lines or vertices were added/removed since the index was built
+	bool valid = (index_map == map &&
+				  index_lines.size() == n_lines &&
+				  index_vertices.size() == n_vertices &&
+				  map->geometryUpdated() <= index_generation);
+
+	// Check lines modified since then (other changes, eg. sides being
+	// created, don't affect the index)
+	if (valid && map->modifiedSince(index_generation, MOBJ_LINE))
+	{
+		vector<MapObject*> modified = map->getModifiedObjects(index_generation, MOBJ_LINE);
+		for (unsigned a = 0; valid && a < modified.size(); a++)
+		{
+			MapLine* line = (MapLine*)modified[a];
+			index_line_t& il = index_lines[line->getIndex()];
+			if (il.line != line || il.v1 != line->v1() || il.v2 != line->v2())
+				valid = false;
+		}
+	}
+
+	// Check vertices modified since then
+	if (valid && map->modifiedSince(index_generation, MOBJ_VERTEX))
+	{
+		vector<MapObject*> modified = map->getModifiedObjects(index_generation, MOBJ_VERTEX);
+		for (unsigned a = 0; valid && a < modified.size(); a++)
+		{
+			MapVertex* vertex = (MapVertex*)modified[a];
+			index_vertex_t& iv = index_vertices[vertex->getIndex()];
+			if (iv.vertex != vertex || iv.x != vertex->xPos() || iv.y != vertex->yPos())
+				valid = false;
+		}
+	}
+
+	// Index is still up to date, don't check the same objects again
+	if (valid)
+	{
+		index_generation = map->currentGeneration();
+		return;
+	}
+
+	// Record current lines and vertices
+	index_map = map;
+	index_generation = map->currentGeneration();
+	index_lines.resize(n_lines);
+	index_vertices.resize(n_vertices);
+	for (unsigned a = 0; a < n_lines; a++)
+	{
+		MapLine* line = map->getLine(a);
+		index_lines[a].line = line;
+		index_lines[a].v1 = line->v1();
+		index_lines[a].v2 = line->v2();
+	}
+	for (unsigned a = 0; a < n_vertices; a++)
+	{
+		MapVertex* vertex = map->getVertex(a);
+		index_vertices[a].vertex = vertex;
+		index_vertices[a].x = vertex->xPos();
+		index_vertices[a].y = vertex->yPos();
+	}
+
+	// Build vertex adjacency lists, sorted by the angle of each line
+	// from the vertex (then by line index, so the order doesn't depend
+	// on the order lines were connected to the vertex in)
+	adj_start.resize(n_vertices + 1);
+	adj_lines.clear();
+	for (unsigned a = 0; a < n_vertices; a++)
+	{
+		MapVertex* vertex = map->getVertex(a);
+		adj_start[a] = adj_lines.size();
+		for (unsigned l = 0; l < vertex->nConnectedLines(); l++)
+		{
+			MapLine* line = vertex->connectedLine(l);
+
+			// Ignore zero-length lines (including lines between separate
+			// vertices at the same position, which have no angle)
+			MapVertex* opposite = (line->v1() == vertex) ? line->v2() : line->v1();
+			if (line->v1() == line->v2() || (opposite->xPos() == vertex->xPos() && opposite->yPos() == vertex->yPos()))
+				continue;
+
+			double angle = atan2(opposite->yPos() - vertex->yPos(), opposite->xPos() - vertex->xPos());
+			adj_lines.push_back(adj_line_t(angle, line->getIndex(), line));
+		}
+		std::sort(adj_lines.begin() + adj_start[a], adj_lines.end());
+	}
+	adj_start[n_vertices] = adj_lines.size();
+
+	// Sort vertices rightmost first (lowest index first if equal)
+	vertices_by_x.resize(n_vertices);
+	vector< std::pair<double, unsigned> > order(n_vertices);
+	for (unsigned a = 0; a < n_vertices; a++)
+		order[a] = std::make_pair(-index_vertices[a].x, a);
+	std::sort(order.begin(), order.end());
+	for (unsigned a = 0; a < n_vertices; a++)
+		vertices_by_x[a] = order[a].second;
+
+	// Build horizontal rows of (non-horizontal) lines, so the lines
+	// crossing any y value can be found quickly
+	double y_min = 0;
+	double y_max = 0;
+	for (unsigned a = 0; a < n_vertices; a++)
+	{
+		if (a == 0 || index_vertices[a].y < y_min)
+			y_min = index_vertices[a].y;
+		if (a == 0 || index_vertices[a].y > y_max)
+			y_max = index_vertices[a].y;
+	}
+	unsigned n_rows = MAX(1u, MIN(4096u, n_lines / 16));
+	row_top = y_min;
+	row_height = (y_max > y_min) ? (y_max - y_min) / n_rows : 1;
+	line_rows.clear();
+	line_rows.resize(n_rows);
+	for (unsigned a = 0; a < n_lines; a++)
+	{
+		MapLine* line = map->getLine(a);
+		if (line->y1() == line->y2())
+			continue;
+
+		int r1 = (int)((MIN(line->y1(), line->y2()) - row_top) / row_height);
+		int r2 = (int)((MAX(line->y1(), line->y2()) - row_top) / row_height);
+		r1 = MAX(0, MIN((int)n_rows - 1, r1));
+		r2 = MAX(0, MIN((int)n_rows - 1, r2));
+		for (int r = r1; r <= r2; r++)
+			line_rows[r].push_back(a);
+	}
+
+	// Reset visited lines
+	visited.assign(n_lines, 0);
+	visited_trace.assign(n_lines, 0);
+	trace_count = 0;
+}
+
+/* SectorBuilder::buildOutlineGrid
+ * Builds a grid of the current outline's edges, for finding the
+ * nearest edge to a point. Small outlines don't need one
+ *******************************************************************/
+void SectorBuilder::buildOutlineGrid()
+{
+	grid_cells.clear();
+	grid_cols = grid_rows = 0;
+	if (o_edges.size() < 32)
+		return;
+
+	// Get outline extents
+	double x_min = o_edges[0].line->x1();
+	double x_max = x_min;
+	double y_min = o_edges[0].line->y1();
+	double y_max = y_min;
+	for (unsigned a = 0; a < o_edges.size(); a++)
+	{
+		MapLine* line = o_edges[a].line;
+		x_min = MIN(x_min, MIN(line->x1(), line->x2()));
+		x_max = MAX(x_max, MAX(line->x1(), line->x2()));
+		y_min = MIN(y_min, MIN(line->y1(), line->y2()));
+		y_max = MAX(y_max, MAX(line->y1(), line->y2()));
+	}
+
+	// Setup grid (about one edge per cell)
+	int size = (int)sqrt((double)o_edges.size());
+	grid_cols = size;
+	grid_rows = size;
+	grid_x = x_min;
+	grid_y = y_min;
+	grid_cell_w = (x_max > x_min) ? (x_max - x_min) / grid_cols : 1;
+	grid_cell_h = (y_max > y_min) ? (y_max - y_min) / grid_rows : 1;
+	grid_cells.resize(grid_cols * grid_rows);
+
+	// Add edges to all cells their bbox covers
+	for (unsigned a = 0; a < o_edges.size(); a++)
+	{
+		MapLine* line = o_edges[a].line;
+		int c1 = MIN(grid_cols - 1, (int)((MIN(line->x1(), line->x2()) - grid_x) / grid_cell_w));
+		int c2 = MIN(grid_cols - 1, (int)((MAX(line->x1(), line->x2()) - grid_x) / grid_cell_w));
+		int r1 = MIN(grid_rows - 1, (int)((MIN(line->y1(), line->y2()) - grid_y) / grid_cell_h));
+		int r2 = MIN(grid_rows - 1, (int)((MAX(line->y1(), line->y2()) - grid_y) / grid_cell_h));
+		for (int r = r1; r <= r2; r++)
+		{
+			for (int c = c1; c <= c2; c++)
+				grid_cells[r * grid_cols + c].push_back(a);
+		}
+	}
+}
+
 /* SectorBuilder::nextEdge
  * Finds the next adjacent edge to [edge], ie the adjacent edge that
  * creates the smallest angle
  *******************************************************************/
-SectorBuilder::edge_t SectorBuilder::nextEdge(SectorBuilder::edge_t edge, MapLineSet& visited_lines)
+SectorBuilder::edge_t SectorBuilder::nextEdge(SectorBuilder::edge_t edge)
 {
 	// Get relevant vertices
 	MapVertex* vertex = edge.line->v2();		// Vertex to be tested
@@ -111,52 +314,105 @@ SectorBuilder::edge_t SectorBuilder::nextEdge(SectorBuilder::edge_t edge, MapLin
 		vertex_prev = edge.line->v2();
 	}
 
-	// Find next connected line with the lowest angle
-	double min_angle = 2*PI;
+	// Without the index, check the angle to every connected line
 	edge_t next;
-	for (unsigned a = 0; a < vertex->nConnectedLines(); a++)
+	if (!use_index)
 	{
-		MapLine* line = vertex->connectedLine(a);
+		double min_angle = 2*PI;
+		for (unsigned a = 0; a < vertex->nConnectedLines(); a++)
+		{
+			MapLine* line = vertex->connectedLine(a);
 
-		// Ignore original line
-		if (line == edge.line)
-			continue;
+			// Ignore original line
+			if (line == edge.line)
+				continue;
 
-		// Ignore if zero-length
-		if (line->v1() == line->v2())
-			continue;
+			// Ignore if zero-length
+			if (line->v1() == line->v2())
+				continue;
 
-		// Get next vertex
-		MapVertex* vertex_next;
-		bool front = true;
-		if (line->v1() == vertex)
-			vertex_next = line->v2();
-		else
+			// Get next vertex
+			MapVertex* vertex_next;
+			bool front = true;
+			if (line->v1() == vertex)
+				vertex_next = line->v2();
+			else
+			{
+				vertex_next = line->v1();
+				front = false;
+			}
+
+			// Ignore already-traversed lines
+			unsigned index = line->getIndex();
+			if (visited_trace[index] == trace_count && (visited[index] & (front ? 1 : 2)))
+				continue;
+
+			// Determine angle between lines
+			double angle = MathStuff::angle2DRad(fpoint2_t(vertex_prev->xPos(), vertex_prev->yPos()),
+			                                     fpoint2_t(vertex->xPos(), vertex->yPos()),
+			                                     fpoint2_t(vertex_next->xPos(), vertex_next->yPos()));
+
+			// Check if minimum angle (lowest line index first if equal,
+			// so the result doesn't depend on connected lines order)
+			if (angle < min_angle || (angle == min_angle && next.line && index < next.line->getIndex()))
+			{
+				min_angle = angle;
+				next.line = line;
+				next.front = front;
+			}
+		}
+	}
+	else
+	{
+		// Find the original line in the vertex's (angle-sorted) lines
+		unsigned start = adj_start[vertex->getIndex()];
+		unsigned end = adj_start[vertex->getIndex() + 1];
+		unsigned first = end;
+		for (unsigned a = start; a < end; a++)
 		{
-			vertex_next = line->v1();
-			front = false;
+			if (adj_lines[a].line == edge.line)
+			{
+				// Go back to the first line at the same angle
+				first = std::lower_bound(adj_lines.begin() + start, adj_lines.begin() + end, adj_line_t(adj_lines[a].angle)) - adj_lines.begin();
+				break;
+			}
 		}
 
-		// Ignore already-traversed lines
-		if (visited_lines[line] & (front ? 1 : 2))
-			continue;
+		// The next edge is the first (unvisited) connected line going
+		// anticlockwise from the original line, ie. with the lowest angle
+		// between the lines
+		for (unsigned a = 0; first < end && a < end - start; a++)
+		{
+			MapLine* line = adj_lines[start + (first - start + a) % (end - start)].line;
 
-		// Determine angle between lines
-		double angle = MathStuff::angle2DRad(fpoint2_t(vertex_prev->xPos(), vertex_prev->yPos()),
-		                                     fpoint2_t(vertex->xPos(), vertex->yPos()),
-		                                     fpoint2_t(vertex_next->xPos(), vertex_next->yPos()));
+			// Ignore original line
+			if (line == edge.line)
+				continue;
+
+			// Ignore already-traversed lines
+			bool front = (line->v1() == vertex);
+			unsigned index = line->getIndex();
+			if (visited_trace[index] == trace_count && (visited[index] & (front ? 1 : 2)))
+				continue;
 
-		// Check if minimum angle
-		if (angle < min_angle)
-		{
-			min_angle = angle;
 			next.line = line;
 			next.front = front;
+			break;
+		}
+	}
+
+	// Mark the next edge as visited
+	if (next.line)
+	{
+		unsigned index = next.line->getIndex();
+		if (visited_trace[index] != trace_count)
+		{
+			visited_trace[index] = trace_count;
+			visited[index] = 0;
 		}
+		visited[index] |= (next.front ? 1 : 2);
 	}
 
-	// Return the next edge found
-	visited_lines[next.line] |= (next.front ? 1 : 2);
 	return next;
 }
 
@@ -176,7 +432,7 @@ bool SectorBuilder::traceOutline(MapLine* line, bool front)
 	edge_t edge(line, front);
 	o_edges.push_back(edge);
 	double edge_sum = 0;
-	MapLineSet visited_lines;
+	trace_count++;
 
 	// Begin tracing
 	vertex_right = edge.line->v1();
@@ -195,7 +451,7 @@ bool SectorBuilder::traceOutline(MapLine* line, bool front)
 			vertex_right = edge.line->v2();
 
 		// Get next edge
-		edge_t edge_next = nextEdge(edge, visited_lines);
+		edge_t edge_next = nextEdge(edge);
 		LOG_MESSAGE(4, "Got next edge line %d", edge_next.line ? edge_next.line->getIndex() : -1);
 
 		// Check if no valid next edge was found
@@ -233,6 +489,12 @@ bool SectorBuilder::traceOutline(MapLine* line, bool front)
 	for (unsigned a = 0; a < o_edges.size(); a++)
 		sector_edges.push_back(o_edges[a]);
 
+	// Build edge grid for point-within-outline checks
+	if (use_index)
+		buildOutlineGrid();
+	else
+		grid_cells.clear();
+
 	// Trace complete
 	return true;
 }
@@ -246,21 +508,74 @@ int SectorBuilder::nearestEdge(double x, double y)
 	double min_dist = 99999999;
 	int nearest = -1;
 
-	// Go through edges
-	double dist;
-	for (unsigned a = 0; a < o_edges.size(); a++)
+	// Check all edges if there is no grid (or the point is outside it)
+	int col = (int)floor((x - grid_x) / grid_cell_w);
+	int row = (int)floor((y - grid_y) / grid_cell_h);
+	if (grid_cells.empty() || col < 0 || row < 0 || col > grid_cols || row > grid_rows)
 	{
-		// Get distance to edge
-		dist = MathStuff::distanceToLineFast(x, y,
-		                                     o_edges[a].line->x1(), o_edges[a].line->y1(),
-		                                     o_edges[a].line->x2(), o_edges[a].line->y2());
+		// Go through edges
+		double dist;
+		for (unsigned a = 0; a < o_edges.size(); a++)
+		{
+			// Get distance to edge
+			dist = MathStuff::distanceToLineFast(x, y,
+			                                     o_edges[a].line->x1(), o_edges[a].line->y1(),
+			                                     o_edges[a].line->x2(), o_edges[a].line->y2());
+
+			// Check if minimum
+			if (dist < min_dist)
+			{
+				min_dist = dist;
+				nearest = a;
+			}
+		}
 
-		// Check if minimum
-		if (dist < min_dist)
+		// Return nearest edge index
+		return nearest;
+	}
+	col = MIN(col, grid_cols - 1);
+	row = MIN(row, grid_rows - 1);
+
+	// Check grid cells in rings around the point's cell, until the next
+	// ring can't contain anything closer than the nearest edge found
+	double cell_min = MIN(grid_cell_w, grid_cell_h);
+	int max_ring = MAX(grid_cols, grid_rows);
+	for (int ring = 0; ring <= max_ring; ring++)
+	{
+		for (int r = row - ring; r <= row + ring; r++)
 		{
-			min_dist = dist;
-			nearest = a;
+			if (r < 0 || r >= grid_rows)
+				continue;
+
+			// Only the edge of the ring (all cells on the top and bottom rows)
+			int step = (r == row - ring || r == row + ring) ? 1 : MAX(1, ring * 2);
+			for (int c = col - ring; c <= col + ring; c += step)
+			{
+				if (c < 0 || c >= grid_cols)
+					continue;
+
+				vector<unsigned>& cell = grid_cells[r * grid_cols + c];
+				for (unsigned a = 0; a < cell.size(); a++)
+				{
+					unsigned e = cell[a];
+					double dist = MathStuff::distanceToLineFast(x, y,
+					                                            o_edges[e].line->x1(), o_edges[e].line->y1(),
+					                                            o_edges[e].line->x2(), o_edges[e].line->y2());
+
+					// Check if minimum (lowest index if equal)
+					if (dist < min_dist || (dist == min_dist && nearest >= 0 && (int)e < nearest))
+					{
+						min_dist = dist;
+						nearest = e;
+					}
+				}
+			}
 		}
+
+		// Anything in further rings is at least [ring] cells away
+		double bound = ring * cell_min;
+		if (nearest >= 0 && bound * bound > min_dist)
+			break;
 	}
 
 	// Return nearest edge index
@@ -342,11 +657,20 @@ SectorBuilder::edge_t SectorBuilder::findOuterEdge()
 
 	//wxLogMessage("Find outer edge from vertex %d", vertex_right->getIndex());
 
-	// Go through map lines
+	// Go through map lines crossing the vertex's row (or all lines
+	// without the index)
+	vector<unsigned>* row_lines = NULL;
+	if (use_index)
+	{
+		int row = (int)floor((vr_y - row_top) / row_height);
+		row = MAX(0, MIN((int)line_rows.size() - 1, row));
+		row_lines = &line_rows[row];
+	}
+	unsigned n_lines = row_lines ? row_lines->size() : map->nLines();
 	MapLine* line = NULL;
-	for (unsigned a = 0; a < map->nLines(); a++)
+	for (unsigned a = 0; a < n_lines; a++)
 	{
-		line = map->getLine(a);
+		line = map->getLine(row_lines ? (*row_lines)[a] : a);
 
 		// Ignore if the line is completely left of the vertex
 		if (line->x1() <= vr_x && line->x2() <= vr_x)
@@ -393,24 +717,24 @@ SectorBuilder::edge_t SectorBuilder::findOuterEdge()
  *******************************************************************/
 SectorBuilder::edge_t SectorBuilder::findInnerEdge()
 {
-	// Find rightmost non-discarded vertex
+	// Find rightmost non-discarded vertex (vertices are never
+	// un-discarded during a trace, so continue from the last one)
 	vertex_right = NULL;
-	for (unsigned a = 0; a < vertex_valid.size(); a++)
+	if (use_index)
 	{
-		// Ignore if discarded
-		if (!vertex_valid[a])
-			continue;
-
-		// Set rightmost if no current rightmost vertex
-		if (!vertex_right)
+		while (inner_pos < vertices_by_x.size() && !vertex_valid[vertices_by_x[inner_pos]])
+			inner_pos++;
+		if (inner_pos < vertices_by_x.size())
+			vertex_right = map->getVertex(vertices_by_x[inner_pos]);
+	}
+	else
+	{
+		// Without the index, check every vertex
+		for (unsigned a = 0; a < vertex_valid.size(); a++)
 		{
-			vertex_right = map->getVertex(a);
-			continue;
+			if (vertex_valid[a] && (!vertex_right || map->getVertex(a)->xPos() > vertex_right->xPos()))
+				vertex_right = map->getVertex(a);
 		}
-
-		// Check if the vertex is rightmost
-		if (map->getVertex(a)->xPos() > vertex_right->xPos())
-			vertex_right = map->getVertex(a);
 	}
 
 	// If no vertex was found, we're done
@@ -442,8 +766,8 @@ SectorBuilder::edge_t SectorBuilder::findInnerEdge()
 		                                     fpoint2_t(vertex_right->xPos(), vertex_right->yPos()),
 		                                     fpoint2_t(opposite->xPos(), opposite->yPos()));
 
-		// Check if minimum
-		if (angle < min_angle)
+		// Check if minimum (lowest line index first if equal)
+		if (angle < min_angle || (angle == min_angle && eline && line->getIndex() < eline->getIndex()))
 		{
 			min_angle = angle;
 			eline = line;
@@ -508,6 +832,10 @@ MapSector* SectorBuilder::findCopySector()
  *******************************************************************/
 MapSector* SectorBuilder::findExistingSector(vector<MapSide*>& sides_ignore)
 {
+	// Sort sides to ignore for quicker lookup
+	vector<MapSide*> ignore = sides_ignore;
+	std::sort(ignore.begin(), ignore.end());
+
 	// Go through new sector edges
 	MapSector* sector = NULL;
 	MapSector* sector_priority = NULL;
@@ -517,7 +845,7 @@ MapSector* SectorBuilder::findExistingSector(vector<MapSide*>& sides_ignore)
 		if (sector_edges[a].front && sector_edges[a].line->frontSector())
 		{
 			//return sector_edges[a].line->frontSector();
-			if (VECTOR_EXISTS(sides_ignore, sector_edges[a].line->s1()))
+			if (std::binary_search(ignore.begin(), ignore.end(), sector_edges[a].line->s1()))
 				sector = sector_edges[a].line->frontSector();
 			else
 				sector_priority = sector_edges[a].line->frontSector();
@@ -527,7 +855,7 @@ MapSector* SectorBuilder::findExistingSector(vector<MapSide*>& sides_ignore)
 		if (!sector_edges[a].front && sector_edges[a].line->backSector())
 		{
 			//return sector_edges[a].line->backSector();
-			if (VECTOR_EXISTS(sides_ignore, sector_edges[a].line->s2()))
+			if (std::binary_search(ignore.begin(), ignore.end(), sector_edges[a].line->s2()))
 				sector = sector_edges[a].line->backSector();
 			else
 				sector_priority = sector_edges[a].line->backSector();
@@ -591,9 +919,20 @@ bool SectorBuilder::traceSector(SLADEMap* map, MapLine* line, bool front)
 	error = "Unknown error";
 
 	// Create valid vertices list
-	vertex_valid.clear();
-	for (unsigned a = 0; a < map->nVertices(); a++)
-		vertex_valid.push_back(true);
+	vertex_valid.assign(map->nVertices(), true);
+	inner_pos = 0;
+
+	// Update map geometry index (without it, only the visited lines
+	// list is needed)
+	if (use_index)
+		updateIndex();
+	else if (visited.size() != map->nLines())
+	{
+		visited.assign(map->nLines(), 0);
+		visited_trace.assign(map->nLines(), 0);
+		trace_count = 0;
+		index_map = NULL;
+	}
 
 	// Find outmost outline
 	for (unsigned a = 0; a < 10000; a++)
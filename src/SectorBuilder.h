@@ -2,8 +2,6 @@
 #ifndef __SECTOR_BUILDER_H__
 #define __SECTOR_BUILDER_H__
 
-#include <wx/hashmap.h>
-
 // Forward declarations
 class MapLine;
 class MapVertex;
@@ -11,8 +9,6 @@ class MapSector;
 class MapSide;
 class SLADEMap;
 
-WX_DECLARE_HASH_MAP(MapLine*, int, wxPointerHash, wxPointerEqual, MapLineSet);
-
 class SectorBuilder
 {
 private:
@@ -30,28 +26,92 @@ private:
 		}
 	};
 
+	struct index_line_t
+	{
+		MapLine*	line;
+		MapVertex*	v1;
+		MapVertex*	v2;
+	};
+	struct index_vertex_t
+	{
+		MapVertex*	vertex;
+		double		x, y;
+	};
+	struct adj_line_t
+	{
+		double		angle;
+		unsigned	index;	// Line index, to order lines at the same angle
+		MapLine*	line;
+
+		adj_line_t(double angle = 0, unsigned index = 0, MapLine* line = NULL)
+		{
+			this->angle = angle;
+			this->index = index;
+			this->line = line;
+		}
+		bool operator<(const adj_line_t& right) const
+		{
+			if (angle != right.angle)
+				return angle < right.angle;
+			return index < right.index;
+		}
+	};
+
 	vector<bool>	vertex_valid;
 	SLADEMap*		map;
 	vector<edge_t>	sector_edges;
 	string			error;
 
+	// Map geometry index. This is kept between traces, and rebuilt
+	// if any lines or vertices in the map are changed
+	bool						use_index;		// If false, trace by searching the whole map (as originally)
+	SLADEMap*					index_map;
+	long						index_generation;	// Map edit generation the index was built at
+	vector<index_line_t>		index_lines;
+	vector<index_vertex_t>		index_vertices;
+	vector<unsigned>			adj_start;		// Start of each vertex's lines in adj_lines
+	vector<adj_line_t>			adj_lines;		// Connected lines, sorted by angle from the vertex
+	vector<unsigned>			vertices_by_x;	// Vertex indices, rightmost first
+	double						row_top;
+	double						row_height;
+	vector< vector<unsigned> >	line_rows;		// Non-horizontal lines crossing each row
+
+	// Visited line sides (bit 1 front, 2 back) in the current outline,
+	// only valid where visited_trace matches the current trace
+	vector<uint8_t>		visited;
+	vector<unsigned>	visited_trace;
+	unsigned			trace_count;
+
+	// Position in vertices_by_x of the rightmost valid vertex
+	unsigned	inner_pos;
+
 	// Current outline
 	vector<edge_t>	o_edges;
 	bool			o_clockwise;
 	bbox_t			o_bbox;
 	MapVertex*		vertex_right;
 
+	// Grid of current outline edges (for nearestEdge)
+	double						grid_x, grid_y;
+	double						grid_cell_w, grid_cell_h;
+	int							grid_cols, grid_rows;
+	vector< vector<unsigned> >	grid_cells;
+
+	void	updateIndex();
+	void	buildOutlineGrid();
+
 public:
 	SectorBuilder();
 	~SectorBuilder();
 
 	string		getError() { return error; }
+	void		setUseIndex(bool use) { use_index = use; }
 	unsigned	nEdges() { return sector_edges.size(); }
 	MapLine*	getEdgeLine(unsigned index);
 	bool		edgeIsFront(unsigned index);
 	bool		edgeSideCreated(unsigned index);
 
-	edge_t		nextEdge(edge_t edge, MapLineSet& visited_lines);
+	edge_t		nextEdge(edge_t edge);
 	bool		traceOutline(MapLine* line, bool front = true);
 	int			nearestEdge(double x, double y);
 	bool		pointWithinOutline(double x, double y);
@@ -0,0 +1,669 @@
+
+/*******************************************************************
+ * SLADE - It's a Doom Editor
+ * Copyright (C) 2008-2014 Simon Judd
+ *
+ * Email:       sirjuddington@gmail.com
+ * Web:         http://slade.mancubus.net
+ * Filename:    TextureAtlas.cpp
+ * Description: TextureAtlas class, packs small images into a few
+ *              large OpenGL textures, and AtlasPacker, the CPU side
+ *              rectangle packer it uses
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *******************************************************************/
+
+
+/*******************************************************************
+ * INCLUDES
+ *******************************************************************/
+#include "Main.h"
+#include "TextureAtlas.h"
+#include "GLTexture.h"
+#include "OpenGL.h"
+#include "Console.h"
+#include <SFML/System.hpp>
+
+
+/*******************************************************************
+ * ATLASPACKER CLASS FUNCTIONS
+ *******************************************************************/
+
+/* AtlasPacker::AtlasPacker
+ * AtlasPacker class constructor
+ *******************************************************************/
+AtlasPacker::AtlasPacker(unsigned width, unsigned height)
+{
+	reset(width, height);
+}
+
+/* AtlasPacker::~AtlasPacker
+ * AtlasPacker class destructor
+ *******************************************************************/
+AtlasPacker::~AtlasPacker()
+{
+}
+
+/* AtlasPacker::reset
+ * Removes all packed rectangles and sets the area size to
+ * [width]x[height]
+ *******************************************************************/
+void AtlasPacker::reset(unsigned width, unsigned height)
+{
+	this->width = width;
+	this->height = height;
+	area_used = 0;
+	n_rects = 0;
+
+	skyline.clear();
+	skyline_node_t node;
+	node.x = 0;
+	node.y = 0;
+	node.width = width;
+	skyline.push_back(node);
+}
+
+/* AtlasPacker::usedHeight
+ * Returns the height of the highest point of the skyline
+ *******************************************************************/
+unsigned AtlasPacker::usedHeight()
+{
+	unsigned top = 0;
+	for (unsigned a = 0; a < skyline.size(); a++)
+	{
+		if (skyline[a].y > top)
+			top = skyline[a].y;
+	}
+
+	return top;
+}
+
+/* AtlasPacker::efficiency
+ * Returns the fraction of the used part of the area (up to the
+ * highest point of the skyline) that is covered by rectangles
+ *******************************************************************/
+double AtlasPacker::efficiency()
+{
+	unsigned top = usedHeight();
+	if (top == 0)
+		return 0;
+
+	return (double)area_used / ((double)width * top);
+}
+
+/* AtlasPacker::fit
+ * Returns the y position a [w]x[h] rectangle would be placed at if
+ * its left edge was at skyline node [index], or -1 if it wouldn't
+ * fit there
+ *******************************************************************/
+int AtlasPacker::fit(unsigned index, unsigned w, unsigned h)
+{
+	if (skyline[index].x + w > width)
+		return -1;
+
+	// Find the highest node the rectangle would sit on
+	unsigned y = skyline[index].y;
+	unsigned width_left = w;
+	while (width_left > 0)
+	{
+		if (skyline[index].y > y)
+			y = skyline[index].y;
+		if (y + h > height)
+			return -1;
+
+		width_left -= min(width_left, skyline[index].width);
+		index++;
+	}
+
+	return y;
+}
+
+/* AtlasPacker::addNode
+ * Adds a skyline node for a [w]x[h] rectangle placed at [x,y], before
+ * node [index]. Nodes the rectangle covers are shortened or removed,
+ * and neighbouring nodes at the same height are merged
+ *******************************************************************/
+void AtlasPacker::addNode(unsigned index, unsigned x, unsigned y, unsigned w, unsigned h)
+{
+	skyline_node_t node;
+	node.x = x;
+	node.y = y + h;
+	node.width = w;
+	skyline.insert(skyline.begin() + index, node);
+
+	// Shrink or remove nodes covered by the new one
+	for (unsigned a = index + 1; a < skyline.size(); a++)
+	{
+		unsigned prev_right = skyline[a-1].x + skyline[a-1].width;
+		if (skyline[a].x >= prev_right)
+			break;
+
+		unsigned shrink = prev_right - skyline[a].x;
+		if (skyline[a].width <= shrink)
+		{
+			skyline.erase(skyline.begin() + a);
+			a--;
+		}
+		else
+		{
+			skyline[a].x += shrink;
+			skyline[a].width -= shrink;
+			break;
+		}
+	}
+
+	// Merge nodes at the same height
+	for (unsigned a = 0; a + 1 < skyline.size(); a++)
+	{
+		if (skyline[a].y == skyline[a+1].y)
+		{
+			skyline[a].width += skyline[a+1].width;
+			skyline.erase(skyline.begin() + a + 1);
+			a--;
+		}
+	}
+}
+
+/* AtlasPacker::insert
+ * Finds space for a [w]x[h] rectangle, placing it as low as possible
+ * (then in the narrowest gap). Sets [x,y] to its position and returns
+ * true, or returns false if there is no space left for it
+ *******************************************************************/
+bool AtlasPacker::insert(unsigned w, unsigned h, unsigned& x, unsigned& y)
+{
+	if (w == 0 || h == 0 || w > width || h > height)
+		return false;
+
+	int best_index = -1;
+	unsigned best_bottom = 0xFFFFFFFF;
+	unsigned best_width = 0xFFFFFFFF;
+	unsigned best_y = 0;
+	for (unsigned a = 0; a < skyline.size(); a++)
+	{
+		int fy = fit(a, w, h);
+		if (fy < 0)
+			continue;
+
+		unsigned bottom = fy + h;
+		if (bottom < best_bottom || (bottom == best_bottom && skyline[a].width < best_width))
+		{
+			best_index = a;
+			best_bottom = bottom;
+			best_width = skyline[a].width;
+			best_y = fy;
+		}
+	}
+
+	if (best_index < 0)
+		return false;
+
+	x = skyline[best_index].x;
+	y = best_y;
+	addNode(best_index, x, y, w, h);
+	area_used += (unsigned long)w * h;
+	n_rects++;
+
+	return true;
+}
+
+
+/*******************************************************************
+ * TEXTUREATLAS CLASS FUNCTIONS
+ *******************************************************************/
+
+/* TextureAtlas::TextureAtlas
+ * TextureAtlas class constructor. Pages are [page_size] square (and
+ * at most [max_pages] are created), images are surrounded by
+ * [padding] pixels (copied from their edges) to stop neighbouring
+ * images bleeding in when filtered, and images larger than
+ * [max_image_size] in either dimension aren't added
+ *******************************************************************/
+TextureAtlas::TextureAtlas(unsigned page_size, unsigned max_pages, unsigned padding, unsigned max_image_size)
+{
+	this->page_size = page_size;
+	this->max_pages = max_pages;
+	this->padding = padding;
+	this->max_image_size = max_image_size;
+	this->filter = GLTexture::NEAREST;
+	this->area_removed = 0;
+
+	// Each mipmap level halves the padding, so only go as far as
+	// leaves at least a pixel of it
+	mip_levels = 0;
+	while ((2u << mip_levels) <= padding)
+		mip_levels++;
+}
+
+/* TextureAtlas::~TextureAtlas
+ * TextureAtlas class destructor
+ *******************************************************************/
+TextureAtlas::~TextureAtlas()
+{
+	clear();
+}
+
+/* TextureAtlas::paddedSize
+ * Returns the space taken in a page by an image [size] pixels wide
+ * or high. This includes padding on both sides, rounded up so that
+ * images are aligned to the smallest mipmap level and never share a
+ * mipmap pixel with their neighbours
+ *******************************************************************/
+unsigned TextureAtlas::paddedSize(unsigned size)
+{
+	unsigned align = 1 << mip_levels;
+	return (size + padding * 2 + align - 1) & ~(align - 1);
+}
+
+/* TextureAtlas::setFilter
+ * Sets the filter used for the page textures, which is applied the
+ * next time each page is used. Pages only have a few mipmap levels
+ * (see paddedSize), below which mipmapped filters use the smallest
+ * level
+ *******************************************************************/
+void TextureAtlas::setFilter(int filter)
+{
+	if (filter == this->filter)
+		return;
+
+	this->filter = filter;
+	for (unsigned a = 0; a < pages.size(); a++)
+		pages[a]->refilter = true;
+}
+
+/* TextureAtlas::clear
+ * Removes all images and pages
+ *******************************************************************/
+void TextureAtlas::clear()
+{
+	for (unsigned a = 0; a < pages.size(); a++)
+	{
+		delete pages[a]->texture;
+		delete pages[a];
+	}
+	pages.clear();
+	entries.clear();
+	area_removed = 0;
+}
+
+/* TextureAtlas::addImage
+ * Adds [width]x[height] [rgba] image data to the atlas, to be looked
+ * up by [texture]. Returns false if the image is too large or there
+ * is no space left for it. The image data is copied and kept until
+ * the page it is in is next loaded
+ *******************************************************************/
+bool TextureAtlas::addImage(GLTexture* texture, const uint8_t* rgba, unsigned width, unsigned height)
+{
+	if (!texture || !rgba || width == 0 || height == 0)
+		return false;
+	if (width > max_image_size || height > max_image_size)
+		return false;
+
+	// Remove any previous image for the texture
+	removeImage(texture);
+
+	// Find space on an existing page
+	unsigned pw = paddedSize(width);
+	unsigned ph = paddedSize(height);
+	unsigned px = 0;
+	unsigned py = 0;
+	int index = -1;
+	for (unsigned a = 0; a < pages.size(); a++)
+	{
+		if (pages[a]->packer.insert(pw, ph, px, py))
+		{
+			index = a;
+			break;
+		}
+	}
+
+	// Otherwise start a new page
+	if (index < 0)
+	{
+		if (pages.size() >= max_pages)
+			return false;
+
+		page_t* page = new page_t();
+		page->packer.reset(page_size, page_size);
+		page->texture = new GLTexture(false);
+		page->texture->setTiling(false);
+		page->refilter = false;
+		page->n_images = 0;
+		page->area_images = 0;
+		pages.push_back(page);
+
+		if (!page->packer.insert(pw, ph, px, py))
+			return false;
+		index = pages.size() - 1;
+	}
+
+	// Copy image, extending its edge pixels into the padding
+	page_t* page = pages[index];
+	page->pending.push_back(image_t());
+	image_t& image = page->pending.back();
+	image.x = px;
+	image.y = py;
+	image.width = pw;
+	image.height = ph;
+	image.pixels.resize(pw * ph * 4);
+	for (unsigned y = 0; y < ph; y++)
+	{
+		int sy = (int)y - (int)padding;
+		if (sy < 0) sy = 0;
+		if (sy >= (int)height) sy = height - 1;
+
+		uint8_t* dest = &image.pixels[y * pw * 4];
+		for (unsigned x = 0; x < pw; x++)
+		{
+			int sx = (int)x - (int)padding;
+			if (sx < 0) sx = 0;
+			if (sx >= (int)width) sx = width - 1;
+
+			memcpy(dest + x * 4, rgba + (sy * width + sx) * 4, 4);
+		}
+	}
+	page->n_images++;
+	page->area_images += (unsigned long)width * height;
+
+	// Add entry
+	entry_t& entry = entries[texture];
+	entry.page = page->texture;
+	entry.page_index = index;
+	entry.x = px + padding;
+	entry.y = py + padding;
+	entry.width = width;
+	entry.height = height;
+	entry.u1 = (float)entry.x / page_size;
+	entry.v1 = (float)entry.y / page_size;
+	entry.u2 = (float)(entry.x + width) / page_size;
+	entry.v2 = (float)(entry.y + height) / page_size;
+
+	return true;
+}
+
+/* TextureAtlas::removeImage
+ * Removes the image for [texture] from the atlas. The space it used
+ * isn't reclaimed until the atlas is cleared
+ *******************************************************************/
+void TextureAtlas::removeImage(GLTexture* texture)
+{
+	std::map<GLTexture*, entry_t>::iterator i = entries.find(texture);
+	if (i == entries.end())
+		return;
+
+	page_t* page = pages[i->second.page_index];
+	page->n_images--;
+	page->area_images -= (unsigned long)i->second.width * i->second.height;
+	area_removed += (unsigned long)paddedSize(i->second.width) * paddedSize(i->second.height);
+	entries.erase(i);
+}
+
+/* TextureAtlas::applyFilter
+ * Sets the filter parameters of [page]'s texture (which must be
+ * bound) for the current filter type
+ *******************************************************************/
+void TextureAtlas::applyFilter(page_t* page)
+{
+	GLint mag = GL_NEAREST;
+	GLint min = GL_NEAREST;
+	if (filter == GLTexture::LINEAR)
+		mag = min = GL_LINEAR;
+	else if (filter == GLTexture::MIPMAP || filter == GLTexture::LINEAR_MIPMAP)
+	{
+		mag = GL_LINEAR;
+		min = GL_LINEAR_MIPMAP_LINEAR;
+	}
+	else if (filter == GLTexture::NEAREST_MIPMAP)
+		min = GL_LINEAR_MIPMAP_LINEAR;
+	else if (filter == GLTexture::NEAREST_LINEAR_MIN)
+		min = GL_LINEAR;
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mag);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mip_levels);
+	page->texture->setFilter(filter);
+	page->refilter = false;
+}
+
+/* TextureAtlas::uploadImage
+ * Uploads [image] and its mipmaps to the currently bound page
+ * texture. Each mipmap level is a 2x2 box filter of the one above,
+ * which only ever averages pixels from within the image (and its
+ * padding) since images are aligned to the smallest level
+ *******************************************************************/
+void TextureAtlas::uploadImage(image_t& image)
+{
+	glTexSubImage2D(GL_TEXTURE_2D, 0, image.x, image.y, image.width, image.height,
+	                GL_RGBA, GL_UNSIGNED_BYTE, &image.pixels[0]);
+
+	unsigned w = image.width;
+	unsigned h = image.height;
+	for (unsigned level = 1; level <= mip_levels; level++)
+	{
+		// Halve the image in place
+		unsigned nw = w / 2;
+		unsigned nh = h / 2;
+		for (unsigned y = 0; y < nh; y++)
+		{
+			for (unsigned x = 0; x < nw; x++)
+			{
+				uint8_t* s1 = &image.pixels[((y * 2) * w + x * 2) * 4];
+				uint8_t* s2 = s1 + w * 4;
+				uint8_t* dest = &image.pixels[(y * nw + x) * 4];
+				for (unsigned c = 0; c < 4; c++)
+					dest[c] = (s1[c] + s1[c + 4] + s2[c] + s2[c + 4] + 2) / 4;
+			}
+		}
+		w = nw;
+		h = nh;
+
+		glTexSubImage2D(GL_TEXTURE_2D, level, image.x >> level, image.y >> level, w, h,
+		                GL_RGBA, GL_UNSIGNED_BYTE, &image.pixels[0]);
+	}
+}
+
+/* TextureAtlas::loadPage
+ * Loads page [index] to its OpenGL texture, creating the texture if
+ * needed and uploading any images added since it was last loaded.
+ * The images' pixel data is freed once uploaded, so the atlas keeps
+ * no copy of the page in memory. Returns false if it couldn't be
+ * loaded
+ *******************************************************************/
+bool TextureAtlas::loadPage(unsigned index)
+{
+	page_t* page = pages[index];
+	if (page->texture->isLoaded() && !page->refilter && page->pending.empty())
+		return true;
+
+	if (!OpenGL::isInitialised() || !OpenGL::validTexDimension(page_size))
+		return false;
+
+	// Create the (empty) texture and its mipmap levels if needed
+	if (!page->texture->isLoaded())
+	{
+		vector<uint8_t> blank(page_size * page_size * 4, 0);
+		page->texture->setFilter(GLTexture::NEAREST);
+		if (!page->texture->loadRawData(&blank[0], page_size, page_size))
+			return false;
+
+		for (unsigned level = 1; level <= mip_levels; level++)
+			glTexImage2D(GL_TEXTURE_2D, level, 4, page_size >> level, page_size >> level, 0,
+			             GL_RGBA, GL_UNSIGNED_BYTE, &blank[0]);
+		page->refilter = true;
+	}
+	else
+		page->texture->bind();
+
+	if (page->refilter)
+		applyFilter(page);
+
+	// Upload new images
+	for (unsigned a = 0; a < page->pending.size(); a++)
+		uploadImage(page->pending[a]);
+	vector<image_t>().swap(page->pending);
+
+	return true;
+}
+
+/* TextureAtlas::getEntry
+ * Returns the atlas entry for [texture], or NULL if it isn't in the
+ * atlas. The page texture is (re)loaded first if needed
+ *******************************************************************/
+TextureAtlas::entry_t* TextureAtlas::getEntry(GLTexture* texture)
+{
+	std::map<GLTexture*, entry_t>::iterator i = entries.find(texture);
+	if (i == entries.end())
+		return NULL;
+
+	if (!loadPage(i->second.page_index))
+		return NULL;
+
+	return &(i->second);
+}
+
+/* TextureAtlas::efficiency
+ * Returns the fraction of the used part of all pages that is taken
+ * up by images, including their padding if [include_padding] is true
+ *******************************************************************/
+double TextureAtlas::efficiency(bool include_padding)
+{
+	double used = 0;
+	double area = 0;
+	for (unsigned a = 0; a < pages.size(); a++)
+	{
+		area += (double)page_size * pages[a]->packer.usedHeight();
+		if (include_padding)
+			used += pages[a]->packer.areaUsed();
+		else
+			used += pages[a]->area_images;
+	}
+	if (include_padding)
+		used -= area_removed;
+
+	if (area == 0)
+		return 0;
+
+	return used / area;
+}
+
+/* TextureAtlas::getReport
+ * Adds lines describing the contents and packing efficiency of each
+ * page to [lines]
+ *******************************************************************/
+void TextureAtlas::getReport(vector<string>& lines)
+{
+	for (unsigned a = 0; a < pages.size(); a++)
+	{
+		page_t* page = pages[a];
+		double top = page->packer.usedHeight();
+		double area = page_size * top;
+		lines.push_back(S_FMT("Page %d (%dx%d): %d images, %1.1f%% of height used, %1.1f%% packed (%1.1f%% excluding padding)",
+		                      a, page_size, page_size, page->n_images, top * 100.0 / page_size,
+		                      area > 0 ? page->packer.areaUsed() * 100.0 / area : 0.0,
+		                      area > 0 ? page->area_images * 100.0 / area : 0.0));
+	}
+	lines.push_back(S_FMT("%d pages, %d images, %1.1f%% packing efficiency (%1.1f%% excluding padding)",
+	                      pages.size(), entries.size(), efficiency(true) * 100.0, efficiency(false) * 100.0));
+}
+
+
+/*******************************************************************
+ * CONSOLE COMMANDS
+ *******************************************************************/
+
+CONSOLE_COMMAND(test_atlas_pack, 0, false)
+{
+	long count = 500;
+	if (args.size() > 0)
+		args[0].ToLong(&count);
+
+	// Test sets: flats, small textures, thing sprites and editor icons
+	const unsigned n_sets = 4;
+	const char* set_names[n_sets] = { "Flats", "Textures", "Sprites", "Icons" };
+	for (unsigned set = 0; set < n_sets; set++)
+	{
+		// Generate sizes
+		srand(1);
+		vector<unsigned> widths, heights;
+		for (long a = 0; a < count; a++)
+		{
+			unsigned w, h;
+			if (set == 0)
+				w = h = (rand() % 8 == 0) ? 128 : 64;
+			else if (set == 1)
+			{
+				w = 32 << (rand() % 3);
+				h = 32 << (rand() % 3);
+			}
+			else if (set == 2)
+			{
+				w = 8 + rand() % 120;
+				h = 8 + rand() % 120;
+			}
+			else
+				w = h = (rand() % 2 == 0) ? 32 : 64;
+			widths.push_back(w + 4);	// With default padding
+			heights.push_back(h + 4);
+		}
+
+		// Pack into as many 1024x1024 pages as needed
+		sf::Clock clock;
+		vector<AtlasPacker> pages;
+		vector<unsigned> page, xs, ys;
+		for (unsigned a = 0; a < widths.size(); a++)
+		{
+			unsigned x = 0, y = 0, p = 0;
+			for (p = 0; p < pages.size(); p++)
+			{
+				if (pages[p].insert(widths[a], heights[a], x, y))
+					break;
+			}
+			if (p == pages.size())
+			{
+				pages.push_back(AtlasPacker(1024, 1024));
+				pages.back().insert(widths[a], heights[a], x, y);
+			}
+			page.push_back(p);
+			xs.push_back(x);
+			ys.push_back(y);
+		}
+		long time = clock.getElapsedTime().asMicroseconds();
+
+		// Check for rectangles outside the page or overlapping
+		unsigned errors = 0;
+		for (unsigned a = 0; a < xs.size(); a++)
+		{
+			if (xs[a] + widths[a] > 1024 || ys[a] + heights[a] > 1024)
+				errors++;
+
+			for (unsigned b = a + 1; b < xs.size(); b++)
+			{
+				if (page[a] == page[b] &&
+					xs[a] < xs[b] + widths[b] && xs[b] < xs[a] + widths[a] &&
+					ys[a] < ys[b] + heights[b] && ys[b] < ys[a] + heights[a])
+					errors++;
+			}
+		}
+
+		// Report
+		double used = 0, area = 0;
+		for (unsigned p = 0; p < pages.size(); p++)
+		{
+			used += pages[p].areaUsed();
+			area += 1024.0 * pages[p].usedHeight();
+		}
+		wxLogMessage("%s: %ld rects in %d pages, %1.1f%% packing efficiency, %1.2fms, %d errors",
+		             set_names[set], count, pages.size(), area > 0 ? used * 100.0 / area : 0.0, time * 0.001, errors);
+	}
+}
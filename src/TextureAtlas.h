@@ -0,0 +1,109 @@
+
+#ifndef __TEXTURE_ATLAS_H__
+#define __TEXTURE_ATLAS_H__
+
+#include <map>
+
+class GLTexture;
+
+// Packs rectangles into a fixed size area using the skyline
+// (bottom-left) method. CPU only, no OpenGL calls are made
+class AtlasPacker
+{
+private:
+	struct skyline_node_t
+	{
+		unsigned	x;
+		unsigned	y;
+		unsigned	width;
+	};
+
+	unsigned				width;
+	unsigned				height;
+	vector<skyline_node_t>	skyline;
+	unsigned long			area_used;
+	unsigned				n_rects;
+
+	int		fit(unsigned index, unsigned w, unsigned h);
+	void	addNode(unsigned index, unsigned x, unsigned y, unsigned w, unsigned h);
+
+public:
+	AtlasPacker(unsigned width = 1024, unsigned height = 1024);
+	~AtlasPacker();
+
+	unsigned		getWidth() { return width; }
+	unsigned		getHeight() { return height; }
+	unsigned		nRects() { return n_rects; }
+	unsigned long	areaUsed() { return area_used; }
+	unsigned		usedHeight();
+	double			efficiency();
+
+	void	reset(unsigned width, unsigned height);
+	bool	insert(unsigned w, unsigned h, unsigned& x, unsigned& y);
+};
+
+// Packs small images into a few large textures ('pages'), so that
+// many objects using different images can be drawn with one texture
+// bound. Images are looked up by the GLTexture they were loaded to
+class TextureAtlas
+{
+public:
+	struct entry_t
+	{
+		GLTexture*	page;
+		unsigned	page_index;
+		unsigned	x, y;			// Position in the page (excluding padding)
+		unsigned	width, height;
+		float		u1, v1, u2, v2;	// Texture coordinates in the page
+	};
+
+private:
+	struct image_t
+	{
+		unsigned		x, y;			// Position in the page (including padding)
+		unsigned		width, height;	// Size (including padding)
+		vector<uint8_t>	pixels;			// RGBA
+	};
+	struct page_t
+	{
+		AtlasPacker		packer;
+		GLTexture*		texture;
+		bool			refilter;	// Filter changed since the texture was created
+		vector<image_t>	pending;	// Images added since the texture was last loaded
+		unsigned		n_images;
+		unsigned long	area_images;	// Pixels used by images (excluding padding)
+	};
+
+	unsigned						page_size;
+	unsigned						max_pages;
+	unsigned						padding;
+	unsigned						mip_levels;		// Mipmap levels below the full size page
+	unsigned						max_image_size;
+	int								filter;
+	vector<page_t*>					pages;
+	std::map<GLTexture*, entry_t>	entries;
+	unsigned long					area_removed;	// Space (with padding) left behind by removed images
+
+	unsigned	paddedSize(unsigned size);
+	void		applyFilter(page_t* page);
+	void		uploadImage(image_t& image);
+	bool	loadPage(unsigned index);
+
+public:
+	TextureAtlas(unsigned page_size = 1024, unsigned max_pages = 4, unsigned padding = 2, unsigned max_image_size = 256);
+	~TextureAtlas();
+
+	unsigned	nPages() { return pages.size(); }
+	unsigned	nEntries() { return entries.size(); }
+	int			getFilter() { return filter; }
+	void		setFilter(int filter);
+
+	void		clear();
+	bool		addImage(GLTexture* texture, const uint8_t* rgba, unsigned width, unsigned height);
+	void		removeImage(GLTexture* texture);
+	entry_t*	getEntry(GLTexture* texture);
+	double		efficiency(bool include_padding = false);
+	void		getReport(vector<string>& lines);
+};
+
+#endif//__TEXTURE_ATLAS_H__
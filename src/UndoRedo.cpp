@@ -135,6 +135,16 @@ void UndoLevel::createMerged(vector<UndoLevel*>& levels)
 	}
 }
 
+/* UndoLevel::getObjectIds
+ * Adds the ids of all map objects referenced by this level's undo
+ * steps to [list]
+ *******************************************************************/
+void UndoLevel::getObjectIds(vector<unsigned>& list)
+{
+	for (unsigned a = 0; a < undo_steps.size(); a++)
+		undo_steps[a]->getObjectIds(list);
+}
+
 
 /*******************************************************************
  * UNDOMANAGER CLASS FUNCTIONS
@@ -201,11 +211,13 @@ void UndoManager::endRecord(bool success)
 	}
 
 	// Remove any undo levels after the current
+	bool levels_removed = false;
 	while ((int)undo_levels.size() - 1 > current_level_index)
 	{
 		//wxLogMessage("Removing undo level \"%s\"", undo_levels.back()->getName());
 		delete undo_levels.back();
 		undo_levels.pop_back();
+		levels_removed = true;
 	}
 
 	// Add current level to levels
@@ -218,6 +230,10 @@ void UndoManager::endRecord(bool success)
 	current_undo_manager = NULL;
 
 	announce("level_recorded");
+
+	// Let listeners know if any objects may no longer be referenced
+	if (levels_removed)
+		announce("levels_removed");
 }
 
 /* UndoManager::currentlyRecording
@@ -313,12 +329,26 @@ void UndoManager::getAllLevels(vector<string>& list)
 		list.push_back(undo_levels[a]->getName());
 }
 
+/* UndoManager::getObjectIds
+ * Adds the ids of all map objects referenced by any undo level
+ * (including the one currently being recorded) to [list]
+ *******************************************************************/
+void UndoManager::getObjectIds(vector<unsigned>& list)
+{
+	for (unsigned a = 0; a < undo_levels.size(); a++)
+		undo_levels[a]->getObjectIds(list);
+
+	if (current_level)
+		current_level->getObjectIds(list);
+}
+
 /* UndoManager::clear
  * Clears all undo levels and resets variables
  *******************************************************************/
 void UndoManager::clear()
 {
 	// Clean up undo levels
+	bool levels_removed = !undo_levels.empty();
 	for (unsigned a = 0; a < undo_levels.size(); a++)
 		delete undo_levels[a];
 
@@ -327,6 +357,10 @@ void UndoManager::clear()
 	current_level = NULL;
 	current_level_index = -1;
 	undo_running = false;
+
+	// Let listeners know if any objects may no longer be referenced
+	if (levels_removed)
+		announce("levels_removed");
 }
 
 /* UndoManager::createMergedLevel
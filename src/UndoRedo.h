@@ -18,6 +18,10 @@ public:
 	virtual bool	writeFile(MemChunk& mc) { return true; }
 	virtual bool	readFile(MemChunk& mc) { return true; }
 	virtual bool	isOk() { return true; }
+
+	// Adds the ids of any map objects this step needs to be kept
+	// around (eg. for restoring them) to [list]
+	virtual void	getObjectIds(vector<unsigned>& list) {}
 };
 
 class UndoLevel
@@ -40,6 +44,7 @@ public:
 	bool	writeFile(string filename);
 	bool	readFile(string filename);
 	void	createMerged(vector<UndoLevel*>& levels);
+	void	getObjectIds(vector<unsigned>& list);
 };
 
 class SLADEMap;
@@ -61,6 +66,7 @@ public:
 	int			getCurrentIndex() { return current_level_index; }
 	unsigned	nUndoLevels() { return undo_levels.size(); }
 	UndoLevel*	undoLevel(unsigned index) { return undo_levels[index]; }
+	void		getObjectIds(vector<unsigned>& list);
 
 	void	beginRecord(string name);
 	void	endRecord(bool success);